@@ -3,6 +3,7 @@ import serial
 import serial.tools.list_ports
 import threading
 import time
+import struct
 from collections import deque
 
 app = Flask(__name__)
@@ -15,6 +16,259 @@ receive_running = False
 
 uart_logs = deque(maxlen=100)  # Lưu 100 dòng log UART gần nhất
 
+# Command frames: [cmd][payload length][payload], replies: [cmd | 0x80][length][payload]
+CMD_BURST = 0x10
+CMD_UART_BAUD = 0x16
+CMD_BATCH = 0x17
+CMD_COMPACT = 0x18
+CMD_FWD = 0x19
+CMD_SEQ = 0x1A                    # Khung kèm số thứ tự: [0x1A][1 + độ dài][seq][khung], MCU trả ack
+CMD_TIME = 0x1B                   # Đọc đồng hồ 1 us của MCU / đặt offset epoch
+CMD_CYCLIC = 0x1C                 # Khung tuần hoàn chu kỳ us: [slot][chu kỳ us 4B][mode][id 4B][len][data]
+CMD_POWER = 0x1D                  # Ngủ WFI/WFE khi rảnh: [mức ngủ][số lần đo 2B], đo độ trễ đánh thức
+CMD_SCHED = 0x1E                  # Thời gian CPU của từng tác vụ trong bộ lập lịch: [1] = xóa thống kê
+CMD_CAPTURE = 0x1F                # Bộ đệm capture có trigger: ghi vòng trước trigger, đọc về sau khi dừng
+CMD_IDSTATS = 0x20                # Bảng thống kê theo từng ID do MCU đếm, đọc theo dải slot
+REPLY_FLAG = 0x80
+UART_BOOT_BAUD = 115200            # Tốc độ UART của MCU sau reset
+UART_BAUD_CONFIRM_S = 1.0         # MCU quay về UART_BOOT_BAUD nếu không được xác nhận
+REC_BATCH = 0x40                  # [0x40][số khung][độ dài 2B][các bản ghi khung]
+BATCH_FRAMES = 16                 # Gom tối đa 16 khung mỗi batch
+BATCH_AGE_US = 2000               # hoặc gửi batch sau 2 ms kể từ khung đầu tiên
+REC_COMPACT = 0x42                # Bản ghi compact: chỉ số từ điển ID + XOR-delta
+compact_slots = {}                # Từ điển ID phía host: slot -> [mode, can_id, payload cuối]
+compact_time_us = 0               # Thời gian tích lũy từ delta timestamp (us)
+seq_next = None                   # Số thứ tự 16 bit mong đợi của khung tiếp theo
+frames_lost = 0                   # Tổng số khung bị mất trên đường chuyển tiếp của MCU
+CMD_WINDOW = 4                    # Số khung chờ ack tối đa (= độ sâu hàng đợi lệnh của MCU)
+CMD_ACK_TIMEOUT_S = 1.0           # Ack không về sau 1 s thì coi như mất, trả lại credit
+CMD_FRAME_MAX = 30                # Khung lớn nhất có thể đặt trong một CMD_SEQ
+ACK_STATUS = {0: 'ok', 1: 'bad frame', 2: 'overflow', 3: 'unknown command',
+              4: 'bus-off', 5: 'tx busy', 6: 'tx failed'}
+cmd_seq = 0                       # Số thứ tự 8 bit của khung tiếp theo
+cmd_pending = {}                  # seq -> {'event', 'status', 'sent'} của khung chưa có ack
+cmd_lock = threading.Lock()
+cmd_credits = threading.Semaphore(CMD_WINDOW)
+mcu_epoch_offset_us = None       # Giờ host (us) - giờ MCU, đặt khi kết nối
+BURST_FLAG_INC_ID = 0x01
+BURST_STATUS = {0: 'ok', 1: 'bad args', 2: 'bus-off', 3: 'timeout'}
+
+last_burst = None  # Kết quả burst gần nhất
+
+def handle_reply(cmd, payload):
+    global last_burst
+    if cmd == CMD_BURST and len(payload) == 25:
+        status, requested, ok, arb_lost, errors, cycles, core_hz = struct.unpack('>BIIIIII', payload)
+        elapsed_s = cycles / core_hz if core_hz else 0
+        last_burst = {
+            'status': BURST_STATUS.get(status, status),
+            'requested': requested,
+            'ok': ok,
+            'arbitration_lost': arb_lost,
+            'errors': errors,
+            'elapsed_cycles': cycles,
+            'core_hz': core_hz,
+            'frames_per_s': round(ok / elapsed_s, 1) if elapsed_s else 0,
+        }
+        log_line = (f"[Burst] status={last_burst['status']}, ok={ok}/{requested}, "
+                    f"arb_lost={arb_lost}, errors={errors}, cycles={cycles}, "
+                    f"fps={last_burst['frames_per_s']}")
+    else:
+        log_line = f"[UART Reply] cmd=0x{cmd:02X}, payload={payload.hex().upper()}"
+    print(log_line)
+    uart_logs.appendleft(log_line)
+
+def read_reply(port, cmd, length, timeout=0.5):
+    # Bỏ qua các byte bản ghi CAN cho tới khi gặp [cmd | 0x80][length]
+    deadline = time.time() + timeout
+    window = b''
+    while time.time() < deadline:
+        b = port.read(1)
+        if not b:
+            continue
+        window = (window + b)[-2:]
+        if window == bytes([cmd | REPLY_FLAG, length]):
+            payload = port.read(length)
+            return payload if len(payload) == length else None
+    return None
+
+def negotiate_baud(port, baudrate):
+    # MCU khởi động ở UART_BOOT_BAUD; đổi tốc độ rồi xác nhận ở tốc độ mới,
+    # nếu không xác nhận được MCU tự quay lại sau UART_BAUD_CONFIRM_S
+    if baudrate == UART_BOOT_BAUD:
+        return UART_BOOT_BAUD
+    port.reset_input_buffer()
+    port.write(bytes([CMD_UART_BAUD, 4]) + baudrate.to_bytes(4, 'big'))
+    reply = read_reply(port, CMD_UART_BAUD, 5)
+    if not reply or reply[0] != 0:
+        print(f"[UART] {baudrate} baud rejected, staying at {UART_BOOT_BAUD}")
+        return UART_BOOT_BAUD
+    port.baudrate = baudrate
+    port.reset_input_buffer()
+    port.write(bytes([CMD_UART_BAUD, 0]))
+    reply = read_reply(port, CMD_UART_BAUD, 5)
+    if reply and int.from_bytes(reply[1:5], 'big') == baudrate:
+        print(f"[UART] Link switched to {baudrate} baud")
+        return baudrate
+    time.sleep(UART_BAUD_CONFIRM_S + 0.1)
+    port.baudrate = UART_BOOT_BAUD
+    print(f"[UART] {baudrate} baud not confirmed, back to {UART_BOOT_BAUD}")
+    return UART_BOOT_BAUD
+
+def sync_epoch(port):
+    # Hỏi đồng hồ 1 us của MCU, lấy offset = thời điểm giữa vòng hỏi (giờ host) - giờ MCU,
+    # rồi ghi offset xuống để MCU quy đổi timestamp sang epoch của host
+    global mcu_epoch_offset_us
+    port.reset_input_buffer()
+    t0 = time.time_ns() // 1000
+    port.write(bytes([CMD_TIME, 0]))
+    reply = read_reply(port, CMD_TIME, 16)
+    t1 = time.time_ns() // 1000
+    if not reply:
+        print("[UART] Time sync: no reply")
+        return
+    offset = (t0 + t1) // 2 - int.from_bytes(reply[0:8], 'big')
+    port.write(bytes([CMD_TIME, 8]) + offset.to_bytes(8, 'big', signed=True))
+    read_reply(port, CMD_TIME, 16)
+    mcu_epoch_offset_us = offset
+    print(f"[UART] Time synced, offset={offset} us, round trip={t1 - t0} us")
+
+def send_sequenced(frame):
+    # Gửi khung trong phong bì CMD_SEQ; chờ credit nếu đã có CMD_WINDOW khung chưa được ack
+    global cmd_seq
+    if len(frame) > CMD_FRAME_MAX:
+        raise ValueError("frame too long for CMD_SEQ")
+    while not cmd_credits.acquire(timeout=CMD_ACK_TIMEOUT_S):
+        expire_pending()
+    with cmd_lock:
+        seq = cmd_seq
+        cmd_seq = (cmd_seq + 1) & 0xFF
+        entry = {'event': threading.Event(), 'status': None, 'sent': time.monotonic()}
+        cmd_pending[seq] = entry
+    ser.write(bytes([CMD_SEQ, len(frame) + 1, seq]) + frame)
+    return entry
+
+def wait_ack(entry, timeout=CMD_ACK_TIMEOUT_S):
+    # Trả về tên trạng thái trong ack, hoặc 'timeout'
+    if not entry['event'].wait(timeout) or entry['status'] is None:
+        return 'timeout'
+    return ACK_STATUS.get(entry['status'], entry['status'])
+
+def handle_ack(payload):
+    # [seq][status][credits]: credits là số chỗ trống trong hàng đợi lệnh của MCU
+    seq, status, credits = payload[0], payload[1], payload[2]
+    with cmd_lock:
+        entry = cmd_pending.pop(seq, None)
+    if entry is None:
+        return  # Ack trễ của khung đã hết hạn
+    entry['status'] = status
+    entry['event'].set()
+    cmd_credits.release()
+    if status != 0:
+        log_line = f"[UART Ack] seq={seq}, status={ACK_STATUS.get(status, status)}, credits={credits}"
+        print(log_line)
+    uart_logs.appendleft(log_line)
+
+def expire_pending():
+    now = time.monotonic()
+    with cmd_lock:
+        expired = [seq for seq, entry in cmd_pending.items() if now - entry['sent'] > CMD_ACK_TIMEOUT_S]
+        for seq in expired:
+            cmd_pending.pop(seq)['event'].set()
+            cmd_credits.release()
+
+def reset_pending():
+    # Khi kết nối lại: bỏ các khung đang chờ và trả lại credit của chúng
+    global cmd_seq
+    with cmd_lock:
+        for entry in cmd_pending.values():
+            entry['event'].set()
+            cmd_credits.release()
+        cmd_pending.clear()
+        cmd_seq = 0
+
+def read_leb128(read):
+    value, shift = 0, 0
+    while True:
+        b = read(1)[0]
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return value
+
+def report_lost(count):
+    global frames_lost
+    frames_lost += count
+    log_line = f"[UART] {count} frames lost (total {frames_lost})"
+    print(log_line)
+    uart_logs.appendleft(log_line)
+
+def track_seq(seq):
+    # Mỗi khung MCU nhận được có số thứ tự 16 bit, kể cả khung bị bỏ khi hàng đợi đầy,
+    # nên bước nhảy của seq chính là số khung bị mất
+    global seq_next
+    if seq_next is not None and seq != seq_next:
+        report_lost((seq - seq_next) & 0xFFFF)
+    seq_next = (seq + 1) & 0xFFFF
+
+def decode_compact(read):
+    # [0x42][slot | IDE<<6 | DEF<<7][ID 2|4 nếu DEF][len][delta us LEB128][gap LEB128][mask][XOR bytes]
+    global compact_time_us, seq_next
+    slot_byte = read(1)[0]
+    slot = slot_byte & 0x3F
+    if slot_byte & 0x80:
+        # ID mới trong từ điển: payload tham chiếu bắt đầu từ toàn 0
+        mode = 'Extended' if slot_byte & 0x40 else 'Standard'
+        can_id = read(4 if slot_byte & 0x40 else 2).hex().upper()
+        compact_slots[slot] = [mode, can_id, bytearray(8)]
+    mode, can_id, last = compact_slots[slot]
+    len_byte = read(1)[0]
+    data_len = len_byte & 0x0F
+    compact_time_us += read_leb128(read)
+    gap = read_leb128(read)  # Số khung bị mất ngay trước bản ghi này
+    if gap:
+        report_lost(gap)
+    if seq_next is not None:
+        seq_next = (seq_next + gap + 1) & 0xFFFF
+    if data_len:
+        mask = read(1)[0]
+        for i in range(data_len):
+            if mask & (1 << i):
+                last[i] ^= read(1)[0]
+    return (mode, can_id, bytes(last[:data_len]))
+
+def decode_batch(payload, count):
+    # Tách các bản ghi khung trong một batch (bản ghi đơn hoặc bản ghi compact)
+    frames = []
+    pos = 0
+    def read(n):
+        nonlocal pos
+        pos += n
+        return payload[pos - n:pos]
+    for _ in range(count):
+        rec_type = read(1)[0]
+        if rec_type == REC_COMPACT:
+            frames.append(decode_compact(read))
+            continue
+        mode = 'Standard' if rec_type == 0 else 'Extended'
+        can_id = read(2 if rec_type == 0 else 4).hex().upper()
+        data_bytes = read(read(1)[0])
+        track_seq(int.from_bytes(read(2), 'big'))
+        frames.append((mode, can_id, data_bytes))
+    return frames
+
+def handle_frames(frames):
+    for mode, can_id, data_bytes in frames:
+        # Decode data
+        try:
+            data = data_bytes.decode('ascii', errors='replace')
+        except Exception:
+            data = data_bytes.hex().upper()
+
+        log_line = f"[UART Frame] mode={mode}, can_id={can_id}, data={data}"
+        print(log_line)
+        uart_logs.appendleft(log_line)
+
 def uart_receive_loop():
     global receive_running
     while receive_running and ser:
@@ -25,6 +279,38 @@ def uart_receive_loop():
                 if not mode_byte:
                     continue
                 mode_val = int.from_bytes(mode_byte, 'big')
+
+                # Reply record to a host command
+                if mode_val & REPLY_FLAG:
+                    length_byte = ser.read(1)
+                    if not length_byte:
+                        continue
+                    payload = ser.read(length_byte[0])
+                    if len(payload) != length_byte[0]:
+                        continue
+                    if mode_val & ~REPLY_FLAG == CMD_SEQ and len(payload) == 3:
+                        handle_ack(payload)
+                        continue
+                    handle_reply(mode_val & ~REPLY_FLAG, payload)
+                    continue
+
+                # Compact record: dictionary slot + XOR-delta payload
+                if mode_val == REC_COMPACT:
+                    handle_frames([decode_compact(ser.read)])
+                    continue
+
+                # Batch record: [0x40][count][length 2B][frame records...]
+                if mode_val == REC_BATCH:
+                    header = ser.read(3)
+                    if len(header) != 3:
+                        continue
+                    length = int.from_bytes(header[1:3], 'big')
+                    payload = ser.read(length)
+                    if len(payload) != length:
+                        continue
+                    handle_frames(decode_batch(payload, header[0]))
+                    continue
+
                 mode = 'Standard' if mode_val == 0 else 'Extended'
 
                 # 2. Read CAN ID
@@ -45,15 +331,13 @@ def uart_receive_loop():
                 if len(data_bytes) != data_len:
                     continue
 
-                # Decode data
-                try:
-                    data = data_bytes.decode('ascii', errors='replace')
-                except Exception:
-                    data = data_bytes.hex().upper()
+                # 5. Read sequence number
+                seq_bytes = ser.read(2)
+                if len(seq_bytes) != 2:
+                    continue
+                track_seq(int.from_bytes(seq_bytes, 'big'))
 
-                log_line = f"[UART Frame] mode={mode}, can_id={can_id}, data={data}"
-                print(log_line)
-                uart_logs.appendleft(log_line)
+                handle_frames([(mode, can_id, data_bytes)])
 
         except Exception as e:
             print("[UART Error]", e)
@@ -72,16 +356,23 @@ def index():
 
 @app.route('/connect', methods=['POST'])
 def connect():
-    global ser
+    global ser, seq_next
     data = request.get_json()
     port = data.get('port')
     baudrate = int(data.get('baudrate', 115200))
     try:
         if ser and ser.is_open:
             ser.close()
-        ser = serial.Serial(port, baudrate, timeout=1)
+        ser = serial.Serial(port, UART_BOOT_BAUD, timeout=1)
+        baudrate = negotiate_baud(ser, baudrate)
+        sync_epoch(ser)
+        reset_pending()
+        send_sequenced(bytes([CMD_BATCH, 5, BATCH_FRAMES]) + BATCH_AGE_US.to_bytes(4, 'big'))
+        compact_slots.clear()
+        seq_next = None  # Chưa biết số thứ tự cho tới bản ghi đầu tiên
+        send_sequenced(bytes([CMD_COMPACT, 1, 1]))  # MCU xóa từ điển khi bật lại
         start_receive_thread()
-        return jsonify({'status': 'connected'})
+        return jsonify({'status': 'connected', 'baudrate': baudrate})
     except Exception as e:
         return jsonify({'status': 'error', 'message': str(e)})
 
@@ -124,7 +415,7 @@ def start_spam():
                             cyclic_bytes = int(1000).to_bytes(2, 'big')
 
                             frame = model_byte + can_id_bytes + data_len_byte + data_bytes + cyclic_bytes
-                            ser.write(frame)
+                            send_sequenced(frame)
                             print("Spam frame sent:", frame.hex())
                         except Exception as e:
                             print("[Spam Error]", e)
@@ -140,5 +431,31 @@ def stop_spam():
     spamming = False
     return '', 204
 
+@app.route('/burst', methods=['POST'])
+def burst():
+    global last_burst
+    data = request.get_json()
+    count = int(data.get('count', 1000))
+    model = data.get('mode', 'Standard')
+    can_id = int(data.get('can_id', '1234'), 16)
+    data_bytes = data.get('data', 'DATA').encode('utf-8')[:8]
+    flags = BURST_FLAG_INC_ID if data.get('incrementing') else 0
+
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+
+    payload = (bytes([flags]) + count.to_bytes(4, 'big') +
+               (b'\x01' if model == 'Extended' else b'\x00') +
+               can_id.to_bytes(4, 'big') + bytes([len(data_bytes)]) + data_bytes)
+    frame = bytes([CMD_BURST, len(payload)]) + payload
+    last_burst = None
+    ack = wait_ack(send_sequenced(frame))
+    print("Burst command sent:", frame.hex(), "ack:", ack)
+    return jsonify({'status': 'sent' if ack == 'ok' else ack})
+
+@app.route('/burst_result')
+def burst_result():
+    return jsonify({'result': last_burst})
+
 if __name__ == '__main__':
     app.run(debug=True)
@@ -3,6 +3,10 @@ import serial
 import serial.tools.list_ports
 import mysql.connector
 import threading
+import struct
+import time
+import queue
+import os
 
 app = Flask(__name__)
 
@@ -19,25 +23,744 @@ ser = None
 receive_thread = None
 receive_running = False
 
+# Command frames: [cmd][payload length][payload], replies: [cmd | 0x80][length][payload]
+CMD_BURST = 0x10
+CMD_PING = 0x11
+CMD_PING_HIST = 0x12
+CMD_CAN_MODE = 0x13
+CMD_SELFTEST = 0x14
+CMD_CAN_BITRATE = 0x15
+CMD_UART_BAUD = 0x16
+CMD_BATCH = 0x17
+CMD_COMPACT = 0x18
+CMD_FWD = 0x19
+CMD_SEQ = 0x1A                    # Khung kèm số thứ tự: [0x1A][1 + độ dài][seq][khung], MCU trả ack
+CMD_TIME = 0x1B                   # Đọc đồng hồ 1 us của MCU / đặt offset epoch
+CMD_CYCLIC = 0x1C                 # Khung tuần hoàn chu kỳ us: [slot][chu kỳ us 4B][mode][id 4B][len][data]
+CMD_POWER = 0x1D                  # Ngủ WFI/WFE khi rảnh: [mức ngủ][số lần đo 2B], đo độ trễ đánh thức
+CMD_SCHED = 0x1E                  # Thời gian CPU của từng tác vụ trong bộ lập lịch: [1] = xóa thống kê
+CMD_CAPTURE = 0x1F                # Bộ đệm capture có trigger: ghi vòng trước trigger, đọc về sau khi dừng
+CMD_IDSTATS = 0x20                # Bảng thống kê theo từng ID do MCU đếm, đọc theo dải slot
+CMD_ISOTP = 0x21                  # ISO-TP: gửi payload dài (tối đa 4095 byte) có flow control, đo thông lượng
+CMD_SLCAN = 0x22                  # Chuyển UART sang giao thức ASCII SLCAN (Lawicel); "B\r" để quay lại nhị phân
+CMD_CRC = 0x23                    # Bộ CRC phần cứng: CRC 4 byte sau mỗi bản ghi/batch, so sánh HW và bảng phần mềm
+CMD_CFGSTORE = 0x24               # Cấu hình lưu trong flash (bit rate, chế độ CAN, khung tuần hoàn), khôi phục khi khởi động
+CMD_BOOT = 0x25                   # Reset vào bootloader: trả [địa chỉ app 4B][dung lượng app 4B] rồi reset
+CMD_TSYNC = 0x26                  # Đồng bộ thời gian qua CAN (SYNC/FUP): vai trò master/slave, mốc quy đổi giờ node -> giờ chung
+CMD_IDDISP = 0x27                 # Bảng điều phối theo ID (hash hoàn hảo trong flash): kích thước, bộ đếm, số chu kỳ tra bảng
+CMD_POOL = 0x28                   # Pool khung dùng chung (RX CAN, lệnh UART): số khối đang dùng, mức cao nhất, số lần hết khối
+REPLY_FLAG = 0x80
+UART_BOOT_BAUD = 115200            # Tốc độ UART của MCU sau reset
+UART_BAUD_CONFIRM_S = 1.0         # MCU quay về UART_BOOT_BAUD nếu không được xác nhận
+REC_BATCH = 0x40                  # [0x40][số khung][độ dài 2B][các bản ghi khung]
+BATCH_FRAMES = 16                 # Gom tối đa 16 khung mỗi batch
+BATCH_AGE_US = 2000               # hoặc gửi batch sau 2 ms kể từ khung đầu tiên
+REC_COMPACT = 0x42                # Bản ghi compact: chỉ số từ điển ID + XOR-delta
+compact_slots = {}                # Từ điển ID phía host: slot -> [mode, can_id, payload cuối]
+compact_time_us = 0               # Thời gian tích lũy từ delta timestamp (us)
+seq_next = None                   # Số thứ tự 16 bit mong đợi của khung tiếp theo
+frames_lost = 0                   # Tổng số khung bị mất trên đường chuyển tiếp của MCU
+CMD_WINDOW = 4                    # Số khung chờ ack tối đa (= độ sâu hàng đợi lệnh của MCU)
+CMD_ACK_TIMEOUT_S = 1.0           # Ack không về sau 1 s thì coi như mất, trả lại credit
+CMD_FRAME_MAX = 30                # Khung lớn nhất có thể đặt trong một CMD_SEQ
+ACK_STATUS = {0: 'ok', 1: 'bad frame', 2: 'overflow', 3: 'unknown command',
+              4: 'bus-off', 5: 'tx busy', 6: 'tx failed'}
+cmd_seq = 0                       # Số thứ tự 8 bit của khung tiếp theo
+cmd_pending = {}                  # seq -> {'event', 'status', 'sent'} của khung chưa có ack
+cmd_lock = threading.Lock()
+cmd_credits = threading.Semaphore(CMD_WINDOW)
+mcu_epoch_offset_us = None       # Giờ host (us) - giờ MCU, đặt khi kết nối
+FWD_POLICIES = {'drop_newest': 0, 'drop_oldest': 1, 'latest_id': 2}
+CAN_MODES = {'normal': 0, 'loopback': 1, 'silent': 2, 'selftest': 3}
+CAN_BITRATES = (125000, 250000, 500000, 1000000)
+CYCLIC_SLOTS = 4                  # Slot 0 cũng dùng cho khung có cyclic (ms) trong bảng transmit
+POWER_DEPTHS = {'off': 0, 'wfi': 1, 'wfe': 2, 'wfe_lp': 3}
+SCHED_TASKS = {1: 'uart_rx', 2: 'timeout', 4: 'can_rx'}  # Bit sự kiện -> tác vụ
+CAPTURE_OPS = {'status': 0, 'arm': 1, 'stop': 2, 'fire': 3, 'dump': 4}
+CAPTURE_TRIGGERS = {'id': 0, 'error': 1, 'load': 2}
+CAPTURE_CAUSES = {**CAPTURE_TRIGGERS, 'manual': 0xFF}  # 0xFE = chưa kích
+CAPTURE_STATES = ('idle', 'armed', 'triggered', 'done')
+CAPTURE_LEC = {1: 'stuff', 2: 'form', 3: 'ack', 4: 'bit recessive', 5: 'bit dominant', 6: 'crc'}
+CAPTURE_REC_LEN = 20              # [stamp 4B][RIR 4B][RDTR 4B][data 8B]
+CAPTURE_DUMP_CHUNK = 12           # Số bản ghi tối đa trong một reply
+IDSTATS_OPS = {'status': 0, 'clear': 1, 'dump': 2, 'changes': 3}
+IDSTATS_SLOTS = 64                # Số slot của bảng trên MCU
+IDSTATS_REC_LEN = 42              # [IDE][ID 4B][frames][bytes][gap min/max/mean][age][DLC][hash][remote][changes]
+IDSTATS_CHUNK = 5                 # Số slot quét mỗi lệnh (vừa một reply)
+ISOTP_OPS = {'status': 0, 'config': 1, 'load': 2, 'send': 3, 'bench': 4, 'abort': 5}
+ISOTP_STATES = {0: 'idle', 1: 'wait_fc', 2: 'sending', 3: 'receiving'}
+ISOTP_RESULTS = {0: 'ok', 1: 'timeout', 2: 'overflow', 3: 'tx failed', 4: 'bad sequence',
+                 5: 'aborted', 6: 'busy', 0xFF: None}
+ISOTP_MAX_LEN = 4095              # Độ dài lớn nhất (12 bit trong first frame)
+ISOTP_BUF_LEN = 1028              # Bộ đệm payload trên MCU (vừa một khối bootloader); benchmark tự sinh dữ liệu nên được tới 4095
+ISOTP_LOAD_CHUNK = 25             # Byte dữ liệu mỗi lệnh load: [op][offset 2B][data]
+SLCAN_OPS = {'status': 0, 'enter': 1, 'clear': 2}
+SLCAN_BENCH_ID = 0x123            # ID chuẩn của khung 8 byte dùng để so sánh hai chế độ
+CRC_OPS = {'status': 0, 'records': 1, 'bench': 2}
+CRC_POLY = 0x04C11DB7             # CRC-32/MPEG-2 như bộ CRC của STM32F1: init 0xFFFFFFFF, MSB trước, không XOR cuối
+CFGSTORE_OPS = {'status': 0, 'save': 1, 'erase': 2}
+CFGSTORE_RESULTS = ('ok', 'flash error', 'verify error')
+TSYNC_OPS = {'status': 0, 'config': 1}
+TSYNC_ROLES = ('off', 'master', 'slave')
+TSYNC_CAN_ID = 0x7C0              # SYNC/FUP 8 byte; giờ chung = epoch host của node master
+TSYNC_PERIOD_MS = 100             # Chu kỳ SYNC mặc định (tối thiểu 10 ms)
+IDDISP_OPS = {'status': 0, 'clear': 1}
+POOL_OPS = {'status': 0, 'clear': 1}
+BOOT_OPS = {'status': 0, 'start': 1, 'data': 2, 'end': 3, 'run': 4, 'enter': 5}
+BOOT_RESULTS = ('ok', 'bad message', 'sequence', 'flash error', 'crc error', 'size')
+BOOT_WHY = ('request', 'no app', 'incomplete')
+BOOT_CAN_RX_ID = 0x7A0            # Host -> bootloader: message ISO-TP (cặp ID riêng, không trùng ping 0x7F0/0x7F1)
+BOOT_CAN_TX_ID = 0x7A8            # Bootloader -> host: flow control và trả lời 8 byte [op | 0x80][kết quả][khối 2B][giá trị 4B]
+BOOT_CAN_BITRATE = 500000         # Bootloader luôn chạy CAN 500 kbit/s
+BOOT_UART_BAUD = 500000           # và UART 500000 baud: message [độ dài 2B][message], trả lời 8 byte
+BOOT_BLOCK_SIZE = 1024            # Một trang flash mỗi khối DATA
+BOOT_IMAGE_OFFSET = 0x2000        # File .bin dựng từ ELF bắt đầu ở 0x08000000: bỏ phần bootloader
+BOOT_REPLY_TIMEOUT_S = 2.0
+PING_HIST_BINS = 1024
+PING_HIST_CHUNK = 100
+
+burst_summary = None              # Kết quả burst gần nhất
+ping_summary = None               # Kết quả ping-pong gần nhất
+selftest_summary = None           # Kết quả self-test loopback gần nhất
+can_mode = None                   # Chế độ CAN hiện tại của MCU
+can_bitrate = None                # Tốc độ bit CAN hiện tại (bit/s) và BTR
+fwd_stats = None                  # Trạng thái hàng đợi chuyển tiếp và bộ đếm khung bị bỏ
+cyclic_stats = [None] * CYCLIC_SLOTS  # Thống kê jitter của từng khung tuần hoàn
+power_stats = None                # Thời gian ngủ và độ trễ đánh thức (chu kỳ CPU)
+sched_stats = None                # Thời gian CPU theo tác vụ
+capture_stats = None              # Trạng thái capture gần nhất
+capture_frames = []               # Các khung đã đọc về, cũ nhất trước
+idstats_status = None             # Trạng thái bảng thống kê ID gần nhất
+id_table = {}                     # (mode, can_id) -> thống kê của ID, cập nhật dần
+idstats_lock = threading.Lock()   # Chỉ một lượt đọc bảng tại một thời điểm
+isotp_stats = None                # Trạng thái gửi/nhận ISO-TP gần nhất
+isotp_config = {'mode': 'Standard', 'rx_id': 0x7E0, 'bs': 0, 'stmin': 0}  # ID nhận, BS/STmin của flow control
+isotp_sent = b''                  # Payload của lần gửi gần nhất, để kiểm tra hash
+slcan_stats = None                # Trạng thái SLCAN và số byte dòng/bản ghi nhị phân
+slcan_active = False              # UART đang ở chế độ SLCAN: luồng nhận đọc từng dòng
+slcan_leaving = False             # Đã gửi "B\r", dòng rỗng tiếp theo là trả lời cuối cùng
+bench_active = False              # Luồng benchmark đang giữ cổng UART
+slcan_bench_summary = None        # Kết quả so sánh nhị phân / SLCAN gần nhất
+record_crc = False                # Bản ghi/batch từ MCU có kèm [CRC 4B]
+crc_checked = 0                   # Số bản ghi/batch đã kiểm CRC
+crc_errors = 0                    # Trong đó sai CRC (bị bỏ)
+crc_stats = None                  # Trạng thái CRC bản ghi trên MCU
+crc_bench_summary = None          # Chu kỳ CPU: bộ CRC phần cứng / DMA / bảng phần mềm
+cfg_stats = None                  # Cấu hình đang lưu trong flash của MCU
+tsync_stats = None                # Trạng thái đồng bộ thời gian và mốc quy đổi của node
+iddisp_stats = None               # Bảng điều phối theo ID: kích thước và thời gian tra bảng đo trên MCU
+pool_stats = None                 # Pool khung trên MCU: số khối đang dùng và mức cao nhất để chọn kích thước
+boot_replies = queue.Queue()      # Trả lời của bootloader trên BOOT_CAN_TX_ID
+boot_stats = None                 # Tiến độ và thời gian của lần nạp firmware gần nhất
+ping_hist = [0] * PING_HIST_BINS  # Histogram RTT, 1 us mỗi bin
+
+def send_command(cmd, payload=b''):
+    if slcan_active or bench_active:
+        # MCU đang đọc dòng SLCAN: không gửi lệnh nhị phân, coi như không có ack
+        entry = {'event': threading.Event(), 'status': None, 'sent': time.monotonic()}
+        entry['event'].set()
+        return entry
+    return send_sequenced(bytes([cmd, len(payload)]) + payload)
+
+def fetch_ping_hist():
+    # Chạy ở luồng riêng: luồng nhận UART phải rảnh để xử lý ack trả credit
+    for first in range(0, PING_HIST_BINS, PING_HIST_CHUNK):
+        send_command(CMD_PING_HIST, first.to_bytes(2, 'big') + bytes([PING_HIST_CHUNK]))
+
+def fetch_capture(frames):
+    # Như fetch_ping_hist: đọc từng phần ở luồng riêng
+    for first in range(0, frames, CAPTURE_DUMP_CHUNK):
+        send_command(CMD_CAPTURE, bytes([CAPTURE_OPS['dump']]) + first.to_bytes(2, 'big'))
+
+def tsync_global_us(local_us):
+    # Giờ 1 us của node (Time_Now32, quay vòng 32 bit) -> giờ chung (us) theo mốc và tốc độ trong
+    # tsync_stats; None khi node chưa đồng bộ. Dùng để gộp bản ghi của nhiều node trên một trục thời gian
+    if not (tsync_stats and tsync_stats['synced']):
+        return None
+    d = (local_us - tsync_stats['local_ref_us']) & 0xFFFFFFFF
+    if d >= 1 << 31:
+        d -= 1 << 32  # Timestamp trước mốc
+    return (tsync_stats['global_ref_ns'] + d * 1000 + d * tsync_stats['rate_ppb'] // 1000000) // 1000
+
+def capture_record(rec):
+    stamp, rir, rdtr = struct.unpack('>III', rec[:12])
+    extended = bool(rir & 0x4)
+    dlc = min(rdtr & 0x0F, 8)
+    return {'stamp_us': stamp, 'global_us': tsync_global_us(stamp), 'mode': 'Extended' if extended else 'Standard',
+            'can_id': f"{(rir >> 3) if extended else (rir >> 21):X}", 'rtr': bool(rir & 0x2),
+            'dlc': rdtr & 0x0F, 'data': rec[12:12 + dlc].hex().upper()}
+
+def fetch_idstats():
+    # Chỉ hỏi các entry thay đổi từ lần đọc trước, lần lượt từng dải slot
+    try:
+        send_command(CMD_IDSTATS)
+        for first in range(0, IDSTATS_SLOTS, IDSTATS_CHUNK):
+            send_command(CMD_IDSTATS, bytes([IDSTATS_OPS['changes'], first, IDSTATS_CHUNK]))
+    finally:
+        idstats_lock.release()
+
+def idstats_record(rec):
+    ide, can_id, frames, nbytes, gap_min, gap_max, gap_mean, age, dlc, payload_hash, remote, changes = \
+        struct.unpack('>BIIIIIIIBIII', rec)
+    mode = 'Extended' if ide else 'Standard'
+    key = (mode, f"{can_id:X}")
+    id_table[key] = {'mode': mode, 'can_id': key[1], 'frames': frames, 'bytes': nbytes,
+                     'gap_min_us': gap_min, 'gap_max_us': gap_max, 'gap_mean_us': gap_mean,
+                     'rate_per_s': round(1e6 / gap_mean, 1) if gap_mean else 0,
+                     'age_us': age, 'read_at': time.time(), 'dlc': dlc,
+                     'payload_hash': f"{payload_hash:08X}", 'remote': remote, 'changes': changes}
+
+def fnv1a(data):
+    h = 2166136261
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+def make_crc_table():
+    table = []
+    for i in range(256):
+        c = i << 24
+        for _ in range(8):
+            c = ((c << 1) ^ CRC_POLY) if c & 0x80000000 else c << 1
+        table.append(c & 0xFFFFFFFF)
+    return table
+
+CRC_TABLE = make_crc_table()
+
+def crc32_words(data):
+    # MCU nạp từng word 32 bit little-endian (byte 3 vào trước), phần dư 1-3 byte đệm 0
+    data = bytes(data) + bytes(-len(data) % 4)
+    crc = 0xFFFFFFFF
+    for i in range(0, len(data), 4):
+        for b in reversed(data[i:i + 4]):
+            crc = ((crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[(crc >> 24) ^ b]
+    return crc
+
+def record_crc_ok(raw):
+    # Đọc [CRC 4B] sau bản ghi khi MCU bật CRC bản ghi; bản ghi sai CRC bị bỏ
+    global crc_checked, crc_errors
+    if not record_crc:
+        return True
+    crc = ser.read(4)
+    crc_checked += 1
+    if len(crc) == 4 and int.from_bytes(crc, 'big') == crc32_words(raw):
+        return True
+    crc_errors += 1
+    print(f"[UART] record CRC mismatch ({crc_errors}/{crc_checked})")
+    return False
+
+def isotp_bench_payload(length):
+    return bytes(i & 0xFF for i in range(length))  # Giống dữ liệu MCU tự sinh
+
+def isotp_load_send(payload):
+    # Nạp payload vào bộ đệm MCU từng phần rồi bắt đầu gửi tới ID đã cấu hình
+    for offset in range(0, len(payload), ISOTP_LOAD_CHUNK):
+        send_command(CMD_ISOTP, bytes([ISOTP_OPS['load']]) + offset.to_bytes(2, 'big') +
+                     payload[offset:offset + ISOTP_LOAD_CHUNK])
+    return wait_ack(send_command(CMD_ISOTP, bytes([ISOTP_OPS['send']]) + len(payload).to_bytes(2, 'big')))
+
+def send_isotp(payload, mode, can_id):
+    # Cấu hình địa chỉ rồi gửi payload
+    global isotp_sent
+    ide = 1 if mode == 'Extended' else 0
+    rx_ide = 1 if isotp_config['mode'] == 'Extended' else 0
+    if ide != rx_ide:
+        return 'addressing mismatch'
+    send_command(CMD_ISOTP, bytes([ISOTP_OPS['config'], ide]) + can_id.to_bytes(4, 'big') +
+                 isotp_config['rx_id'].to_bytes(4, 'big') + bytes([isotp_config['bs'], isotp_config['stmin']]))
+    isotp_sent = payload
+    return isotp_load_send(payload)
+
+def handle_reply(cmd, payload):
+    global burst_summary, ping_summary, selftest_summary, can_mode, can_bitrate, fwd_stats, power_stats, sched_stats
+    global capture_stats, idstats_status, isotp_stats, slcan_stats, slcan_active, record_crc, crc_stats
+    global crc_bench_summary, cfg_stats, tsync_stats, iddisp_stats, pool_stats
+    if cmd == CMD_BURST and len(payload) == 25:
+        status, requested, ok, arb_lost, errors, cycles, core_hz = struct.unpack('>BIIIIII', payload)
+        elapsed_s = cycles / core_hz if core_hz else 0
+        burst_summary = {'status': status, 'requested': requested, 'ok': ok,
+                         'arbitration_lost': arb_lost, 'errors': errors,
+                         'elapsed_cycles': cycles, 'core_hz': core_hz,
+                         'frames_per_s': round(ok / elapsed_s, 1) if elapsed_s else 0}
+        print(f"[Burst] ok={ok}/{requested}, arb_lost={arb_lost}, errors={errors}, "
+              f"fps={burst_summary['frames_per_s']}")
+    elif cmd == CMD_CAN_MODE and len(payload) == 1:
+        can_mode = next((k for k, v in CAN_MODES.items() if v == payload[0]), payload[0])
+        print(f"[CAN Mode] {can_mode}")
+    elif cmd == CMD_CAN_BITRATE and len(payload) == 9:
+        status, bitrate, btr = struct.unpack('>BII', payload)
+        can_bitrate = {'status': status, 'bitrate': bitrate, 'btr': f"0x{btr:08X}"}
+        print(f"[CAN Bitrate] {bitrate} bit/s, BTR=0x{btr:08X}" + (" (unsupported request)" if status else ""))
+    elif cmd == CMD_FWD and len(payload) == 22:
+        policy, queue_len, queued, high_water, next_seq, newest, oldest, superseded, overruns = \
+            struct.unpack('>BBBBHIIII', payload)
+        fwd_stats = {'policy': next((k for k, v in FWD_POLICIES.items() if v == policy), policy),
+                     'queue_len': queue_len, 'queued': queued, 'high_water': high_water,
+                     'next_seq': next_seq, 'dropped_newest': newest, 'dropped_oldest': oldest,
+                     'superseded': superseded, 'fifo_overruns': overruns,
+                     'host_frames_lost': frames_lost}
+        print(f"[Forwarding] policy={fwd_stats['policy']}, high_water={high_water}/{queue_len}, "
+              f"dropped_newest={newest}, dropped_oldest={oldest}, superseded={superseded}, "
+              f"fifo_overruns={overruns}, host_lost={frames_lost}")
+    elif cmd == CMD_CYCLIC and len(payload) == 30:
+        slot, active, period, sent, missed, failed, jmin, jmax, jmean = struct.unpack('>BBIIIIIII', payload)
+        if slot < CYCLIC_SLOTS:
+            cyclic_stats[slot] = {'active': bool(active), 'period_us': period, 'sent': sent,
+                                  'missed': missed, 'failed': failed, 'jitter_min_us': jmin,
+                                  'jitter_max_us': jmax, 'jitter_mean_us': jmean}
+    elif cmd == CMD_POWER and len(payload) == 27:
+        depth, sleeps, asleep_us, awake_us, probes, *lat = struct.unpack('>BIIIHHHHHHH', payload)
+        power_stats = {'depth': next((k for k, v in POWER_DEPTHS.items() if v == depth), depth),
+                       'sleeps': sleeps, 'asleep_us': asleep_us, 'awake_us': awake_us,
+                       'sleep_ratio': round(asleep_us / (asleep_us + awake_us), 3) if asleep_us + awake_us else 0,
+                       'probes': probes,
+                       'irq_cycles': {'min': lat[0], 'mean': lat[1], 'max': lat[2]},
+                       'processing_cycles': {'min': lat[3], 'mean': lat[4], 'max': lat[5]}}
+        print(f"[Power] depth={power_stats['depth']}, sleeps={sleeps}, ratio={power_stats['sleep_ratio']}, "
+              f"irq={lat[0]}/{lat[1]}/{lat[2]} cyc, processing={lat[3]}/{lat[4]}/{lat[5]} cyc")
+    elif cmd == CMD_SCHED and len(payload) >= 17 and len(payload) == 17 + 21 * payload[0]:
+        count, core_hz, window_us, idle_cycles = struct.unpack('>BIIQ', payload[:17])
+        window_cycles = window_us * (core_hz // 1000000)
+        tasks = []
+        for i in range(count):
+            events, runs, cycles, max_cycles, overruns = struct.unpack('>BIQII', payload[17 + 21 * i:38 + 21 * i])
+            tasks.append({'task': SCHED_TASKS.get(events, events), 'runs': runs, 'cycles': cycles,
+                          'max_us': round(max_cycles * 1e6 / core_hz, 1) if core_hz else 0,
+                          'overruns': overruns,
+                          'cpu_percent': round(100 * cycles / window_cycles, 2) if window_cycles else 0})
+        sched_stats = {'window_us': window_us, 'tasks': tasks,
+                       'idle_percent': round(100 * idle_cycles / window_cycles, 2) if window_cycles else 0}
+        print(f"[Scheduler] idle={sched_stats['idle_percent']}%, " +
+              ", ".join(f"{t['task']}={t['cpu_percent']}%" for t in tasks))
+    elif cmd == CMD_CAPTURE and len(payload) == 23 and payload[0] == CAPTURE_OPS['status']:
+        _, state, trigger, cause, lec, depth, frames, trig_index, post_left, trig_stamp, seen, peak = \
+            struct.unpack('>BBBBBHHHHIIH', payload)
+        capture_stats = {'state': CAPTURE_STATES[state] if state < len(CAPTURE_STATES) else state,
+                         'trigger': next((k for k, v in CAPTURE_TRIGGERS.items() if v == trigger), trigger),
+                         'cause': next((k for k, v in CAPTURE_CAUSES.items() if v == cause), None),
+                         'lec': CAPTURE_LEC.get(lec), 'depth': depth, 'frames': frames,
+                         'trigger_index': trig_index if trig_index != 0xFFFF else None,
+                         'post_left': post_left, 'trigger_stamp_us': trig_stamp,
+                         'frames_seen': seen, 'peak_load_permille': peak}
+        print(f"[Capture] state={capture_stats['state']}, cause={capture_stats['cause']}, "
+              f"frames={frames}/{depth}, trigger_index={capture_stats['trigger_index']}, peak_load={peak}")
+    elif cmd == CMD_CAPTURE and len(payload) >= 4 and payload[0] == CAPTURE_OPS['dump'] and \
+            len(payload) == 4 + CAPTURE_REC_LEN * payload[3]:
+        first = int.from_bytes(payload[1:3], 'big')
+        records = [capture_record(payload[4 + CAPTURE_REC_LEN * i:4 + CAPTURE_REC_LEN * (i + 1)])
+                   for i in range(payload[3])]
+        capture_frames[first:first + len(records)] = records
+    elif cmd == CMD_IDSTATS and len(payload) == 15 and payload[0] == IDSTATS_OPS['status']:
+        _, slots, used, overflow, frames, since = struct.unpack('>BBBIII', payload)
+        idstats_status = {'slots': slots, 'used': used, 'overflow_frames': overflow,
+                          'frames': frames, 'since_s': round(since / 1e6, 1)}
+    elif cmd == CMD_IDSTATS and len(payload) >= 4 and payload[0] in (IDSTATS_OPS['dump'], IDSTATS_OPS['changes']) and \
+            len(payload) == 4 + IDSTATS_REC_LEN * payload[3]:
+        for i in range(payload[3]):
+            idstats_record(payload[4 + IDSTATS_REC_LEN * i:4 + IDSTATS_REC_LEN * (i + 1)])
+    elif cmd == CMD_ISOTP and len(payload) == 45 and payload[0] == ISOTP_OPS['status']:
+        _, tx_state, tx_result, tx_len, sent, tx_frames, fc, waits, bs, stmin, tx_us, tx_hash = \
+            struct.unpack('>BBBHHHHHBBII', payload[:23])
+        rx_state, rx_result, rx_len, received, rx_frames, sn_errors, rx_us, rx_hash, transfers = \
+            struct.unpack('>BBHHHHIII', payload[23:])
+        isotp_stats = {
+            'tx': {'state': ISOTP_STATES.get(tx_state, tx_state), 'result': ISOTP_RESULTS.get(tx_result, tx_result),
+                   'length': tx_len, 'sent': sent, 'frames': tx_frames, 'flow_controls': fc, 'waits': waits,
+                   'bs': bs, 'stmin': stmin, 'duration_us': tx_us, 'hash': f"{tx_hash:08X}",
+                   'bytes_per_s': round(tx_len * 1e6 / tx_us) if tx_us and tx_result == 0 else 0},
+            'rx': {'state': ISOTP_STATES.get(rx_state, rx_state), 'result': ISOTP_RESULTS.get(rx_result, rx_result),
+                   'length': rx_len, 'received': received, 'frames': rx_frames, 'sn_errors': sn_errors,
+                   'duration_us': rx_us, 'hash': f"{rx_hash:08X}", 'transfers': transfers,
+                   'bytes_per_s': round(rx_len * 1e6 / rx_us) if rx_us and rx_result == 0 else 0}}
+        print(f"[ISO-TP] tx {isotp_stats['tx']['state']}/{isotp_stats['tx']['result']} {sent}/{tx_len} B "
+              f"in {tx_us} us, rx {isotp_stats['rx']['state']}/{isotp_stats['rx']['result']} {received}/{rx_len} B")
+    elif cmd == CMD_SLCAN and len(payload) == 27:
+        enabled, is_open, timestamps, lines, errors, tx, rx, line_bytes, plain_bytes = \
+            struct.unpack('>BBBIIIIII', payload)
+        slcan_stats = {'enabled': bool(enabled), 'open': bool(is_open), 'timestamps': bool(timestamps),
+                       'lines': lines, 'errors': errors, 'frames_sent': tx, 'frames_forwarded': rx,
+                       'line_bytes': line_bytes, 'plain_bytes': plain_bytes,
+                       'size_ratio': round(line_bytes / plain_bytes, 2) if plain_bytes else 0}
+        slcan_active = bool(enabled)  # Sau trả lời của lệnh enter chỉ còn dòng ASCII
+    elif cmd == CMD_CRC and len(payload) == 6 and payload[0] == CRC_OPS['status']:
+        enabled, sent = struct.unpack('>BI', payload[1:])
+        crc_stats = {'records': bool(enabled), 'sent': sent}
+        record_crc = bool(enabled)  # MCU gửi batch cũ trước trả lời, bản ghi sau đó mới có CRC
+    elif cmd == CMD_CRC and len(payload) == 30 and payload[0] == CRC_OPS['bench']:
+        frames, hw, sw, buf_len, dma, cpu, soft, buf_crc, match = struct.unpack('>HIIHIIIIB', payload[1:])
+        crc_bench_summary = {'frames': frames, 'hw_cycles_per_frame': round(hw / frames, 1),
+                             'sw_cycles_per_frame': round(sw / frames, 1),
+                             'frame_speedup': round(sw / hw, 2) if hw else 0,
+                             'buffer_bytes': buf_len, 'dma_cycles': dma, 'cpu_cycles': cpu, 'sw_cycles': soft,
+                             'buffer_crc': f"{buf_crc:08X}", 'match': bool(match)}
+        print(f"[CRC Bench] {crc_bench_summary['hw_cycles_per_frame']} vs "
+              f"{crc_bench_summary['sw_cycles_per_frame']} cycles/frame, {buf_len} B: "
+              f"dma {dma}, cpu {cpu}, sw {soft} cycles, match={bool(match)}")
+    elif cmd == CMD_CFGSTORE and len(payload) == 18:
+        op, result, restored, seq, slot, restore_us, bitrate, mode, mask = struct.unpack('>BBBIBIIBB', payload)
+        cfg_stats = {'result': CFGSTORE_RESULTS[result] if result < len(CFGSTORE_RESULTS) else result,
+                     'restored': bool(restored), 'saves': seq, 'slot': slot if slot != 0xFF else None,
+                     'restore_us': restore_us, 'bitrate': bitrate or None,
+                     'can_mode': next((k for k, v in CAN_MODES.items() if v == mode), mode),
+                     'cyclic_slots': [i for i in range(8) if mask & (1 << i)]}
+        print(f"[Config] op={op}, result={cfg_stats['result']}, restored={bool(restored)}, "
+              f"saves={seq}, restore={restore_us} us")
+    elif cmd == CMD_TSYNC and len(payload) == 54:
+        _, role, domain, synced, period, syncs, fups, dropped, steps, window, offset, offset_max, rate, \
+            local_ref, global_ref = struct.unpack('>BBBBHIIIIIiIiQQ', payload)
+        tsync_stats = {'role': TSYNC_ROLES[role] if role < len(TSYNC_ROLES) else role, 'domain': domain,
+                       'synced': bool(synced), 'period_ms': period, 'syncs': syncs, 'fups': fups,
+                       'dropped': dropped, 'steps': steps, 'window_us': window, 'offset_ns': offset,
+                       'max_offset_ns': offset_max, 'rate_ppb': rate,
+                       'local_ref_us': local_ref, 'global_ref_ns': global_ref}
+        print(f"[TSync] role={tsync_stats['role']}, domain={domain}, synced={bool(synced)}, "
+              f"offset={offset} ns (max {offset_max}), rate={rate} ppb, dropped={dropped}, steps={steps}")
+    elif cmd == CMD_IDDISP and len(payload) == 32:
+        _, entries, slots, entry_bytes, table_bytes, mult, handled, dropped, limited, cyc_min, cyc_max, timed = \
+            struct.unpack('>BBBBHIIIIIIH', payload)
+        iddisp_stats = {'entries': entries, 'slots': slots, 'entry_bytes': entry_bytes, 'table_bytes': table_bytes,
+                        'multiplier': f"{mult:08X}", 'handled': handled, 'dropped': dropped, 'limited': limited,
+                        'lookup_cycles_min': cyc_min, 'lookup_cycles_max': cyc_max, 'lookups_timed': timed}
+        print(f"[IdDisp] {entries} IDs in {slots} slots ({table_bytes} B), lookup {cyc_min}-{cyc_max} cycles, "
+              f"handled={handled}, dropped={dropped}, limited={limited}")
+    elif cmd == CMD_POOL and len(payload) == 13:
+        _, blocks, block_size, in_use, high_water, failures, allocs = struct.unpack('>BBBBBII', payload)
+        pool_stats = {'blocks': blocks, 'block_size': block_size, 'in_use': in_use, 'high_water': high_water,
+                      'alloc_failures': failures, 'allocs': allocs}
+        print(f"[Pool] {in_use}/{blocks} blocks of {block_size} B in use, high_water={high_water}, "
+              f"failures={failures}, allocs={allocs}")
+    elif cmd == CMD_SELFTEST and len(payload) == 6:
+        status, rx_frames, restored = struct.unpack('>BIB', payload)
+        selftest_summary = {'status': status, 'rx_frames': rx_frames,
+                            'burst': burst_summary, 'ping': ping_summary}
+        print(f"[Self-test] status={status}, rx_frames={rx_frames}")
+    elif cmd == CMD_PING and len(payload) == 29:
+        status, sent, received, lost, min_us, max_us, mean_us, overflow = struct.unpack('>BIIIIIII', payload)
+        ping_summary = {'status': status, 'sent': sent, 'received': received, 'lost': lost,
+                        'min_us': min_us, 'max_us': max_us, 'mean_us': mean_us, 'overflow': overflow}
+        print(f"[Ping] sent={sent}, received={received}, lost={lost}, "
+              f"min={min_us}us, mean={mean_us}us, max={max_us}us")
+        # Đọc toàn bộ histogram sau khi có kết quả
+        threading.Thread(target=fetch_ping_hist, daemon=True).start()
+    elif cmd == CMD_PING_HIST and len(payload) >= 3:
+        first = int.from_bytes(payload[0:2], 'big')
+        count = payload[2]
+        for i in range(count):
+            ping_hist[first + i] = int.from_bytes(payload[3 + 2 * i:5 + 2 * i], 'big')
+    else:
+        print(f"[UART Reply] cmd=0x{cmd:02X}, payload={payload.hex().upper()}")
+
+def read_reply(port, cmd, length, timeout=0.5):
+    # Bỏ qua các byte bản ghi CAN cho tới khi gặp [cmd | 0x80][length]
+    deadline = time.time() + timeout
+    window = b''
+    while time.time() < deadline:
+        b = port.read(1)
+        if not b:
+            continue
+        window = (window + b)[-2:]
+        if window == bytes([cmd | REPLY_FLAG, length]):
+            payload = port.read(length)
+            return payload if len(payload) == length else None
+    return None
+
+def negotiate_baud(port, baudrate):
+    # MCU khởi động ở UART_BOOT_BAUD; đổi tốc độ rồi xác nhận ở tốc độ mới,
+    # nếu không xác nhận được MCU tự quay lại sau UART_BAUD_CONFIRM_S
+    if baudrate == UART_BOOT_BAUD:
+        return UART_BOOT_BAUD
+    port.reset_input_buffer()
+    port.write(bytes([CMD_UART_BAUD, 4]) + baudrate.to_bytes(4, 'big'))
+    reply = read_reply(port, CMD_UART_BAUD, 5)
+    if not reply or reply[0] != 0:
+        print(f"[UART] {baudrate} baud rejected, staying at {UART_BOOT_BAUD}")
+        return UART_BOOT_BAUD
+    port.baudrate = baudrate
+    port.reset_input_buffer()
+    port.write(bytes([CMD_UART_BAUD, 0]))
+    reply = read_reply(port, CMD_UART_BAUD, 5)
+    if reply and int.from_bytes(reply[1:5], 'big') == baudrate:
+        print(f"[UART] Link switched to {baudrate} baud")
+        return baudrate
+    time.sleep(UART_BAUD_CONFIRM_S + 0.1)
+    port.baudrate = UART_BOOT_BAUD
+    print(f"[UART] {baudrate} baud not confirmed, back to {UART_BOOT_BAUD}")
+    return UART_BOOT_BAUD
+
+def sync_epoch(port):
+    # Hỏi đồng hồ 1 us của MCU, lấy offset = thời điểm giữa vòng hỏi (giờ host) - giờ MCU,
+    # rồi ghi offset xuống để MCU quy đổi timestamp sang epoch của host
+    global mcu_epoch_offset_us
+    port.reset_input_buffer()
+    t0 = time.time_ns() // 1000
+    port.write(bytes([CMD_TIME, 0]))
+    reply = read_reply(port, CMD_TIME, 16)
+    t1 = time.time_ns() // 1000
+    if not reply:
+        print("[UART] Time sync: no reply")
+        return
+    offset = (t0 + t1) // 2 - int.from_bytes(reply[0:8], 'big')
+    port.write(bytes([CMD_TIME, 8]) + offset.to_bytes(8, 'big', signed=True))
+    read_reply(port, CMD_TIME, 16)
+    mcu_epoch_offset_us = offset
+    print(f"[UART] Time synced, offset={offset} us, round trip={t1 - t0} us")
+
 def connect_uart(port, baudrate):
-    global ser, receive_running, receive_thread
+    global ser, receive_running, receive_thread, seq_next, record_crc
     if ser and ser.is_open:
         ser.close()
-    ser = serial.Serial(port, baudrate, timeout=1)
+    ser = serial.Serial(port, UART_BOOT_BAUD, timeout=1)
+    baudrate = negotiate_baud(ser, baudrate)
+    sync_epoch(ser)
+    reset_pending()
+    send_sequenced(bytes([CMD_BATCH, 5, BATCH_FRAMES]) + BATCH_AGE_US.to_bytes(4, 'big'))
+    compact_slots.clear()
+    seq_next = None  # Chưa biết số thứ tự cho tới bản ghi đầu tiên
+    send_sequenced(bytes([CMD_COMPACT, 1, 1]))  # MCU xóa từ điển khi bật lại
+    record_crc = False  # Bật lại khi trả lời của CMD_CRC tới luồng nhận
+    send_sequenced(bytes([CMD_CRC, 2, CRC_OPS['records'], 1]))
+    send_sequenced(bytes([CMD_CFGSTORE, 0]))  # Cấu hình khôi phục khi khởi động, thời gian khôi phục
+    send_sequenced(bytes([CMD_TSYNC, 0]))  # Mốc quy đổi giờ node, nếu node đang đồng bộ
     receive_running = True
     receive_thread = threading.Thread(target=uart_receive_loop)
     receive_thread.start()
+    return baudrate
+
+def send_sequenced(frame):
+    # Gửi khung trong phong bì CMD_SEQ; chờ credit nếu đã có CMD_WINDOW khung chưa được ack
+    global cmd_seq
+    if len(frame) > CMD_FRAME_MAX:
+        raise ValueError("frame too long for CMD_SEQ")
+    while not cmd_credits.acquire(timeout=CMD_ACK_TIMEOUT_S):
+        expire_pending()
+    with cmd_lock:
+        seq = cmd_seq
+        cmd_seq = (cmd_seq + 1) & 0xFF
+        entry = {'event': threading.Event(), 'status': None, 'sent': time.monotonic()}
+        cmd_pending[seq] = entry
+    ser.write(bytes([CMD_SEQ, len(frame) + 1, seq]) + frame)
+    return entry
+
+def wait_ack(entry, timeout=CMD_ACK_TIMEOUT_S):
+    # Trả về tên trạng thái trong ack, hoặc 'timeout'
+    if not entry['event'].wait(timeout) or entry['status'] is None:
+        return 'timeout'
+    return ACK_STATUS.get(entry['status'], entry['status'])
+
+def handle_ack(payload):
+    # [seq][status][credits]: credits là số chỗ trống trong hàng đợi lệnh của MCU
+    seq, status, credits = payload[0], payload[1], payload[2]
+    with cmd_lock:
+        entry = cmd_pending.pop(seq, None)
+    if entry is None:
+        return  # Ack trễ của khung đã hết hạn
+    entry['status'] = status
+    entry['event'].set()
+    cmd_credits.release()
+    if status != 0:
+        log_line = f"[UART Ack] seq={seq}, status={ACK_STATUS.get(status, status)}, credits={credits}"
+        print(log_line)
+
+def expire_pending():
+    now = time.monotonic()
+    with cmd_lock:
+        expired = [seq for seq, entry in cmd_pending.items() if now - entry['sent'] > CMD_ACK_TIMEOUT_S]
+        for seq in expired:
+            cmd_pending.pop(seq)['event'].set()
+            cmd_credits.release()
+
+def reset_pending():
+    # Khi kết nối lại: bỏ các khung đang chờ và trả lại credit của chúng
+    global cmd_seq
+    with cmd_lock:
+        for entry in cmd_pending.values():
+            entry['event'].set()
+            cmd_credits.release()
+        cmd_pending.clear()
+        cmd_seq = 0
+
+def read_leb128(read):
+    value, shift = 0, 0
+    while True:
+        b = read(1)[0]
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return value
+
+def report_lost(count):
+    global frames_lost
+    frames_lost += count
+    log_line = f"[UART] {count} frames lost (total {frames_lost})"
+    print(log_line)
+
+def track_seq(seq):
+    # Mỗi khung MCU nhận được có số thứ tự 16 bit, kể cả khung bị bỏ khi hàng đợi đầy,
+    # nên bước nhảy của seq chính là số khung bị mất
+    global seq_next
+    if seq_next is not None and seq != seq_next:
+        report_lost((seq - seq_next) & 0xFFFF)
+    seq_next = (seq + 1) & 0xFFFF
+
+def decode_compact(read):
+    # [0x42][slot | IDE<<6 | DEF<<7][ID 2|4 nếu DEF][len | attack<<7][delta us LEB128][gap LEB128][mask][XOR bytes]
+    global compact_time_us, seq_next
+    slot_byte = read(1)[0]
+    slot = slot_byte & 0x3F
+    if slot_byte & 0x80:
+        # ID mới trong từ điển: payload tham chiếu bắt đầu từ toàn 0
+        mode = 'Extended' if slot_byte & 0x40 else 'Standard'
+        can_id = read(4 if slot_byte & 0x40 else 2).hex().upper()
+        compact_slots[slot] = [mode, can_id, bytearray(8)]
+    mode, can_id, last = compact_slots[slot]
+    len_byte = read(1)[0]
+    data_len = len_byte & 0x0F
+    compact_time_us += read_leb128(read)
+    gap = read_leb128(read)  # Số khung bị mất ngay trước bản ghi này
+    if gap:
+        report_lost(gap)
+    if seq_next is not None:
+        seq_next = (seq_next + gap + 1) & 0xFFFF
+    if data_len:
+        mask = read(1)[0]
+        for i in range(data_len):
+            if mask & (1 << i):
+                last[i] ^= read(1)[0]
+    attack_flash = '01' if len_byte & 0x80 else '00'
+    return (mode, can_id, bytes(last[:data_len]), attack_flash)
+
+def decode_batch(payload, count):
+    # Tách các bản ghi khung trong một batch (bản ghi đơn hoặc bản ghi compact)
+    frames = []
+    pos = 0
+    def read(n):
+        nonlocal pos
+        pos += n
+        return payload[pos - n:pos]
+    for _ in range(count):
+        rec_type = read(1)[0]
+        if rec_type == REC_COMPACT:
+            frames.append(decode_compact(read))
+            continue
+        mode = 'Standard' if rec_type == 0 else 'Extended'
+        can_id = read(2 if rec_type == 0 else 4).hex().upper()
+        data_bytes = read(read(1)[0])
+        track_seq(int.from_bytes(read(2), 'big'))
+        frames.append((mode, can_id, data_bytes, '00'))  # Bản ghi không có cờ tấn công
+    return frames
+
+def handle_frames(frames):
+    # Một kết nối DB cho cả batch thay vì mỗi khung một kết nối
+    conn = mysql.connector.connect(**db_config)
+    cursor = conn.cursor()
+    for mode, can_id, data_bytes, attack_flash in frames:
+        if mode == 'Standard' and int(can_id, 16) == BOOT_CAN_TX_ID and data_bytes and data_bytes[0] & REPLY_FLAG:
+            boot_replies.put(data_bytes)  # Trả lời của bootloader (flow control có PCI 0x3x, không lấy)
+
+        # Decode data
+        try:
+            data = data_bytes.decode('ascii', errors='replace')
+        except Exception:
+            data = data_bytes.hex().upper()
+
+        print(f"[UART Frame] mode={mode}, can_id={can_id}, data={data}, attack_flash={attack_flash}")
+
+        # Save to DB
+        cursor.execute("SELECT description FROM can WHERE can_id = %s", (can_id,))
+        result = cursor.fetchone()
+        description = result[0] if result else ''
+        cursor.execute("""
+            INSERT INTO receive (model, can_id, data, description, direction, timestamp)
+            VALUES (%s, %s, %s, %s, 'Rx', NOW())
+        """, (mode, can_id, data, description))
+    conn.commit()
+    cursor.close()
+    conn.close()
+
+def slcan_frame(line):
+    # "t1238DDDDDDDDDDDDDDDD[tttt]\r" -> (mode, can_id, data), None nếu không phải khung
+    kind = line[:1]
+    if kind not in (b't', b'T', b'r', b'R'):
+        return None
+    id_len = 8 if kind in (b'T', b'R') else 3
+    try:
+        can_id = int(line[1:1 + id_len], 16)
+        dlc = int(line[1 + id_len:2 + id_len], 16)
+        data = b'' if kind in (b'r', b'R') else bytes.fromhex(line[2 + id_len:2 + id_len + 2 * min(dlc, 8)].decode())
+    except ValueError:
+        return None
+    if id_len == 8:
+        return ('Extended', f"{can_id:08X}", data)
+    return ('Standard', f"{can_id:04X}", data)
+
+def handle_slcan_line(line):
+    global slcan_active, slcan_leaving
+    if line == b'\r' and slcan_leaving:
+        slcan_active = slcan_leaving = False  # Trả lời của "B": từ đây là nhị phân
+        return
+    frame = slcan_frame(line)
+    if frame:
+        handle_frames([(frame[0], frame[1], frame[2], '00')])
 
 def uart_receive_loop():
     global receive_running
     while receive_running and ser:
         try:
+            if bench_active:
+                time.sleep(0.01)  # Benchmark đọc cổng trực tiếp
+                continue
+            if slcan_active:
+                line = ser.read_until(b'\r')
+                if line:
+                    handle_slcan_line(line)
+                continue
             if ser.in_waiting >= 4:
                 # 1. Read mode
                 mode_byte = ser.read(1)
                 if not mode_byte:
                     continue
                 mode_val = int.from_bytes(mode_byte, 'big')
+
+                # Reply record to a host command
+                if mode_val & REPLY_FLAG:
+                    length_byte = ser.read(1)
+                    if not length_byte:
+                        continue
+                    payload = ser.read(length_byte[0])
+                    if len(payload) != length_byte[0]:
+                        continue
+                    if mode_val & ~REPLY_FLAG == CMD_SEQ and len(payload) == 3:
+                        handle_ack(payload)
+                        continue
+                    handle_reply(mode_val & ~REPLY_FLAG, payload)
+                    continue
+
+                # Compact record: dictionary slot + XOR-delta payload
+                if mode_val == REC_COMPACT:
+                    raw = bytearray(mode_byte)
+                    def read(n):
+                        b = ser.read(n)
+                        raw.extend(b)
+                        return b
+                    frame = decode_compact(read)
+                    if record_crc_ok(raw):
+                        handle_frames([frame])
+                    continue
+
+                # Batch record: [0x40][count][length 2B][frame records...]
+                if mode_val == REC_BATCH:
+                    header = ser.read(3)
+                    if len(header) != 3:
+                        continue
+                    length = int.from_bytes(header[1:3], 'big')
+                    payload = ser.read(length)
+                    if len(payload) != length:
+                        continue
+                    if not record_crc_ok(mode_byte + header + payload):
+                        continue
+                    handle_frames(decode_batch(payload, header[0]))
+                    continue
+
                 mode = 'Standard' if mode_val == 0 else 'Extended'
 
                 # 2. Read CAN ID
@@ -58,33 +781,17 @@ def uart_receive_loop():
                 if len(data_bytes) != data_len:
                     continue
 
-                # 5. Read attack flash
-                attack_flash_byte = ser.read(1)
-                if not attack_flash_byte:
+                # 5. Read sequence number
+                seq_bytes = ser.read(2)
+                if len(seq_bytes) != 2:
+                    continue
+
+                # 6. Check the record CRC
+                if not record_crc_ok(mode_byte + can_id_bytes + length_byte + data_bytes + seq_bytes):
                     continue
-                attack_flash = attack_flash_byte.hex().upper()
-
-                # Decode data
-                try:
-                    data = data_bytes.decode('ascii', errors='replace')
-                except Exception:
-                    data = data_bytes.hex().upper()
-
-                print(f"[UART Frame] mode={mode}, can_id={can_id}, data={data}, attack_flash={attack_flash}")
-
-                # Save to DB
-                conn = mysql.connector.connect(**db_config)
-                cursor = conn.cursor()
-                cursor.execute("SELECT description FROM can WHERE can_id = %s", (can_id,))
-                result = cursor.fetchone()
-                description = result[0] if result else ''
-                cursor.execute("""
-                    INSERT INTO receive (model, can_id, data, description, direction, timestamp)
-                    VALUES (%s, %s, %s, %s, 'Rx', NOW())
-                """, (mode, can_id, data, description))
-                conn.commit()
-                cursor.close()
-                conn.close()
+                track_seq(int.from_bytes(seq_bytes, 'big'))
+
+                handle_frames([(mode, can_id, data_bytes, '00')])
 
         except Exception as e:
             print("[UART Error]", e)
@@ -113,7 +820,7 @@ def index():
     conn.close()
 
     ports = [port.device for port in serial.tools.list_ports.comports()]
-    baudrates = [115200, 19200, 38400, 57600, 9600]
+    baudrates = [115200, 230400, 460800, 921600, 2000000, 3000000, 4500000, 57600, 38400, 19200, 9600]
 
     return render_template('index.html', ports=ports, baudrates=baudrates,
                            can_ids=can_ids, transmit_rows=transmit_rows, receive_rows=receive_rows)
@@ -122,9 +829,8 @@ def index():
 def connect_uart_route():
     global uart_port, uart_baudrate
     uart_port = request.form['port']
-    uart_baudrate = int(request.form['baudrate'])
-    connect_uart(uart_port, uart_baudrate)
-    return jsonify({'status': 'connected'})
+    uart_baudrate = connect_uart(uart_port, int(request.form['baudrate']))
+    return jsonify({'status': 'connected', 'baudrate': uart_baudrate})
 
 @app.route('/add_transmit', methods=['POST'])
 def add_transmit():
@@ -164,16 +870,25 @@ def send_frame(transmit_id):
         frame = model_byte + can_id_bytes + data_len_byte + data_bytes + cyclic_bytes
         if ser and ser.is_open:
             try:
-                ser.write(frame)
-                print("Frame sent:", frame.hex())
+                if len(data_bytes) > 8:
+                    # Dữ liệu dài hơn một khung: gửi một lần bằng ISO-TP (không tuần hoàn)
+                    ack = send_isotp(data_bytes[:ISOTP_BUF_LEN], model, int(row['can_id'], 16))
+                    print("ISO-TP sent:", len(data_bytes), "bytes, ack:", ack)
+                else:
+                    ack = wait_ack(send_sequenced(frame))
+                    print("Frame sent:", frame.hex(), "ack:", ack)
             except Exception as e:
                 print("UART Send Error:", e)
+                ack = 'error'
         else:
             print("UART not connected.")
+            ack = 'not connected'
+    else:
+        ack = 'not found'
 
     cursor.close()
     conn.close()
-    return jsonify({'status': 'sent'})
+    return jsonify({'status': 'sent' if ack == 'ok' else ack})
 
 @app.route('/delete_transmit/<int:transmit_id>', methods=['POST'])
 def delete_transmit(transmit_id):
@@ -207,6 +922,633 @@ def edit_transmit(transmit_id):
     conn.close()
     return jsonify({'status': 'updated'})
 
+@app.route('/ping', methods=['POST'])
+def ping():
+    global ping_summary, ping_hist
+    count = int(request.form.get('count', 1000))
+    gap_us = int(request.form.get('gap_us', 1000))
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    ping_summary = None
+    ping_hist = [0] * PING_HIST_BINS
+    send_command(CMD_PING, count.to_bytes(4, 'big') + gap_us.to_bytes(2, 'big'))
+    return jsonify({'status': 'started'})
+
+@app.route('/ping_stats')
+def ping_stats():
+    histogram = [[us, n] for us, n in enumerate(ping_hist) if n]
+    return jsonify({'summary': ping_summary, 'histogram': histogram})
+
+@app.route('/can_mode', methods=['POST'])
+def set_can_mode():
+    mode = request.form.get('mode', 'normal')
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if mode not in CAN_MODES:
+        return jsonify({'status': 'error', 'message': 'unknown mode'})
+    send_command(CMD_CAN_MODE, bytes([CAN_MODES[mode]]))
+    return jsonify({'status': 'sent'})
+
+@app.route('/can_bitrate', methods=['POST'])
+def set_can_bitrate():
+    bitrate = int(request.form.get('bitrate', 500000))
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if bitrate not in CAN_BITRATES:
+        return jsonify({'status': 'error', 'message': 'unsupported bitrate'})
+    send_command(CMD_CAN_BITRATE, bitrate.to_bytes(4, 'big'))
+    return jsonify({'status': 'sent'})
+
+@app.route('/fwd_policy', methods=['POST'])
+def set_fwd_policy():
+    policy = request.form.get('policy', 'drop_newest')
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if policy not in FWD_POLICIES:
+        return jsonify({'status': 'error', 'message': 'unknown policy'})
+    send_command(CMD_FWD, bytes([FWD_POLICIES[policy]]))  # Đổi chính sách và xóa bộ đếm
+    return jsonify({'status': 'sent'})
+
+@app.route('/fwd_stats')
+def get_fwd_stats():
+    if ser and ser.is_open:
+        send_command(CMD_FWD)  # Hỏi lại trạng thái, kết quả có ở lần gọi sau
+    return jsonify({'stats': fwd_stats, 'frames_lost': frames_lost})
+
+@app.route('/cyclic', methods=['POST'])
+def set_cyclic():
+    # Khung tuần hoàn với chu kỳ tính bằng us (0 = dừng), ví dụ 1000 hoặc 2500
+    slot = int(request.form.get('slot', 1))
+    period_us = int(request.form.get('period_us', 0))
+    mode = 1 if request.form.get('mode') == 'Extended' else 0
+    can_id = int(request.form.get('can_id', '0'), 16)
+    data_bytes = request.form.get('data', '').encode('utf-8')[:7]  # Firmware thêm byte counter
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if not 0 <= slot < CYCLIC_SLOTS:
+        return jsonify({'status': 'error', 'message': 'bad slot'})
+    cyclic_stats[slot] = None
+    send_command(CMD_CYCLIC, bytes([slot]) + period_us.to_bytes(4, 'big') + bytes([mode]) +
+                 can_id.to_bytes(4, 'big') + bytes([len(data_bytes)]) + data_bytes)
+    return jsonify({'status': 'sent'})
+
+@app.route('/cyclic_stats')
+def get_cyclic_stats():
+    if ser and ser.is_open:
+        for slot in range(CYCLIC_SLOTS):
+            send_command(CMD_CYCLIC, bytes([slot]))  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': cyclic_stats})
+
+@app.route('/power', methods=['POST'])
+def set_power():
+    # Mức ngủ khi vòng lặp chính rảnh; probes > 0 đo độ trễ ngắt và xử lý ở mức đó
+    depth = request.form.get('depth', 'off')
+    probes = int(request.form.get('probes', 0))
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if depth not in POWER_DEPTHS:
+        return jsonify({'status': 'error', 'message': 'unknown depth'})
+    payload = bytes([POWER_DEPTHS[depth]])
+    if probes > 0:
+        payload += min(probes, 1000).to_bytes(2, 'big')
+    send_command(CMD_POWER, payload)  # Đổi mức ngủ và xóa thống kê
+    return jsonify({'status': 'sent'})
+
+@app.route('/power_stats')
+def get_power_stats():
+    if ser and ser.is_open:
+        send_command(CMD_POWER)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': power_stats})
+
+@app.route('/sched_stats')
+def get_sched_stats():
+    if ser and ser.is_open:
+        send_command(CMD_SCHED)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': sched_stats})
+
+@app.route('/sched_reset', methods=['POST'])
+def reset_sched_stats():
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    send_command(CMD_SCHED, bytes([1]))  # Trả thống kê cũ rồi xóa
+    return jsonify({'status': 'sent'})
+
+@app.route('/config_save', methods=['POST'])
+def config_save():
+    # Lưu cấu hình đang chạy; xóa trang flash (~20 ms, CPU dừng) mỗi 8 lần lưu nên chỉ lưu khi bus rảnh
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    send_command(CMD_CFGSTORE, bytes([CFGSTORE_OPS['save']]))
+    return jsonify({'status': 'sent'})
+
+@app.route('/config_erase', methods=['POST'])
+def config_erase():
+    # Xóa cấu hình đã lưu: lần khởi động sau dùng giá trị mặc định
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    send_command(CMD_CFGSTORE, bytes([CFGSTORE_OPS['erase']]))
+    return jsonify({'status': 'sent'})
+
+@app.route('/config_stats')
+def get_config_stats():
+    if ser and ser.is_open:
+        send_command(CMD_CFGSTORE)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': cfg_stats})
+
+@app.route('/tsync', methods=['POST'])
+def set_tsync():
+    # role = off | master | slave; một master mỗi domain (0-15), master lấy giờ chung từ epoch host của nó
+    role = request.form.get('role', 'off')
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if role not in TSYNC_ROLES:
+        return jsonify({'status': 'error', 'message': 'role must be off, master or slave'})
+    try:
+        domain = int(request.form.get('domain', 0))
+        period = int(request.form.get('period_ms', TSYNC_PERIOD_MS))
+    except ValueError:
+        return jsonify({'status': 'error', 'message': 'Invalid domain or period'})
+    if not (0 <= domain <= 15 and 10 <= period <= 0xFFFF):
+        return jsonify({'status': 'error', 'message': 'domain 0-15, period_ms 10-65535'})
+    send_command(CMD_TSYNC, bytes([TSYNC_OPS['config'], TSYNC_ROLES.index(role), domain]) + period.to_bytes(2, 'big'))
+    return jsonify({'status': 'sent'})
+
+@app.route('/tsync_stats')
+def get_tsync_stats():
+    # Mốc (local_ref_us, global_ref_ns, rate_ppb) đổi giờ node sang giờ chung: xem tsync_global_us()
+    if ser and ser.is_open:
+        send_command(CMD_TSYNC)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': tsync_stats})
+
+@app.route('/iddisp_stats')
+def get_iddisp_stats():
+    # Số chu kỳ tra bảng đo lại mỗi lần hỏi (mọi ID trong bảng và 64 ID ngoài bảng), không phụ thuộc số ID
+    if ser and ser.is_open:
+        send_command(CMD_IDDISP)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': iddisp_stats})
+
+@app.route('/iddisp_reset', methods=['POST'])
+def reset_iddisp_stats():
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    send_command(CMD_IDDISP, bytes([IDDISP_OPS['clear']]))  # Trả bộ đếm cũ rồi xóa
+    return jsonify({'status': 'sent'})
+
+@app.route('/pool_stats')
+def get_pool_stats():
+    # high_water gần bằng blocks khi bus đầy tải nghĩa là hàng đợi chuyển tiếp đã chạm giới hạn
+    if ser and ser.is_open:
+        send_command(CMD_POOL)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': pool_stats})
+
+@app.route('/pool_reset', methods=['POST'])
+def reset_pool_stats():
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    send_command(CMD_POOL, bytes([POOL_OPS['clear']]))  # Trả số liệu cũ rồi đo lại mức cao nhất
+    return jsonify({'status': 'sent'})
+
+@app.route('/capture', methods=['POST'])
+def set_capture():
+    # op = arm | stop | fire; arm: trigger id (can_id, mode), error, hoặc load (load_permille)
+    op = request.form.get('op', 'arm')
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if op not in ('arm', 'stop', 'fire'):
+        return jsonify({'status': 'error', 'message': 'unknown op'})
+    payload = bytes([CAPTURE_OPS[op]])
+    if op == 'arm':
+        trigger = request.form.get('trigger', 'id')
+        if trigger not in CAPTURE_TRIGGERS:
+            return jsonify({'status': 'error', 'message': 'unknown trigger'})
+        post = min(int(request.form.get('post', 128)), 0xFFFF)
+        if trigger == 'load':
+            param = int(request.form.get('load_permille', 800))
+        else:
+            param = int(request.form.get('can_id', '0'), 16)
+        mode = 1 if request.form.get('mode') == 'Extended' else 0
+        payload += bytes([CAPTURE_TRIGGERS[trigger]]) + post.to_bytes(2, 'big') + \
+            param.to_bytes(4, 'big') + bytes([mode])
+        capture_frames.clear()
+    send_command(CMD_CAPTURE, payload)  # MCU trả trạng thái
+    return jsonify({'status': 'sent'})
+
+@app.route('/capture_stats')
+def get_capture_stats():
+    if ser and ser.is_open:
+        send_command(CMD_CAPTURE)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': capture_stats})
+
+@app.route('/capture_dump', methods=['POST'])
+def capture_dump():
+    # Đọc bộ đệm về khi capture đã xong (hoặc đã dừng)
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if not capture_stats or capture_stats['state'] not in ('idle', 'done'):
+        return jsonify({'status': 'error', 'message': 'capture still running'})
+    capture_frames.clear()
+    threading.Thread(target=fetch_capture, args=(capture_stats['frames'],), daemon=True).start()
+    return jsonify({'status': 'started', 'frames': capture_stats['frames']})
+
+@app.route('/capture_frames')
+def get_capture_frames():
+    return jsonify({'stats': capture_stats, 'frames': capture_frames})
+
+@app.route('/id_stats')
+def get_id_stats():
+    if ser and ser.is_open and idstats_lock.acquire(blocking=False):
+        threading.Thread(target=fetch_idstats, daemon=True).start()  # Kết quả có ở lần gọi sau
+    now = time.time()
+    rows = []
+    for key in sorted(id_table):
+        row = {k: v for k, v in id_table[key].items() if k not in ('age_us', 'read_at')}
+        row['age_ms'] = round(id_table[key]['age_us'] / 1000 + (now - id_table[key]['read_at']) * 1000)
+        rows.append(row)
+    return jsonify({'status': idstats_status, 'ids': rows})
+
+@app.route('/id_stats_reset', methods=['POST'])
+def reset_id_stats():
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    id_table.clear()
+    send_command(CMD_IDSTATS, bytes([IDSTATS_OPS['clear']]))
+    return jsonify({'status': 'sent'})
+
+@app.route('/isotp_config', methods=['POST'])
+def set_isotp_config():
+    # ID nhận khung và flow control của đối tác; BS/STmin gửi trong flow control của MCU
+    isotp_config['mode'] = 'Extended' if request.form.get('mode') == 'Extended' else 'Standard'
+    isotp_config['rx_id'] = int(request.form.get('rx_id', '7E0'), 16)
+    isotp_config['bs'] = min(int(request.form.get('bs', 0)), 0xFF)
+    isotp_config['stmin'] = min(int(request.form.get('stmin', 0)), 0xFF)
+    return jsonify({'status': 'saved', 'config': {**isotp_config, 'rx_id': f"{isotp_config['rx_id']:X}"}})
+
+@app.route('/isotp_bench', methods=['POST'])
+def isotp_bench():
+    # Gửi payload tự sinh trên MCU; mặc định ID = ID nhận (một board ở chế độ loopback tự trả lời)
+    global isotp_stats, isotp_sent
+    length = max(1, min(int(request.form.get('len', ISOTP_MAX_LEN)), ISOTP_MAX_LEN))
+    can_id = int(request.form.get('can_id', f"{isotp_config['rx_id']:X}"), 16)
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    isotp_stats = None
+    ide = 1 if isotp_config['mode'] == 'Extended' else 0
+    send_command(CMD_ISOTP, bytes([ISOTP_OPS['config'], ide]) + can_id.to_bytes(4, 'big') +
+                 isotp_config['rx_id'].to_bytes(4, 'big') + bytes([isotp_config['bs'], isotp_config['stmin']]))
+    isotp_sent = isotp_bench_payload(length)
+    ack = wait_ack(send_command(CMD_ISOTP, bytes([ISOTP_OPS['bench']]) + length.to_bytes(2, 'big')))
+    if ack != 'ok':
+        return jsonify({'status': 'error', 'message': f'ISO-TP bench not started: {ack}'})
+    return jsonify({'status': 'started', 'len': length})
+
+@app.route('/isotp_abort', methods=['POST'])
+def isotp_abort():
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    send_command(CMD_ISOTP, bytes([ISOTP_OPS['abort']]))
+    return jsonify({'status': 'sent'})
+
+@app.route('/isotp_stats')
+def get_isotp_stats():
+    if ser and ser.is_open:
+        send_command(CMD_ISOTP)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': isotp_stats, 'expected_hash': f"{fnv1a(isotp_sent):08X}" if isotp_sent else None})
+
+def read_plain_record(port):
+    # [IDE][ID 2|4][len][data][seq 2B][CRC 4B nếu bật] (batch và compact tắt trong benchmark)
+    head = port.read(1)
+    if not head:
+        return None
+    rest = port.read((4 if head[0] else 2) + 1)
+    data = port.read(rest[-1] if rest else 0)
+    seq = port.read(2)
+    crc = port.read(4) if record_crc else b''
+    return 1 + len(rest) + len(data) + len(seq) + len(crc) if len(seq) == 2 else None
+
+def bench_phase(port, frames, read_record):
+    # Gửi tất cả rồi đọc tới khi đủ khung vòng lại (loopback) hoặc 1 s không có dữ liệu
+    tx_bytes = sum(len(f) for f in frames)
+    start = time.time()
+    port.write(b''.join(frames))
+    received, rx_bytes, last = 0, 0, start
+    while received < len(frames):
+        n = read_record(port)
+        if n is None:
+            break
+        if n > 0:
+            received += 1
+            rx_bytes += n
+            last = time.time()
+    elapsed = last - start
+    return {'sent': len(frames), 'received': received, 'elapsed_s': round(elapsed, 3),
+            'frames_per_s': round(received / elapsed, 1) if elapsed else 0,
+            'tx_bytes_per_frame': round(tx_bytes / len(frames), 1),
+            'rx_bytes_per_frame': round(rx_bytes / received, 1) if received else 0,
+            'link_limit_fps': round(port.baudrate / 10 / (rx_bytes / received), 1) if received else 0}
+
+def read_slcan_record(port):
+    # Số byte của một dòng khung nhận được, 0 cho trả lời z/Z, None khi hết thời gian
+    line = port.read_until(b'\r')
+    if not line.endswith(b'\r'):
+        return None
+    return len(line) if slcan_frame(line) else 0
+
+def run_slcan_bench(count):
+    # So sánh đường nhị phân và SLCAN trên cùng một board ở chế độ loopback
+    global bench_active, slcan_bench_summary, seq_next
+    bench_active = True
+    time.sleep(0.1)  # Chờ luồng nhận xử lý xong bản ghi đang đọc
+    port = ser
+    try:
+        port.reset_input_buffer()
+        data = bytes(range(8))
+        port.write(bytes([CMD_CAN_MODE, 0]))
+        saved_mode = read_reply(port, CMD_CAN_MODE, 1)
+        port.write(bytes([CMD_BATCH, 0]))
+        saved_batch = read_reply(port, CMD_BATCH, 6)
+        port.write(bytes([CMD_COMPACT, 0]))
+        saved_compact = read_reply(port, CMD_COMPACT, 14)
+        port.write(bytes([CMD_CAN_MODE, 1, CAN_MODES['loopback']]))
+        read_reply(port, CMD_CAN_MODE, 1)
+        port.write(bytes([CMD_BATCH, 5, 0, 0, 0, 0, 0]))
+        read_reply(port, CMD_BATCH, 6)
+        port.write(bytes([CMD_COMPACT, 1, 0]))
+        read_reply(port, CMD_COMPACT, 14)
+
+        # Khung cũ không có phong bì: [mode][ID 2B][len][data][cyclic 2B], không ack
+        binary = bench_phase(port, [bytes([0]) + SLCAN_BENCH_ID.to_bytes(2, 'big') + bytes([8]) + data + bytes(2)
+                                    for _ in range(count)], read_plain_record)
+
+        port.write(bytes([CMD_SLCAN, 1, SLCAN_OPS['enter']]))
+        read_reply(port, CMD_SLCAN, 27)
+        port.write(b'O\r')
+        port.read_until(b'\r')
+        line = f"t{SLCAN_BENCH_ID:03X}8{data.hex().upper()}\r".encode()
+        slcan = bench_phase(port, [line] * count, read_slcan_record)
+        port.write(b'B\r')
+        while port.read_until(b'\r') not in (b'\r', b''):
+            pass  # Các trả lời z còn lại, rồi CR của "B"
+
+        if saved_mode:
+            port.write(bytes([CMD_CAN_MODE, 1, saved_mode[0]]))
+            read_reply(port, CMD_CAN_MODE, 1)
+        if saved_batch:
+            port.write(bytes([CMD_BATCH, 5]) + saved_batch[1:6])
+            read_reply(port, CMD_BATCH, 6)
+        if saved_compact and saved_compact[0]:
+            compact_slots.clear()
+            port.write(bytes([CMD_COMPACT, 1, 1]))
+            read_reply(port, CMD_COMPACT, 14)
+        slcan_bench_summary = {'count': count, 'baud': port.baudrate, 'binary': binary, 'slcan': slcan,
+                               'speedup': round(binary['frames_per_s'] / slcan['frames_per_s'], 2)
+                               if slcan['frames_per_s'] else 0}
+        print(f"[SLCAN Bench] binary {binary['frames_per_s']} fps, slcan {slcan['frames_per_s']} fps")
+    except Exception as e:
+        print("[SLCAN Bench Error]", e)
+        slcan_bench_summary = {'error': str(e)}
+    finally:
+        seq_next = None  # Các khung của benchmark đã tiêu thụ số thứ tự
+        bench_active = False
+
+@app.route('/slcan', methods=['POST'])
+def set_slcan():
+    # enter: từ đây UART nói SLCAN (slcand / python-can dùng được khi ngắt kết nối app); leave: quay lại nhị phân
+    global slcan_leaving
+    op = request.form.get('op', 'enter')
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if op == 'enter' and not slcan_active:
+        ser.write(bytes([CMD_SLCAN, 1, SLCAN_OPS['enter']]))  # Không bọc CMD_SEQ: sau trả lời không còn ack nhị phân
+    elif op == 'leave' and slcan_active:
+        slcan_leaving = True
+        ser.write(b'B\r')
+    elif op == 'open' and slcan_active:
+        ser.write(b'O\r')
+    elif op == 'close' and slcan_active:
+        ser.write(b'C\r')
+    elif op == 'clear' and not slcan_active:
+        send_command(CMD_SLCAN, bytes([SLCAN_OPS['clear']]))
+    else:
+        return jsonify({'status': 'error', 'message': 'not allowed in this mode'})
+    return jsonify({'status': 'sent', 'slcan': slcan_active})
+
+@app.route('/slcan_stats')
+def get_slcan_stats():
+    if ser and ser.is_open and not slcan_active and not bench_active:
+        send_command(CMD_SLCAN)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': slcan_stats, 'slcan': slcan_active, 'bench': slcan_bench_summary})
+
+@app.route('/slcan_bench', methods=['POST'])
+def slcan_bench():
+    global slcan_bench_summary
+    count = max(1, min(int(request.form.get('count', 500)), 10000))
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if slcan_active or bench_active:
+        return jsonify({'status': 'error', 'message': 'busy'})
+    slcan_bench_summary = None
+    threading.Thread(target=run_slcan_bench, args=(count,), daemon=True).start()
+    return jsonify({'status': 'started', 'count': count})
+
+@app.route('/crc_records', methods=['POST'])
+def set_crc_records():
+    enabled = request.form.get('enabled', '1') == '1'
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    send_command(CMD_CRC, bytes([CRC_OPS['records'], int(enabled)]))
+    return jsonify({'status': 'sent', 'enabled': enabled})
+
+@app.route('/crc_bench', methods=['POST'])
+def crc_bench():
+    global crc_bench_summary
+    frames = max(1, min(int(request.form.get('frames', 1000)), 0xFFFF))
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    crc_bench_summary = None
+    send_command(CMD_CRC, bytes([CRC_OPS['bench']]) + frames.to_bytes(2, 'big'))
+    return jsonify({'status': 'started', 'frames': frames})
+
+@app.route('/crc_stats')
+def get_crc_stats():
+    if ser and ser.is_open:
+        send_command(CMD_CRC)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': crc_stats, 'record_crc': record_crc, 'checked': crc_checked,
+                    'errors': crc_errors, 'bench': crc_bench_summary})
+
+def boot_can_send(msg):
+    # Message tới bootloader qua bộ gửi ISO-TP của bridge (đã cấu hình BOOT_CAN_RX_ID / BOOT_CAN_TX_ID)
+    return isotp_load_send(msg)
+
+def boot_can_reply(op, block=None, timeout=BOOT_REPLY_TIMEOUT_S):
+    # (kết quả, khối, giá trị) của trả lời cho op, bỏ qua trả lời muộn của khối khác
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            r = boot_replies.get(timeout=max(0.0, deadline - time.time()))
+        except queue.Empty:
+            break
+        if len(r) == 8 and r[0] == BOOT_OPS[op] | REPLY_FLAG:
+            result, blk, value = struct.unpack('>BHI', r[1:])
+            if block is None or blk == block:
+                return result, blk, value
+    return None
+
+def boot_uart_reply(port, op, block=None, timeout=BOOT_REPLY_TIMEOUT_S):
+    # Như boot_can_reply, đọc trực tiếp 8 byte từ cổng (bootloader không gửi gì khác)
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        b = port.read(1)
+        if not b or b[0] != BOOT_OPS[op] | REPLY_FLAG:
+            continue
+        r = port.read(7)
+        if len(r) == 7:
+            result, blk, value = struct.unpack('>BHI', r)
+            if block is None or blk == block:
+                return result, blk, value
+    return None
+
+def boot_result(r):
+    return 'timeout' if r is None else BOOT_RESULTS[r[0]] if r[0] < len(BOOT_RESULTS) else r[0]
+
+def boot_transfer(image, send, reply):
+    # START, các khối DATA, END, RUN. Bootloader trả lời DATA khi bắt đầu ghi khối nên khối sau
+    # được gửi trong lúc khối trước đang ghi; khối mất trả lời được gửi lại (MCU ack lại khối trùng)
+    crc = crc32_words(image)
+    blocks = (len(image) + BOOT_BLOCK_SIZE - 1) // BOOT_BLOCK_SIZE
+    start = time.time()
+    send(bytes([BOOT_OPS['start']]) + len(image).to_bytes(4, 'big') + crc.to_bytes(4, 'big'))
+    r = reply('start')
+    if boot_result(r) != 'ok':
+        return {'state': 'error', 'stage': 'start', 'result': boot_result(r)}
+    for block in range(blocks):
+        msg = bytes([BOOT_OPS['data']]) + block.to_bytes(2, 'big') + \
+            image[block * BOOT_BLOCK_SIZE:(block + 1) * BOOT_BLOCK_SIZE]
+        for _ in range(3):
+            send(msg)
+            r = reply('data', block)
+            if r is not None:
+                break
+        if boot_result(r) != 'ok':
+            return {'state': 'error', 'stage': 'data', 'block': block, 'result': boot_result(r)}
+        boot_stats['blocks_done'] = block + 1
+    send(bytes([BOOT_OPS['end']]))
+    r = reply('end', timeout=5.0)
+    elapsed = time.time() - start
+    if boot_result(r) != 'ok':
+        return {'state': 'error', 'stage': 'end', 'result': boot_result(r)}
+    send(bytes([BOOT_OPS['run']]))
+    reply('run', timeout=0.5)
+    return {'state': 'done', 'crc': f"{crc:08X}", 'host_s': round(elapsed, 3), 'node_us': r[2],
+            'bytes_per_s': round(len(image) / elapsed) if elapsed else 0}
+
+def reflash_can(image):
+    # Nạp một node khác trên bus qua bridge: yêu cầu vào bootloader, chuyển bus sang 500 kbit/s
+    # (bootloader không đọc bit rate đã lưu), rồi trao đổi message ISO-TP. Mỗi lúc một node trong bootloader.
+    saved = can_bitrate['bitrate'] if can_bitrate else None
+    wait_ack(send_sequenced(bytes([0]) + BOOT_CAN_RX_ID.to_bytes(2, 'big') +
+                            bytes([2, 0x01, BOOT_OPS['enter']]) + bytes(2)))
+    if saved != BOOT_CAN_BITRATE:
+        wait_ack(send_command(CMD_CAN_BITRATE, BOOT_CAN_BITRATE.to_bytes(4, 'big')))
+    try:
+        send_command(CMD_ISOTP, bytes([ISOTP_OPS['config'], 0]) + BOOT_CAN_RX_ID.to_bytes(4, 'big') +
+                     BOOT_CAN_TX_ID.to_bytes(4, 'big') + bytes([0, 0]))
+        while not boot_replies.empty():
+            boot_replies.get()
+        r = None
+        for _ in range(10):  # Lời chào lúc khởi động có thể đã qua trước khi bridge đổi bit rate
+            boot_can_send(bytes([BOOT_OPS['status']]))
+            r = boot_can_reply('status', timeout=0.2)
+            if r:
+                break
+        if not r:
+            return {'state': 'error', 'stage': 'enter', 'result': 'no bootloader'}
+        boot_stats['why'] = BOOT_WHY[r[1]] if r[1] < len(BOOT_WHY) else r[1]
+        return boot_transfer(image, boot_can_send, boot_can_reply)
+    finally:
+        if saved and saved != BOOT_CAN_BITRATE:
+            send_command(CMD_CAN_BITRATE, saved.to_bytes(4, 'big'))
+
+def reflash_uart(image):
+    # Nạp chính board nối UART: CMD_BOOT, rồi nói với bootloader ở BOOT_UART_BAUD; sau khi chạy
+    # firmware mới thì kết nối lại từ UART_BOOT_BAUD
+    global bench_active, receive_running
+    bench_active = True
+    time.sleep(0.1)  # Chờ luồng nhận xử lý xong bản ghi đang đọc
+    port = ser
+    try:
+        port.reset_input_buffer()
+        port.write(bytes([CMD_BOOT, 0]))
+        if not read_reply(port, CMD_BOOT, 8):
+            return {'state': 'error', 'stage': 'enter', 'result': 'no reply'}
+        port.baudrate = BOOT_UART_BAUD
+        r = boot_uart_reply(port, 'status', timeout=0.5)
+        if not r:
+            port.write((1).to_bytes(2, 'big') + bytes([BOOT_OPS['status']]))
+            r = boot_uart_reply(port, 'status', timeout=0.5)
+        if not r:
+            return {'state': 'error', 'stage': 'enter', 'result': 'no bootloader'}
+        boot_stats['why'] = BOOT_WHY[r[1]] if r[1] < len(BOOT_WHY) else r[1]
+        return boot_transfer(image, lambda msg: port.write(len(msg).to_bytes(2, 'big') + msg),
+                             lambda op, block=None, timeout=BOOT_REPLY_TIMEOUT_S:
+                                 boot_uart_reply(port, op, block, timeout))
+    finally:
+        port.baudrate = UART_BOOT_BAUD
+        bench_active = False
+        receive_running = False
+        receive_thread.join()
+        time.sleep(0.2)  # Firmware mới khởi động
+        connect_uart(uart_port, uart_baudrate)
+
+def run_reflash(image, link):
+    try:
+        summary = reflash_uart(image) if link == 'uart' else reflash_can(image)
+    except Exception as e:
+        print("[Reflash Error]", e)
+        summary = {'state': 'error', 'result': str(e)}
+    boot_stats.update(summary)
+    print(f"[Reflash] {link}: {boot_stats}")
+
+@app.route('/reflash', methods=['POST'])
+def reflash():
+    # path: file .bin, link: can (node khác qua bridge) | uart (board đang nối), offset: hex, mặc định bỏ 8 KB bootloader
+    global boot_stats
+    path = request.form.get('path', '')
+    link = 'uart' if request.form.get('link') == 'uart' else 'can'
+    offset = int(request.form.get('offset', f"{BOOT_IMAGE_OFFSET:X}"), 16)
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if slcan_active or bench_active or (boot_stats and boot_stats['state'] == 'running'):
+        return jsonify({'status': 'error', 'message': 'busy'})
+    if not os.path.isfile(path):
+        return jsonify({'status': 'error', 'message': 'file not found'})
+    with open(path, 'rb') as f:
+        image = f.read()[offset:]
+    if not image:
+        return jsonify({'status': 'error', 'message': 'empty image'})
+    boot_stats = {'state': 'running', 'link': link, 'size': len(image),
+                  'blocks': (len(image) + BOOT_BLOCK_SIZE - 1) // BOOT_BLOCK_SIZE, 'blocks_done': 0}
+    threading.Thread(target=run_reflash, args=(image, link), daemon=True).start()
+    return jsonify({'status': 'started', 'size': len(image)})
+
+@app.route('/reflash_stats')
+def get_reflash_stats():
+    return jsonify({'stats': boot_stats})
+
+@app.route('/selftest', methods=['POST'])
+def selftest():
+    global selftest_summary, burst_summary, ping_summary, ping_hist
+    count = int(request.form.get('count', 1000))
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    selftest_summary = burst_summary = ping_summary = None
+    ping_hist = [0] * PING_HIST_BINS
+    send_command(CMD_SELFTEST, count.to_bytes(4, 'big'))
+    return jsonify({'status': 'started'})
+
+@app.route('/selftest_stats')
+def selftest_stats():
+    return jsonify({'selftest': selftest_summary, 'can_mode': can_mode, 'can_bitrate': can_bitrate})
+
 if __name__ == '__main__':
     app.run(debug=True)
 
@@ -5,6 +5,8 @@ import mysql.connector
 import threading
 import os
 import json
+import time
+import struct
 
 app = Flask(__name__)
 
@@ -23,14 +25,471 @@ ser = None
 receive_thread = None
 receive_running = False
 
+# Command frames: [cmd][payload length][payload], replies: [cmd | 0x80][length][payload]
+CMD_UART_BAUD = 0x16
+CMD_BATCH = 0x17
+CMD_COMPACT = 0x18
+CMD_FWD = 0x19
+CMD_SEQ = 0x1A                    # Khung kèm số thứ tự: [0x1A][1 + độ dài][seq][khung], MCU trả ack
+CMD_TIME = 0x1B                   # Đọc đồng hồ 1 us của MCU / đặt offset epoch
+CMD_CYCLIC = 0x1C                 # Khung tuần hoàn chu kỳ us: [slot][chu kỳ us 4B][mode][id 4B][len][data]
+CMD_POWER = 0x1D                  # Ngủ WFI/WFE khi rảnh: [mức ngủ][số lần đo 2B], đo độ trễ đánh thức
+CMD_SCHED = 0x1E                  # Thời gian CPU của từng tác vụ trong bộ lập lịch: [1] = xóa thống kê
+CMD_CAPTURE = 0x1F                # Bộ đệm capture có trigger: ghi vòng trước trigger, đọc về sau khi dừng
+CMD_IDSTATS = 0x20                # Bảng thống kê theo từng ID do MCU đếm, đọc theo dải slot
+CMD_CRC = 0x23                    # Bộ CRC phần cứng: CRC 4 byte sau mỗi bản ghi/batch, so sánh HW và bảng phần mềm
+CMD_CFGSTORE = 0x24               # Cấu hình lưu trong flash (bit rate, chế độ CAN, khung tuần hoàn), khôi phục khi khởi động
+CMD_TSYNC = 0x26                  # Đồng bộ thời gian qua CAN (SYNC/FUP): vai trò master/slave, mốc quy đổi giờ node -> giờ chung
+CMD_IDDISP = 0x27                 # Bảng điều phối theo ID (hash hoàn hảo trong flash): kích thước, bộ đếm, số chu kỳ tra bảng
+CMD_POOL = 0x28                   # Pool khung dùng chung (RX CAN, lệnh UART): số khối đang dùng, mức cao nhất, số lần hết khối
+REPLY_FLAG = 0x80
+UART_BOOT_BAUD = 115200            # Tốc độ UART của MCU sau reset
+UART_BAUD_CONFIRM_S = 1.0         # MCU quay về UART_BOOT_BAUD nếu không được xác nhận
+REC_BATCH = 0x40                  # [0x40][số khung][độ dài 2B][các bản ghi khung]
+BATCH_FRAMES = 16                 # Gom tối đa 16 khung mỗi batch
+BATCH_AGE_US = 2000               # hoặc gửi batch sau 2 ms kể từ khung đầu tiên
+REC_COMPACT = 0x42                # Bản ghi compact: chỉ số từ điển ID + XOR-delta
+compact_slots = {}                # Từ điển ID phía host: slot -> [mode, can_id, payload cuối]
+compact_time_us = 0               # Thời gian tích lũy từ delta timestamp (us)
+seq_next = None                   # Số thứ tự 16 bit mong đợi của khung tiếp theo
+frames_lost = 0                   # Tổng số khung bị mất trên đường chuyển tiếp của MCU
+CMD_WINDOW = 4                    # Số khung chờ ack tối đa (= độ sâu hàng đợi lệnh của MCU)
+CMD_ACK_TIMEOUT_S = 1.0           # Ack không về sau 1 s thì coi như mất, trả lại credit
+CMD_FRAME_MAX = 30                # Khung lớn nhất có thể đặt trong một CMD_SEQ
+ACK_STATUS = {0: 'ok', 1: 'bad frame', 2: 'overflow', 3: 'unknown command',
+              4: 'bus-off', 5: 'tx busy', 6: 'tx failed'}
+cmd_seq = 0                       # Số thứ tự 8 bit của khung tiếp theo
+cmd_pending = {}                  # seq -> {'event', 'status', 'sent'} của khung chưa có ack
+cmd_lock = threading.Lock()
+cmd_credits = threading.Semaphore(CMD_WINDOW)
+mcu_epoch_offset_us = None       # Giờ host (us) - giờ MCU, đặt khi kết nối
+CAPTURE_OPS = {'status': 0, 'arm': 1, 'stop': 2, 'fire': 3, 'dump': 4}
+CAPTURE_TRIGGERS = {'id': 0, 'error': 1, 'load': 2, 'attack': 3}
+CAPTURE_CAUSES = {**CAPTURE_TRIGGERS, 'manual': 0xFF}  # 0xFE = chưa kích
+CAPTURE_STATES = ('idle', 'armed', 'triggered', 'done')
+CAPTURE_LEC = {1: 'stuff', 2: 'form', 3: 'ack', 4: 'bit recessive', 5: 'bit dominant', 6: 'crc'}
+CAPTURE_REC_LEN = 21              # [stamp 4B][RIR 4B][RDTR 4B][data 8B][attack]
+CAPTURE_DUMP_CHUNK = 11           # Số bản ghi tối đa trong một reply
+IDSTATS_OPS = {'status': 0, 'clear': 1, 'dump': 2, 'changes': 3}
+IDSTATS_SLOTS = 64                # Số slot của bảng trên MCU
+IDSTATS_REC_LEN = 46              # [IDE][ID 4B][frames][bytes][gap min/max/mean][age][DLC][hash][remote][changes][attacks]
+IDSTATS_CHUNK = 5                 # Số slot quét mỗi lệnh (vừa một reply)
+CRC_OPS = {'status': 0, 'records': 1, 'bench': 2}
+CRC_POLY = 0x04C11DB7             # CRC-32/MPEG-2 như bộ CRC của STM32F1: init 0xFFFFFFFF, MSB trước, không XOR cuối
+CFGSTORE_OPS = {'status': 0, 'save': 1, 'erase': 2, 'protect': 3}
+CFGSTORE_RESULTS = ('ok', 'flash error', 'verify error')
+TSYNC_OPS = {'status': 0, 'config': 1}
+TSYNC_ROLES = ('off', 'master', 'slave')
+TSYNC_CAN_ID = 0x7C0              # SYNC/FUP 8 byte; giờ chung = epoch host của node master
+TSYNC_PERIOD_MS = 100             # Chu kỳ SYNC mặc định (tối thiểu 10 ms)
+IDDISP_OPS = {'status': 0, 'clear': 1}
+POOL_OPS = {'status': 0, 'clear': 1}
+idstats_status = None             # Trạng thái bảng gần nhất
+id_table = {}                     # (model, can_id) -> thống kê của ID, cập nhật dần
+idstats_lock = threading.Lock()   # Chỉ một lượt đọc bảng tại một thời điểm
+capture_stats = None              # Trạng thái capture gần nhất
+capture_frames = []               # Các khung đã đọc về, cũ nhất trước
+record_crc = False                # Bản ghi/batch từ MCU có kèm [CRC 4B]
+crc_checked = 0                   # Số bản ghi/batch đã kiểm CRC
+crc_errors = 0                    # Trong đó sai CRC (bị bỏ)
+crc_stats = None                  # Trạng thái CRC bản ghi trên MCU
+crc_bench_summary = None          # Chu kỳ CPU: bộ CRC phần cứng / DMA / bảng phần mềm
+cfg_stats = None                  # Cấu hình đang lưu trong flash của MCU
+tsync_stats = None                # Trạng thái đồng bộ thời gian và mốc quy đổi của node
+iddisp_stats = None               # Bảng điều phối theo ID: kích thước và thời gian tra bảng đo trên MCU
+pool_stats = None                 # Pool khung trên MCU: số khối đang dùng và mức cao nhất để chọn kích thước
+
+def read_reply(port, cmd, length, timeout=0.5):
+    # Bỏ qua các byte bản ghi CAN cho tới khi gặp [cmd | 0x80][length]
+    deadline = time.time() + timeout
+    window = b''
+    while time.time() < deadline:
+        b = port.read(1)
+        if not b:
+            continue
+        window = (window + b)[-2:]
+        if window == bytes([cmd | REPLY_FLAG, length]):
+            payload = port.read(length)
+            return payload if len(payload) == length else None
+    return None
+
+def negotiate_baud(port, baudrate):
+    # MCU khởi động ở UART_BOOT_BAUD; đổi tốc độ rồi xác nhận ở tốc độ mới,
+    # nếu không xác nhận được MCU tự quay lại sau UART_BAUD_CONFIRM_S
+    if baudrate == UART_BOOT_BAUD:
+        return UART_BOOT_BAUD
+    port.reset_input_buffer()
+    port.write(bytes([CMD_UART_BAUD, 4]) + baudrate.to_bytes(4, 'big'))
+    reply = read_reply(port, CMD_UART_BAUD, 5)
+    if not reply or reply[0] != 0:
+        print(f"[UART] {baudrate} baud rejected, staying at {UART_BOOT_BAUD}")
+        return UART_BOOT_BAUD
+    port.baudrate = baudrate
+    port.reset_input_buffer()
+    port.write(bytes([CMD_UART_BAUD, 0]))
+    reply = read_reply(port, CMD_UART_BAUD, 5)
+    if reply and int.from_bytes(reply[1:5], 'big') == baudrate:
+        print(f"[UART] Link switched to {baudrate} baud")
+        return baudrate
+    time.sleep(UART_BAUD_CONFIRM_S + 0.1)
+    port.baudrate = UART_BOOT_BAUD
+    print(f"[UART] {baudrate} baud not confirmed, back to {UART_BOOT_BAUD}")
+    return UART_BOOT_BAUD
+
+def sync_epoch(port):
+    # Hỏi đồng hồ 1 us của MCU, lấy offset = thời điểm giữa vòng hỏi (giờ host) - giờ MCU,
+    # rồi ghi offset xuống để MCU quy đổi timestamp sang epoch của host
+    global mcu_epoch_offset_us
+    port.reset_input_buffer()
+    t0 = time.time_ns() // 1000
+    port.write(bytes([CMD_TIME, 0]))
+    reply = read_reply(port, CMD_TIME, 16)
+    t1 = time.time_ns() // 1000
+    if not reply:
+        print("[UART] Time sync: no reply")
+        return
+    offset = (t0 + t1) // 2 - int.from_bytes(reply[0:8], 'big')
+    port.write(bytes([CMD_TIME, 8]) + offset.to_bytes(8, 'big', signed=True))
+    read_reply(port, CMD_TIME, 16)
+    mcu_epoch_offset_us = offset
+    print(f"[UART] Time synced, offset={offset} us, round trip={t1 - t0} us")
+
 def connect_uart(port, baudrate):
-    global ser, receive_running, receive_thread
+    global ser, receive_running, receive_thread, seq_next, record_crc
     if ser and ser.is_open:
         ser.close()
-    ser = serial.Serial(port, baudrate, timeout=1)
+    ser = serial.Serial(port, UART_BOOT_BAUD, timeout=1)
+    baudrate = negotiate_baud(ser, baudrate)
+    sync_epoch(ser)
+    reset_pending()
+    send_sequenced(bytes([CMD_BATCH, 5, BATCH_FRAMES]) + BATCH_AGE_US.to_bytes(4, 'big'))
+    compact_slots.clear()
+    seq_next = None  # Chưa biết số thứ tự cho tới bản ghi đầu tiên
+    send_sequenced(bytes([CMD_COMPACT, 1, 1]))  # MCU xóa từ điển khi bật lại
+    record_crc = False  # Bật lại khi trả lời của CMD_CRC tới luồng nhận
+    send_sequenced(bytes([CMD_CRC, 2, CRC_OPS['records'], 1]))
+    send_sequenced(bytes([CMD_CFGSTORE, 0]))  # Node khởi động từ flash thì chế độ bảo vệ lấy theo node
+    send_sequenced(bytes([CMD_TSYNC, 0]))  # Mốc quy đổi giờ node, nếu node đang đồng bộ
     receive_running = True
     receive_thread = threading.Thread(target=uart_receive_loop)
     receive_thread.start()
+    return baudrate
+
+def send_sequenced(frame):
+    # Gửi khung trong phong bì CMD_SEQ; chờ credit nếu đã có CMD_WINDOW khung chưa được ack
+    global cmd_seq
+    if len(frame) > CMD_FRAME_MAX:
+        raise ValueError("frame too long for CMD_SEQ")
+    while not cmd_credits.acquire(timeout=CMD_ACK_TIMEOUT_S):
+        expire_pending()
+    with cmd_lock:
+        seq = cmd_seq
+        cmd_seq = (cmd_seq + 1) & 0xFF
+        entry = {'event': threading.Event(), 'status': None, 'sent': time.monotonic()}
+        cmd_pending[seq] = entry
+    ser.write(bytes([CMD_SEQ, len(frame) + 1, seq]) + frame)
+    return entry
+
+def send_command(cmd, payload=b''):
+    return send_sequenced(bytes([cmd, len(payload)]) + payload)
+
+def wait_ack(entry, timeout=CMD_ACK_TIMEOUT_S):
+    # Trả về tên trạng thái trong ack, hoặc 'timeout'
+    if not entry['event'].wait(timeout) or entry['status'] is None:
+        return 'timeout'
+    return ACK_STATUS.get(entry['status'], entry['status'])
+
+def handle_ack(payload):
+    # [seq][status][credits]: credits là số chỗ trống trong hàng đợi lệnh của MCU
+    seq, status, credits = payload[0], payload[1], payload[2]
+    with cmd_lock:
+        entry = cmd_pending.pop(seq, None)
+    if entry is None:
+        return  # Ack trễ của khung đã hết hạn
+    entry['status'] = status
+    entry['event'].set()
+    cmd_credits.release()
+    if status != 0:
+        log_line = f"[UART Ack] seq={seq}, status={ACK_STATUS.get(status, status)}, credits={credits}"
+        print(log_line)
+
+def expire_pending():
+    now = time.monotonic()
+    with cmd_lock:
+        expired = [seq for seq, entry in cmd_pending.items() if now - entry['sent'] > CMD_ACK_TIMEOUT_S]
+        for seq in expired:
+            cmd_pending.pop(seq)['event'].set()
+            cmd_credits.release()
+
+def reset_pending():
+    # Khi kết nối lại: bỏ các khung đang chờ và trả lại credit của chúng
+    global cmd_seq
+    with cmd_lock:
+        for entry in cmd_pending.values():
+            entry['event'].set()
+            cmd_credits.release()
+        cmd_pending.clear()
+        cmd_seq = 0
+
+def read_leb128(read):
+    value, shift = 0, 0
+    while True:
+        b = read(1)[0]
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return value
+
+def report_lost(count):
+    global frames_lost
+    frames_lost += count
+    log_line = f"[UART] {count} frames lost (total {frames_lost})"
+    print(log_line)
+
+def track_seq(seq):
+    # Mỗi khung MCU nhận được có số thứ tự 16 bit, kể cả khung bị bỏ khi hàng đợi đầy,
+    # nên bước nhảy của seq chính là số khung bị mất
+    global seq_next
+    if seq_next is not None and seq != seq_next:
+        report_lost((seq - seq_next) & 0xFFFF)
+    seq_next = (seq + 1) & 0xFFFF
+
+def make_crc_table():
+    table = []
+    for i in range(256):
+        c = i << 24
+        for _ in range(8):
+            c = ((c << 1) ^ CRC_POLY) if c & 0x80000000 else c << 1
+        table.append(c & 0xFFFFFFFF)
+    return table
+
+CRC_TABLE = make_crc_table()
+
+def crc32_words(data):
+    # MCU nạp từng word 32 bit little-endian (byte 3 vào trước), phần dư 1-3 byte đệm 0
+    data = bytes(data) + bytes(-len(data) % 4)
+    crc = 0xFFFFFFFF
+    for i in range(0, len(data), 4):
+        for b in reversed(data[i:i + 4]):
+            crc = ((crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[(crc >> 24) ^ b]
+    return crc
+
+def record_crc_ok(raw):
+    # Đọc [CRC 4B] sau bản ghi khi MCU bật CRC bản ghi; bản ghi sai CRC bị bỏ
+    global crc_checked, crc_errors
+    if not record_crc:
+        return True
+    crc = ser.read(4)
+    crc_checked += 1
+    if len(crc) == 4 and int.from_bytes(crc, 'big') == crc32_words(raw):
+        return True
+    crc_errors += 1
+    print(f"[UART] record CRC mismatch ({crc_errors}/{crc_checked})")
+    return False
+
+def decode_compact(read):
+    # [0x42][slot | IDE<<6 | DEF<<7][ID 2|4 nếu DEF][len | attack<<7][delta us LEB128][gap LEB128][mask][XOR bytes]
+    global compact_time_us, seq_next
+    slot_byte = read(1)[0]
+    slot = slot_byte & 0x3F
+    if slot_byte & 0x80:
+        # ID mới trong từ điển: payload tham chiếu bắt đầu từ toàn 0
+        mode = 'Extended' if slot_byte & 0x40 else 'Standard'
+        can_id = read(4 if slot_byte & 0x40 else 2).hex().upper()
+        compact_slots[slot] = [mode, can_id, bytearray(8)]
+    mode, can_id, last = compact_slots[slot]
+    len_byte = read(1)[0]
+    data_len = len_byte & 0x0F
+    compact_time_us += read_leb128(read)
+    gap = read_leb128(read)  # Số khung bị mất ngay trước bản ghi này
+    if gap:
+        report_lost(gap)
+    if seq_next is not None:
+        seq_next = (seq_next + gap + 1) & 0xFFFF
+    if data_len:
+        mask = read(1)[0]
+        for i in range(data_len):
+            if mask & (1 << i):
+                last[i] ^= read(1)[0]
+    attack_flash = '01' if len_byte & 0x80 else '00'
+    return (mode, can_id, bytes(last[:data_len]), attack_flash)
+
+def decode_batch(payload, count):
+    # Tách các bản ghi khung trong một batch (bản ghi đơn hoặc bản ghi compact)
+    frames = []
+    pos = 0
+    def read(n):
+        nonlocal pos
+        pos += n
+        return payload[pos - n:pos]
+    for _ in range(count):
+        rec_type = read(1)[0]
+        if rec_type == REC_COMPACT:
+            frames.append(decode_compact(read))
+            continue
+        mode = 'Standard' if rec_type == 0 else 'Extended'
+        can_id = read(2 if rec_type == 0 else 4).hex().upper()
+        data_bytes = read(read(1)[0])
+        attack_flash = f"{read(1)[0]:02X}"
+        track_seq(int.from_bytes(read(2), 'big'))
+        frames.append((mode, can_id, data_bytes, attack_flash))
+    return frames
+
+def handle_frames(frames):
+    global attack_flash
+    # Một kết nối DB cho cả batch thay vì mỗi khung một kết nối
+    conn = mysql.connector.connect(**db_config)
+    cursor = conn.cursor()
+    for mode, can_id, data_bytes, attack_flash in frames:
+        # Nếu đang ở trạng thái bảo vệ và attack_flash = '01', bỏ qua tín hiệu
+        if is_protected and attack_flash == '01':
+            print(f"[UART Frame] Signal blocked due to protect mode: attack_flash={attack_flash}")
+            continue
+
+        # Decode data
+        try:
+            data = data_bytes.decode('ascii', errors='replace')
+        except Exception:
+            data = data_bytes.hex().upper()
+
+        print(f"[UART Frame] mode={mode}, can_id={can_id}, data={data}, attack_flash={attack_flash}")
+
+        # Save to DB
+        cursor.execute("SELECT description FROM can WHERE can_id = %s", (can_id,))
+        result = cursor.fetchone()
+        description = result[0] if result else ''
+        cursor.execute("""
+            INSERT INTO receive (model, can_id, data, description, direction, timestamp)
+            VALUES (%s, %s, %s, %s, 'Rx', NOW())
+        """, (mode, can_id, data, description))
+    conn.commit()
+    cursor.close()
+    conn.close()
+
+def fetch_capture(frames):
+    # Đọc từng phần ở luồng riêng: luồng nhận UART phải rảnh để xử lý ack trả credit
+    for first in range(0, frames, CAPTURE_DUMP_CHUNK):
+        send_command(CMD_CAPTURE, bytes([CAPTURE_OPS['dump']]) + first.to_bytes(2, 'big'))
+
+def tsync_global_us(local_us):
+    # Giờ 1 us của node (Time_Now32, quay vòng 32 bit) -> giờ chung (us) theo mốc và tốc độ trong
+    # tsync_stats; None khi node chưa đồng bộ. Dùng để gộp bản ghi của nhiều node trên một trục thời gian
+    if not (tsync_stats and tsync_stats['synced']):
+        return None
+    d = (local_us - tsync_stats['local_ref_us']) & 0xFFFFFFFF
+    if d >= 1 << 31:
+        d -= 1 << 32  # Timestamp trước mốc
+    return (tsync_stats['global_ref_ns'] + d * 1000 + d * tsync_stats['rate_ppb'] // 1000000) // 1000
+
+def capture_record(rec):
+    stamp, rir, rdtr = struct.unpack('>III', rec[:12])
+    extended = bool(rir & 0x4)
+    dlc = min(rdtr & 0x0F, 8)
+    return {'stamp_us': stamp, 'global_us': tsync_global_us(stamp), 'mode': 'Extended' if extended else 'Standard',
+            'can_id': f"{(rir >> 3) if extended else (rir >> 21):X}", 'rtr': bool(rir & 0x2),
+            'dlc': rdtr & 0x0F, 'data': rec[12:12 + dlc].hex().upper(), 'attack': bool(rec[20])}
+
+def fetch_idstats():
+    # Chỉ hỏi các entry thay đổi từ lần đọc trước, lần lượt từng dải slot
+    try:
+        send_command(CMD_IDSTATS)
+        for first in range(0, IDSTATS_SLOTS, IDSTATS_CHUNK):
+            send_command(CMD_IDSTATS, bytes([IDSTATS_OPS['changes'], first, IDSTATS_CHUNK]))
+    finally:
+        idstats_lock.release()
+
+def idstats_record(rec):
+    ide, can_id, frames, nbytes, gap_min, gap_max, gap_mean, age, dlc, payload_hash, remote, changes, attacks = \
+        struct.unpack('>BIIIIIIIBIIII', rec)
+    model = 'Extended' if ide else 'Standard'
+    key = (model, f"{can_id:0{8 if ide else 4}X}")
+    id_table[key] = {'model': model, 'can_id': key[1], 'frames': frames, 'bytes': nbytes,
+                     'gap_min_us': gap_min, 'gap_max_us': gap_max, 'gap_mean_us': gap_mean,
+                     'rate_per_s': round(1e6 / gap_mean, 1) if gap_mean else 0,
+                     'age_us': age, 'read_at': time.time(), 'dlc': dlc,
+                     'payload_hash': f"{payload_hash:08X}", 'remote': remote,
+                     'changes': changes, 'attacks': attacks}
+
+def handle_reply(cmd, payload):
+    global capture_stats, idstats_status, record_crc, crc_stats, crc_bench_summary, cfg_stats, is_protected
+    global tsync_stats, iddisp_stats, pool_stats
+    if cmd == CMD_CAPTURE and len(payload) == 23 and payload[0] == CAPTURE_OPS['status']:
+        _, state, trigger, cause, lec, depth, frames, trig_index, post_left, trig_stamp, seen, peak = \
+            struct.unpack('>BBBBBHHHHIIH', payload)
+        capture_stats = {'state': CAPTURE_STATES[state] if state < len(CAPTURE_STATES) else state,
+                         'trigger': next((k for k, v in CAPTURE_TRIGGERS.items() if v == trigger), trigger),
+                         'cause': next((k for k, v in CAPTURE_CAUSES.items() if v == cause), None),
+                         'lec': CAPTURE_LEC.get(lec), 'depth': depth, 'frames': frames,
+                         'trigger_index': trig_index if trig_index != 0xFFFF else None,
+                         'post_left': post_left, 'trigger_stamp_us': trig_stamp,
+                         'frames_seen': seen, 'peak_load_permille': peak}
+        print(f"[Capture] state={capture_stats['state']}, cause={capture_stats['cause']}, "
+              f"frames={frames}/{depth}, trigger_index={capture_stats['trigger_index']}, peak_load={peak}")
+    elif cmd == CMD_CAPTURE and len(payload) >= 4 and payload[0] == CAPTURE_OPS['dump'] and \
+            len(payload) == 4 + CAPTURE_REC_LEN * payload[3]:
+        first = int.from_bytes(payload[1:3], 'big')
+        records = [capture_record(payload[4 + CAPTURE_REC_LEN * i:4 + CAPTURE_REC_LEN * (i + 1)])
+                   for i in range(payload[3])]
+        capture_frames[first:first + len(records)] = records
+    elif cmd == CMD_IDSTATS and len(payload) == 15 and payload[0] == IDSTATS_OPS['status']:
+        _, slots, used, overflow, frames, since = struct.unpack('>BBBIII', payload)
+        idstats_status = {'slots': slots, 'used': used, 'overflow_frames': overflow,
+                          'frames': frames, 'since_s': round(since / 1e6, 1)}
+    elif cmd == CMD_IDSTATS and len(payload) >= 4 and payload[0] in (IDSTATS_OPS['dump'], IDSTATS_OPS['changes']) and \
+            len(payload) == 4 + IDSTATS_REC_LEN * payload[3]:
+        for i in range(payload[3]):
+            idstats_record(payload[4 + IDSTATS_REC_LEN * i:4 + IDSTATS_REC_LEN * (i + 1)])
+    elif cmd == CMD_CRC and len(payload) == 6 and payload[0] == CRC_OPS['status']:
+        enabled, sent = struct.unpack('>BI', payload[1:])
+        crc_stats = {'records': bool(enabled), 'sent': sent}
+        record_crc = bool(enabled)  # MCU gửi batch cũ trước trả lời, bản ghi sau đó mới có CRC
+    elif cmd == CMD_CRC and len(payload) == 30 and payload[0] == CRC_OPS['bench']:
+        frames, hw, sw, buf_len, dma, cpu, soft, buf_crc, match = struct.unpack('>HIIHIIIIB', payload[1:])
+        crc_bench_summary = {'frames': frames, 'hw_cycles_per_frame': round(hw / frames, 1),
+                             'sw_cycles_per_frame': round(sw / frames, 1),
+                             'frame_speedup': round(sw / hw, 2) if hw else 0,
+                             'buffer_bytes': buf_len, 'dma_cycles': dma, 'cpu_cycles': cpu, 'sw_cycles': soft,
+                             'buffer_crc': f"{buf_crc:08X}", 'match': bool(match)}
+        print(f"[CRC Bench] {crc_bench_summary['hw_cycles_per_frame']} vs "
+              f"{crc_bench_summary['sw_cycles_per_frame']} cycles/frame, {buf_len} B: "
+              f"dma {dma}, cpu {cpu}, sw {soft} cycles, match={bool(match)}")
+    elif cmd == CMD_CFGSTORE and len(payload) == 19:
+        op, result, restored, seq, slot, restore_us, bitrate, mode, mask, protect = struct.unpack('>BBBIBIIBBB', payload)
+        cfg_stats = {'result': CFGSTORE_RESULTS[result] if result < len(CFGSTORE_RESULTS) else result,
+                     'restored': bool(restored), 'saves': seq, 'slot': slot if slot != 0xFF else None,
+                     'restore_us': restore_us, 'bitrate': bitrate or None, 'can_mode': mode,
+                     'cyclic_slots': [i for i in range(8) if mask & (1 << i)], 'protect': bool(protect)}
+        if restored and op == CFGSTORE_OPS['status'] and bool(protect) != is_protected:
+            is_protected = bool(protect)  # Node khởi động từ flash: lấy chế độ bảo vệ đã lưu
+            save_protect_state()
+        print(f"[Config] op={op}, result={cfg_stats['result']}, restored={bool(restored)}, "
+              f"saves={seq}, restore={restore_us} us")
+    elif cmd == CMD_TSYNC and len(payload) == 54:
+        _, role, domain, synced, period, syncs, fups, dropped, steps, window, offset, offset_max, rate, \
+            local_ref, global_ref = struct.unpack('>BBBBHIIIIIiIiQQ', payload)
+        tsync_stats = {'role': TSYNC_ROLES[role] if role < len(TSYNC_ROLES) else role, 'domain': domain,
+                       'synced': bool(synced), 'period_ms': period, 'syncs': syncs, 'fups': fups,
+                       'dropped': dropped, 'steps': steps, 'window_us': window, 'offset_ns': offset,
+                       'max_offset_ns': offset_max, 'rate_ppb': rate,
+                       'local_ref_us': local_ref, 'global_ref_ns': global_ref}
+        print(f"[TSync] role={tsync_stats['role']}, domain={domain}, synced={bool(synced)}, "
+              f"offset={offset} ns (max {offset_max}), rate={rate} ppb, dropped={dropped}, steps={steps}")
+    elif cmd == CMD_IDDISP and len(payload) == 32:
+        _, entries, slots, entry_bytes, table_bytes, mult, handled, dropped, limited, cyc_min, cyc_max, timed = \
+            struct.unpack('>BBBBHIIIIIIH', payload)
+        iddisp_stats = {'entries': entries, 'slots': slots, 'entry_bytes': entry_bytes, 'table_bytes': table_bytes,
+                        'multiplier': f"{mult:08X}", 'handled': handled, 'dropped': dropped, 'limited': limited,
+                        'lookup_cycles_min': cyc_min, 'lookup_cycles_max': cyc_max, 'lookups_timed': timed}
+        print(f"[IdDisp] {entries} IDs in {slots} slots ({table_bytes} B), lookup {cyc_min}-{cyc_max} cycles, "
+              f"handled={handled}, dropped={dropped}, limited={limited}")
+    elif cmd == CMD_POOL and len(payload) == 13:
+        _, blocks, block_size, in_use, high_water, failures, allocs = struct.unpack('>BBBBBII', payload)
+        pool_stats = {'blocks': blocks, 'block_size': block_size, 'in_use': in_use, 'high_water': high_water,
+                      'alloc_failures': failures, 'allocs': allocs}
+        print(f"[Pool] {in_use}/{blocks} blocks of {block_size} B in use, high_water={high_water}, "
+              f"failures={failures}, allocs={allocs}")
+    else:
+        print(f"[UART Reply] cmd=0x{cmd:02X}, payload={payload.hex().upper()}")
 
 def uart_receive_loop():
     global receive_running, attack_flash, is_protected
@@ -42,6 +501,47 @@ def uart_receive_loop():
                 if not mode_byte:
                     continue
                 mode_val = int.from_bytes(mode_byte, 'big')
+
+                # Reply record to a host command
+                if mode_val & REPLY_FLAG:
+                    length_byte = ser.read(1)
+                    if not length_byte:
+                        continue
+                    payload = ser.read(length_byte[0])
+                    if len(payload) != length_byte[0]:
+                        continue
+                    if mode_val & ~REPLY_FLAG == CMD_SEQ and len(payload) == 3:
+                        handle_ack(payload)
+                        continue
+                    handle_reply(mode_val & ~REPLY_FLAG, payload)
+                    continue
+
+                # Compact record: dictionary slot + XOR-delta payload
+                if mode_val == REC_COMPACT:
+                    raw = bytearray(mode_byte)
+                    def read(n):
+                        b = ser.read(n)
+                        raw.extend(b)
+                        return b
+                    frame = decode_compact(read)
+                    if record_crc_ok(raw):
+                        handle_frames([frame])
+                    continue
+
+                # Batch record: [0x40][count][length 2B][frame records...]
+                if mode_val == REC_BATCH:
+                    header = ser.read(3)
+                    if len(header) != 3:
+                        continue
+                    length = int.from_bytes(header[1:3], 'big')
+                    payload = ser.read(length)
+                    if len(payload) != length:
+                        continue
+                    if not record_crc_ok(mode_byte + header + payload):
+                        continue
+                    handle_frames(decode_batch(payload, header[0]))
+                    continue
+
                 mode = 'Standard' if mode_val == 0 else 'Extended'
 
                 # 2. Read CAN ID
@@ -68,32 +568,18 @@ def uart_receive_loop():
                     continue
                 attack_flash = attack_flash_byte.hex().upper()
 
-                # Nếu đang ở trạng thái bảo vệ và attack_flash = '01', bỏ qua tín hiệu
-                if is_protected and attack_flash == '01':
-                    print(f"[UART Frame] Signal blocked due to protect mode: attack_flash={attack_flash}")
+                # 6. Read sequence number
+                seq_bytes = ser.read(2)
+                if len(seq_bytes) != 2:
+                    continue
+
+                # 7. Check the record CRC
+                if not record_crc_ok(mode_byte + can_id_bytes + length_byte + data_bytes +
+                                     attack_flash_byte + seq_bytes):
                     continue
+                track_seq(int.from_bytes(seq_bytes, 'big'))
 
-                # Decode data
-                try:
-                    data = data_bytes.decode('ascii', errors='replace')
-                except Exception:
-                    data = data_bytes.hex().upper()
-
-                print(f"[UART Frame] mode={mode}, can_id={can_id}, data={data}, attack_flash={attack_flash}")
-
-                # Save to DB
-                conn = mysql.connector.connect(**db_config)
-                cursor = conn.cursor()
-                cursor.execute("SELECT description FROM can WHERE can_id = %s", (can_id,))
-                result = cursor.fetchone()
-                description = result[0] if result else ''
-                cursor.execute("""
-                    INSERT INTO receive (model, can_id, data, description, direction, timestamp)
-                    VALUES (%s, %s, %s, %s, 'Rx', NOW())
-                """, (mode, can_id, data, description))
-                conn.commit()
-                cursor.close()
-                conn.close()
+                handle_frames([(mode, can_id, data_bytes, attack_flash)])
 
         except Exception as e:
             print("[UART Error]", e)
@@ -133,7 +619,7 @@ def index():
     conn.close()
 
     ports = [port.device for port in serial.tools.list_ports.comports()]
-    baudrates = [115200, 19200, 38400, 57600, 9600]
+    baudrates = [115200, 230400, 460800, 921600, 2000000, 3000000, 4500000, 57600, 38400, 19200, 9600]
 
     return render_template('index.html', ports=ports, baudrates=baudrates,
                            can_ids=can_ids, transmit_rows=transmit_rows, receive_rows=receive_rows,
@@ -152,9 +638,8 @@ def protect_status():
 def connect_uart_route():
     global uart_port, uart_baudrate
     uart_port = request.form['port']
-    uart_baudrate = int(request.form['baudrate'])
-    connect_uart(uart_port, uart_baudrate)
-    return jsonify({'status': 'connected'})
+    uart_baudrate = connect_uart(uart_port, int(request.form['baudrate']))
+    return jsonify({'status': 'connected', 'baudrate': uart_baudrate})
 
 @app.route('/add_transmit', methods=['POST'])
 def add_transmit():
@@ -194,17 +679,195 @@ def send_frame(transmit_id):
         frame = model_byte + can_id_bytes + data_len_byte + data_bytes + cyclic_bytes
         if ser and ser.is_open:
             try:
-                ser.write(frame)
-                print("Frame sent:", frame.hex())
+                ack = wait_ack(send_sequenced(frame))
+                print("Frame sent:", frame.hex(), "ack:", ack)
             except Exception as e:
                 print("UART Send Error:", e)
+                ack = 'error'
         else:
             print("UART not connected.")
+            ack = 'not connected'
+    else:
+        ack = 'not found'
+
+    cursor.close()
+    conn.close()
+    return jsonify({'status': 'sent' if ack == 'ok' else ack})
 
+@app.route('/id_overview')
+def id_overview():
+    # Tổng quan theo ID do MCU đếm: đúng cả khi khung thô bị lọc (protect) hoặc mất trên UART
+    if ser and ser.is_open and idstats_lock.acquire(blocking=False):
+        threading.Thread(target=fetch_idstats, daemon=True).start()  # Kết quả có ở lần gọi sau
+    conn = mysql.connector.connect(**db_config)
+    cursor = conn.cursor()
+    cursor.execute("SELECT can_id, description FROM can")
+    descriptions = dict(cursor.fetchall())
     cursor.close()
     conn.close()
+    now = time.time()
+    rows = []
+    for key in sorted(id_table):
+        row = {k: v for k, v in id_table[key].items() if k not in ('age_us', 'read_at')}
+        row['age_ms'] = round(id_table[key]['age_us'] / 1000 + (now - id_table[key]['read_at']) * 1000)
+        row['description'] = descriptions.get(row['can_id'], '')
+        rows.append(row)
+    return jsonify({'status': idstats_status, 'ids': rows})
+
+@app.route('/id_reset', methods=['POST'])
+def id_reset():
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    id_table.clear()
+    send_command(CMD_IDSTATS, bytes([IDSTATS_OPS['clear']]))
+    return jsonify({'status': 'sent'})
+
+@app.route('/crc_records', methods=['POST'])
+def set_crc_records():
+    enabled = request.form.get('enabled', '1') == '1'
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    send_command(CMD_CRC, bytes([CRC_OPS['records'], int(enabled)]))
+    return jsonify({'status': 'sent', 'enabled': enabled})
+
+@app.route('/crc_bench', methods=['POST'])
+def crc_bench():
+    global crc_bench_summary
+    frames = max(1, min(int(request.form.get('frames', 1000)), 0xFFFF))
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    crc_bench_summary = None
+    send_command(CMD_CRC, bytes([CRC_OPS['bench']]) + frames.to_bytes(2, 'big'))
+    return jsonify({'status': 'started', 'frames': frames})
+
+@app.route('/crc_stats')
+def get_crc_stats():
+    if ser and ser.is_open:
+        send_command(CMD_CRC)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': crc_stats, 'record_crc': record_crc, 'checked': crc_checked,
+                    'errors': crc_errors, 'bench': crc_bench_summary})
+
+@app.route('/config_save', methods=['POST'])
+def config_save():
+    # Lưu cấu hình đang chạy; xóa trang flash (~20 ms, CPU dừng) mỗi 8 lần lưu nên chỉ lưu khi bus rảnh
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    send_command(CMD_CFGSTORE, bytes([CFGSTORE_OPS['save']]))
+    return jsonify({'status': 'sent'})
+
+@app.route('/config_erase', methods=['POST'])
+def config_erase():
+    # Xóa cấu hình đã lưu: lần khởi động sau dùng giá trị mặc định
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    send_command(CMD_CFGSTORE, bytes([CFGSTORE_OPS['erase']]))
+    return jsonify({'status': 'sent'})
+
+@app.route('/config_stats')
+def get_config_stats():
+    if ser and ser.is_open:
+        send_command(CMD_CFGSTORE)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': cfg_stats})
+
+@app.route('/tsync', methods=['POST'])
+def set_tsync():
+    # role = off | master | slave; một master mỗi domain (0-15), master lấy giờ chung từ epoch host của nó
+    role = request.form.get('role', 'off')
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if role not in TSYNC_ROLES:
+        return jsonify({'status': 'error', 'message': 'role must be off, master or slave'})
+    try:
+        domain = int(request.form.get('domain', 0))
+        period = int(request.form.get('period_ms', TSYNC_PERIOD_MS))
+    except ValueError:
+        return jsonify({'status': 'error', 'message': 'Invalid domain or period'})
+    if not (0 <= domain <= 15 and 10 <= period <= 0xFFFF):
+        return jsonify({'status': 'error', 'message': 'domain 0-15, period_ms 10-65535'})
+    send_command(CMD_TSYNC, bytes([TSYNC_OPS['config'], TSYNC_ROLES.index(role), domain]) + period.to_bytes(2, 'big'))
+    return jsonify({'status': 'sent'})
+
+@app.route('/tsync_stats')
+def get_tsync_stats():
+    # Mốc (local_ref_us, global_ref_ns, rate_ppb) đổi giờ node sang giờ chung: xem tsync_global_us()
+    if ser and ser.is_open:
+        send_command(CMD_TSYNC)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': tsync_stats})
+
+@app.route('/iddisp_stats')
+def get_iddisp_stats():
+    # Số chu kỳ tra bảng đo lại mỗi lần hỏi (mọi ID trong bảng và 64 ID ngoài bảng), không phụ thuộc số ID
+    if ser and ser.is_open:
+        send_command(CMD_IDDISP)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': iddisp_stats})
+
+@app.route('/iddisp_reset', methods=['POST'])
+def reset_iddisp_stats():
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    send_command(CMD_IDDISP, bytes([IDDISP_OPS['clear']]))  # Trả bộ đếm cũ rồi xóa
+    return jsonify({'status': 'sent'})
+
+@app.route('/pool_stats')
+def get_pool_stats():
+    # high_water gần bằng blocks khi bus đầy tải nghĩa là hàng đợi chuyển tiếp đã chạm giới hạn
+    if ser and ser.is_open:
+        send_command(CMD_POOL)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': pool_stats})
+
+@app.route('/pool_reset', methods=['POST'])
+def reset_pool_stats():
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    send_command(CMD_POOL, bytes([POOL_OPS['clear']]))  # Trả số liệu cũ rồi đo lại mức cao nhất
     return jsonify({'status': 'sent'})
 
+@app.route('/capture', methods=['POST'])
+def set_capture():
+    # op = arm | stop | fire; arm: trigger attack, id (can_id, mode), error, hoặc load (load_permille)
+    op = request.form.get('op', 'arm')
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if op not in ('arm', 'stop', 'fire'):
+        return jsonify({'status': 'error', 'message': 'unknown op'})
+    payload = bytes([CAPTURE_OPS[op]])
+    if op == 'arm':
+        trigger = request.form.get('trigger', 'attack')
+        if trigger not in CAPTURE_TRIGGERS:
+            return jsonify({'status': 'error', 'message': 'unknown trigger'})
+        post = min(int(request.form.get('post', 128)), 0xFFFF)
+        if trigger == 'load':
+            param = int(request.form.get('load_permille', 800))
+        else:
+            param = int(request.form.get('can_id', '0'), 16)
+        mode = 1 if request.form.get('mode') == 'Extended' else 0
+        payload += bytes([CAPTURE_TRIGGERS[trigger]]) + post.to_bytes(2, 'big') + \
+            param.to_bytes(4, 'big') + bytes([mode])
+        capture_frames.clear()
+    send_command(CMD_CAPTURE, payload)  # MCU trả trạng thái
+    return jsonify({'status': 'sent'})
+
+@app.route('/capture_stats')
+def get_capture_stats():
+    if ser and ser.is_open:
+        send_command(CMD_CAPTURE)  # Kết quả có ở lần gọi sau
+    return jsonify({'stats': capture_stats})
+
+@app.route('/capture_dump', methods=['POST'])
+def capture_dump():
+    # Đọc bộ đệm về khi capture đã xong (hoặc đã dừng)
+    if not (ser and ser.is_open):
+        return jsonify({'status': 'error', 'message': 'UART not connected'})
+    if not capture_stats or capture_stats['state'] not in ('idle', 'done'):
+        return jsonify({'status': 'error', 'message': 'capture still running'})
+    capture_frames.clear()
+    threading.Thread(target=fetch_capture, args=(capture_stats['frames'],), daemon=True).start()
+    return jsonify({'status': 'started', 'frames': capture_stats['frames']})
+
+@app.route('/capture_frames')
+def get_capture_frames():
+    return jsonify({'stats': capture_stats, 'frames': capture_frames})
+
 @app.route('/delete_transmit/<int:transmit_id>', methods=['POST'])
 def delete_transmit(transmit_id):
     conn = mysql.connector.connect(**db_config)
@@ -267,6 +930,10 @@ def toggle_protect():
         # Chuyển đổi trạng thái bảo vệ
         is_protected = not is_protected
         save_protect_state()
+        if ser and ser.is_open:
+            # Lưu cả vào flash của node để còn sau khi khởi động lại / đổi máy host
+            send_command(CMD_CFGSTORE, bytes([CFGSTORE_OPS['protect'], int(is_protected)]))
+            send_command(CMD_CFGSTORE, bytes([CFGSTORE_OPS['save']]))
         return jsonify({"protected": is_protected})
     except Exception as e:
         print("Error toggling protect mode:", e)
@@ -0,0 +1,155 @@
+/*****************************************************************************
+ * @file    bench.h
+ * @brief   CAN bus benchmark commands (max-rate burst transmit, ping-pong
+ *          round-trip probe, loopback self-test) and the DWT cycle counter
+ *          used to time them.
+ *****************************************************************************/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "main.h"
+#include "can.h"
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Burst command flags (first payload byte).
+ */
+#define BENCH_FLAG_INC_ID       0x01    /**< Add the frame index to the base ID */
+
+/**
+ * @brief Burst command payload layout:
+ *        [flags][count 4B][mode][id 4B][len][data...]
+ */
+#define BENCH_BURST_HDR_LEN     11
+
+/**
+ * @brief Benchmark status codes (first reply payload byte).
+ */
+#define BENCH_STATUS_OK         0x00    /**< All frames completed              */
+#define BENCH_STATUS_BAD_ARGS   0x01    /**< Malformed command payload         */
+#define BENCH_STATUS_BUS_OFF    0x02    /**< Controller is bus-off             */
+#define BENCH_STATUS_TIMEOUT    0x03    /**< No completion for 100 ms, aborted */
+
+/**
+ * @brief Ping-pong latency probe. The originator sends BENCH_PING_ID frames
+ *        carrying [seq][DWT timestamp 4B]; the peer echoes the payload from
+ *        its RX path on BENCH_PONG_ID. Both IDs are standard 11-bit.
+ */
+#define BENCH_PING_ID           0x7F0
+#define BENCH_PONG_ID           0x7F1
+#define BENCH_PING_LEN          5       /**< Probe payload length           */
+#define BENCH_PING_TIMEOUT_US   10000   /**< Probe counted lost after 10 ms */
+
+/**
+ * @brief Self-test frame sent by the loopback burst (standard ID).
+ */
+#define BENCH_SELFTEST_ID       0x100
+
+/**
+ * @brief Round-trip histogram: 1 us bins starting at 0 us, RTTs past the
+ *        last bin are counted as overflow.
+ */
+#define BENCH_HIST_BINS         1024
+#define BENCH_HIST_MAX_READ     100     /**< Bins per histogram reply */
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Enable the DWT cycle counter used as the benchmark time base.
+ */
+void Bench_Init(void);
+
+/**
+ * @brief Read the free-running DWT cycle counter.
+ * @return Core clock cycles since Bench_Init() (wraps at 2^32).
+ */
+uint32_t Bench_Cycles(void);
+
+/**
+ * @brief Transmit N frames back-to-back through TX mailboxes 0 and 1 and
+ *        reply to the host with the measured result.
+ *
+ * Reply payload: [status][requested 4B][ok 4B][arbitration lost 4B]
+ *                [errors 4B][elapsed cycles 4B][core clock Hz 4B]
+ *
+ * @param[in] args  Burst command payload (see BENCH_BURST_HDR_LEN).
+ * @param[in] len   Payload length in bytes.
+ */
+void Bench_Burst(const uint8_t *args, uint8_t len);
+
+/**
+ * @brief Run the ping-pong probe as originator and reply with the summary.
+ *
+ * Command payload: [count 4B][gap between probes us 2B]. A count of 0 only
+ * reports the current statistics; any other count clears them first.
+ *
+ * Reply payload: [status][sent 4B][received 4B][lost 4B][min us 4B]
+ *                [max us 4B][mean us 4B][overflow 4B]
+ *
+ * @param[in] args  Ping command payload.
+ * @param[in] len   Payload length in bytes.
+ */
+void Bench_Ping(const uint8_t *args, uint8_t len);
+
+/**
+ * @brief Reply with a slice of the round-trip histogram.
+ *
+ * Command payload: [first bin 2B][bin count 1B]
+ * Reply payload:   [first bin 2B][bin count 1B][count per bin 2B...]
+ *
+ * @param[in] args  Histogram query payload.
+ * @param[in] len   Payload length in bytes.
+ */
+void Bench_PingHistogram(const uint8_t *args, uint8_t len);
+
+/**
+ * @brief Run the burst and ping-pong benchmarks on a single board in
+ *        loopback + silent mode, then restore the previous CAN mode.
+ *
+ * Frames travel the full TX -> RX -> detection -> UART path. The burst and
+ * ping replies are sent exactly as for the two-node commands so the results
+ * can be compared directly, followed by the self-test reply.
+ *
+ * Command payload: [count 4B] (frames for the burst, probes for the ping)
+ * Reply payload:   [status][frames received during burst 4B][restored mode]
+ *
+ * @param[in] args  Self-test command payload.
+ * @param[in] len   Payload length in bytes.
+ */
+void Bench_SelfTest(const uint8_t *args, uint8_t len);
+
+/**
+ * @brief Handle ping-pong frames in the CAN RX path (BENCH_PING_ID and
+ *        BENCH_PONG_ID entries of the dispatch table).
+ *
+ * Probes are echoed immediately; echoes matching the outstanding probe are timed and added
+ * to the histogram.
+ *
+ * @param frame Register image from the RX FIFO.
+ * @return 1 if the frame was a ping-pong frame (not to be forwarded), else 0.
+ */
+uint8_t Bench_PingRx(const CanFrame *frame);
+
+/**
+ * @brief Count a self-test frame (BENCH_SELFTEST_ID entry of the dispatch
+ *        table); the frame continues on the replay path as usual.
+ *
+ * @param frame Register image from the RX FIFO.
+ * @return 0.
+ */
+uint8_t Bench_SelfTestRx(const CanFrame *frame);
+
+#endif /* BENCH_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -0,0 +1,171 @@
+/*****************************************************************************
+ * @file    boot.h
+ * @brief   Bootloader in the first flash pages: receives an application
+ *          image over CAN (ISO-TP) or UART, programs each page while the
+ *          next block arrives, verifies the image CRC and starts it.
+ *****************************************************************************/
+
+#ifndef BOOT_H
+#define BOOT_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "main.h"
+#include "can.h"
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Flash layout (see the BOOT, BOOTINFO and FLASH regions in
+ *        STM32F103C8TX_FLASH.ld):
+ *
+ *   0x08000000  7 KB  bootloader (vector, entry code, RAM code image)
+ *   0x08001C00  1 KB  image information page
+ *   0x08002000 54 KB  application (its vector table first)
+ *   0x0800F800  2 KB  configuration records (cfgstore.h)
+ *
+ * The application's vector table offset is set in system_stm32f1xx.c.
+ */
+#define BOOT_INFO_ADDR          0x08001C00UL
+#define BOOT_APP_BASE           0x08002000UL
+#define BOOT_APP_MAX            (0x0800F800UL - BOOT_APP_BASE)
+
+/**
+ * @brief Image information, programmed after a verified update:
+ *        [BOOT_INFO_MAGIC][size][CRC][update time us], one word each.
+ *
+ * An erased page means an image written by the debugger: it is started
+ * when its vector table looks valid. Any other content marks an update
+ * that did not complete, and the node stays in the bootloader.
+ */
+#define BOOT_INFO_MAGIC         0xB0071A6EUL
+
+/**
+ * @brief Written to the last RAM word by Boot_Request() before a reset;
+ *        the bootloader then waits for an image instead of starting the
+ *        application.
+ */
+#define BOOT_REQUEST_ADDR       0x20004FFCUL
+#define BOOT_REQUEST_MAGIC      0xB0075EEDUL
+
+/**
+ * @brief The bootloader runs from the 8 MHz HSI with the PLL off.
+ *
+ * UART: 500000 baud (USARTDIV exactly 1). CAN: 500 kbit/s, 16 tq of
+ * 125 ns, sample point 87.5 %, regardless of the bit rate the application
+ * has saved.
+ */
+#define BOOT_CLOCK_HZ           8000000UL
+#define BOOT_UART_BAUD          500000UL
+#define BOOT_CAN_BTR            ((1UL << 20) | (12UL << 16))    /* SJW 1, BS2 2, BS1 13, BRP 1 */
+
+/**
+ * @brief CAN IDs (standard): host to node carries ISO-TP messages, node to
+ *        host carries the flow control and the 8-byte replies.
+ *
+ * Replies start with an op | 0x80, which an ISO-TP receiver on the same ID
+ * ignores (no such PCI type). The pair is used by nothing else (the ping
+ * probe is on 0x7F0/0x7F1, time sync on 0x7C0), so a node in the
+ * bootloader never takes other traffic for commands.
+ */
+#define BOOT_CAN_RX_ID          0x7A0
+#define BOOT_CAN_TX_ID          0x7A8
+
+/**
+ * @brief Image block: one flash page, sent as one message
+ *        [BOOT_OP_DATA][block 2B][data...]. The last block may be shorter.
+ */
+#define BOOT_BLOCK_SIZE         1024
+#define BOOT_MSG_MAX            (3 + BOOT_BLOCK_SIZE)
+
+/**
+ * @brief A UART message whose bytes stop for this long is dropped.
+ */
+#define BOOT_UART_GAP_US        100000UL
+
+/**
+ * @brief Messages (first byte). In the application, the single frame
+ *        [0x01][BOOT_OP_ENTER] on BOOT_CAN_RX_ID resets into the
+ *        bootloader, as does UART_CMD_BOOT.
+ */
+#define BOOT_OP_STATUS          0       /**< Query; also sent unasked at start */
+#define BOOT_OP_START           1       /**< [size 4B][CRC 4B]: begin an update */
+#define BOOT_OP_DATA            2       /**< [block 2B][data]: next page       */
+#define BOOT_OP_END             3       /**< Verify and record the image      */
+#define BOOT_OP_RUN             4       /**< Reset into the application       */
+#define BOOT_OP_ENTER           5       /**< Application: reset into the bootloader */
+
+/**
+ * @brief Reply: [op | 0x80][result][block 2B][value 4B], big-endian.
+ *
+ *   STATUS: block = why the bootloader runs (BOOT_WHY_xxx),
+ *           value = BOOT_APP_MAX
+ *   START:  value = BOOT_APP_MAX
+ *   DATA:   sent when the block starts programming, so the host may send
+ *           the next one; value = bytes accepted so far
+ *   END:    value = update time in us, START to verified image
+ *
+ * Over UART a message is [length 2B][message] and a reply is the 8 bytes.
+ */
+#define BOOT_RES_OK             0
+#define BOOT_RES_BAD_MSG        1       /**< Unknown op, wrong length, no START */
+#define BOOT_RES_SEQUENCE       2       /**< Block out of order               */
+#define BOOT_RES_FLASH          3       /**< Erase or program error           */
+#define BOOT_RES_CRC            4       /**< Image CRC differs                */
+#define BOOT_RES_SIZE           5       /**< Image larger than BOOT_APP_MAX   */
+
+#define BOOT_WHY_REQUEST        0       /**< Boot_Request()                   */
+#define BOOT_WHY_NO_APP         1       /**< No valid vector table            */
+#define BOOT_WHY_INCOMPLETE     2       /**< Update did not complete          */
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Reset vector of the part: start the application unless an update
+ *        was requested or is incomplete.
+ *
+ * Runs from flash without the C runtime. Only the image information page
+ * and the application's vector table are read; the image CRC is checked
+ * once, at the end of the update. To stay in the bootloader it copies the
+ * bootloader code to RAM and runs it there, so the CPU keeps receiving
+ * while the flash is busy.
+ */
+void Boot_Reset(void);
+
+/**
+ * @brief Reset into the bootloader (application side).
+ */
+void Boot_Request(void);
+
+/**
+ * @brief Check a received frame for the enter request (application side).
+ *
+ * Dispatch table handler for BOOT_CAN_RX_ID (CAN RX interrupt); resets on
+ * the ISO-TP single frame [0x01][BOOT_OP_ENTER].
+ *
+ * @param frame  Register image from the RX FIFO
+ * @return 0: other frames on the ID are left to the table's policy.
+ */
+uint8_t Boot_Frame(const CanFrame *frame);
+
+/**
+ * @brief Handle UART_CMD_BOOT: reply [BOOT_APP_BASE 4B][BOOT_APP_MAX 4B],
+ *        then reset into the bootloader.
+ *
+ * The host then talks to the bootloader at BOOT_UART_BAUD.
+ *
+ * @param args  Command payload (unused)
+ * @param len   Payload length in bytes
+ */
+void Boot_Command(const uint8_t *args, uint8_t len);
+
+#endif /* BOOT_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -16,7 +16,80 @@
 /*****************************************************************************
  * Macro definitions
  *****************************************************************************/
-// (Nếu có các macro định nghĩa liên quan CAN, bạn đặt ở đây)
+
+/**
+ * @brief bxCAN test modes (BTR bit 30 = LBKM, bit 31 = SILM).
+ */
+#define CAN_MODE_NORMAL     0x00    /**< Normal bus operation                        */
+#define CAN_MODE_LOOPBACK   0x01    /**< TX fed back to RX, frames still on the bus   */
+#define CAN_MODE_SILENT     0x02    /**< Receive only, TX pin held recessive          */
+#define CAN_MODE_SELFTEST   0x03    /**< Loopback + silent: internal loop, bus untouched */
+
+/**
+ * @brief Supported bit rates (index into the bit timing table).
+ */
+#define CAN_BITRATE_125K    0
+#define CAN_BITRATE_250K    1
+#define CAN_BITRATE_500K    2
+#define CAN_BITRATE_1M      3
+#define CAN_BITRATE_COUNT   4
+#define CAN_BITRATE_DEFAULT CAN_BITRATE_500K
+
+/**
+ * @brief CAN_Send() results.
+ */
+#define CAN_TX_OK           0x00    /**< Transmitted (TXOK0)                         */
+#define CAN_TX_BUS_OFF      0x01    /**< Controller is bus-off, nothing sent         */
+#define CAN_TX_BUSY         0x02    /**< Mailbox 0 did not become free               */
+#define CAN_TX_FAILED       0x03    /**< Error, arbitration lost or no completion    */
+
+/**
+ * @brief TX wait bounds.
+ */
+#define CAN_FRAME_BITS_MAX  160     /**< Longest frame incl. stuffing and IFS, bits  */
+#define CAN_TX_WAIT_FRAMES  4       /**< Frame times CAN_SendFrame() waits per step  */
+
+/**
+ * @brief TX mailbox ownership.
+ *
+ * - 0: the main loop, through CAN_SendFrame() (polls its completion).
+ * - 1: the burst benchmark, with mailbox 0.
+ * - 2: interrupt handlers, through CAN_QueueFrame() (never waits).
+ *
+ * The TIM3, CAN RX0 and CAN TX interrupts share one priority, so none of
+ * them preempts another while it uses mailbox 2 or its queue.
+ */
+#define CAN_TXQ_LEN         4       /**< Frames waiting for mailbox 2               */
+
+/**
+ * @brief Field access on a CanFrame register image.
+ *
+ * RIR/TIR and RDTR/TDTR share the ID and DLC layout, and on the little-endian
+ * core rdlr/rdhr hold the data bytes in frame order, so CAN_FRAME_DATA() is a
+ * byte view of the image rather than a decoded copy.
+ */
+#define CAN_FRAME_IDE(f)    (((f)->rir >> 2) & 1)                   /**< 1 = extended ID      */
+#define CAN_FRAME_ID(f)     (CAN_FRAME_IDE(f) ? (f)->rir >> 3 : (f)->rir >> 21)
+#define CAN_FRAME_DLC(f)    ((uint8_t)((f)->rdtr & 0x0F))           /**< DLC field (0..15)    */
+#define CAN_FRAME_LEN(f)    (CAN_FRAME_DLC(f) > 8 ? 8 : CAN_FRAME_DLC(f))  /**< Data bytes   */
+#define CAN_FRAME_DATA(f)   ((const uint8_t *)&(f)->rdlr)           /**< Byte i = data[i]     */
+
+/*****************************************************************************
+ * Type definitions
+ *****************************************************************************/
+
+/**
+ * @brief Frame as the bxCAN mailbox registers hold it.
+ *
+ * Written to a TX mailbox with four stores and filled from the RX FIFO with
+ * four loads; fields are decoded only where they are needed.
+ */
+typedef struct {
+    uint32_t rir;       /**< ID, IDE, RTR (TIR layout without TXRQ)     */
+    uint32_t rdtr;      /**< DLC in bits 0-3                            */
+    uint32_t rdlr;      /**< Data bytes 0-3                             */
+    uint32_t rdhr;      /**< Data bytes 4-7                             */
+} CanFrame;
 
 /*****************************************************************************
  * Global variables
@@ -34,6 +107,103 @@
  */
 void CAN_Config(void);
 
+/**
+ * @brief Select the bit rate and test mode used by CAN_Config().
+ *
+ * Call before CAN_Config() (saved configuration, see cfgstore.h).
+ *
+ * @param[in] bitrate  Bit rate in bit/s; must be one of the table entries.
+ * @param[in] mode     One of CAN_MODE_NORMAL/LOOPBACK/SILENT/SELFTEST.
+ * @return 0 on success, 1 if the bit rate is not in the table.
+ */
+uint8_t CAN_Preset(uint32_t bitrate, uint8_t mode);
+
+/**
+ * @brief Change the bit rate at runtime (test mode bits are kept).
+ * @param[in] bitrate  Bit rate in bit/s; must be one of the table entries.
+ * @return 0 on success, 1 if the bit rate is not in the table.
+ */
+uint8_t CAN_SetBitrate(uint32_t bitrate);
+
+/**
+ * @brief Current bit rate in bit/s.
+ */
+uint32_t CAN_GetBitrate(void);
+
+/**
+ * @brief Longest frame on the bus at the current bit rate, in us.
+ *
+ * CAN_FRAME_BITS_MAX bits: extended ID, 8 data bytes, worst-case stuffing
+ * and the interframe space. TX waits are bounded in multiples of it.
+ */
+uint32_t CAN_FrameTimeUs(void);
+
+/**
+ * @brief Current BTR timing bits (prescaler, BS1, BS2, SJW).
+ */
+uint32_t CAN_GetBitTiming(void);
+
+/**
+ * @brief Switch the controller between normal, loopback and silent modes.
+ *        Passes through initialization mode; filters and bit timing are kept.
+ * @param[in] mode  One of CAN_MODE_NORMAL/LOOPBACK/SILENT/SELFTEST.
+ */
+void CAN_SetTestMode(uint8_t mode);
+
+/**
+ * @brief Read the current test mode from the bit timing register.
+ * @return One of CAN_MODE_NORMAL/LOOPBACK/SILENT/SELFTEST.
+ */
+uint8_t CAN_GetTestMode(void);
+
+/**
+ * @brief Build a register image from ID and data bytes.
+ *
+ * @param[out] f          Frame to fill.
+ * @param[in] isExtended  Set to 0 for standard 11-bit ID, 1 for extended 29-bit ID.
+ * @param[in] id          CAN identifier.
+ * @param[in] data        Data bytes (max 8 are copied).
+ * @param[in] len         Number of data bytes (0 to 8).
+ */
+void CAN_FramePack(CanFrame *f, uint8_t isExtended, uint32_t id, const uint8_t *data, uint8_t len);
+
+/**
+ * @brief Send a register image through mailbox 0.
+ *
+ * @param[in] f  Frame to send; only ID, IDE, RTR, DLC and data are used.
+ * @return CAN_TX_OK, CAN_TX_BUS_OFF, CAN_TX_BUSY or CAN_TX_FAILED.
+ */
+uint8_t CAN_SendFrame(const CanFrame *f);
+
+/**
+ * @brief Send a register image through mailbox 0 and timestamp the end of
+ *        its transmission.
+ *
+ * The completion wait reads the time base on every poll. The stamp is the
+ * reading just before the poll that saw the request complete; the window
+ * is the time since the previous reading, i.e. the uncertainty of the
+ * stamp (wide when an interrupt ran in between).
+ *
+ * @param[in]  f          Frame to send.
+ * @param[out] done_us    Set to Time_Now32() at completion.
+ * @param[out] window_us  Set to the stamp uncertainty in us.
+ * @return As CAN_SendFrame().
+ */
+uint8_t CAN_SendFrameTimed(const CanFrame *f, uint32_t *done_us, uint32_t *window_us);
+
+/**
+ * @brief Queue a register image for mailbox 2 from an interrupt handler.
+ *
+ * Loaded at once when the mailbox is idle and nothing is queued ahead,
+ * otherwise kept until the TX interrupt sees mailbox 2 complete. Never
+ * waits, so the caller does not hold its interrupt for a frame time.
+ *
+ * @param[in] f  Frame to send; only ID, IDE, RTR, DLC and data are used.
+ * @return CAN_TX_OK (loaded or queued), CAN_TX_BUS_OFF or CAN_TX_BUSY
+ *         (queue full).
+ */
+uint8_t CAN_QueueFrame(const CanFrame *f);
+
 /**
  * @brief Send a CAN message.
  *
@@ -41,20 +211,18 @@ void CAN_Config(void);
  * @param[in] id          CAN identifier.
  * @param[in] data        Pointer to data bytes array (max 8 bytes).
  * @param[in] len         Number of data bytes (0 to 8).
+ * @return CAN_TX_OK, CAN_TX_BUS_OFF, CAN_TX_BUSY or CAN_TX_FAILED.
  */
-void CAN_Send(uint8_t isExtended, uint32_t id, uint8_t *data, uint8_t len);
+uint8_t CAN_Send(uint8_t isExtended, uint32_t id, uint8_t *data, uint8_t len);
 
 /**
  * @brief Process a received CAN frame.
  *
  * Application-specific handler called when a CAN message is received.
  *
- * @param[in] id          CAN identifier.
- * @param[in] isExtended  Set to 0 for standard frame, 1 for extended frame.
- * @param[in] data        Pointer to data bytes received.
- * @param[in] len         Number of data bytes received.
+ * @param[in] frame  Register image read from FIFO 0.
  */
-void Process_CAN_Frame(uint32_t id, uint8_t isExtended, uint8_t *data, uint8_t len);
+void Process_CAN_Frame(const CanFrame *frame);
 
 /*****************************************************************************
  * Interrupt handlers
@@ -67,10 +235,18 @@ void Process_CAN_Frame(uint32_t id, uint8_t isExtended, uint8_t *data, uint8_t l
  */
 void USB_LP_CAN1_RX0_IRQHandler(void);
 
+/**
+ * @brief CAN status change/error interrupt handler.
+ *
+ * Reports bus errors to the capture trigger.
+ */
+void CAN1_SCE_IRQHandler(void);
+
 /**
  * @brief CAN TX interrupt handler.
  *
- * Handles CAN transmit complete events.
+ * Clears every mailbox completion, latches mailbox 0's status for
+ * CAN_SendFrame() and loads mailbox 2 with the next CAN_QueueFrame() frame.
  */
 void USB_HP_CAN1_TX_IRQHandler(void);
 
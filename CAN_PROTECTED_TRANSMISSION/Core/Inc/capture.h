@@ -0,0 +1,129 @@
+/*****************************************************************************
+ * @file    capture.h
+ * @brief   Triggered capture of received frames into RAM: a pre-trigger
+ *          ring, a configurable trigger and a post-trigger count, dumped to
+ *          the host afterwards at UART speed.
+ *****************************************************************************/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "main.h"
+#include "can.h"
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Frames held in RAM (power of two). Each frame takes 24 bytes, so
+ *        the buffer uses 6 KB of the 20 KB.
+ */
+#define CAPTURE_DEPTH           256
+
+/**
+ * @brief Capture states.
+ *        ARMED records into the ring until the trigger fires; TRIGGERED
+ *        records the post-trigger frames; DONE freezes the buffer for the
+ *        dump. IDLE also freezes it (nothing armed, or stopped early).
+ */
+#define CAPTURE_IDLE            0
+#define CAPTURE_ARMED           1
+#define CAPTURE_TRIGGERED       2
+#define CAPTURE_DONE            3
+
+/**
+ * @brief Trigger conditions.
+ *        CAPTURE_TRIG_ID: a frame with the given ID and IDE.
+ *        CAPTURE_TRIG_ERROR: bxCAN reports a bus error (LEC, from the status
+ *        change/error interrupt).
+ *        CAPTURE_TRIG_LOAD: bus load in a CAPTURE_LOAD_WINDOW_US window
+ *        reaches the threshold (per mille).
+ *        CAPTURE_TRIG_ATTACK: replay detection sets attack_flag.
+ *        CAPTURE_TRIG_MANUAL and CAPTURE_TRIG_NONE are only reported as the
+ *        cause: fired by CAPTURE_OP_FIRE, or not fired yet.
+ */
+#define CAPTURE_TRIG_ID         0
+#define CAPTURE_TRIG_ERROR      1
+#define CAPTURE_TRIG_LOAD       2
+#define CAPTURE_TRIG_ATTACK     3
+#define CAPTURE_TRIG_COUNT      4
+#define CAPTURE_TRIG_NONE       0xFE
+#define CAPTURE_TRIG_MANUAL     0xFF
+
+/**
+ * @brief Bus load window. Frame lengths are counted without stuff bits, so
+ *        the measured load is a lower bound.
+ */
+#define CAPTURE_LOAD_WINDOW_US  10000
+
+/**
+ * @brief UART_CMD_CAPTURE operations (first payload byte).
+ */
+#define CAPTURE_OP_STATUS       0       /**< Query state                      */
+#define CAPTURE_OP_ARM          1       /**< Clear the buffer and arm          */
+#define CAPTURE_OP_STOP         2       /**< Stop recording, keep the buffer   */
+#define CAPTURE_OP_FIRE         3       /**< Trigger now                       */
+#define CAPTURE_OP_DUMP         4       /**< Read recorded frames              */
+
+/**
+ * @brief Dump record: [stamp 4B][RIR 4B][RDTR 4B][data 8B][attack]
+ *        RIR/RDTR are the raw mailbox words; data is in frame order and the
+ *        bytes past the DLC are zero. The counter byte is not removed.
+ */
+#define CAPTURE_REC_LEN         21
+#define CAPTURE_DUMP_MAX        ((255 - 4) / CAPTURE_REC_LEN)
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Record a received frame and evaluate the frame triggers.
+ *        Called from the CAN RX interrupt after replay detection.
+ * @param frame  Register image from the RX FIFO.
+ * @param attack Replay detection result.
+ */
+void Capture_Frame(const CanFrame *frame, uint8_t attack);
+
+/**
+ * @brief Evaluate the error trigger. Called from the CAN status change/error
+ *        interrupt.
+ * @param lec Last error code from ESR (1..6).
+ */
+void Capture_Error(uint8_t lec);
+
+/**
+ * @brief Handle UART_CMD_CAPTURE.
+ *
+ * Command payload: empty or [CAPTURE_OP_STATUS]: query
+ *                  [CAPTURE_OP_ARM][trigger][post frames 2B][param 4B][IDE]
+ *                      param = CAN ID (TRIG_ID) or load per mille (TRIG_LOAD)
+ *                  [CAPTURE_OP_STOP], [CAPTURE_OP_FIRE]
+ *                  [CAPTURE_OP_DUMP][first 2B]
+ * Reply payload:   status: [CAPTURE_OP_STATUS][state][trigger][cause][LEC]
+ *                          [depth 2B][frames 2B][trigger index 2B]
+ *                          [post left 2B][trigger stamp 4B][frames seen 4B]
+ *                          [peak load per mille 2B]
+ *                  dump:   [CAPTURE_OP_DUMP][first 2B][count]
+ *                          [count x CAPTURE_REC_LEN records, oldest first]
+ *
+ * The trigger index is the position of the trigger frame; for the error and
+ * manual triggers it is the latest frame recorded before the trigger. It is
+ * 0xFFFF until the trigger fires with a frame in the buffer.
+ *
+ * The dump is refused (status reply) while a capture is running.
+ *
+ * @param args Command payload.
+ * @param len  Payload length in bytes.
+ */
+void Capture_Command(const uint8_t *args, uint8_t len);
+
+#endif /* CAPTURE_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
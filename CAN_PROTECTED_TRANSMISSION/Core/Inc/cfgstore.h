@@ -0,0 +1,112 @@
+/*****************************************************************************
+ * @file    cfgstore.h
+ * @brief   Node configuration (bit rate, test mode, cyclic messages, host
+ *          protection mode) kept in the last two flash pages as
+ *          wear-levelled, CRC-checked records and restored at boot before
+ *          CAN starts.
+ *****************************************************************************/
+
+#ifndef CFGSTORE_H
+#define CFGSTORE_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "main.h"
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Flash area: the last two 1 KB pages of the 64 KB part, left out of
+ *        the FLASH region in STM32F103C8TX_FLASH.ld.
+ */
+#define CFGSTORE_BASE           0x0800F800UL
+#define CFGSTORE_PAGES          2
+
+/**
+ * @brief Each page holds eight fixed-size record slots. Saves append to the
+ *        next erased slot; the other page is erased only when the current
+ *        one is full, so each page is erased once every eight saves.
+ */
+#define CFGSTORE_SLOT_SIZE      128
+#define CFGSTORE_SLOTS_PER_PAGE (FLASH_PAGE_SIZE / CFGSTORE_SLOT_SIZE)
+#define CFGSTORE_SLOTS          (CFGSTORE_PAGES * CFGSTORE_SLOTS_PER_PAGE)
+
+/**
+ * @brief Record header. The first word (magic, version, size) is programmed
+ *        last, so a record interrupted by a reset is never taken as valid.
+ *        A record with another version is ignored (defaults are used).
+ */
+#define CFGSTORE_MAGIC          0xC0F6
+#define CFGSTORE_VERSION        1
+
+#define CFGSTORE_NO_SLOT        0xFF
+
+/**
+ * @brief Result of the last save or erase.
+ */
+#define CFGSTORE_RES_OK         0
+#define CFGSTORE_RES_FLASH      1       /**< Erase or program error           */
+#define CFGSTORE_RES_VERIFY     2       /**< Read-back differs                */
+
+/**
+ * @brief UART_CMD_CFGSTORE operations (first payload byte).
+ */
+#define CFGSTORE_OP_STATUS      0       /**< Query the stored configuration   */
+#define CFGSTORE_OP_SAVE        1       /**< Save the running configuration   */
+#define CFGSTORE_OP_ERASE       2       /**< Erase both pages (defaults next boot) */
+#define CFGSTORE_OP_PROTECT     3       /**< Set the protection mode to save  */
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Find the newest valid record and preset the CAN bit rate and test
+ *        mode from it.
+ *
+ * Call before CAN_Config(), after Time_Init() and Crc_Init(). Only the slot
+ * headers are read, and the CRC is checked for newer candidates only.
+ */
+void CfgStore_Restore(void);
+
+/**
+ * @brief Start the saved cyclic messages.
+ *
+ * Call after CAN_Config() and Timer_Config(). The time from the start of
+ * CfgStore_Restore() to here is reported as the restore time.
+ */
+void CfgStore_StartCyclic(void);
+
+/**
+ * @brief Handle UART_CMD_CFGSTORE.
+ *
+ * Command payload: empty or [CFGSTORE_OP_STATUS]: query
+ *                  [CFGSTORE_OP_SAVE]
+ *                  [CFGSTORE_OP_ERASE]
+ *                  [CFGSTORE_OP_PROTECT][on]
+ * Reply payload:   [op][result][restored][seq 4B][slot][restore us 4B]
+ *                  [bitrate 4B][CAN mode][cyclic slots mask][protect]
+ *
+ * restored is 1 when the node booted from a record. seq counts saves; seq,
+ * slot and the settings describe the newest record (0 / CFGSTORE_NO_SLOT
+ * when there is none). protect is the running value: the host's
+ * protection mode (blocking frames flagged as attacks), kept here so it
+ * survives without protect_state.json; the next save stores it.
+ *
+ * A save programs about 50 half-words, and every eighth save erases a
+ * page first (about 20 ms, CPU stalled). Frames may be lost meanwhile, so
+ * save when the bus is quiet.
+ *
+ * @param args  Command payload
+ * @param len   Payload length in bytes
+ */
+void CfgStore_Command(const uint8_t *args, uint8_t len);
+
+#endif /* CFGSTORE_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
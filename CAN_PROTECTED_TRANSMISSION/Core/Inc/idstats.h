@@ -0,0 +1,90 @@
+/*****************************************************************************
+ * @file    idstats.h
+ * @brief   Per-ID traffic statistics kept by the CAN RX interrupt, so the
+ *          host gets exact counts even when the raw frame stream is
+ *          filtered or loses frames.
+ *****************************************************************************/
+
+#ifndef IDSTATS_H
+#define IDSTATS_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "main.h"
+#include "can.h"
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Table size (power of two). Each entry takes 48 bytes, so the table
+ *        uses 3 KB. IDs that find no free entry within IDSTATS_PROBES slots
+ *        of their hash are only counted as overflow.
+ */
+#define IDSTATS_SLOT_BITS       6
+#define IDSTATS_SLOTS           (1 << IDSTATS_SLOT_BITS)
+#define IDSTATS_PROBES          8
+
+/**
+ * @brief UART_CMD_IDSTATS operations (first payload byte).
+ */
+#define IDSTATS_OP_STATUS       0       /**< Query table state                */
+#define IDSTATS_OP_CLEAR        1       /**< Empty the table                   */
+#define IDSTATS_OP_DUMP         2       /**< Read used entries of a slot range */
+#define IDSTATS_OP_CHANGES      3       /**< Same, only entries updated since
+                                             they were last read              */
+
+/**
+ * @brief Entry record:
+ *        [IDE][ID 4B][frames 4B][bytes 4B][gap min 4B][gap max 4B]
+ *        [gap mean 4B][age 4B][last DLC][payload hash 4B][remote 4B]
+ *        [payload changes 4B][attacks 4B]
+ *        Gaps are inter-arrival times in us (0 until the second frame); the
+ *        mean is the sum of the gaps over their count, so it stays valid for
+ *        gaps under 71.6 minutes each. Age is the time since the latest frame.
+ *        Bytes and the payload hash include the counter byte; the hash is
+ *        Crc_Payload() (see crc.h).
+ */
+#define IDSTATS_REC_LEN         46
+#define IDSTATS_DUMP_MAX        ((255 - 4) / IDSTATS_REC_LEN)
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Account a received frame. Called from the CAN RX interrupt after
+ *        replay detection; constant time.
+ * @param frame  Register image from the RX FIFO.
+ * @param attack Replay detection result.
+ */
+void IdStats_Frame(const CanFrame *frame, uint8_t attack);
+
+/**
+ * @brief Handle UART_CMD_IDSTATS.
+ *
+ * Command payload: empty or [IDSTATS_OP_STATUS]: query
+ *                  [IDSTATS_OP_CLEAR]
+ *                  [IDSTATS_OP_DUMP][first slot][slots]
+ *                  [IDSTATS_OP_CHANGES][first slot][slots]
+ * Reply payload:   status: [IDSTATS_OP_STATUS][slots][used][overflow 4B]
+ *                          [frames 4B][since 4B]
+ *                  dump:   [op][first slot][slots scanned][count]
+ *                          [count x IDSTATS_REC_LEN records]
+ *
+ * At most IDSTATS_DUMP_MAX slots are scanned per request, so every used
+ * entry in the range fits in the reply. Polling IDSTATS_OP_CHANGES over
+ * the whole table streams the table incrementally.
+ *
+ * @param args Command payload.
+ * @param len  Payload length in bytes.
+ */
+void IdStats_Command(const uint8_t *args, uint8_t len);
+
+#endif /* IDSTATS_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -0,0 +1,91 @@
+/*****************************************************************************
+ * @file    sched.h
+ * @brief   Run-to-completion scheduler for the main loop: interrupts post
+ *          event bits, the main loop runs the highest-priority task with a
+ *          pending event, and each task's run time is accounted.
+ *****************************************************************************/
+
+#ifndef SCHED_H
+#define SCHED_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "main.h"
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Event bits. Interrupt handlers post them with Sched_Post() and
+ *        return; the bit is cleared just before the task runs, so an event
+ *        posted while the task is running runs it again.
+ */
+#define SCHED_EVT_UART_RX       (1UL << 0)  /**< Host frame queued (USART1 RX)        */
+#define SCHED_EVT_TIMEOUT       (1UL << 1)  /**< Batch age / baud confirmation due    */
+#define SCHED_EVT_CAN_RX        (1UL << 2)  /**< CAN frame in the forwarding queue    */
+
+#define SCHED_TASK_MAX          8           /**< Tasks in the table                   */
+
+/*****************************************************************************
+ * Type definitions
+ *****************************************************************************/
+
+/**
+ * @brief One task. The table passed to Sched_Init() is in priority order,
+ *        highest first. A task that runs longer than its budget is not
+ *        interrupted (run to completion) but the overrun is counted.
+ */
+typedef struct {
+    uint32_t events;        /**< Event bits that make the task runnable  */
+    void   (*run)(void);    /**< Task body                               */
+    uint32_t budget_us;     /**< Expected worst-case run time            */
+} SchedTask;
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Register the task table (priority order, at most SCHED_TASK_MAX).
+ * @param tasks Task table; must stay valid.
+ * @param count Number of tasks.
+ */
+void Sched_Init(const SchedTask *tasks, uint8_t count);
+
+/**
+ * @brief Mark events pending. Safe from any interrupt or the main loop.
+ * @param events SCHED_EVT_* bits.
+ */
+void Sched_Post(uint32_t events);
+
+/**
+ * @brief Event bits currently pending (0 = nothing to run).
+ */
+uint32_t Sched_Pending(void);
+
+/**
+ * @brief Dispatch loop; never returns. Calls Power_Idle() when no event is
+ *        pending.
+ */
+void Sched_Run(void);
+
+/**
+ * @brief Handle UART_CMD_SCHED.
+ *
+ * Command payload: [1] clears the statistics (empty = query only)
+ * Reply payload:   [tasks][core clock Hz 4B][window us 4B][idle cycles 8B]
+ *                  then per task, in priority order:
+ *                  [events][runs 4B][cycles 8B][max cycles 4B][overruns 4B]
+ *
+ * @param args Command payload.
+ * @param len  Payload length in bytes.
+ */
+void Sched_Command(const uint8_t *args, uint8_t len);
+
+#endif /* SCHED_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -1,6 +1,7 @@
 /*****************************************************************************
  * @file    timer.h
- * @brief   Timer configuration and interrupt handling for STM32F1 series.
+ * @brief   Cyclic CAN transmission on absolute deadlines of the 1 us time
+ *          base (TIM3 channel 1 compare), with jitter statistics.
  *****************************************************************************/
 
 #ifndef TIMER_H
@@ -14,38 +15,90 @@
 /*****************************************************************************
  * Macro definitions
  *****************************************************************************/
-// (Nếu có macro định nghĩa liên quan timer, đặt ở đây)
 
-/*****************************************************************************
- * Global variables
- *****************************************************************************/
-// (Nếu có biến toàn cục dùng cho timer, khai báo extern ở đây)
+/**
+ * @brief Number of cyclic messages sent at the same time. Slot 0 is also
+ *        used by the legacy UART frame with a non-zero interval.
+ */
+#define TIMER_CYCLIC_SLOTS      4
+
+/**
+ * @brief UART_CMD_CYCLIC payload layout:
+ *        [slot][period us 4B][mode][id 4B][len][data...]
+ *        A period of 0 stops the slot; a payload of [slot] only queries it.
+ */
+#define TIMER_CYCLIC_HDR_LEN    11
 
 /*****************************************************************************
  * Function prototypes
  *****************************************************************************/
 
 /**
- * @brief Configure Timer 2 peripheral with basic settings.
+ * @brief Enable the TIM3 interrupt used for cyclic deadlines. Call after
+ *        Time_Init().
+ */
+void Timer_Config(void);
+
+/**
+ * @brief Start (or replace) a cyclic message.
+ *
+ * Deadlines are absolute: each one is the previous deadline plus the
+ * period, never the time the previous frame actually went out, so latency
+ * does not accumulate. The first frame is sent one period from now. The
+ * counter byte is appended to every frame as for single frames.
+ *
+ * Called from the main loop. The frame is double-buffered and published by
+ * a pointer swap, so the TIM3 interrupt is never masked and never sends a
+ * half-updated frame.
+ *
+ * @param slot      Cyclic slot (0 .. TIMER_CYCLIC_SLOTS-1).
+ * @param mode      0 = standard ID, 1 = extended ID.
+ * @param id        CAN identifier.
+ * @param data      Payload without the counter byte.
+ * @param len       Payload length (0..7).
+ * @param period_us Period in microseconds (> 0).
+ */
+void Timer_StartCyclic(uint8_t slot, uint8_t mode, uint32_t id, const uint8_t *data,
+                       uint8_t len, uint32_t period_us);
+
+/**
+ * @brief Stop a cyclic message. Its statistics are kept until restarted.
+ * @param slot Cyclic slot.
  */
-void Timer2_Config(void);
+void Timer_StopCyclic(uint8_t slot);
 
 /**
- * @brief Start Timer 2 with a specified interval in milliseconds.
- * @param interval_ms Timer interval period in milliseconds.
+ * @brief Read back the message of a slot (for the saved configuration).
+ * @param slot      Cyclic slot.
+ * @param mode      0 = standard ID, 1 = extended ID.
+ * @param id        CAN identifier.
+ * @param data      Payload without the counter byte (buffer of 8).
+ * @param len       Payload length (0..7).
+ * @param period_us Period in microseconds.
+ * @return 1 if the slot is running, 0 if stopped.
  */
-void Timer2_Start(uint16_t interval_ms);
+uint8_t Timer_GetCyclic(uint8_t slot, uint8_t *mode, uint32_t *id, uint8_t *data,
+                        uint8_t *len, uint32_t *period_us);
 
 /**
- * @brief Stop Timer 2.
+ * @brief Handle UART_CMD_CYCLIC: start, stop or query a slot.
+ *
+ * Reply payload: [slot][active][period us 4B][sent 4B][missed 4B][failed 4B]
+ *                [jitter min us 4B][jitter max us 4B][jitter mean us 4B]
+ *
+ * Jitter is the time from the deadline to the start of the transmit request.
+ * Missed counts deadlines skipped because a whole period had already passed.
+ *
+ * @param args Command payload (see TIMER_CYCLIC_HDR_LEN).
+ * @param len  Payload length in bytes.
  */
-void Timer2_Stop(void);
+void Timer_CyclicCommand(const uint8_t *args, uint8_t len);
 
 /**
- * @brief Timer 2 interrupt handler.
- *        Handles Timer 2 update interrupts.
+ * @brief TIM3 interrupt handler: sends every cyclic message that is due and
+ *        arms channel 1 for the next deadline.
  */
-void TIM2_IRQHandler(void);
+void TIM3_IRQHandler(void);
 
 #endif /* TIMER_H */
 
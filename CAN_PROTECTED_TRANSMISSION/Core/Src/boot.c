@@ -0,0 +1,703 @@
+/*****************************************************************************
+ * @file    boot.c
+ * @brief   Bootloader: reset entry in flash, receiver and page programming
+ *          engine copied to RAM, plus the application's enter requests
+ *****************************************************************************/
+
+/******************************************************************************
+ * Include files
+ ******************************************************************************/
+#include "boot.h"
+#include "uart.h"
+
+/******************************************************************************
+ * Local macros and types
+ ******************************************************************************/
+
+/**
+ * @brief Placement. BOOT_FLASH code runs from the bootloader pages before
+ *        the C runtime; BOOT_RAM code is copied to RAM by Boot_Reset().
+ *
+ * Both may only call each other (Boot_Main() with a long call) and must
+ * not use library calls, globals, constant tables or the non-inlined CMSIS
+ * helpers: those live in the application, which an update erases. Hence
+ * the explicit loops and register writes below; no-tree-loop-distribute-
+ * patterns keeps GCC from turning those loops back into memcpy()/memset(),
+ * and the linker script rejects any reference to the application sections.
+ */
+#define BOOT_FLASH              __attribute__((section(".boot"), \
+                                               optimize("no-tree-loop-distribute-patterns")))
+#define BOOT_RAM                __attribute__((section(".boot_ram"), \
+                                               optimize("no-tree-loop-distribute-patterns")))
+
+#define BOOT_LINK_ANY           0       // No update started: both links
+#define BOOT_LINK_CAN           1
+#define BOOT_LINK_UART          2
+
+#define BOOT_FL_IDLE            0
+#define BOOT_FL_BLANK           1       // Check the page, erase if needed
+#define BOOT_FL_ERASE           2       // Page erase running
+#define BOOT_FL_WRITE           3       // Half-word programming
+
+/**
+ * @brief Bootloader state, on the bootloader's stack (no globals).
+ */
+typedef struct {
+    uint8_t  buf[2][BOOT_MSG_MAX + 1];  // Messages; +1: odd block padding
+    uint8_t  rx;            // Buffer the next message goes to
+    uint8_t  link;          // BOOT_LINK_xxx of the accepted START
+    uint8_t  why;           // BOOT_WHY_xxx
+    uint8_t  waiting;       // Block in buf[rx] waits for the flash
+    uint8_t  end_pending;   // BOOT_OP_END once the flash is idle
+    uint8_t  started;       // BOOT_OP_START accepted
+    uint8_t  result;        // First error of the update
+    uint8_t  can_sn;        // Next consecutive frame number
+    uint16_t can_len;       // ISO-TP message length, 0 = none
+    uint16_t can_pos;       // Bytes received of it
+    uint16_t uart_len;      // Message length from the header
+    uint16_t uart_pos;      // Header and message bytes received
+    uint32_t uart_last;     // Cycle count at the last byte
+    uint32_t size;          // Image size from BOOT_OP_START
+    uint32_t crc;           // Image CRC from BOOT_OP_START
+    uint32_t accepted;      // Image bytes accepted
+    uint16_t block;         // Next block expected
+    uint16_t block_len;     // Data bytes of the waiting block
+    uint32_t start;         // Cycle count at BOOT_OP_START
+    uint8_t  fl_state;      // BOOT_FL_xxx
+    uint8_t  fl_buf;        // Buffer being programmed
+    uint16_t fl_index;      // Next half-word
+    uint16_t fl_count;      // Half-words in the block
+    uint32_t fl_addr;       // Page address
+} BootCtx;
+
+extern uint32_t _siboot_ram;            // RAM code image in flash (linker)
+extern uint32_t _sboot_ram;             // RAM code start; boot stack top
+extern uint32_t _eboot_ram;             // RAM code end
+
+void Boot_Main(uint8_t why) __attribute__((long_call, noreturn)) BOOT_RAM;
+static void Boot_Fault(void) BOOT_FLASH;
+
+/******************************************************************************
+ * Local variables
+ ******************************************************************************/
+
+/**
+ * @brief Vector table of the part at 0x08000000: stack, reset, NMI and
+ *        HardFault. The application's own table follows at BOOT_APP_BASE.
+ */
+__attribute__((section(".boot_vector"), used))
+void (* const boot_vector[4])(void) = {
+    (void (*)(void))&_sboot_ram,
+    Boot_Reset,
+    Boot_Fault,
+    Boot_Fault,
+};
+
+/**
+ * @brief Image information page as programmed with the application ELF:
+ *        erased, i.e. an image written by the debugger.
+ */
+__attribute__((section(".boot_info"), used))
+const uint32_t boot_info_erased[4] = {
+    0xFFFFFFFFUL, 0xFFFFFFFFUL, 0xFFFFFFFFUL, 0xFFFFFFFFUL,
+};
+
+/******************************************************************************
+ * Function: Boot_Fault
+ * Description:
+ *   NMI / HardFault while the bootloader runs.
+ ******************************************************************************/
+static void Boot_Fault(void) {
+    for (;;);
+}
+
+/******************************************************************************
+ * Function: Boot_Reset
+ * Description:
+ *   Start the application, or copy the bootloader to RAM and run it.
+ ******************************************************************************/
+BOOT_FLASH void Boot_Reset(void) {
+    volatile uint32_t *request = (volatile uint32_t *)BOOT_REQUEST_ADDR;
+    const uint32_t *info = (const uint32_t *)BOOT_INFO_ADDR;
+    const uint32_t *app = (const uint32_t *)BOOT_APP_BASE;
+    uint32_t *src = &_siboot_ram;
+    uint32_t *dst = &_sboot_ram;
+    uint8_t why;
+
+    if (*request == BOOT_REQUEST_MAGIC) {
+        *request = 0;
+        why = BOOT_WHY_REQUEST;
+    } else if (info[0] != BOOT_INFO_MAGIC && info[0] != 0xFFFFFFFFUL) {
+        why = BOOT_WHY_INCOMPLETE;
+    } else if (app[0] > SRAM_BASE && app[0] <= SRAM_BASE + 20 * 1024 && (app[0] & 3) == 0 &&
+               app[1] > BOOT_APP_BASE && app[1] < BOOT_APP_BASE + BOOT_APP_MAX && (app[1] & 1)) {
+        SCB->VTOR = BOOT_APP_BASE;
+        __set_MSP(app[0]);
+        ((void (*)(void))app[1])();             // Reset_Handler of the application
+        for (;;);
+    } else {
+        why = BOOT_WHY_NO_APP;
+    }
+
+    while (dst < &_eboot_ram) {
+        *dst++ = *src++;
+    }
+    Boot_Main(why);
+}
+
+/******************************************************************************
+ * Function: Boot_Cycles
+ * Description:
+ *   DWT cycle counter (BOOT_CLOCK_HZ).
+ ******************************************************************************/
+BOOT_RAM static uint32_t Boot_Cycles(void) {
+    return DWT->CYCCNT;
+}
+
+/******************************************************************************
+ * Function: Boot_Init
+ * Description:
+ *   Clocks, USART1 on PA9/PA10, CAN1 on PA11/PA12 with filter 0 accepting
+ *   all, the CRC unit and the cycle counter, all polled.
+ *
+ *   Leaving CAN initialization mode needs 11 recessive bits; without a bus
+ *   the wait gives up and only the UART works.
+ ******************************************************************************/
+BOOT_RAM static void Boot_Init(void) {
+    uint32_t n;
+
+    RCC->APB2ENR |= (1 << 0) | (1 << 2) | (1 << 14);    // AFIO, GPIOA, USART1
+    RCC->APB1ENR |= (1 << 25);                          // CAN1
+    RCC->AHBENR |= (1 << 6);                            // CRC
+
+    GPIOA->CRH = (GPIOA->CRH & ~0x000FFFF0UL)
+               | (0xAUL << 4)                           // PA9: AF push-pull, 2 MHz
+               | (0x4UL << 8)                           // PA10: input floating
+               | (0x4UL << 12)                          // PA11: input floating
+               | (0xAUL << 16);                         // PA12: AF push-pull, 2 MHz
+
+    USART1->BRR = BOOT_CLOCK_HZ / BOOT_UART_BAUD;       // USARTDIV 1.0
+    USART1->CR1 = (1 << 13) | (1 << 3) | (1 << 2);      // UE, TE, RE
+
+    CAN1->MCR = (1 << 6) | (1 << 0);                    // ABOM, INRQ (clears SLEEP)
+    for (n = 0; n < 100000 && !(CAN1->MSR & (1 << 0)); n++);
+    CAN1->BTR = BOOT_CAN_BTR;
+    CAN1->FMR |= (1 << 0);                              // Filter init mode
+    CAN1->FA1R &= ~(1 << 0);
+    CAN1->FS1R |= (1 << 0);                             // 32-bit
+    CAN1->FM1R &= ~(1 << 0);                            // Mask mode
+    CAN1->sFilterRegister[0].FR1 = 0;
+    CAN1->sFilterRegister[0].FR2 = 0;                   // Accept all
+    CAN1->FFA1R &= ~(1 << 0);                           // FIFO 0
+    CAN1->FA1R |= (1 << 0);
+    CAN1->FMR &= ~(1 << 0);
+    CAN1->MCR &= ~(1 << 0);                             // Leave init mode
+    for (n = 0; n < 100000 && (CAN1->MSR & (1 << 0)); n++);
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/******************************************************************************
+ * Function: Boot_CanSend
+ * Description:
+ *   Queue an 8-byte frame on BOOT_CAN_TX_ID in a free mailbox.
+ *
+ *   Dropped when all three are pending (no bus).
+ ******************************************************************************/
+BOOT_RAM static void Boot_CanSend(const uint8_t *d) {
+    uint32_t tsr = CAN1->TSR;
+    uint8_t mb;
+
+    if (tsr & (1 << 26))      mb = 0;                   // TME0
+    else if (tsr & (1 << 27)) mb = 1;                   // TME1
+    else if (tsr & (1 << 28)) mb = 2;                   // TME2
+    else return;
+
+    CAN1->sTxMailBox[mb].TDTR = 8;
+    CAN1->sTxMailBox[mb].TDLR = d[0] | (d[1] << 8) | (d[2] << 16) | ((uint32_t)d[3] << 24);
+    CAN1->sTxMailBox[mb].TDHR = d[4] | (d[5] << 8) | (d[6] << 16) | ((uint32_t)d[7] << 24);
+    CAN1->sTxMailBox[mb].TIR = ((uint32_t)BOOT_CAN_TX_ID << 21) | (1 << 0);  // TXRQ
+}
+
+/******************************************************************************
+ * Function: Boot_UartSend
+ * Description:
+ *   Send bytes, polling TXE.
+ ******************************************************************************/
+BOOT_RAM static void Boot_UartSend(const uint8_t *d, uint8_t n) {
+    for (uint8_t i = 0; i < n; i++) {
+        while (!(USART1->SR & (1 << 7)));
+        USART1->DR = d[i];
+    }
+}
+
+/******************************************************************************
+ * Function: Boot_Reply
+ * Description:
+ *   Send [op | 0x80][result][block 2B][value 4B] on the session link.
+ ******************************************************************************/
+BOOT_RAM static void Boot_Reply(BootCtx *b, uint8_t op, uint8_t result, uint16_t block, uint32_t value) {
+    uint8_t r[8];
+
+    r[0] = op | 0x80;
+    r[1] = result;
+    r[2] = block >> 8;
+    r[3] = block;
+    r[4] = value >> 24;
+    r[5] = value >> 16;
+    r[6] = value >> 8;
+    r[7] = value;
+    if (b->link != BOOT_LINK_UART) Boot_CanSend(r);
+    if (b->link != BOOT_LINK_CAN)  Boot_UartSend(r, 8);
+}
+
+/******************************************************************************
+ * Function: Boot_FlashWait
+ * Description:
+ *   Wait for the flash to finish; clear and report its status.
+ *
+ *   @retval BOOT_RES_OK or BOOT_RES_FLASH
+ ******************************************************************************/
+BOOT_RAM static uint8_t Boot_FlashWait(void) {
+    uint32_t sr;
+
+    while (FLASH->SR & (1 << 0));                       // BSY
+    sr = FLASH->SR;
+    FLASH->SR = (1 << 5) | (1 << 4) | (1 << 2);         // Clear EOP, WRPRTERR, PGERR
+    FLASH->CR &= ~((1 << 0) | (1 << 1));                // PG, PER off
+    return (sr & ((1 << 4) | (1 << 2))) ? BOOT_RES_FLASH : BOOT_RES_OK;
+}
+
+/******************************************************************************
+ * Function: Boot_InfoWrite
+ * Description:
+ *   Erase the information page and program words into it (blocking).
+ *
+ *   @param words Values of the first n words @param n Number of words (0:
+ *   erase only)
+ ******************************************************************************/
+BOOT_RAM static uint8_t Boot_InfoWrite(const uint32_t *words, uint8_t n) {
+    volatile uint16_t *p = (volatile uint16_t *)BOOT_INFO_ADDR;
+    uint8_t res;
+
+    FLASH->CR |= (1 << 1);                              // PER
+    FLASH->AR = BOOT_INFO_ADDR;
+    FLASH->CR |= (1 << 6);                              // STRT
+    res = Boot_FlashWait();
+    for (uint8_t i = 0; res == BOOT_RES_OK && i < 2 * n; i++) {
+        FLASH->CR |= (1 << 0);                          // PG
+        p[i] = (i & 1) ? words[i / 2] >> 16 : words[i / 2];
+        res = Boot_FlashWait();
+    }
+    return res;
+}
+
+/******************************************************************************
+ * Function: Boot_Program
+ * Description:
+ *   Hand the block in buf[rx] to the flash engine, acknowledge it and receive
+ *   the next one into the other buffer.
+ ******************************************************************************/
+BOOT_RAM static void Boot_Program(BootCtx *b) {
+    uint16_t n = b->block_len;
+
+    b->buf[b->rx][3 + n] = 0xFF;                        // Odd length: pad the last half-word
+    b->fl_buf = b->rx;
+    b->fl_addr = BOOT_APP_BASE + (uint32_t)b->block * BOOT_BLOCK_SIZE;
+    b->fl_count = (n + 1) / 2;
+    b->fl_index = 0;
+    b->fl_state = BOOT_FL_BLANK;
+    b->accepted += n;
+    Boot_Reply(b, BOOT_OP_DATA, b->result, b->block, b->accepted);
+    b->block++;
+    b->rx ^= 1;
+    b->waiting = 0;
+}
+
+/******************************************************************************
+ * Function: Boot_FlashStep
+ * Description:
+ *   Advance the flash engine by one operation when the flash is idle.
+ *
+ *   Blank pages are not erased and 0xFFFF half-words are not programmed, so
+ *   the tail of an image costs nothing. A waiting block starts as soon as the
+ *   current one is done.
+ ******************************************************************************/
+BOOT_RAM static void Boot_FlashStep(BootCtx *b) {
+    const uint8_t *d = &b->buf[b->fl_buf][3];
+    const uint32_t *w = (const uint32_t *)b->fl_addr;
+    uint16_t hw;
+
+    if (b->fl_state == BOOT_FL_IDLE || (FLASH->SR & (1 << 0))) return;
+    if (b->fl_state != BOOT_FL_BLANK && Boot_FlashWait() != BOOT_RES_OK) {
+        b->result = BOOT_RES_FLASH;
+        b->fl_state = BOOT_FL_IDLE;
+    }
+
+    switch (b->fl_state) {
+    case BOOT_FL_BLANK:
+        b->fl_state = BOOT_FL_WRITE;
+        for (uint16_t i = 0; i < BOOT_BLOCK_SIZE / 4; i++) {
+            if (w[i] != 0xFFFFFFFFUL) {
+                FLASH->CR |= (1 << 1);                  // PER
+                FLASH->AR = b->fl_addr;
+                FLASH->CR |= (1 << 6);                  // STRT
+                b->fl_state = BOOT_FL_ERASE;
+                break;
+            }
+        }
+        return;
+    case BOOT_FL_ERASE:
+        b->fl_state = BOOT_FL_WRITE;
+        return;
+    case BOOT_FL_WRITE:
+        do {
+            hw = d[2 * b->fl_index] | (d[2 * b->fl_index + 1] << 8);
+        } while (hw == 0xFFFF && ++b->fl_index < b->fl_count);
+        if (b->fl_index < b->fl_count) {
+            FLASH->CR |= (1 << 0);                      // PG
+            *(volatile uint16_t *)(b->fl_addr + 2 * b->fl_index) = hw;
+            b->fl_index++;
+            return;
+        }
+        b->fl_state = BOOT_FL_IDLE;
+        break;
+    default:
+        break;
+    }
+
+    if (b->waiting) {
+        Boot_Program(b);
+    }
+}
+
+/******************************************************************************
+ * Function: Boot_End
+ * Description:
+ *   Check the image CRC with the CRC unit, record the image and reply with
+ *   the update time.
+ *
+ *   The CRC follows Crc_Buffer(): words little-endian, tail zero-padded.
+ ******************************************************************************/
+BOOT_RAM static void Boot_End(BootCtx *b) {
+    const uint32_t *app = (const uint32_t *)BOOT_APP_BASE;
+    uint32_t info[4];
+    uint32_t i;
+    uint8_t res = b->result;
+
+    if (res == BOOT_RES_OK && b->accepted != b->size) res = BOOT_RES_SIZE;
+    if (res == BOOT_RES_OK) {
+        CRC->CR = 1;                                    // Reset to 0xFFFFFFFF
+        for (i = 0; i < b->size / 4; i++) {
+            CRC->DR = app[i];
+        }
+        if (b->size & 3) {
+            CRC->DR = app[i] & ((1UL << (8 * (b->size & 3))) - 1);
+        }
+        if (CRC->DR != b->crc) res = BOOT_RES_CRC;
+    }
+
+    info[0] = BOOT_INFO_MAGIC;
+    info[1] = b->size;
+    info[2] = b->crc;
+    info[3] = (Boot_Cycles() - b->start) / (BOOT_CLOCK_HZ / 1000000);
+    if (res == BOOT_RES_OK) {
+        res = Boot_InfoWrite(info, 4);
+    }
+    FLASH->CR |= (1 << 7);                              // LOCK
+    Boot_Reply(b, BOOT_OP_END, res, b->block, info[3]);
+    b->end_pending = 0;
+    b->started = 0;
+}
+
+/******************************************************************************
+ * Function: Boot_Message
+ * Description:
+ *   Executes a complete message in buf[rx], received on link (BOOT_LINK_CAN
+ *   or BOOT_LINK_UART).
+ *
+ *   A block already accepted (repeated by the host after a lost reply) is
+ *   acknowledged again without programming. Only an accepted BOOT_OP_START
+ *   ties the session to its link; until then both links are served, so a
+ *   stray frame on the CAN ID cannot lock out a UART update.
+ ******************************************************************************/
+BOOT_RAM static void Boot_Message(BootCtx *b, uint16_t len, uint8_t link) {
+    const uint8_t *m = b->buf[b->rx];
+    uint16_t block;
+    uint8_t res = BOOT_RES_OK;
+    uint32_t v;
+
+    switch (m[0]) {
+    case BOOT_OP_STATUS:
+        Boot_Reply(b, BOOT_OP_STATUS, BOOT_RES_OK, b->why, BOOT_APP_MAX);
+        break;
+
+    case BOOT_OP_START:
+        if (len != 9 || b->fl_state != BOOT_FL_IDLE || b->end_pending) {
+            res = BOOT_RES_BAD_MSG;
+        } else {
+            b->size = ((uint32_t)m[1] << 24) | ((uint32_t)m[2] << 16) | (m[3] << 8) | m[4];
+            b->crc  = ((uint32_t)m[5] << 24) | ((uint32_t)m[6] << 16) | (m[7] << 8) | m[8];
+            if (b->size == 0 || b->size > BOOT_APP_MAX) res = BOOT_RES_SIZE;
+        }
+        if (res == BOOT_RES_OK) {
+            if (FLASH->CR & (1 << 7)) {                 // LOCK
+                FLASH->KEYR = 0x45670123UL;
+                FLASH->KEYR = 0xCDEF89ABUL;
+            }
+            v = 0;
+            res = Boot_InfoWrite(&v, 1);                // Update incomplete until BOOT_OP_END
+            b->why = BOOT_WHY_INCOMPLETE;
+            b->started = (res == BOOT_RES_OK);
+            if (b->started) {
+                b->link = link;                         // Session on this link from now on
+            }
+            b->result = res;
+            b->accepted = 0;
+            b->block = 0;
+            b->start = Boot_Cycles();
+        }
+        Boot_Reply(b, BOOT_OP_START, res, 0, BOOT_APP_MAX);
+        break;
+
+    case BOOT_OP_DATA:
+        block = (m[1] << 8) | m[2];
+        b->block_len = len - 3;
+        if (!b->started || len < 4) {
+            res = BOOT_RES_BAD_MSG;
+        } else if (block < b->block) {
+            Boot_Reply(b, BOOT_OP_DATA, b->result, block, b->accepted);
+            break;
+        } else if (block != b->block) {
+            res = BOOT_RES_SEQUENCE;
+        } else if (b->accepted + b->block_len > b->size ||
+                   (b->block_len < BOOT_BLOCK_SIZE && b->accepted + b->block_len != b->size) ||
+                   b->block_len > BOOT_BLOCK_SIZE) {
+            res = BOOT_RES_SIZE;
+        } else {
+            res = b->result;
+        }
+        if (res != BOOT_RES_OK) {
+            Boot_Reply(b, BOOT_OP_DATA, res, block, b->accepted);
+        } else if (b->fl_state == BOOT_FL_IDLE) {
+            Boot_Program(b);
+        } else {
+            b->waiting = 1;                             // Acknowledged when its turn comes
+        }
+        break;
+
+    case BOOT_OP_END:
+        if (!b->started) {
+            Boot_Reply(b, BOOT_OP_END, BOOT_RES_BAD_MSG, b->block, 0);
+        } else {
+            b->end_pending = 1;
+        }
+        break;
+
+    case BOOT_OP_RUN:
+        Boot_Reply(b, BOOT_OP_RUN, BOOT_RES_OK, 0, 0);
+        while (!(USART1->SR & (1 << 6)));               // TC: reply out
+        for (v = 0; v < 100000 && (CAN1->TSR & (7UL << 26)) != (7UL << 26); v++);
+        __DSB();
+        SCB->AIRCR = (0x5FAUL << SCB_AIRCR_VECTKEY_Pos) | (SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk) |
+                     SCB_AIRCR_SYSRESETREQ_Msk;
+        for (;;);
+
+    default:
+        Boot_Reply(b, m[0], BOOT_RES_BAD_MSG, 0, 0);
+        break;
+    }
+}
+
+/******************************************************************************
+ * Function: Boot_PollCan
+ * Description:
+ *   Take one frame from FIFO 0 and run the ISO-TP receiver on BOOT_CAN_RX_ID:
+ *   single frames, and first/consecutive frames with one flow control (CTS,
+ *   no block limit, no STmin).
+ ******************************************************************************/
+BOOT_RAM static void Boot_PollCan(BootCtx *b) {
+    uint8_t d[8];
+    uint8_t fc[8];
+    uint8_t *dst = b->buf[b->rx];
+    uint32_t rir, lo, hi;
+    uint8_t dlc, n;
+
+    if (!(CAN1->RF0R & 3)) return;                      // FMP0
+    rir = CAN1->sFIFOMailBox[0].RIR;
+    dlc = CAN1->sFIFOMailBox[0].RDTR & 0x0F;
+    lo = CAN1->sFIFOMailBox[0].RDLR;
+    hi = CAN1->sFIFOMailBox[0].RDHR;
+    CAN1->RF0R = (1 << 5);                              // RFOM0: release
+    if ((rir & ((1 << 2) | (1 << 1))) || (rir >> 21) != BOOT_CAN_RX_ID || dlc == 0) return;
+    if (b->waiting || b->link == BOOT_LINK_UART) return;
+    if (dlc > 8) dlc = 8;
+    for (uint8_t i = 0; i < 8; i++) {
+        d[i] = (i < 4) ? lo >> (8 * i) : hi >> (8 * (i - 4));
+        fc[i] = 0xCC;                                   // ISO-TP padding
+    }
+
+    switch (d[0] >> 4) {
+    case 0:                                             // Single frame
+        n = d[0] & 0x0F;
+        if (n == 0 || n > dlc - 1) return;
+        for (uint8_t i = 0; i < n; i++) dst[i] = d[1 + i];
+        b->can_len = 0;
+        Boot_Message(b, n, BOOT_LINK_CAN);
+        break;
+    case 1:                                             // First frame
+        if (dlc < 8) return;
+        b->can_len = ((d[0] & 0x0F) << 8) | d[1];
+        fc[1] = 0;                                      // BS: no limit
+        fc[2] = 0;                                      // STmin
+        if (b->can_len < 8 || b->can_len > BOOT_MSG_MAX) {
+            b->can_len = 0;
+            fc[0] = 0x32;                               // Overflow
+        } else {
+            for (uint8_t i = 0; i < 6; i++) dst[i] = d[2 + i];
+            b->can_pos = 6;
+            b->can_sn = 1;
+            fc[0] = 0x30;                               // Continue to send
+        }
+        Boot_CanSend(fc);
+        break;
+    case 2:                                             // Consecutive frame
+        if (b->can_len == 0) return;
+        if ((d[0] & 0x0F) != b->can_sn) {
+            b->can_len = 0;                             // Out of order: drop the message
+            return;
+        }
+        n = (b->can_len - b->can_pos > 7) ? 7 : b->can_len - b->can_pos;
+        if (dlc < n + 1) return;
+        for (uint8_t i = 0; i < n; i++) dst[b->can_pos + i] = d[1 + i];
+        b->can_pos += n;
+        b->can_sn = (b->can_sn + 1) & 0x0F;
+        if (b->can_pos == b->can_len) {
+            b->can_len = 0;
+            Boot_Message(b, b->can_pos, BOOT_LINK_CAN);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/******************************************************************************
+ * Function: Boot_PollUart
+ * Description:
+ *   Take one byte of a [length 2B][message] frame.
+ ******************************************************************************/
+BOOT_RAM static void Boot_PollUart(BootCtx *b) {
+    uint32_t now = Boot_Cycles();
+    uint8_t c;
+
+    if (b->uart_pos && now - b->uart_last > BOOT_UART_GAP_US * (BOOT_CLOCK_HZ / 1000000)) {
+        b->uart_pos = 0;                                // Stalled frame: resync
+    }
+    if (!(USART1->SR & ((1 << 5) | (1 << 3)))) return;  // RXNE, ORE
+    c = USART1->DR;                                     // Also clears ORE
+    if (b->waiting || b->link == BOOT_LINK_CAN) return;
+    b->uart_last = now;
+
+    if (b->uart_pos < 2) {
+        b->uart_len = (b->uart_len << 8) | c;
+        if (++b->uart_pos == 2 && (b->uart_len == 0 || b->uart_len > BOOT_MSG_MAX)) {
+            b->uart_pos = 0;
+        }
+        return;
+    }
+    b->buf[b->rx][b->uart_pos - 2] = c;
+    if (++b->uart_pos - 2 == b->uart_len) {
+        b->uart_pos = 0;
+        Boot_Message(b, b->uart_len, BOOT_LINK_UART);
+    }
+}
+
+/******************************************************************************
+ * Function: Boot_Main
+ * Description:
+ *   Bootloader loop, from RAM with interrupts unused.
+ *
+ *   Reception goes on while the flash engine erases or programs the previous
+ *   block (the CPU only stalls on flash reads, and none happen meanwhile), so
+ *   an update takes about the page programming time when the link is faster:
+ *   roughly 45 ms per full page, under 3 s for the whole application area.
+ ******************************************************************************/
+void Boot_Main(uint8_t why) {
+    BootCtx ctx;
+    BootCtx *b = &ctx;
+
+    b->rx = 0;
+    b->link = BOOT_LINK_ANY;
+    b->why = why;
+    b->waiting = 0;
+    b->end_pending = 0;
+    b->started = 0;
+    b->result = BOOT_RES_OK;
+    b->can_len = 0;
+    b->uart_len = 0;
+    b->uart_pos = 0;
+    b->accepted = 0;
+    b->block = 0;
+    b->fl_state = BOOT_FL_IDLE;
+
+    Boot_Init();
+    Boot_Reply(b, BOOT_OP_STATUS, BOOT_RES_OK, why, BOOT_APP_MAX);  // Announce on both links
+
+    for (;;) {
+        Boot_PollCan(b);
+        Boot_PollUart(b);
+        Boot_FlashStep(b);
+        if (b->end_pending && b->fl_state == BOOT_FL_IDLE && !b->waiting) {
+            Boot_End(b);
+        }
+    }
+}
+
+/******************************************************************************
+ * Function: Boot_Request
+ * Description:
+ *   Leave the request word for Boot_Reset() and reset.
+ ******************************************************************************/
+void Boot_Request(void) {
+    __disable_irq();
+    *(volatile uint32_t *)BOOT_REQUEST_ADDR = BOOT_REQUEST_MAGIC;
+    NVIC_SystemReset();
+}
+
+/******************************************************************************
+ * Function: Boot_Frame
+ * Description:
+ *   Enter request: data frame, ISO-TP single frame [BOOT_OP_ENTER]. The
+ *   dispatch table only calls it for BOOT_CAN_RX_ID.
+ ******************************************************************************/
+uint8_t Boot_Frame(const CanFrame *frame) {
+    const uint8_t *d = CAN_FRAME_DATA(frame);
+
+    if (frame->rir & (1 << 1)) return 0;                // RTR: no data
+    if (CAN_FRAME_LEN(frame) >= 2 && d[0] == 0x01 && d[1] == BOOT_OP_ENTER) {
+        Boot_Request();
+    }
+    return 0;
+}
+
+/******************************************************************************
+ * Function: Boot_Command
+ * Description:
+ *   Reply with the application area, wait until it is out, reset.
+ ******************************************************************************/
+void Boot_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[8];
+
+    UART_PutU32(&reply[0], BOOT_APP_BASE);
+    UART_PutU32(&reply[4], BOOT_APP_MAX);
+    UART_SendReply(UART_CMD_BOOT, reply, sizeof(reply));
+    while (!(USART1->SR & (1 << 6)));                   // TC
+    Boot_Request();
+}
+
+/******************************************************************************
+ * End of File
+ ******************************************************************************/
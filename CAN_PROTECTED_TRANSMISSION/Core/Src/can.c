@@ -6,11 +6,73 @@
 
 #include "can.h"
 #include "uart.h"
+#include "forward.h"
+#include "capture.h"
+#include "idstats.h"
+#include "iddisp.h"
+#include "timebase.h"
+
+/*****************************************************************************
+ * Bit timing calculator
+ *
+ * Evaluated at compile time from PCLK1_HZ. The number of time quanta per bit
+ * is the first of 16, 18, 20, 15, 12, 10, 8 that divides the clock exactly
+ * with a prescaler <= 1024. BS2 = round(tq / 8) gives a sample point close
+ * to 87.5 % (CiA recommendation), SJW = min(BS2, 4).
+ *****************************************************************************/
+#define CAN_TQ_FITS(r, n)   ((PCLK1_HZ % ((uint32_t)(r) * (n))) == 0 && \
+                             (PCLK1_HZ / ((uint32_t)(r) * (n))) <= 1024)
+#define CAN_NTQ(r)          (CAN_TQ_FITS(r, 16) ? 16 : CAN_TQ_FITS(r, 18) ? 18 : \
+                             CAN_TQ_FITS(r, 20) ? 20 : CAN_TQ_FITS(r, 15) ? 15 : \
+                             CAN_TQ_FITS(r, 12) ? 12 : CAN_TQ_FITS(r, 10) ? 10 : \
+                             CAN_TQ_FITS(r,  8) ?  8 : 0)
+#define CAN_PRESC(r)        (PCLK1_HZ / ((uint32_t)(r) * CAN_NTQ(r)))
+#define CAN_BS2(r)          ((CAN_NTQ(r) + 4) / 8)
+#define CAN_BS1(r)          (CAN_NTQ(r) - 1 - CAN_BS2(r))
+#define CAN_SJW(r)          (CAN_BS2(r) < 4 ? CAN_BS2(r) : 4)
+#define CAN_BTR_VALUE(r)    (((uint32_t)(CAN_SJW(r) - 1) << 24)   /* SJW, bits 24-25 */ \
+                           | ((uint32_t)(CAN_BS2(r) - 1) << 20)   /* BS2, bits 20-22 */ \
+                           | ((uint32_t)(CAN_BS1(r) - 1) << 16)   /* BS1, bits 16-19 */ \
+                           | ((uint32_t)(CAN_PRESC(r) - 1)))      /* BRP, bits 0-9   */
+
+_Static_assert(CAN_NTQ(125000)  != 0, "no exact 125 kbit/s timing at PCLK1_HZ");
+_Static_assert(CAN_NTQ(250000)  != 0, "no exact 250 kbit/s timing at PCLK1_HZ");
+_Static_assert(CAN_NTQ(500000)  != 0, "no exact 500 kbit/s timing at PCLK1_HZ");
+_Static_assert(CAN_NTQ(1000000) != 0, "no exact 1 Mbit/s timing at PCLK1_HZ");
+_Static_assert(sizeof(CanFrame) == 16, "CanFrame must mirror the four mailbox registers");
+
+/**
+ * @brief Bit rate and its BTR value.
+ */
+typedef struct {
+    uint32_t bitrate;   /**< Bit rate in bit/s              */
+    uint32_t btr;       /**< SJW/BS2/BS1/BRP fields of BTR  */
+} CanBitTiming;
+
+/**
+ * @brief Bit timing table, generated at compile time and kept in flash.
+ */
+static const CanBitTiming can_bit_timing[CAN_BITRATE_COUNT] = {
+    { 125000,  CAN_BTR_VALUE(125000)  },
+    { 250000,  CAN_BTR_VALUE(250000)  },
+    { 500000,  CAN_BTR_VALUE(500000)  },
+    { 1000000, CAN_BTR_VALUE(1000000) },
+};
+
+/*****************************************************************************
+ * Local variables
+ *****************************************************************************/
+static uint8_t can_bitrate_index = CAN_BITRATE_DEFAULT;    // Active table entry
+static uint8_t can_boot_mode = CAN_MODE_NORMAL;            // Test mode CAN_Config() starts in
+static volatile uint32_t can_tx0_status;                   // Mailbox 0 status bits latched by the TX interrupt
+static CanFrame can_txq[CAN_TXQ_LEN];                      // Interrupt senders' frames waiting for mailbox 2
+static uint8_t can_txq_head;                               // Oldest queued frame
+static uint8_t can_txq_count;                              // Frames queued
 
 /*****************************************************************************
  * Function prototypes
  *****************************************************************************/
-void Process_CAN_Frame(uint32_t id, uint8_t isExtended, uint8_t *data, uint8_t len);
+void Process_CAN_Frame(const CanFrame *frame);
 
 /*****************************************************************************
  * Functions
@@ -30,8 +92,9 @@ void CAN_Config(void) {
 	CAN1->MCR &= ~((1 << 1) | (1 << 7) | (1 << 2) | (1 << 4));  // Disable sleep, time-triggered, auto wakeup, no auto retransmit
 	CAN1->MCR |= (1 << 3);                                  // Enable automatic bus-off management
 
-    // Bit timing for 500kbps @ 8MHz: Prescaler=4, SJW=1, BS1=13, BS2=2
-    CAN1->BTR = (0 << 24) | (1 << 16) | (0 << 20) | (3 << 0);  // SJW=1, BS2=2, BS1=13, Prescaler=4
+    // Bit timing from the compile-time table (500 kbit/s @ 36 MHz: Prescaler=4, 18 tq, BS1=15, BS2=2, SJW=2)
+    CAN1->BTR = can_bit_timing[can_bitrate_index].btr
+              | ((uint32_t)can_boot_mode << 30);            // LBKM/SILM (CAN_Preset())
 
     // Configure filter 0 to accept all messages
     CAN1->FMR |= (1 << 0);                                  // Enter filter initialization mode
@@ -44,11 +107,12 @@ void CAN_Config(void) {
     CAN1->FA1R |= (1 << 0);                                 // Activate filter 0
     CAN1->FMR &= ~(1 << 0);                                 // Leave filter initialization mode
 
-    // Enable CAN interrupts for FIFO0 message pending, error warning/passive, bus-off
-    CAN1->IER |= (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4);  // Enable interrupts
+    // Enable CAN interrupts for TX mailbox empty, FIFO0 message pending, error warning/passive, bus-off
+    CAN1->IER |= (1 << 0) | (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4);  // Enable interrupts
 
     NVIC_EnableIRQ(CAN1_RX0_IRQn);                          // Enable CAN RX0 interrupt in NVIC
     NVIC_EnableIRQ(CAN1_TX_IRQn);                           // Enable CAN TX interrupt in NVIC
+    NVIC_EnableIRQ(CAN1_SCE_IRQn);                          // Error interrupt, enabled in IER by capture.c
 
     // Exit initialization mode
     CAN1->MCR &= ~(1 << 0);                                 // Clear initialization request
@@ -56,110 +120,316 @@ void CAN_Config(void) {
 }
 
 /**
- * @brief Send a CAN frame.
- * @param isExtended 1 if extended ID (29-bit), 0 if standard ID (11-bit).
- * @param id CAN identifier.
- * @param data Pointer to data bytes.
- * @param len Number of data bytes (0-8).
+ * @brief Look a bit rate up in the bit timing table.
+ * @return Table index, CAN_BITRATE_COUNT if not supported.
+ */
+static uint8_t CAN_BitrateIndex(uint32_t bitrate) {
+    uint8_t index = 0;
+    while (index < CAN_BITRATE_COUNT && can_bit_timing[index].bitrate != bitrate) {
+        index++;
+    }
+    return index;
+}
+
+/**
+ * @brief Select the bit rate and test mode CAN_Config() starts with. Only
+ *        stores them, so a saved configuration is applied before the
+ *        controller first leaves initialization mode.
+ * @param bitrate Bit rate in bit/s (125000, 250000, 500000 or 1000000).
+ * @param mode CAN_MODE_NORMAL, CAN_MODE_LOOPBACK, CAN_MODE_SILENT or CAN_MODE_SELFTEST.
+ * @return 0 on success, 1 if not supported (nothing changed).
+ */
+uint8_t CAN_Preset(uint32_t bitrate, uint8_t mode) {
+    uint8_t index = CAN_BitrateIndex(bitrate);
+    if (index == CAN_BITRATE_COUNT) return 1;
+
+    can_bitrate_index = index;
+    can_boot_mode = mode & 0x03;
+    return 0;
+}
+
+/**
+ * @brief Change the bit rate: look it up in the bit timing table and reload
+ *        BTR in initialization mode, keeping the LBKM/SILM bits.
+ * @param bitrate Bit rate in bit/s (125000, 250000, 500000 or 1000000).
+ * @return 0 on success, 1 if not supported.
+ */
+uint8_t CAN_SetBitrate(uint32_t bitrate) {
+    uint8_t index = CAN_BitrateIndex(bitrate);
+    if (index == CAN_BITRATE_COUNT) return 1;              // Not in the table
+
+	CAN1->MCR |= (1 << 0);                                  // Request initialization mode
+	while (!(CAN1->MSR & (1 << 0)));                        // Wait until initialization acknowledged
+
+    CAN1->BTR = (CAN1->BTR & (0x3UL << 30))                 // Keep LBKM/SILM
+              | can_bit_timing[index].btr;                  // New SJW/BS2/BS1/prescaler
+    can_bitrate_index = index;
+
+    CAN1->MCR &= ~(1 << 0);                                 // Clear initialization request
+    while (CAN1->MSR & (1 << 0));                           // Wait until normal mode
+    return 0;
+}
+
+/**
+ * @brief Current bit rate in bit/s.
+ */
+uint32_t CAN_GetBitrate(void) {
+    return can_bit_timing[can_bitrate_index].bitrate;
+}
+
+/**
+ * @brief Longest frame time at the current bit rate.
+ * @return CAN_FRAME_BITS_MAX bit times in us, rounded up.
+ */
+uint32_t CAN_FrameTimeUs(void) {
+    uint32_t bitrate = CAN_GetBitrate();
+
+    return (CAN_FRAME_BITS_MAX * 1000000UL + bitrate - 1) / bitrate;
+}
+
+/**
+ * @brief Current BTR timing bits without the test mode bits.
+ */
+uint32_t CAN_GetBitTiming(void) {
+    return CAN1->BTR & ~(0x3UL << 30);
+}
+
+/**
+ * @brief Switch test mode: enter initialization mode, update LBKM/SILM in BTR
+ *        and return to normal operation.
+ * @param mode CAN_MODE_NORMAL, CAN_MODE_LOOPBACK, CAN_MODE_SILENT or CAN_MODE_SELFTEST.
+ */
+void CAN_SetTestMode(uint8_t mode) {
+	CAN1->MCR |= (1 << 0);                                  // Request initialization mode
+	while (!(CAN1->MSR & (1 << 0)));                        // Wait until initialization acknowledged
+
+    CAN1->BTR = (CAN1->BTR & ~(0x3UL << 30))                // Clear LBKM (bit 30) and SILM (bit 31)
+              | ((uint32_t)(mode & 0x03) << 30);            // Bit 30 = loopback, bit 31 = silent
+
+    CAN1->MCR &= ~(1 << 0);                                 // Clear initialization request
+    while (CAN1->MSR & (1 << 0));                           // Wait until normal mode
+}
+
+/**
+ * @brief Read the current test mode.
+ * @return LBKM/SILM bits of BTR as CAN_MODE_xxx.
+ */
+uint8_t CAN_GetTestMode(void) {
+    return (CAN1->BTR >> 30) & 0x03;
+}
+
+/**
+ * @brief Build a register image: ID/IDE as in TIR, DLC, data packed into the
+ *        two data words (unused bytes are zero).
+ */
+void CAN_FramePack(CanFrame *f, uint8_t isExtended, uint32_t id, const uint8_t *data, uint8_t len) {
+    if (isExtended) {
+        f->rir = (id << 3) | (1 << 2);                      // Extended ID format, IDE=1
+    } else {
+        f->rir = (id << 21);                                // Standard ID format, IDE=0 (bit 2)
+    }
+    f->rdtr = len & 0x0F;                                   // DLC (Data Length Code)
+    f->rdlr = 0;
+    f->rdhr = 0;
+    memcpy(&f->rdlr, data, len < 8 ? len : 8);              // Little-endian: byte i lands in bits 8*i
+}
+
+/**
+ * @brief Send a register image through mailbox 0.
+ *        The mailbox is written with four word stores; the TIR store carries
+ *        TXRQ and goes last so the frame is complete when it is requested.
+ *        With done_us set, each completion poll is preceded by a time base
+ *        read (see CAN_SendFrameTimed()). Each wait lasts at most
+ *        CAN_TX_WAIT_FRAMES frame times at the current bit rate.
+ * @param f Frame to send.
+ * @param done_us Completion stamp, or NULL.
+ * @param window_us Stamp uncertainty (with done_us).
+ * @return CAN_TX_OK, CAN_TX_BUS_OFF, CAN_TX_BUSY or CAN_TX_FAILED.
  */
-void CAN_Send(uint8_t isExtended, uint32_t id, uint8_t *data, uint8_t len) {
+static uint8_t CAN_SendMailbox0(const CanFrame *f, uint32_t *done_us, uint32_t *window_us) {
+    uint8_t result;
+    uint32_t prev, now;
+    uint32_t t0, limit;
+
     // Check if CAN bus is off
     if (CAN1->ESR & (1 << 2)) {                             // If bus-off state detected
-        return;
+        return CAN_TX_BUS_OFF;
     }
 
-    // Wait for empty transmit mailbox with timeout
-    uint32_t timeout = 10000;
-    while (!(CAN1->TSR & (1 << 26)) && timeout--) ;         // Wait mailbox 0 empty or timeout
-    if (timeout == 0) {
-        return;
+    // Wait for empty transmit mailbox, bounded in time at any bit rate
+    limit = CAN_TX_WAIT_FRAMES * CAN_FrameTimeUs();
+    t0 = Time_Now32();
+    while (!(CAN1->TSR & (1 << 26)) && Time_Now32() - t0 < limit) ;  // Wait mailbox 0 empty or timeout
+    if (!(CAN1->TSR & (1 << 26))) {                         // Still busy
+        return CAN_TX_BUSY;
     }
 
-    // Set up identifier and IDE bit
-    if (isExtended) {
-    	CAN1->sTxMailBox[0].TIR = (id << 3) | (1 << 2);     // Extended ID format, IDE=1
+    CAN1->sTxMailBox[0].TDTR = f->rdtr & 0x0F;              // DLC only (no TGT, RX filter index/time dropped)
+    CAN1->sTxMailBox[0].TDLR = f->rdlr;                     // Data bytes 0-3
+    CAN1->sTxMailBox[0].TDHR = f->rdhr;                     // Data bytes 4-7
+    can_tx0_status = 0;                                     // Latched by the TX interrupt on completion
+    CAN1->sTxMailBox[0].TIR  = f->rir | (1 << 0);           // ID/IDE/RTR and transmit request
+
+    // Wait for transmission complete with timeout
+    t0 = Time_Now32();
+    if (done_us) {
+        now = t0;
+        prev = now;
+        while (!((CAN1->TSR | can_tx0_status) & ((1 << 0) | (1 << 1) | (1 << 2))) && now - t0 < limit) {
+            prev = now;                                     // Completion lies after this read...
+            now = Time_Now32();                             // ...and before the next poll
+        }
+        *done_us = now;
+        *window_us = now - prev;
     } else {
-        CAN1->sTxMailBox[0].TIR = (id << 21);               // Standard ID format, IDE=0 (bit 2)
+        while (!((CAN1->TSR | can_tx0_status) & ((1 << 0) | (1 << 1) | (1 << 2))) && Time_Now32() - t0 < limit);
     }
+    result = ((CAN1->TSR | can_tx0_status) & (1 << 1)) ? CAN_TX_OK : CAN_TX_FAILED;  // TXOK0
 
-    // Set data length and clear data registers
-    CAN1->sTxMailBox[0].TDTR = len & 0x0F;                  // DLC (Data Length Code)
-    CAN1->sTxMailBox[0].TDLR = 0;                           // Clear low data register
-    CAN1->sTxMailBox[0].TDHR = 0;                           // Clear high data register
+    // Clear status flags (rc_w1); a read-modify-write would also clear RQCP2
+    // before the TX interrupt has seen it
+    CAN1->TSR = (1 << 0);
+    return result;
+}
 
-    // Copy data bytes into mailbox registers
-    for (uint8_t i = 0; i < len && i < 8; i++) {
-        if (i < 4) {
-            CAN1->sTxMailBox[0].TDLR |= ((uint32_t)data[i] << (8 * i));   // Pack first 4 bytes into TDLR
-        } else {
-            CAN1->sTxMailBox[0].TDHR |= ((uint32_t)data[i] << (8 * (i - 4)));  // Pack bytes 4-7 into TDHR
+/**
+ * @brief Send a register image through mailbox 0.
+ * @param f Frame to send.
+ * @return CAN_TX_OK, CAN_TX_BUS_OFF, CAN_TX_BUSY or CAN_TX_FAILED.
+ */
+uint8_t CAN_SendFrame(const CanFrame *f) {
+    return CAN_SendMailbox0(f, NULL, NULL);
+}
+
+/**
+ * @brief Send a register image through mailbox 0, stamping its completion.
+ * @param f Frame to send.
+ * @param done_us Time_Now32() at completion.
+ * @param window_us Stamp uncertainty in us.
+ * @return CAN_TX_OK, CAN_TX_BUS_OFF, CAN_TX_BUSY or CAN_TX_FAILED.
+ */
+uint8_t CAN_SendFrameTimed(const CanFrame *f, uint32_t *done_us, uint32_t *window_us) {
+    return CAN_SendMailbox0(f, done_us, window_us);
+}
+
+/**
+ * @brief Load a register image into mailbox 2, TIR with TXRQ last.
+ * @param f Frame to send.
+ */
+static void CAN_LoadMailbox2(const CanFrame *f) {
+    CAN1->sTxMailBox[2].TDTR = f->rdtr & 0x0F;              // DLC only
+    CAN1->sTxMailBox[2].TDLR = f->rdlr;
+    CAN1->sTxMailBox[2].TDHR = f->rdhr;
+    CAN1->sTxMailBox[2].TIR  = f->rir | (1 << 0);
+}
+
+/**
+ * @brief Move the oldest queued frame into mailbox 2 (TME2 set).
+ */
+static void CAN_TxqNext(void) {
+    CAN_LoadMailbox2(&can_txq[can_txq_head]);
+    can_txq_head = (can_txq_head + 1) % CAN_TXQ_LEN;
+    can_txq_count--;
+}
+
+/**
+ * @brief Queue a register image for mailbox 2 (interrupt handlers only).
+ * @param f Frame to send.
+ * @return CAN_TX_OK (loaded or queued), CAN_TX_BUS_OFF or CAN_TX_BUSY.
+ */
+uint8_t CAN_QueueFrame(const CanFrame *f) {
+    if (CAN1->ESR & (1 << 2)) {                             // Bus-off
+        return CAN_TX_BUS_OFF;
+    }
+    if (CAN1->TSR & (1 << 28)) {                            // TME2: mailbox 2 idle
+        if (can_txq_count == 0) {
+            CAN_LoadMailbox2(f);                            // Four stores, no copy
+            return CAN_TX_OK;
         }
+        CAN_TxqNext();                                      // Left idle while Bench_Burst() masked the TX interrupt
     }
+    if (can_txq_count == CAN_TXQ_LEN) {
+        return CAN_TX_BUSY;
+    }
+    can_txq[(can_txq_head + can_txq_count) % CAN_TXQ_LEN] = *f;
+    can_txq_count++;
+    return CAN_TX_OK;
+}
 
-    // Request transmission
-    CAN1->sTxMailBox[0].TIR |= (1 << 0);                    // Set transmit request bit
-
-    // Wait for transmission complete with timeout
-    timeout = 10000;
-    while (!(CAN1->TSR & ((1 << 0) | (1 << 1) | (1 << 2))) && timeout--);
+/**
+ * @brief Send a CAN frame.
+ * @param isExtended 1 if extended ID (29-bit), 0 if standard ID (11-bit).
+ * @param id CAN identifier.
+ * @param data Pointer to data bytes.
+ * @param len Number of data bytes (0-8).
+ * @return CAN_TX_OK, CAN_TX_BUS_OFF, CAN_TX_BUSY or CAN_TX_FAILED.
+ */
+uint8_t CAN_Send(uint8_t isExtended, uint32_t id, uint8_t *data, uint8_t len) {
+    CanFrame f;
 
-    // Clear status flags
-    CAN1->TSR |= (1 << 0) | (1 << 1) | (1 << 2);
+    CAN_FramePack(&f, isExtended, id, data, len);
+    return CAN_SendFrame(&f);
 }
 
 /**
  * @brief CAN FIFO 0 RX interrupt handler.
- *        Checks for errors, reads received frame, releases FIFO,
+ *        Clears FIFO full/overrun flags, reads the register image, releases FIFO,
  *        and calls Process_CAN_Frame().
+ *        Error warning/passive/bus-off are controller states (read-only in ESR),
+ *        not per-frame errors, so they must not stop the FIFO from draining.
  */
 void CAN1_RX0_IRQHandler(void) {
-    // Clear CAN error flags if any
-	if (CAN1->ESR & ((1 << 0) | (1 << 1) | (1 << 2))) {
-		CAN1->ESR &= ~((1 << 0) | (1 << 1) | (1 << 2));   // Clear error flags
-        // UART_SendString("CAN Error!\r\n");
-        return;
+    // Clear FIFO full / overrun flags (write 1 to clear), otherwise their interrupts stay pending
+	if (CAN1->RF0R & ((1 << 3) | (1 << 4))) {
+        if (CAN1->RF0R & (1 << 4)) Fwd_FifoOverrun();    // Frames lost in hardware
+		CAN1->RF0R = (1 << 3) | (1 << 4);                  // FULL0, FOVR0
     }
 
     // Return if no message pending in FIFO 0
 	if ((CAN1->RF0R & 0x03) == 0) return;                 // No pending message
 
-    // Read ID type, length, and data bytes
-    uint32_t id = 0;
-    uint8_t isExtended = (CAN1->sFIFOMailBox[0].RIR & (1 << 2)) ? 1 : 0;  // IDE bit: 1=extended, 0=standard
-    uint8_t len = CAN1->sFIFOMailBox[0].RDTR & 0x0F;      // Data length code (DLC)
-    uint8_t data[8];
-
-    if (isExtended)
-        id = (CAN1->sFIFOMailBox[0].RIR >> 3);            // Extended ID is bits 3..31
-    else
-        id = (CAN1->sFIFOMailBox[0].RIR >> 21);           // Standard ID is bits 21..31
-
-    uint32_t rdlr = CAN1->sFIFOMailBox[0].RDLR;           // Low data register
-    uint32_t rdhr = CAN1->sFIFOMailBox[0].RDHR;           // High data register
-
-    for (uint8_t i = 0; i < len && i < 8; i++) {
-        data[i] = (i < 4) ? (rdlr >> (8 * i)) & 0xFF : (rdhr >> (8 * (i - 4))) & 0xFF;  // Extract data bytes
-    }
+    // Read the output mailbox as it is, decoding happens where fields are used
+    CanFrame frame;
+    frame.rir  = CAN1->sFIFOMailBox[0].RIR;               // ID, IDE, RTR
+    frame.rdtr = CAN1->sFIFOMailBox[0].RDTR;              // DLC
+    frame.rdlr = CAN1->sFIFOMailBox[0].RDLR;              // Data bytes 0-3
+    frame.rdhr = CAN1->sFIFOMailBox[0].RDHR;              // Data bytes 4-7
 
     // Release FIFO
     CAN1->RF0R |= (1 << 5);                               // Release FIFO 0 output mailbox
 
     // Process received CAN frame
-    Process_CAN_Frame(id, isExtended, data, len);
+    Process_CAN_Frame(&frame);
 }
 
 /**
  * @brief Process a received CAN frame.
- *        Checks replay attacks via counter byte and sends frame info to UART.
- * @param id CAN identifier.
- * @param isExtended 1 if extended ID, 0 if standard ID.
- * @param data Pointer to data bytes.
- * @param len Length of data bytes.
+ *        Checks replay attacks via counter byte and queues the frame for UART.
+ *        The per-ID dispatch table runs first: its handlers (time sync,
+ *        ping-pong probe, bootloader enter request) and policies (drop,
+ *        rate limit) may take the frame, and IDDISP_FORWARD IDs skip the
+ *        counter byte and the replay check.
+ * @param frame Register image read from FIFO 0.
  */
-void Process_CAN_Frame(uint32_t id, uint8_t isExtended, uint8_t *data, uint8_t len) {
-    if (len == 0) return;                      // No counter byte present
+void Process_CAN_Frame(const CanFrame *frame) {
+    uint8_t policy = IdDisp_Frame(frame);      // Per-ID handler or policy, O(1) lookup
+    if (policy == IDDISP_TAKEN) return;
+
+    uint32_t id = CAN_FRAME_ID(frame);
+    uint8_t len = CAN_FRAME_LEN(frame);
+    if (policy == IDDISP_FORWARD) {            // No counter byte: whole payload, never flagged
+        Capture_Frame(frame, 0);
+        IdStats_Frame(frame, 0);
+        Fwd_Push(frame, len, 0);
+        return;
+    }
+    if (len == 0) {                            // No counter byte present
+        Capture_Frame(frame, 0);               // Recorded, never forwarded
+        IdStats_Frame(frame, 0);
+        return;
+    }
 
-    uint8_t counter  = data[len-1];            // Last byte is counter
+    uint8_t counter  = CAN_FRAME_DATA(frame)[len-1];  // Last byte is counter
     uint8_t payload_len = len - 1;             // Payload length (0…7)
 
     /* ---- Replay attack detection ---- */
@@ -173,42 +443,53 @@ void Process_CAN_Frame(uint32_t id, uint8_t isExtended, uint8_t *data, uint8_t l
     }
     rx_tracker.last_counter = counter;
 
-    /* ---- Send to PC via UART ---- */
-    UART_SendByte(isExtended);                  // Send IDE flag
-    if (isExtended) {
-        UART_SendByte((id >> 24) & 0xFF);      // Extended ID byte 3 (MSB)
-        UART_SendByte((id >> 16) & 0xFF);      // Extended ID byte 2
-        UART_SendByte((id >>  8) & 0xFF);      // Extended ID byte 1
-        UART_SendByte( id        & 0xFF);      // Extended ID byte 0 (LSB)
-    } else {
-        UART_SendByte((id >> 8) & 0xFF);       // Standard ID high byte
-        UART_SendByte( id       & 0xFF);       // Standard ID low byte
-    }
+    Capture_Frame(frame, attack_flag);         // Triggered capture buffer
+    IdStats_Frame(frame, attack_flag);         // Per-ID statistics
 
-    UART_SendByte(payload_len);                  // Actual payload length (excluding counter)
-    for (uint8_t i = 0; i < payload_len; i++) {
-        UART_SendByte(data[i]);                  // Send payload bytes
-    }
+    /* ---- Queue for the PC, sent from the main loop ---- */
+    Fwd_Push(frame, payload_len, attack_flag);
+
+    attack_flag = 0;                             // Reset flag after queueing
+}
 
-    UART_SendByte(attack_flag);                  // Send attack flag byte
+/**
+ * @brief CAN status change/error interrupt handler.
+ *        Only raised while the capture error trigger is armed (LECIE/ERRIE);
+ *        passes the last error code on and clears ERRI.
+ */
+void CAN1_SCE_IRQHandler(void) {
+    uint8_t lec = (CAN1->ESR >> 4) & 0x07;                 // Last error code
 
-    attack_flag = 0;                             // Reset flag after sending
-    can_frame_ready = 1;                         // Indicate new CAN frame ready
+    CAN1->MSR = (1 << 2);                                   // Clear ERRI (rc_w1)
+    if (lec != 0 && lec != 7) {                             // 7 = set by software, no new error
+        Capture_Error(lec);
+    }
 }
 
 /**
- * @brief CAN TX interrupt handler.
- *        Clears transmit status flags for all mailboxes.
+ * @brief CAN TX interrupt handler (TMEIE).
+ *        TMEIE is level-triggered, so every completion is cleared here:
+ *        mailbox 0's status bits are latched for CAN_SendFrame(), and once
+ *        mailbox 2 is empty (TME2; a sender that ran before this handler
+ *        may have reloaded it) the next CAN_QueueFrame() frame goes out.
+ *        Bench_Burst() masks this interrupt and collects mailboxes 0 and 1
+ *        itself.
  */
 void CAN1_TX_IRQHandler(void) {
-	if (CAN1->TSR & ((1 << 0) | (1 << 1) | (1 << 3))) {
-		CAN1->TSR |= (1 << 0) | (1 << 1) | (1 << 3);  // Clear mailbox 0 status flags
+    uint32_t tsr = CAN1->TSR;
+
+    if (tsr & (1 << 0)) {                                   // RQCP0
+        can_tx0_status = tsr & 0xFF;                        // RQCP0/TXOK0/ALST0/TERR0
+        CAN1->TSR = (1 << 0);                               // Clear them (rc_w1)
     }
-	if (CAN1->TSR & ((1 << 8) | (1 << 9) | (1 << 10))) {
-		CAN1->TSR |= (1 << 8) | (1 << 9) | (1 << 10);  // Clear mailbox 1 status flags
+    if (tsr & (1 << 8)) {                                   // RQCP1
+        CAN1->TSR = (1 << 8);
     }
-	if (CAN1->TSR & ((1 << 16) | (1 << 17) | (1 << 18))) {
-		CAN1->TSR |= (1 << 16) | (1 << 17) | (1 << 18);  // Clear mailbox 2 status flags
+    if (tsr & (1 << 16)) {                                  // RQCP2
+        CAN1->TSR = (1 << 16);
+        if (can_txq_count && (CAN1->TSR & (1 << 28))) {     // TME2
+            CAN_TxqNext();
+        }
     }
 }
 
@@ -0,0 +1,287 @@
+/*****************************************************************************
+ * @file    capture.c
+ * @brief   Triggered capture buffer: the CAN RX interrupt records frames
+ *          into a RAM ring, the trigger freezes it after a post-trigger
+ *          count, the main loop dumps it to the host
+ *****************************************************************************/
+
+/******************************************************************************
+ * Include files
+ ******************************************************************************/
+#include "capture.h"
+#include "uart.h"
+#include "timebase.h"
+
+/******************************************************************************
+ * Local types and variables
+ ******************************************************************************/
+
+/**
+ * @brief One recorded frame.
+ */
+typedef struct {
+    CanFrame can;           // Register image as received
+    uint32_t stamp;         // Time_Now32() at reception (us)
+    uint8_t  attack;        // Replay detection result
+} CaptureRec;
+
+#define CAPTURE_ERR_IRQ     ((1 << 11) | (1 << 15))    // IER: LECIE, ERRIE
+
+static CaptureRec capture_buf[CAPTURE_DEPTH];
+static volatile uint8_t capture_state = CAPTURE_IDLE;
+static uint8_t  capture_trigger = CAPTURE_TRIG_ID;  // Armed condition
+static uint8_t  capture_cause = CAPTURE_TRIG_NONE;  // Condition that fired
+static uint8_t  capture_lec = 0;                    // Error code of an error trigger
+static uint32_t capture_mask = 0;                   // RIR bits compared for TRIG_ID
+static uint32_t capture_match = 0;                  // Expected RIR bits for TRIG_ID
+static uint16_t capture_post = 0;                   // Frames recorded after the trigger
+static uint16_t capture_post_left = 0;              // Of those, still to come
+static uint32_t capture_total = 0;                  // Frames recorded since arming
+static uint32_t capture_trig_index = 0;             // Trigger frame, or the latest before it
+static uint32_t capture_trig_stamp = 0;             // Time base when the trigger fired
+static uint32_t capture_window_bits = 0;            // Bit times in one load window
+static uint32_t capture_load_limit = 0;             // Bits per window for TRIG_LOAD
+static uint32_t capture_load_start = 0;             // Start of the current window
+static uint32_t capture_load_bits = 0;              // Bits received in the current window
+static uint32_t capture_load_peak = 0;              // Most bits in one window
+
+/******************************************************************************
+ * Function: Capture_Fire
+ * Description:
+ *   Starts the post-trigger phase at frame number index. The error
+ *   interrupt is only needed until the first trigger.
+ ******************************************************************************/
+static void Capture_Fire(uint8_t cause, uint32_t index, uint32_t stamp) {
+    capture_cause = cause;
+    capture_trig_index = index;
+    capture_trig_stamp = stamp;
+    capture_post_left = capture_post;
+    capture_state = capture_post ? CAPTURE_TRIGGERED : CAPTURE_DONE;
+    CAN1->IER &= ~CAPTURE_ERR_IRQ;
+}
+
+/******************************************************************************
+ * Function: Capture_Load
+ * Description:
+ *   Adds the frame's bit count (ID, control, CRC, ACK, EOF and intermission,
+ *   no stuff bits) to the current window and returns 1 when the window has
+ *   reached the load threshold.
+ ******************************************************************************/
+static uint8_t Capture_Load(const CanFrame *frame, uint32_t now) {
+    uint32_t bits = CAN_FRAME_IDE(frame) ? 67 : 47;
+
+    if (!(frame->rir & (1 << 1))) {             // Remote frames carry no data
+        bits += 8 * CAN_FRAME_LEN(frame);
+    }
+    if (now - capture_load_start >= CAPTURE_LOAD_WINDOW_US) {
+        capture_load_start = now;
+        capture_load_bits = 0;
+    }
+    capture_load_bits += bits;
+    if (capture_load_bits > capture_load_peak) {
+        capture_load_peak = capture_load_bits;
+    }
+    return capture_load_limit && capture_load_bits >= capture_load_limit;
+}
+
+/******************************************************************************
+ * Function: Capture_Frame
+ * Description:
+ *   Writes the frame over the oldest ring entry. While armed the frame
+ *   triggers are checked, a matching frame becomes the trigger frame; once
+ *   triggered, the post-trigger count runs down to DONE.
+ ******************************************************************************/
+void Capture_Frame(const CanFrame *frame, uint8_t attack) {
+    uint8_t state = capture_state;
+    uint8_t overload, hit = 0;
+    CaptureRec *r;
+    uint32_t now;
+
+    if (state != CAPTURE_ARMED && state != CAPTURE_TRIGGERED) return;
+
+    now = Time_Now32();
+    r = &capture_buf[capture_total & (CAPTURE_DEPTH - 1)];
+    r->can = *frame;
+    r->stamp = now;
+    r->attack = attack;
+    capture_total++;
+
+    overload = Capture_Load(frame, now);        // Peak load is kept for every trigger
+
+    if (state == CAPTURE_TRIGGERED) {
+        if (--capture_post_left == 0) {
+            capture_state = CAPTURE_DONE;
+        }
+        return;
+    }
+
+    if (capture_trigger == CAPTURE_TRIG_ID) {
+        hit = (frame->rir & capture_mask) == capture_match;
+    } else if (capture_trigger == CAPTURE_TRIG_ATTACK) {
+        hit = attack;
+    } else if (capture_trigger == CAPTURE_TRIG_LOAD) {
+        hit = overload;
+    }
+    if (hit) {
+        Capture_Fire(capture_trigger, capture_total - 1, now);
+    }
+}
+
+/******************************************************************************
+ * Function: Capture_Error
+ * Description:
+ *   Fires the error trigger; the next frame recorded is the first
+ *   post-trigger frame. The trigger index marks the latest frame before the
+ *   error (the first frame if none yet).
+ ******************************************************************************/
+void Capture_Error(uint8_t lec) {
+    if (capture_state != CAPTURE_ARMED || capture_trigger != CAPTURE_TRIG_ERROR) return;
+
+    capture_lec = lec;
+    Capture_Fire(CAPTURE_TRIG_ERROR, capture_total ? capture_total - 1 : 0, Time_Now32());
+}
+
+/******************************************************************************
+ * Function: Capture_Arm
+ * Description:
+ *   Clears the buffer and arms the trigger. The post-trigger count is
+ *   limited to CAPTURE_DEPTH - 1 so the trigger frame is never overwritten.
+ ******************************************************************************/
+static void Capture_Arm(uint8_t trigger, uint16_t post, uint32_t param, uint8_t isExtended) {
+    uint32_t window_bits = (uint32_t)((uint64_t)CAN_GetBitrate() * CAPTURE_LOAD_WINDOW_US / 1000000);
+
+    if (post > CAPTURE_DEPTH - 1) post = CAPTURE_DEPTH - 1;
+
+    NVIC_DisableIRQ(CAN1_RX0_IRQn);
+    NVIC_DisableIRQ(CAN1_SCE_IRQn);
+    capture_trigger = trigger;
+    capture_cause = CAPTURE_TRIG_NONE;
+    capture_lec = 0;
+    if (isExtended) {
+        capture_mask = 0xFFFFFFF8UL | (1 << 2);    // EXID and IDE
+        capture_match = (param << 3) | (1 << 2);
+    } else {
+        capture_mask = 0xFFE00000UL | (1 << 2);    // STID and IDE
+        capture_match = param << 21;
+    }
+    capture_post = post;
+    capture_post_left = 0;
+    capture_total = 0;
+    capture_trig_index = 0;
+    capture_trig_stamp = 0;
+    capture_window_bits = window_bits;
+    capture_load_limit = (trigger == CAPTURE_TRIG_LOAD) ? (uint32_t)((uint64_t)window_bits * param / 1000) : 0;
+    capture_load_start = Time_Now32();
+    capture_load_bits = 0;
+    capture_load_peak = 0;
+    capture_state = CAPTURE_ARMED;
+    if (trigger == CAPTURE_TRIG_ERROR) {
+        CAN1->IER |= CAPTURE_ERR_IRQ;           // Bus errors raise the SCE interrupt
+    } else {
+        CAN1->IER &= ~CAPTURE_ERR_IRQ;
+    }
+    NVIC_EnableIRQ(CAN1_SCE_IRQn);
+    NVIC_EnableIRQ(CAN1_RX0_IRQn);
+}
+
+/******************************************************************************
+ * Function: Capture_Dump
+ * Description:
+ *   Replies with up to CAPTURE_DUMP_MAX records starting at position first
+ *   (0 = oldest frame still in the ring).
+ ******************************************************************************/
+static void Capture_Dump(uint16_t first) {
+    uint8_t reply[4 + CAPTURE_DUMP_MAX * CAPTURE_REC_LEN];
+    uint32_t frames = capture_total < CAPTURE_DEPTH ? capture_total : CAPTURE_DEPTH;
+    uint32_t oldest = capture_total - frames;
+    uint8_t count = 0;
+    uint8_t n = 4;
+
+    while (count < CAPTURE_DUMP_MAX && first + count < frames) {
+        const CaptureRec *r = &capture_buf[(oldest + first + count) & (CAPTURE_DEPTH - 1)];
+        UART_PutU32(&reply[n], r->stamp);
+        UART_PutU32(&reply[n + 4], r->can.rir);
+        UART_PutU32(&reply[n + 8], r->can.rdtr);
+        memcpy(&reply[n + 12], CAN_FRAME_DATA(&r->can), 8);
+        reply[n + 20] = r->attack;
+        n += CAPTURE_REC_LEN;
+        count++;
+    }
+
+    reply[0] = CAPTURE_OP_DUMP;
+    reply[1] = (first >> 8) & 0xFF;
+    reply[2] =  first       & 0xFF;
+    reply[3] = count;
+    UART_SendReply(UART_CMD_CAPTURE, reply, n);
+}
+
+/******************************************************************************
+ * Function: Capture_Command
+ * Description:
+ *   Arms, stops or fires the capture, or dumps a frozen buffer; otherwise
+ *   replies with the state. The interrupts are masked for the snapshot.
+ ******************************************************************************/
+void Capture_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[23];
+    uint32_t frames, oldest, fired, peak;
+
+    if (len >= 8 && args[0] == CAPTURE_OP_ARM && args[1] < CAPTURE_TRIG_COUNT) {
+        Capture_Arm(args[1], (args[2] << 8) | args[3],
+                    ((uint32_t)args[4] << 24) | ((uint32_t)args[5] << 16) |
+                    ((uint32_t)args[6] << 8) | args[7],
+                    len >= 9 ? args[8] : 0);
+    } else if (len >= 1 && args[0] == CAPTURE_OP_STOP) {
+        NVIC_DisableIRQ(CAN1_RX0_IRQn);
+        NVIC_DisableIRQ(CAN1_SCE_IRQn);
+        if (capture_state != CAPTURE_DONE) {
+            capture_state = CAPTURE_IDLE;
+        }
+        CAN1->IER &= ~CAPTURE_ERR_IRQ;
+        NVIC_EnableIRQ(CAN1_SCE_IRQn);
+        NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    } else if (len >= 1 && args[0] == CAPTURE_OP_FIRE) {
+        NVIC_DisableIRQ(CAN1_RX0_IRQn);
+        NVIC_DisableIRQ(CAN1_SCE_IRQn);
+        if (capture_state == CAPTURE_ARMED) {
+            Capture_Fire(CAPTURE_TRIG_MANUAL, capture_total ? capture_total - 1 : 0, Time_Now32());
+        }
+        NVIC_EnableIRQ(CAN1_SCE_IRQn);
+        NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    } else if (len >= 3 && args[0] == CAPTURE_OP_DUMP &&
+               (capture_state == CAPTURE_IDLE || capture_state == CAPTURE_DONE)) {
+        Capture_Dump((args[1] << 8) | args[2]);  // Buffer is frozen: no masking needed
+        return;
+    }
+
+    NVIC_DisableIRQ(CAN1_RX0_IRQn);             // Consistent snapshot
+    NVIC_DisableIRQ(CAN1_SCE_IRQn);
+    frames = capture_total < CAPTURE_DEPTH ? capture_total : CAPTURE_DEPTH;
+    oldest = capture_total - frames;
+    fired = capture_cause != CAPTURE_TRIG_NONE && frames;
+    reply[0] = CAPTURE_OP_STATUS;
+    reply[1] = capture_state;
+    reply[2] = capture_trigger;
+    reply[3] = capture_cause;
+    reply[4] = capture_lec;
+    reply[5] = (CAPTURE_DEPTH >> 8) & 0xFF;
+    reply[6] =  CAPTURE_DEPTH       & 0xFF;
+    reply[7] = (frames >> 8) & 0xFF;
+    reply[8] =  frames       & 0xFF;
+    reply[9]  = fired ? ((capture_trig_index - oldest) >> 8) & 0xFF : 0xFF;
+    reply[10] = fired ?  (capture_trig_index - oldest)       & 0xFF : 0xFF;
+    reply[11] = (capture_post_left >> 8) & 0xFF;
+    reply[12] =  capture_post_left       & 0xFF;
+    UART_PutU32(&reply[13], capture_trig_stamp);
+    UART_PutU32(&reply[17], capture_total);
+    peak = capture_window_bits ? capture_load_peak * 1000 / capture_window_bits : 0;
+    if (peak > 0xFFFF) peak = 0xFFFF;
+    reply[21] = (peak >> 8) & 0xFF;
+    reply[22] =  peak       & 0xFF;
+    NVIC_EnableIRQ(CAN1_SCE_IRQn);
+    NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    UART_SendReply(UART_CMD_CAPTURE, reply, sizeof(reply));
+}
+
+/******************************************************************************
+ * End of File
+ ******************************************************************************/
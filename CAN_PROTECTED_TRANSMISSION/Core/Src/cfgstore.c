@@ -0,0 +1,246 @@
+/*****************************************************************************
+ * @file    cfgstore.c
+ * @brief   Wear-levelled configuration records in flash, programmed with the
+ *          HAL flash driver and checked with the CRC unit
+ *****************************************************************************/
+
+/******************************************************************************
+ * Include files
+ ******************************************************************************/
+#include "cfgstore.h"
+#include "uart.h"
+#include "can.h"
+#include "timer.h"
+#include "timebase.h"
+#include "crc.h"
+#include <stddef.h>
+
+/******************************************************************************
+ * Local types and variables
+ ******************************************************************************/
+
+/**
+ * @brief A cyclic message as passed to Timer_StartCyclic().
+ */
+typedef struct {
+    uint32_t period_us;     // 0 = slot stopped
+    uint32_t id;
+    uint8_t  mode;          // 0 = standard, 1 = extended
+    uint8_t  len;           // Without the counter byte
+    uint8_t  data[8];
+    uint8_t  reserved[2];
+} CfgCyclic;
+
+/**
+ * @brief Record layout in a flash slot (little-endian, word aligned).
+ */
+typedef struct {
+    uint16_t  magic;        // CFGSTORE_MAGIC
+    uint8_t   version;      // CFGSTORE_VERSION
+    uint8_t   size;         // sizeof(CfgRecord)
+    uint32_t  seq;          // Save counter, the highest valid one wins
+    uint32_t  bitrate;      // CAN bit rate (bit/s)
+    uint8_t   can_mode;     // CAN_MODE_xxx
+    uint8_t   protect;      // Host protection mode
+    uint8_t   reserved[2];
+    CfgCyclic cyclic[TIMER_CYCLIC_SLOTS];
+    uint32_t  crc;          // Crc_Buffer() of the bytes above
+} CfgRecord;
+
+_Static_assert(sizeof(CfgRecord) <= CFGSTORE_SLOT_SIZE, "record must fit a flash slot");
+_Static_assert(sizeof(CfgRecord) % 4 == 0, "record is programmed in words");
+
+#define CFGSTORE_SLOT(s)        ((const CfgRecord *)(CFGSTORE_BASE + (uint32_t)(s) * CFGSTORE_SLOT_SIZE))
+#define CFGSTORE_CRC_LEN        offsetof(CfgRecord, crc)
+
+static CfgRecord cfg_record;                    // Newest record (copy in RAM)
+static uint8_t  cfg_slot = CFGSTORE_NO_SLOT;    // Its flash slot
+static uint8_t  cfg_restored = 0;               // Booted from a record
+static uint8_t  cfg_protect = 0;                // Running protection mode
+static uint8_t  cfg_result = CFGSTORE_RES_OK;   // Last save or erase
+static uint32_t cfg_restore_start = 0;          // Time_Now32() at CfgStore_Restore()
+static uint32_t cfg_restore_us = 0;             // Restore to cyclic messages running
+
+/******************************************************************************
+ * Function: CfgStore_Valid
+ * Description:
+ *   Check header and CRC of a slot.
+ ******************************************************************************/
+static uint8_t CfgStore_Valid(const CfgRecord *r) {
+    return r->magic == CFGSTORE_MAGIC && r->version == CFGSTORE_VERSION &&
+           r->size == sizeof(CfgRecord) &&
+           Crc_Buffer(r, CFGSTORE_CRC_LEN) == r->crc;
+}
+
+/******************************************************************************
+ * Function: CfgStore_Restore
+ * Description:
+ *   Scans all slots; the header is compared before the CRC is spent.
+ ******************************************************************************/
+void CfgStore_Restore(void) {
+    const CfgRecord *best = 0;
+    const CfgRecord *r;
+
+    cfg_restore_start = Time_Now32();
+    for (uint8_t s = 0; s < CFGSTORE_SLOTS; s++) {
+        r = CFGSTORE_SLOT(s);
+        if (r->magic != CFGSTORE_MAGIC || (best && r->seq <= best->seq)) continue;
+        if (!CfgStore_Valid(r)) continue;
+        best = r;
+        cfg_slot = s;
+    }
+    if (!best) return;
+
+    cfg_record = *best;
+    cfg_protect = best->protect;
+    cfg_restored = (CAN_Preset(best->bitrate, best->can_mode) == 0);
+}
+
+/******************************************************************************
+ * Function: CfgStore_StartCyclic
+ * Description:
+ *   Starts each saved slot; first frames go out one period later.
+ ******************************************************************************/
+void CfgStore_StartCyclic(void) {
+    if (cfg_restored) {
+        for (uint8_t i = 0; i < TIMER_CYCLIC_SLOTS; i++) {
+            const CfgCyclic *c = &cfg_record.cyclic[i];
+            if (c->period_us) {
+                Timer_StartCyclic(i, c->mode, c->id, c->data, c->len, c->period_us);
+            }
+        }
+    }
+    cfg_restore_us = Time_Now32() - cfg_restore_start;
+}
+
+/******************************************************************************
+ * Function: CfgStore_Erased
+ * Description:
+ *   Check that a slot can be programmed (every word still erased).
+ ******************************************************************************/
+static uint8_t CfgStore_Erased(uint8_t slot) {
+    const uint32_t *w = (const uint32_t *)CFGSTORE_SLOT(slot);
+
+    for (uint8_t i = 0; i < CFGSTORE_SLOT_SIZE / 4; i++) {
+        if (w[i] != 0xFFFFFFFFUL) return 0;
+    }
+    return 1;
+}
+
+/******************************************************************************
+ * Function: CfgStore_ErasePages
+ * Description:
+ *   Erase pages of the store (flash unlocked by the caller).
+ ******************************************************************************/
+static uint8_t CfgStore_ErasePages(uint8_t first, uint8_t pages) {
+    FLASH_EraseInitTypeDef erase = { 0 };
+    uint32_t page_error;
+
+    erase.TypeErase   = FLASH_TYPEERASE_PAGES;
+    erase.Banks       = FLASH_BANK_1;
+    erase.PageAddress = CFGSTORE_BASE + (uint32_t)first * FLASH_PAGE_SIZE;
+    erase.NbPages     = pages;
+    return HAL_FLASHEx_Erase(&erase, &page_error) == HAL_OK;
+}
+
+/******************************************************************************
+ * Function: CfgStore_Save
+ * Description:
+ *   Capture the running configuration and append it as a new record.
+ *
+ *   The next slot is the first erased one after the current record in its
+ *   page. When that page is full the other page is erased and its first slot
+ *   used; the current record stays intact until the new one is complete.
+ ******************************************************************************/
+static uint8_t CfgStore_Save(void) {
+    CfgRecord rec;
+    const uint32_t *w = (const uint32_t *)&rec;
+    uint8_t page = (cfg_slot == CFGSTORE_NO_SLOT) ? 0 : cfg_slot / CFGSTORE_SLOTS_PER_PAGE;
+    uint8_t slot = (cfg_slot == CFGSTORE_NO_SLOT) ? 0 : cfg_slot + 1;
+    uint8_t ok = 1;
+    uint32_t addr;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.magic   = CFGSTORE_MAGIC;
+    rec.version = CFGSTORE_VERSION;
+    rec.size    = sizeof(CfgRecord);
+    rec.seq     = cfg_record.seq + 1;
+    rec.bitrate = CAN_GetBitrate();
+    rec.can_mode = CAN_GetTestMode();
+    rec.protect = cfg_protect;
+    for (uint8_t i = 0; i < TIMER_CYCLIC_SLOTS; i++) {
+        CfgCyclic *c = &rec.cyclic[i];
+        if (!Timer_GetCyclic(i, &c->mode, &c->id, c->data, &c->len, &c->period_us)) {
+            memset(c, 0, sizeof(*c));
+        }
+    }
+    rec.crc = Crc_Buffer(&rec, CFGSTORE_CRC_LEN);
+
+    while (slot < (page + 1) * CFGSTORE_SLOTS_PER_PAGE && !CfgStore_Erased(slot)) {
+        slot++;
+    }
+
+    HAL_FLASH_Unlock();
+    if (slot == (page + 1) * CFGSTORE_SLOTS_PER_PAGE) {
+        page = (cfg_slot == CFGSTORE_NO_SLOT) ? 0 : page ^ 1;   // Page full: take the other one
+        slot = page * CFGSTORE_SLOTS_PER_PAGE;
+        ok = CfgStore_ErasePages(page, 1);
+    }
+    addr = (uint32_t)CFGSTORE_SLOT(slot);
+    for (uint8_t i = 1; ok && i < sizeof(CfgRecord) / 4; i++) {
+        ok = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr + 4 * i, w[i]) == HAL_OK;
+    }
+    if (ok) {
+        ok = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr, w[0]) == HAL_OK;  // Header commits
+    }
+    HAL_FLASH_Lock();
+
+    if (!ok) return CFGSTORE_RES_FLASH;
+    if (memcmp(CFGSTORE_SLOT(slot), &rec, sizeof(rec)) != 0) return CFGSTORE_RES_VERIFY;
+    cfg_record = rec;
+    cfg_slot = slot;
+    return CFGSTORE_RES_OK;
+}
+
+/******************************************************************************
+ * Function: CfgStore_Command
+ * Description:
+ *   Saves, erases or sets the protection mode, then replies with the stored
+ *   configuration.
+ ******************************************************************************/
+void CfgStore_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[19];
+    uint8_t op = (len >= 1) ? args[0] : CFGSTORE_OP_STATUS;
+    uint8_t mask = 0;
+
+    if (op == CFGSTORE_OP_SAVE) {
+        cfg_result = CfgStore_Save();
+    } else if (op == CFGSTORE_OP_ERASE) {
+        HAL_FLASH_Unlock();
+        cfg_result = CfgStore_ErasePages(0, CFGSTORE_PAGES) ? CFGSTORE_RES_OK : CFGSTORE_RES_FLASH;
+        HAL_FLASH_Lock();
+        memset(&cfg_record, 0, sizeof(cfg_record));
+        cfg_slot = CFGSTORE_NO_SLOT;
+    } else if (op == CFGSTORE_OP_PROTECT && len >= 2) {
+        cfg_protect = args[1] ? 1 : 0;
+    }
+
+    for (uint8_t i = 0; i < TIMER_CYCLIC_SLOTS; i++) {
+        if (cfg_record.cyclic[i].period_us) mask |= 1 << i;
+    }
+    reply[0] = op;
+    reply[1] = cfg_result;
+    reply[2] = cfg_restored;
+    UART_PutU32(&reply[3], cfg_record.seq);
+    reply[7] = cfg_slot;
+    UART_PutU32(&reply[8], cfg_restore_us);
+    UART_PutU32(&reply[12], cfg_record.bitrate);
+    reply[16] = cfg_record.can_mode;
+    reply[17] = mask;
+    reply[18] = cfg_protect;
+    UART_SendReply(UART_CMD_CFGSTORE, reply, sizeof(reply));
+}
+
+/******************************************************************************
+ * End of File
+ ******************************************************************************/
@@ -0,0 +1,74 @@
+/*****************************************************************************
+ * @file    clock.c
+ * @brief   System clock configuration: HSE + PLL at 72 MHz with HSI fallback
+ *****************************************************************************/
+
+/******************************************************************************
+ * Include files
+ ******************************************************************************/
+#include "clock.h"
+
+/******************************************************************************
+ * Function: Clock_Config
+ * Description:
+ *   Starts the 8 MHz crystal and runs the PLL at x9 for a 72 MHz SYSCLK.
+ *   Flash needs 2 wait states above 48 MHz and APB1 is limited to 36 MHz.
+ *   Without a crystal the PLL is fed from HSI/2, still giving 36 MHz on APB1.
+ ******************************************************************************/
+void Clock_Config(void) {
+    uint32_t timeout = CLOCK_HSE_TIMEOUT;
+    uint32_t cfgr;
+
+    RCC->CR |= (1 << 16);                                   // HSEON: start the crystal oscillator
+    while (!(RCC->CR & (1 << 17)) && --timeout);            // Wait for HSERDY
+
+    FLASH->ACR = (1 << 4) | (2 << 0);                       // Prefetch buffer on, 2 wait states
+
+    if (RCC->CR & (1 << 17)) {
+        cfgr = (7 << 18)                                    // PLLMUL = x9
+             | (1 << 16)                                    // PLLSRC = HSE (no /2)
+             | (0 << 11)                                    // PPRE2 = /1 (72 MHz)
+             | (4 << 8)                                     // PPRE1 = /2 (36 MHz)
+             | (0 << 4);                                    // HPRE  = /1
+    } else {
+        RCC->CR &= ~(1 << 16);                              // Crystal missing: stop HSE
+        cfgr = (7 << 18)                                    // PLLMUL = x9, PLLSRC = HSI/2 -> 36 MHz
+             | (0 << 11)                                    // PPRE2 = /1 (36 MHz)
+             | (0 << 8)                                     // PPRE1 = /1 (36 MHz)
+             | (0 << 4);                                    // HPRE  = /1
+    }
+    RCC->CFGR = cfgr;                                       // SYSCLK still on HSI (SW = 00)
+
+    RCC->CR |= (1 << 24);                                   // PLLON
+    while (!(RCC->CR & (1 << 25)));                         // Wait for PLLRDY
+
+    RCC->CFGR = cfgr | (2 << 0);                            // SW = PLL
+    while (((RCC->CFGR >> 2) & 0x3) != 2);                  // Wait until SWS reports PLL
+
+    SystemCoreClockUpdate();                                // Recompute SystemCoreClock from RCC
+}
+
+/******************************************************************************
+ * Function: Clock_GetPclk2
+ * Description:
+ *   Returns the APB2 clock derived from SystemCoreClock and PPRE2.
+ ******************************************************************************/
+uint32_t Clock_GetPclk2(void) {
+    return SystemCoreClock >> APBPrescTable[(RCC->CFGR >> 11) & 0x7];
+}
+
+/******************************************************************************
+ * Function: Clock_GetTimerClock
+ * Description:
+ *   Returns the TIM2-TIM4 clock. When APB1 is divided the timers run at
+ *   2x PCLK1.
+ ******************************************************************************/
+uint32_t Clock_GetTimerClock(void) {
+    uint32_t ppre1 = (RCC->CFGR >> 8) & 0x7;
+    uint32_t pclk1 = SystemCoreClock >> APBPrescTable[ppre1];
+    return (ppre1 < 4) ? pclk1 : pclk1 * 2;
+}
+
+/******************************************************************************
+ * End of File
+ ******************************************************************************/
@@ -0,0 +1,245 @@
+/*****************************************************************************
+ * @file    forward.c
+ * @brief   Forwarding queue: the CAN RX interrupt queues frames, the main
+ *          loop sends them to the host; overflow policy and loss accounting
+ *****************************************************************************/
+
+/******************************************************************************
+ * Include files
+ ******************************************************************************/
+#include "forward.h"
+#include "uart.h"
+#include "timebase.h"
+#include "compact.h"
+#include "sched.h"
+
+/******************************************************************************
+ * Local variables
+ ******************************************************************************/
+_Static_assert(sizeof(FwdFrame) <= POOL_BLOCK_SIZE, "FwdFrame does not fit a pool block");
+
+static uint8_t  fwd_queue[FWD_QUEUE_LEN];       // Ring of pool handles of received frames
+static volatile uint8_t fwd_head = 0;           // Oldest queued frame
+static volatile uint8_t fwd_count = 0;          // Frames in the queue
+static volatile uint8_t fwd_busy = 0;           // Fwd_Poll() is encoding the oldest frame in place
+static uint8_t  fwd_high_water = 0;             // Most frames queued at once
+static uint8_t  fwd_policy = FWD_POLICY_DROP_NEWEST;
+static uint16_t fwd_seq = 0;                    // Sequence number of the next received frame
+static uint32_t fwd_dropped_newest = 0;         // Arrived to a full queue and discarded
+static uint32_t fwd_dropped_oldest = 0;         // Pushed out of a full queue by a newer frame
+static uint32_t fwd_superseded = 0;             // Replaced by a newer frame with the same ID
+static uint32_t fwd_fifo_overruns = 0;          // bxCAN FIFO 0 overruns
+
+/******************************************************************************
+ * Function: Fwd_Remove
+ * Description:
+ *   Frees the frame at position pos (0 = oldest) and closes the gap, so
+ *   the queue stays in sequence order; only handles move. Only used on
+ *   overflow.
+ ******************************************************************************/
+static void Fwd_Remove(uint8_t pos) {
+    Pool_Free(fwd_queue[(fwd_head + pos) % FWD_QUEUE_LEN]);
+    for (uint8_t i = pos; i + 1 < fwd_count; i++) {
+        fwd_queue[(fwd_head + i) % FWD_QUEUE_LEN] = fwd_queue[(fwd_head + i + 1) % FWD_QUEUE_LEN];
+    }
+    fwd_count--;
+}
+
+/******************************************************************************
+ * Function: Fwd_Push
+ * Description:
+ *   Numbers the frame, stores its register image in a pool block and queues
+ *   the handle. When the queue is full the policy decides which frame is
+ *   lost; each case has its own counter. The frame Fwd_Poll() is encoding in
+ *   place is never chosen. An empty pool counts as a full queue that keeps
+ *   its frames.
+ ******************************************************************************/
+void Fwd_Push(const CanFrame *frame, uint8_t len, uint8_t attack) {
+    uint16_t seq = fwd_seq++;                   // Lost frames use up their number too
+    uint8_t first = fwd_busy;                   // Oldest frame is being read, keep it
+    FwdFrame *f;
+    uint8_t h;
+
+    if (fwd_count == FWD_QUEUE_LEN) {
+        if (fwd_policy == FWD_POLICY_DROP_NEWEST) {
+            fwd_dropped_newest++;
+            return;
+        }
+        if (fwd_policy == FWD_POLICY_LATEST_ID) {
+            uint8_t pos = first;
+            while (pos < fwd_count) {
+                f = Pool_Block(fwd_queue[(fwd_head + pos) % FWD_QUEUE_LEN]);
+                if (f->can.rir == frame->rir) break;    // Same ID and IDE (RTR kept apart)
+                pos++;
+            }
+            if (pos < fwd_count) {
+                Fwd_Remove(pos);                // Older value of this ID is stale
+                fwd_superseded++;
+            }
+        }
+        if (fwd_count == FWD_QUEUE_LEN) {
+            if (first) {
+                Fwd_Remove(1);
+            } else {
+                Pool_Free(fwd_queue[fwd_head]);
+                fwd_head = (fwd_head + 1) % FWD_QUEUE_LEN;
+                fwd_count--;
+            }
+            fwd_dropped_oldest++;
+        }
+    }
+
+    h = Pool_Alloc();
+    if (h == POOL_NONE) {                       // Host path over its share
+        fwd_dropped_newest++;
+        return;
+    }
+    f = Pool_Block(h);
+    f->can = *frame;                            // Four word stores
+    f->stamp = Time_Now32();
+    f->seq = seq;
+    f->len = len;
+    f->attack = attack;
+    fwd_queue[(fwd_head + fwd_count) % FWD_QUEUE_LEN] = h;
+    fwd_count++;
+
+    if (fwd_count > fwd_high_water) {
+        fwd_high_water = fwd_count;
+    }
+    Sched_Post(SCHED_EVT_CAN_RX);
+}
+
+/******************************************************************************
+ * Function: Fwd_FifoOverrun
+ * Description:
+ *   Counts a FOVR0 event seen by the RX interrupt.
+ ******************************************************************************/
+void Fwd_FifoOverrun(void) {
+    fwd_fifo_overruns++;
+}
+
+/******************************************************************************
+ * Function: Fwd_SendPlain
+ * Description:
+ *   Builds the plain record for one frame (layout in forward.h).
+ ******************************************************************************/
+static void Fwd_SendPlain(const FwdFrame *f) {
+    uint8_t rec[FWD_REC_MAX];
+    uint8_t n = 0;
+    uint8_t ide = CAN_FRAME_IDE(&f->can);
+    uint32_t id = CAN_FRAME_ID(&f->can);
+
+    rec[n++] = ide;                             // IDE flag
+    if (ide) {
+        rec[n++] = (id >> 24) & 0xFF;           // Extended ID byte 3 (MSB)
+        rec[n++] = (id >> 16) & 0xFF;           // Extended ID byte 2
+        rec[n++] = (id >>  8) & 0xFF;           // Extended ID byte 1
+        rec[n++] =  id        & 0xFF;           // Extended ID byte 0 (LSB)
+    } else {
+        rec[n++] = (id >> 8) & 0xFF;            // Standard ID high byte
+        rec[n++] =  id       & 0xFF;            // Standard ID low byte
+    }
+
+    rec[n++] = f->len;                          // Payload length (excluding counter)
+    memcpy(&rec[n], CAN_FRAME_DATA(&f->can), f->len);   // Payload bytes
+    n += f->len;
+
+    rec[n++] = f->attack;                       // Attack flag byte
+    rec[n++] = (f->seq >> 8) & 0xFF;            // Sequence number
+    rec[n++] =  f->seq       & 0xFF;
+    UART_SendRecord(rec, n);
+}
+
+/******************************************************************************
+ * Function: Fwd_Poll
+ * Description:
+ *   Encodes the oldest frame straight from its pool block; fwd_busy keeps
+ *   the RX interrupt's overflow handling away from that block meanwhile, the
+ *   interrupt is masked only to dequeue it, and the block is freed after. At most FWD_POLL_BUDGET
+ *   frames per run; if more are queued the event is posted again, so the
+ *   scheduler can run a pending UART command first under full bus load.
+ ******************************************************************************/
+void Fwd_Poll(void) {
+    const FwdFrame *f;
+    uint8_t h;
+
+    for (uint8_t i = 0; i < FWD_POLL_BUDGET; i++) {
+        if (fwd_count == 0) {                   // The interrupt only ever adds frames
+            return;
+        }
+        fwd_busy = 1;
+        __DMB();                                // Head is read after the block is claimed
+        h = fwd_queue[fwd_head];
+        f = Pool_Block(h);
+
+        if (Compact_IsEnabled()) {
+            Compact_Forward(f);                 // Dictionary/XOR-delta record
+        } else {
+            Fwd_SendPlain(f);
+        }
+
+        NVIC_DisableIRQ(CAN1_RX0_IRQn);
+        fwd_head = (fwd_head + 1) % FWD_QUEUE_LEN;
+        fwd_count--;
+        fwd_busy = 0;
+        Pool_Free(h);                           // Slot and block free together
+        NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    }
+    if (fwd_count) {
+        Sched_Post(SCHED_EVT_CAN_RX);           // Rest in the next run
+    }
+}
+
+/******************************************************************************
+ * Function: Fwd_NextSeq
+ * Description:
+ *   The oldest queued frame, or the next frame to arrive if the queue is
+ *   empty.
+ ******************************************************************************/
+uint16_t Fwd_NextSeq(void) {
+    uint16_t seq;
+
+    NVIC_DisableIRQ(CAN1_RX0_IRQn);
+    seq = fwd_count ? ((const FwdFrame*)Pool_Block(fwd_queue[fwd_head]))->seq : fwd_seq;
+    NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    return seq;
+}
+
+/******************************************************************************
+ * Function: Fwd_Command
+ * Description:
+ *   Selects the overflow policy (clearing the counters) and replies with the
+ *   queue state and the loss counters.
+ ******************************************************************************/
+void Fwd_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[22];
+
+    if (len >= 1 && args[0] < FWD_POLICY_COUNT) {
+        NVIC_DisableIRQ(CAN1_RX0_IRQn);
+        fwd_policy = args[0];
+        fwd_high_water = fwd_count;
+        fwd_dropped_newest = 0;
+        fwd_dropped_oldest = 0;
+        fwd_superseded = 0;
+        fwd_fifo_overruns = 0;
+        NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    }
+
+    NVIC_DisableIRQ(CAN1_RX0_IRQn);             // Consistent snapshot
+    reply[0] = fwd_policy;
+    reply[1] = FWD_QUEUE_LEN;
+    reply[2] = fwd_count;
+    reply[3] = fwd_high_water;
+    reply[4] = (fwd_seq >> 8) & 0xFF;
+    reply[5] =  fwd_seq       & 0xFF;
+    UART_PutU32(&reply[6], fwd_dropped_newest);
+    UART_PutU32(&reply[10], fwd_dropped_oldest);
+    UART_PutU32(&reply[14], fwd_superseded);
+    UART_PutU32(&reply[18], fwd_fifo_overruns);
+    NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    UART_SendReply(UART_CMD_FWD, reply, sizeof(reply));
+}
+
+/******************************************************************************
+ * End of File
+ ******************************************************************************/
@@ -0,0 +1,211 @@
+/*****************************************************************************
+ * @file    idstats.c
+ * @brief   Per-ID traffic statistics: a fixed open-addressing table updated
+ *          by the CAN RX interrupt, read back in slot ranges by the host
+ *****************************************************************************/
+
+/******************************************************************************
+ * Include files
+ ******************************************************************************/
+#include "idstats.h"
+#include "uart.h"
+#include "timebase.h"
+#include "crc.h"
+
+/******************************************************************************
+ * Local types and variables
+ ******************************************************************************/
+
+/**
+ * @brief Statistics of one (IDE, ID).
+ */
+typedef struct {
+    uint32_t key;           // IdStats_Key(), 0 = free
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t gap_sum;       // Sum of the gaps, bits 0-31 (us)
+    uint32_t last;          // Time_Now32() of the latest frame (us)
+    uint32_t gap_min;       // Inter-arrival times (us)
+    uint32_t gap_max;
+    uint32_t hash;          // Crc_Payload() of the latest payload
+    uint32_t remote;        // Remote frames
+    uint32_t changes;       // Payload differed from the previous frame
+    uint32_t attacks;       // Flagged by replay detection
+    uint8_t  dlc;           // Latest DLC
+    uint8_t  dirty;         // Updated since last read by IDSTATS_OP_CHANGES
+    uint16_t gap_sum_hi;    // Bits 32-47 (in the padding)
+} IdStatsEntry;
+
+static IdStatsEntry idstats_table[IDSTATS_SLOTS];
+static uint8_t  idstats_used = 0;               // Entries taken
+static uint32_t idstats_overflow = 0;           // Frames of IDs without an entry
+static uint32_t idstats_frames = 0;             // All frames accounted
+static uint32_t idstats_since = 0;              // Time base at the last clear (us)
+
+/******************************************************************************
+ * Function: IdStats_Key
+ * Description:
+ *   RIR with the RTR bit dropped and the unused EXID bits of a standard
+ *   frame masked, bit 0 set so a key is never 0.
+ ******************************************************************************/
+static uint32_t IdStats_Key(const CanFrame *frame) {
+    uint32_t mask = CAN_FRAME_IDE(frame) ? 0xFFFFFFFCUL : 0xFFE00004UL;
+
+    return (frame->rir & mask) | 1;
+}
+
+/******************************************************************************
+ * Function: IdStats_Find
+ * Description:
+ *   Multiplicative hash of the key, then at most IDSTATS_PROBES linear
+ *   probes. Entries are only freed all at once by a clear, so the first
+ *   free slot ends the search and is taken for a new ID. Returns 0 when
+ *   none of the probed slots matches or is free.
+ ******************************************************************************/
+static IdStatsEntry *IdStats_Find(uint32_t key) {
+    uint32_t slot = (key * 2654435761UL) >> (32 - IDSTATS_SLOT_BITS);
+    IdStatsEntry *e;
+
+    for (uint8_t i = 0; i < IDSTATS_PROBES; i++) {
+        e = &idstats_table[(slot + i) & (IDSTATS_SLOTS - 1)];
+        if (e->key == key) return e;
+        if (e->key == 0) {
+            e->key = key;
+            e->gap_min = 0xFFFFFFFFUL;
+            idstats_used++;
+            return e;
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************
+ * Function: IdStats_Frame
+ * Description:
+ *   Updates the frame's entry: counts, inter-arrival extremes, latest DLC
+ *   and payload CRC. The gaps are summed in 48 bits (8.9 years of
+ *   microseconds) for the mean, which is derived when read.
+ ******************************************************************************/
+void IdStats_Frame(const CanFrame *frame, uint8_t attack) {
+    IdStatsEntry *e = IdStats_Find(IdStats_Key(frame));
+    uint32_t now = Time_Now32();
+    uint8_t len = CAN_FRAME_LEN(frame);
+    uint32_t hash, gap;
+
+    idstats_frames++;
+    if (!e) {
+        idstats_overflow++;
+        return;
+    }
+
+    if (frame->rir & (1 << 1)) {                // Remote frame: no data
+        e->remote++;
+        len = 0;
+    }
+    hash = Crc_Payload(frame, len);
+
+    if (e->frames != 0) {
+        gap = now - e->last;
+        e->gap_sum += gap;
+        if (e->gap_sum < gap) e->gap_sum_hi++;  // Carry
+        if (gap < e->gap_min) e->gap_min = gap;
+        if (gap > e->gap_max) e->gap_max = gap;
+        if (hash != e->hash) e->changes++;
+    }
+    e->frames++;
+    e->bytes += len;
+    e->last = now;
+    e->hash = hash;
+    e->dlc = CAN_FRAME_DLC(frame);
+    if (attack) e->attacks++;
+    e->dirty = 1;
+}
+
+/******************************************************************************
+ * Function: IdStats_Dump
+ * Description:
+ *   Replies with the used entries among slots first..first+slots-1 (all of
+ *   them, or for IDSTATS_OP_CHANGES only those updated since their last
+ *   read).
+ *   Each entry is copied with the RX interrupt masked.
+ ******************************************************************************/
+static void IdStats_Dump(uint8_t op, uint8_t first, uint8_t slots) {
+    uint8_t reply[4 + IDSTATS_DUMP_MAX * IDSTATS_REC_LEN];
+    uint8_t count = 0;
+    uint8_t n = 4;
+    IdStatsEntry e;
+    uint32_t now, mean;
+
+    if (first > IDSTATS_SLOTS) first = IDSTATS_SLOTS;
+    if (slots > IDSTATS_DUMP_MAX) slots = IDSTATS_DUMP_MAX;
+    if (slots > IDSTATS_SLOTS - first) slots = IDSTATS_SLOTS - first;
+
+    for (uint8_t i = first; i < first + slots; i++) {
+        NVIC_DisableIRQ(CAN1_RX0_IRQn);
+        e = idstats_table[i];
+        idstats_table[i].dirty = 0;
+        now = Time_Now32();
+        NVIC_EnableIRQ(CAN1_RX0_IRQn);
+
+        if (e.key == 0 || (op == IDSTATS_OP_CHANGES && !e.dirty)) continue;
+
+        mean = (e.frames > 1) ? (((uint64_t)e.gap_sum_hi << 32) | e.gap_sum) / (e.frames - 1) : 0;
+        reply[n] = (e.key >> 2) & 1;
+        UART_PutU32(&reply[n + 1], (e.key & (1 << 2)) ? e.key >> 3 : e.key >> 21);
+        UART_PutU32(&reply[n + 5], e.frames);
+        UART_PutU32(&reply[n + 9], e.bytes);
+        UART_PutU32(&reply[n + 13], (e.frames > 1) ? e.gap_min : 0);
+        UART_PutU32(&reply[n + 17], e.gap_max);
+        UART_PutU32(&reply[n + 21], mean);
+        UART_PutU32(&reply[n + 25], now - e.last);
+        reply[n + 29] = e.dlc;
+        UART_PutU32(&reply[n + 30], e.hash);
+        UART_PutU32(&reply[n + 34], e.remote);
+        UART_PutU32(&reply[n + 38], e.changes);
+        UART_PutU32(&reply[n + 42], e.attacks);
+        n += IDSTATS_REC_LEN;
+        count++;
+    }
+
+    reply[0] = op;
+    reply[1] = first;
+    reply[2] = slots;
+    reply[3] = count;
+    UART_SendReply(UART_CMD_IDSTATS, reply, n);
+}
+
+/******************************************************************************
+ * Function: IdStats_Command
+ * Description:
+ *   Clears the table or dumps a slot range; otherwise (and after a clear)
+ *   replies with the table state.
+ ******************************************************************************/
+void IdStats_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[15];
+
+    if (len >= 3 && (args[0] == IDSTATS_OP_DUMP || args[0] == IDSTATS_OP_CHANGES)) {
+        IdStats_Dump(args[0], args[1], args[2]);
+        return;
+    }
+
+    NVIC_DisableIRQ(CAN1_RX0_IRQn);
+    if (len >= 1 && args[0] == IDSTATS_OP_CLEAR) {
+        memset(idstats_table, 0, sizeof(idstats_table));
+        idstats_used = 0;
+        idstats_overflow = 0;
+        idstats_frames = 0;
+        idstats_since = Time_Now32();
+    }
+    reply[0] = IDSTATS_OP_STATUS;
+    reply[1] = IDSTATS_SLOTS;
+    reply[2] = idstats_used;
+    UART_PutU32(&reply[3], idstats_overflow);
+    UART_PutU32(&reply[7], idstats_frames);
+    UART_PutU32(&reply[11], Time_Now32() - idstats_since);
+    NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    UART_SendReply(UART_CMD_IDSTATS, reply, sizeof(reply));
+}
+
+/******************************************************************************
+ * End of File
+ ******************************************************************************/
@@ -7,69 +7,90 @@
  * Include files
  ******************************************************************************/
 #include "main.h"
+#include "clock.h"
 #include "gpio.h"
 #include "uart.h"
 #include "can.h"
 #include "timer.h"
+#include "bench.h"
+#include "forward.h"
+#include "timebase.h"
+#include "sched.h"
+#include "crc.h"
+#include "cfgstore.h"
+#include "tsync.h"
+#include "pool.h"
 
 /******************************************************************************
  * Global variable definitions
  ******************************************************************************/
-volatile uint8_t uart_rx_buffer[UART_RX_BUFFER_SIZE];  // UART receive buffer
-volatile uint16_t uart_rx_index = 0;                   // Current index in UART buffer
-volatile uint8_t uart_frame_ready = 0;                 // Flag: UART frame received completely
-volatile uint8_t can_rx_buffer[CAN_RX_BUFFER_SIZE];    // CAN receive buffer
-volatile uint8_t can_frame_ready = 0;                  // Flag: CAN frame received
-volatile uint8_t repeat = 0;                            // Flag: whether to repeatedly send CAN frame
-volatile uint8_t current_frame[CURRENT_FRAME_SIZE];    // Buffer for repeated CAN frame
+volatile uint16_t uart_rx_index = 0;                   // Current index in the UART frame being assembled
 volatile uint8_t tx_counter = 0;                        // Transmit frame counter (increments every send)
 volatile uint8_t attack_flag = 0;                       // Flag for special condition (e.g., attack detection)
 volatile CounterTracker rx_tracker = {0, 0};            // Struct to track CAN receive counters (example)
 
+/******************************************************************************
+ * Function: Task_Timeouts
+ * Description:
+ *   Timed work, run when the deadline armed by Power_Idle() is due.
+ ******************************************************************************/
+static void Task_Timeouts(void) {
+    UART_BatchPoll();           // Send a batch that reached its age limit
+    UART_BaudCheck();           // Fall back if a new UART speed was not confirmed
+    Tsync_Poll();               // SYNC/FUP due (master), received pair (slave)
+}
+
+/******************************************************************************
+ * Main loop tasks, highest priority first
+ ******************************************************************************/
+static const SchedTask main_tasks[] = {
+    { SCHED_EVT_UART_RX, Process_UART_Frame, 5000 },  // Host frames queued by USART1
+    { SCHED_EVT_TIMEOUT, Task_Timeouts,      2000 },  // Batch age, baud, time sync
+    { SCHED_EVT_CAN_RX,  Fwd_Poll,           2000 },  // Forward received CAN frames
+};
+
 /******************************************************************************
  * Function: main
  * Description:
  *   Main program entry point.
  *   Initializes all required modules:
+ *     - Links the frame pool, before any interrupt can allocate from it
+ *     - Switches the system clock to the 72 MHz PLL
+ *     - Starts the 1 us time base (TIM3 -> TIM4) used for timestamps
  *     - Configures GPIO pins
- *     - Configures UART, CAN, and Timer2 peripherals
- *     - Initializes buffer indices and status flags
+ *     - Clocks the CRC unit and DMA1 before CAN reception starts
+ *     - Configures UART, CAN and the cyclic transmit deadlines (TIM3 compare)
+ *       with the configuration saved in flash, if any (cfgstore.h)
+ *     - Starts the DWT cycle counter used by the benchmark and the
+ *       scheduler's run-time accounting
+ *     - Initializes buffer indices
  *
- *   Main infinite loop:
- *     - Checks if a full UART frame has been received from PC, processes it, then resets buffer.
- *     - Checks if a new CAN frame is available (set in CAN interrupt), processes accordingly.
+ *   Then hands over to the scheduler (sched.h). The USART1, CAN RX and TIM3
+ *   interrupts post events; the scheduler runs the matching task from
+ *   main_tasks[] and sleeps (WFI/WFE, see power.h) when none is pending.
  ******************************************************************************/
 int main(void) {
     // Initialize all hardware modules
+    Pool_Init();                // Frame pool free list, before any interrupt
+    Clock_Config();
+    Time_Init();
     GPIO_Config();
+    Crc_Init();
     UART_Config();
+    CfgStore_Restore();         // Saved bit rate and test mode, before CAN starts
     CAN_Config();
-    Timer2_Config();
+    Timer_Config();
+    CfgStore_StartCyclic();
+    Bench_Init();
 
     // Initialize state variables and buffers
     uart_rx_index = 0;
-    uart_frame_ready = 0;
-    can_frame_ready = 0;
-    repeat = 0;
 
     // Optional: send a startup message to UART
     // UART_SendString("CAN Bridge Ready\r\n");
 
-    while (1) {
-        // If a complete UART frame is ready, process it
-        if (uart_frame_ready) {
-            uart_frame_ready = 0;   // Clear flag
-            Process_UART_Frame();   // Decode and handle UART frame
-            uart_rx_index = 0;      // Reset UART buffer index for next frame
-        }
-
-        // If a CAN frame is received (flag set in CAN ISR)
-        if (can_frame_ready) {
-            can_frame_ready = 0;    // Clear flag
-            // Frame is already processed inside CAN interrupt handler
-            // Optional additional processing can be done here
-        }
-    }
+    Sched_Init(main_tasks, sizeof(main_tasks) / sizeof(main_tasks[0]));
+    Sched_Run();                // Never returns
 }
 
 /******************************************************************************
@@ -0,0 +1,157 @@
+/*****************************************************************************
+ * @file    pool.c
+ * @brief   Frame pool: free list of fixed-size blocks with lock-free
+ *          allocation, occupancy accounting and the host command
+ *****************************************************************************/
+
+/******************************************************************************
+ * Include files
+ ******************************************************************************/
+#include "pool.h"
+#include "uart.h"
+
+/******************************************************************************
+ * Local variables
+ ******************************************************************************/
+
+_Static_assert(POOL_BLOCKS < POOL_NONE, "handles are 8 bits with POOL_NONE reserved");
+_Static_assert(POOL_BLOCK_SIZE % 4 == 0, "blocks must stay word aligned");
+
+/**
+ * @brief Free list state in one word, so a single exclusive store updates
+ *        it: bits 0-7 first free block, bits 8-15 free blocks, bits 16-23
+ *        fewest free blocks seen (the high water mark of use).
+ */
+#define POOL_HEAD(s)            ((s) & 0xFFUL)
+#define POOL_FREE(s)            (((s) >> 8) & 0xFFUL)
+#define POOL_LOW(s)             (((s) >> 16) & 0xFFUL)
+#define POOL_STATE(head, free, low)  ((uint32_t)(head) | ((uint32_t)(free) << 8) | ((uint32_t)(low) << 16))
+
+static uint32_t pool_mem[POOL_BLOCKS][POOL_BLOCK_SIZE / 4];  // Block storage
+static uint8_t  pool_next[POOL_BLOCKS];         // Free list links, valid for free blocks
+static volatile uint32_t pool_state = 0;        // POOL_STATE(head, free, low)
+static volatile uint32_t pool_allocs = 0;       // Blocks handed out
+static volatile uint32_t pool_failures = 0;     // Pool_Alloc() calls on an empty pool
+
+/******************************************************************************
+ * Function: Pool_Count
+ * Description:
+ *   Increments a counter shared by interrupts of different priority.
+ ******************************************************************************/
+static void Pool_Count(volatile uint32_t *counter) {
+    uint32_t v;
+
+    do {
+        v = __LDREXW(counter);
+    } while (__STREXW(v + 1, counter));
+}
+
+/******************************************************************************
+ * Function: Pool_Init
+ * Description:
+ *   Chains the blocks in order; all are free.
+ ******************************************************************************/
+void Pool_Init(void) {
+    for (uint8_t i = 0; i < POOL_BLOCKS; i++) {
+        pool_next[i] = (i + 1 < POOL_BLOCKS) ? i + 1 : POOL_NONE;
+    }
+    pool_state = POOL_STATE(0, POOL_BLOCKS, POOL_BLOCKS);
+    pool_allocs = 0;
+    pool_failures = 0;
+}
+
+/******************************************************************************
+ * Function: Pool_Alloc
+ * Description:
+ *   Pops the head of the free list.
+ *
+ *   The link of the head block is read between the exclusive load and store.
+ *   Any exception in between clears the exclusive monitor, so if an interrupt
+ *   pops or pushes blocks meanwhile the store fails and the pop starts over
+ *   with the new head; a stale link is never stored (no ABA on a single
+ *   core).
+ ******************************************************************************/
+uint8_t Pool_Alloc(void) {
+    uint32_t s, free, low;
+    uint8_t h;
+
+    do {
+        s = __LDREXW(&pool_state);
+        free = POOL_FREE(s);
+        if (free == 0) {
+            __CLREX();
+            Pool_Count(&pool_failures);
+            return POOL_NONE;
+        }
+        h = POOL_HEAD(s);
+        low = POOL_LOW(s);
+        if (free - 1 < low) {
+            low = free - 1;
+        }
+    } while (__STREXW(POOL_STATE(pool_next[h], free - 1, low), &pool_state));
+
+    Pool_Count(&pool_allocs);
+    return h;
+}
+
+/******************************************************************************
+ * Function: Pool_Free
+ * Description:
+ *   Pushes the block on the free list.
+ *
+ *   The block's link is written inside the exclusive pair: it belongs to the
+ *   caller until the store succeeds, and is rewritten on a retry.
+ ******************************************************************************/
+void Pool_Free(uint8_t h) {
+    uint32_t s;
+
+    if (h >= POOL_BLOCKS) {
+        return;
+    }
+    do {
+        s = __LDREXW(&pool_state);
+        pool_next[h] = POOL_HEAD(s);
+    } while (__STREXW(POOL_STATE(h, POOL_FREE(s) + 1, POOL_LOW(s)), &pool_state));
+}
+
+/******************************************************************************
+ * Function: Pool_Block
+ * Description:
+ *   Returns the block address of a handle.
+ ******************************************************************************/
+void *Pool_Block(uint8_t h) {
+    return pool_mem[h];
+}
+
+/******************************************************************************
+ * Function: Pool_Command
+ * Description:
+ *   Reports the occupancy and counters; POOL_OP_CLEAR then restarts the high
+ *   water mark from the current use.
+ ******************************************************************************/
+void Pool_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[13];
+    uint32_t s = pool_state;
+    uint8_t op = (len >= 1) ? args[0] : POOL_OP_STATUS;
+
+    reply[0] = op;
+    reply[1] = POOL_BLOCKS;
+    reply[2] = POOL_BLOCK_SIZE;
+    reply[3] = POOL_BLOCKS - POOL_FREE(s);
+    reply[4] = POOL_BLOCKS - POOL_LOW(s);
+    UART_PutU32(&reply[5], pool_failures);
+    UART_PutU32(&reply[9], pool_allocs);
+    UART_SendReply(UART_CMD_POOL, reply, sizeof(reply));
+
+    if (op == POOL_OP_CLEAR) {
+        do {
+            s = __LDREXW(&pool_state);
+        } while (__STREXW(POOL_STATE(POOL_HEAD(s), POOL_FREE(s), POOL_FREE(s)), &pool_state));
+        pool_failures = 0;
+        pool_allocs = 0;
+    }
+}
+
+/******************************************************************************
+ * End of File
+ ******************************************************************************/
@@ -0,0 +1,230 @@
+/*****************************************************************************
+ * @file    power.c
+ * @brief   Tickless idle (WFI/WFE) with a TIM3 channel 2 wakeup for timed
+ *          work, and a SysTick probe for the wakeup latency
+ *****************************************************************************/
+
+/******************************************************************************
+ * Include files
+ ******************************************************************************/
+#include "power.h"
+#include "uart.h"
+#include "timebase.h"
+#include "bench.h"
+#include "sched.h"
+#include "tsync.h"
+
+/******************************************************************************
+ * Local types and variables
+ ******************************************************************************/
+
+/**
+ * @brief Min/max/sum of one latency measure, in core cycles.
+ */
+typedef struct {
+    uint32_t min;
+    uint32_t max;
+    uint32_t sum;
+} PowerLatency;
+
+static uint8_t  power_depth = POWER_SLEEP_DEFAULT;
+static uint32_t power_sleeps = 0;               // Times the main loop slept
+static uint32_t power_asleep_us = 0;            // Time spent in WFI/WFE
+static uint32_t power_since = 0;                // Time base at the last reset (0 = boot)
+static uint16_t power_probes = 0;               // Probes completed
+static PowerLatency power_irq = {0xFFFFFFFFUL, 0, 0};   // Counter zero -> SysTick handler
+static PowerLatency power_proc = {0xFFFFFFFFUL, 0, 0};  // SysTick handler -> main loop
+static volatile uint8_t  power_probe_done = 0;
+static volatile uint32_t power_probe_irq = 0;   // Cycles measured in the handler
+static volatile uint32_t power_probe_stamp = 0; // DWT cycles at the end of the handler
+
+/******************************************************************************
+ * Function: Power_Reset
+ * Description:
+ *   Clears the sleep and latency statistics.
+ ******************************************************************************/
+static void Power_Reset(void) {
+    power_sleeps = 0;
+    power_asleep_us = 0;
+    power_since = Time_Now32();
+    power_probes = 0;
+    power_irq.min = power_proc.min = 0xFFFFFFFFUL;
+    power_irq.max = power_proc.max = 0;
+    power_irq.sum = power_proc.sum = 0;
+}
+
+/******************************************************************************
+ * Function: Power_Add
+ * Description:
+ *   Adds one sample to a latency measure.
+ ******************************************************************************/
+static void Power_Add(PowerLatency *l, uint32_t cycles) {
+    if (cycles < l->min) l->min = cycles;
+    if (cycles > l->max) l->max = cycles;
+    l->sum += cycles;
+}
+
+/******************************************************************************
+ * Function: Power_SetDepth
+ * Description:
+ *   SEVONPEND for the WFE modes; FLITFEN/SRAMEN (clock kept during sleep)
+ *   cleared only for the low-power WFE mode.
+ ******************************************************************************/
+static void Power_SetDepth(uint8_t depth) {
+    power_depth = depth;
+
+    if (depth == POWER_SLEEP_WFE || depth == POWER_SLEEP_WFE_LP) {
+        SCB->SCR |= (1 << 4);                   // SEVONPEND
+    } else {
+        SCB->SCR &= ~(1 << 4);
+    }
+    SCB->SCR &= ~(1 << 2);                      // SLEEPDEEP off: Sleep, not Stop
+
+    if (depth == POWER_SLEEP_WFE_LP) {
+        RCC->AHBENR &= ~((1 << 4) | (1 << 2));  // FLITFEN, SRAMEN off during sleep
+    } else {
+        RCC->AHBENR |= (1 << 4) | (1 << 2);
+    }
+}
+
+/******************************************************************************
+ * Function: Power_Idle
+ * Description:
+ *   Called by the scheduler when no event is pending. Timed work (batch age,
+ *   baud confirmation, the time sync master's SYNC) arms TIM3 CC2 at its
+ *   deadline and the compare interrupt posts SCHED_EVT_TIMEOUT, so no periodic tick is needed; a
+ *   deadline that has already passed is posted directly. The WFI path
+ *   re-checks with PRIMASK set and WFI still wakes on the pending interrupt,
+ *   which then runs after PRIMASK is cleared.
+ ******************************************************************************/
+void Power_Idle(void) {
+    uint32_t deadline, sync, t0;
+    uint8_t timed;
+
+    if (Sched_Pending()) return;
+
+    timed = UART_NextDeadline(&deadline);
+    if (Tsync_NextDeadline(&sync) && (!timed || (int32_t)(sync - deadline) < 0)) {
+        deadline = sync;                        // Earliest of the two
+        timed = 1;
+    }
+    if (timed) {
+        // CCR2 matches the low 16 bits, so a deadline more than 65 ms away
+        // wakes early and the loop simply sleeps again.
+        TIM3->CCR2 = deadline & 0xFFFF;
+        TIM3->SR = ~(1 << 2);                   // Clear a stale CC2IF (rc_w0)
+        TIM3_DIER_BB(2) = 1;                    // CC2IE: posts SCHED_EVT_TIMEOUT
+        if ((int32_t)(Time_Now32() - deadline) >= 0) {
+            TIM3_DIER_BB(2) = 0;
+            Sched_Post(SCHED_EVT_TIMEOUT);      // Already due
+            return;
+        }
+    }
+    if (power_depth == POWER_SLEEP_OFF) return;
+
+    t0 = Time_Now32();
+    if (power_depth == POWER_SLEEP_WFI) {
+        __disable_irq();
+        if (!Sched_Pending()) {
+            __WFI();
+        }
+        __enable_irq();
+    } else {
+        __WFE();                                // Event register set by any interrupt since the check
+    }
+    power_asleep_us += Time_Now32() - t0;
+    power_sleeps++;
+}
+
+/******************************************************************************
+ * Function: Power_SysTickProbe
+ * Description:
+ *   SysTick counts down from LOAD and pends its interrupt on reaching zero,
+ *   then reloads; LOAD - VAL is therefore the number of cycles from the
+ *   interrupt request to this point. One-shot: the counter is stopped.
+ ******************************************************************************/
+void Power_SysTickProbe(void) {
+    uint32_t elapsed = SysTick->LOAD - SysTick->VAL;
+
+    if (!(SysTick->CTRL & (1 << 0))) return;    // Not a probe
+    SysTick->CTRL = 0;
+    power_probe_irq = elapsed;
+    power_probe_stamp = Bench_Cycles();
+    power_probe_done = 1;
+}
+
+/******************************************************************************
+ * Function: Power_Probe
+ * Description:
+ *   Runs the probes at the current depth. The SysTick period is varied so
+ *   the probe does not lock onto other periodic interrupts.
+ ******************************************************************************/
+static void Power_Probe(uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        power_probe_done = 0;
+        SysTick->CTRL = 0;
+        SysTick->LOAD = POWER_PROBE_BASE_CYCLES + (i * 37) % 1000;
+        SysTick->VAL = 0;
+        SysTick->CTRL = (1 << 2) | (1 << 1) | (1 << 0);  // Core clock, TICKINT, ENABLE
+
+        while (!power_probe_done) {
+            Power_Idle();
+        }
+        Power_Add(&power_proc, Bench_Cycles() - power_probe_stamp);
+        Power_Add(&power_irq, power_probe_irq);
+        power_probes++;
+    }
+}
+
+/******************************************************************************
+ * Function: Power_PutLatency
+ * Description:
+ *   Writes [min][mean][max] as 16-bit cycle counts (saturated).
+ ******************************************************************************/
+static void Power_PutLatency(uint8_t *p, const PowerLatency *l) {
+    uint32_t v[3];
+
+    v[0] = power_probes ? l->min : 0;
+    v[1] = power_probes ? l->sum / power_probes : 0;
+    v[2] = l->max;
+    for (uint8_t i = 0; i < 3; i++) {
+        if (v[i] > 0xFFFF) v[i] = 0xFFFF;
+        p[2 * i]     = (v[i] >> 8) & 0xFF;
+        p[2 * i + 1] =  v[i]       & 0xFF;
+    }
+}
+
+/******************************************************************************
+ * Function: Power_Command
+ * Description:
+ *   Sets the depth (clearing the statistics), optionally runs probes, then
+ *   replies with the sleep statistics and the two latency measures.
+ ******************************************************************************/
+void Power_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[27];
+    uint32_t total;
+
+    if (len >= 1 && args[0] < POWER_SLEEP_COUNT) {
+        Power_SetDepth(args[0]);
+        Power_Reset();
+        if (len >= 3) {
+            uint16_t count = (args[1] << 8) | args[2];
+            Power_Probe(count > POWER_PROBE_MAX ? POWER_PROBE_MAX : count);
+        }
+    }
+
+    total = Time_Now32() - power_since;
+    reply[0] = power_depth;
+    UART_PutU32(&reply[1], power_sleeps);
+    UART_PutU32(&reply[5], power_asleep_us);
+    UART_PutU32(&reply[9], total - power_asleep_us);
+    reply[13] = (power_probes >> 8) & 0xFF;
+    reply[14] =  power_probes       & 0xFF;
+    Power_PutLatency(&reply[15], &power_irq);
+    Power_PutLatency(&reply[21], &power_proc);
+    UART_SendReply(UART_CMD_POWER, reply, sizeof(reply));
+}
+
+/******************************************************************************
+ * End of File
+ ******************************************************************************/
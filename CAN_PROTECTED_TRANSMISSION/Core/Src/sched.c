@@ -0,0 +1,163 @@
+/*****************************************************************************
+ * @file    sched.c
+ * @brief   Event bitmap, priority dispatch and per-task run-time accounting
+ *****************************************************************************/
+
+/******************************************************************************
+ * Include files
+ ******************************************************************************/
+#include "sched.h"
+#include "uart.h"
+#include "power.h"
+#include "bench.h"
+#include "timebase.h"
+
+/******************************************************************************
+ * Local types and variables
+ ******************************************************************************/
+
+/**
+ * @brief Run-time statistics of one task, in core cycles.
+ */
+typedef struct {
+    uint32_t runs;
+    uint32_t max;
+    uint32_t overruns;
+    uint64_t cycles;
+} SchedStats;
+
+static volatile uint32_t sched_pending = 0;     // Posted, not yet dispatched events
+static const SchedTask *sched_tasks = 0;
+static uint8_t  sched_count = 0;
+static SchedStats sched_stats[SCHED_TASK_MAX];
+static uint64_t sched_idle_cycles = 0;          // Cycles spent in Power_Idle()
+static uint32_t sched_since = 0;                // Time base at the last reset (us)
+
+/******************************************************************************
+ * Function: Sched_Init
+ * Description:
+ *   Registers the task table and clears the statistics.
+ ******************************************************************************/
+void Sched_Init(const SchedTask *tasks, uint8_t count) {
+    sched_tasks = tasks;
+    sched_count = (count > SCHED_TASK_MAX) ? SCHED_TASK_MAX : count;
+    memset(sched_stats, 0, sizeof(sched_stats));
+    sched_idle_cycles = 0;
+    sched_since = Time_Now32();
+}
+
+/******************************************************************************
+ * Function: Sched_Post
+ * Description:
+ *   Sets the bits with an exclusive load/store pair, so a post from a higher
+ *   priority interrupt in between is not lost and no interrupt is masked.
+ ******************************************************************************/
+void Sched_Post(uint32_t events) {
+    uint32_t v;
+
+    do {
+        v = __LDREXW(&sched_pending);
+    } while (__STREXW(v | events, &sched_pending));
+}
+
+/******************************************************************************
+ * Function: Sched_Clear
+ * Description:
+ *   Clears the bits of the task about to run, the same way.
+ ******************************************************************************/
+static void Sched_Clear(uint32_t events) {
+    uint32_t v;
+
+    do {
+        v = __LDREXW(&sched_pending);
+    } while (__STREXW(v & ~events, &sched_pending));
+}
+
+/******************************************************************************
+ * Function: Sched_Pending
+ * Description:
+ *   Used by the idle path to re-check for work before sleeping.
+ ******************************************************************************/
+uint32_t Sched_Pending(void) {
+    return sched_pending;
+}
+
+/******************************************************************************
+ * Function: Sched_Run
+ * Description:
+ *   Each pass runs the first task (highest priority) with a pending event,
+ *   then starts again from the top, so a burst of low-priority work never
+ *   delays a host command by more than one task run. With nothing pending
+ *   the loop idles (and may sleep) until an interrupt posts an event.
+ ******************************************************************************/
+void Sched_Run(void) {
+    uint32_t pending, start, cycles;
+    uint8_t i;
+
+    while (1) {
+        pending = sched_pending;
+        for (i = 0; i < sched_count; i++) {
+            if (pending & sched_tasks[i].events) break;
+        }
+
+        start = Bench_Cycles();
+        if (i == sched_count) {
+            Power_Idle();
+            sched_idle_cycles += Bench_Cycles() - start;
+            continue;
+        }
+
+        Sched_Clear(sched_tasks[i].events);
+        sched_tasks[i].run();
+        cycles = Bench_Cycles() - start;
+
+        sched_stats[i].runs++;
+        sched_stats[i].cycles += cycles;
+        if (cycles > sched_stats[i].max) {
+            sched_stats[i].max = cycles;
+        }
+        if (cycles > sched_tasks[i].budget_us * (SystemCoreClock / 1000000)) {
+            sched_stats[i].overruns++;
+        }
+    }
+}
+
+/******************************************************************************
+ * Function: Sched_Command
+ * Description:
+ *   Replies with the idle time and each task's runs and cycles. The reply
+ *   is built before clearing, so a clear returns the final figures.
+ ******************************************************************************/
+void Sched_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[17 + 21 * SCHED_TASK_MAX];
+    uint8_t n = 0;
+
+    reply[n++] = sched_count;
+    UART_PutU32(&reply[n], SystemCoreClock);
+    n += 4;
+    UART_PutU32(&reply[n], Time_Now32() - sched_since);
+    n += 4;
+    UART_PutU32(&reply[n], (uint32_t)(sched_idle_cycles >> 32));
+    UART_PutU32(&reply[n + 4], (uint32_t)sched_idle_cycles);
+    n += 8;
+
+    for (uint8_t i = 0; i < sched_count; i++) {
+        const SchedStats *s = &sched_stats[i];
+        reply[n++] = sched_tasks[i].events & 0xFF;
+        UART_PutU32(&reply[n], s->runs);
+        UART_PutU32(&reply[n + 4], (uint32_t)(s->cycles >> 32));
+        UART_PutU32(&reply[n + 8], (uint32_t)s->cycles);
+        UART_PutU32(&reply[n + 12], s->max);
+        UART_PutU32(&reply[n + 16], s->overruns);
+        n += 20;
+    }
+    UART_SendReply(UART_CMD_SCHED, reply, n);
+
+    if (len >= 1 && args[0]) {
+        Sched_Init(sched_tasks, sched_count);
+    }
+}
+
+/******************************************************************************
+ * End of File
+ ******************************************************************************/
@@ -0,0 +1,152 @@
+/*****************************************************************************
+ * @file    timebase.c
+ * @brief   Monotonic 64-bit microsecond clock on the TIM3 -> TIM4 chain and
+ *          the host epoch offset
+ *****************************************************************************/
+
+/******************************************************************************
+ * Include files
+ ******************************************************************************/
+#include "timebase.h"
+#include "clock.h"
+#include "uart.h"
+
+/******************************************************************************
+ * Local variables
+ ******************************************************************************/
+static volatile uint32_t time_wraps = 0;        // TIM4 overflows: bits 32..63
+static int64_t time_epoch_offset = 0;           // Host epoch - local time (us)
+
+/******************************************************************************
+ * Function: Time_Init
+ * Description:
+ *   TIM3: prescaled to 1 MHz, full 16-bit range, TRGO on update.
+ *   TIM4: external clock mode 1 from ITR2 (TIM3 TRGO), full 16-bit range,
+ *   update interrupt on overflow.
+ ******************************************************************************/
+void Time_Init(void) {
+    RCC->APB1ENR |= (1 << 1) | (1 << 2);        // Enable clock for TIM3 and TIM4
+
+    TIM3->CR1 = 0;
+    TIM3->PSC = Clock_GetTimerClock() / 1000000 - 1;  // 1 tick = 1 us
+    TIM3->ARR = 0xFFFF;
+    TIM3->CR2 = (2 << 4);                       // MMS = update event as TRGO
+    TIM3->EGR = (1 << 0);                       // UG: load PSC (before TIM4 counts TRGO)
+    TIM3->CNT = 0;
+    TIM3->SR = 0;
+
+    TIM4->CR1 = 0;
+    TIM4->PSC = 0;
+    TIM4->ARR = 0xFFFF;
+    TIM4->SMCR = (2 << 4)                       // TS = ITR2 (TIM3)
+               | (7 << 0);                      // SMS = external clock mode 1
+    TIM4->EGR = (1 << 0);                       // UG: load PSC
+    TIM4->CNT = 0;
+    TIM4->SR = 0;
+    TIM4->DIER = (1 << 0);                      // Update interrupt (UIE)
+    TIM4->CR1 = (1 << 2)                        // URS: only overflow raises UIF
+              | (1 << 0);                       // CEN
+
+    time_wraps = 0;
+    NVIC_EnableIRQ(TIM4_IRQn);
+    TIM3->CR1 |= (1 << 0);                      // CEN: start counting
+}
+
+/******************************************************************************
+ * Function: Time_ReadChain
+ * Description:
+ *   Reads TIM4:TIM3 as one 32-bit value. TIM4 counts the TIM3 overflow a few
+ *   timer clocks after TIM3 reaches 0, so a low half of 0 is read again
+ *   (it lasts 1 us), and the high half is read twice around it.
+ ******************************************************************************/
+static uint32_t Time_ReadChain(void) {
+    uint32_t hi, lo;
+
+    do {
+        hi = TIM4->CNT;
+        lo = TIM3->CNT;
+    } while (lo == 0 || TIM4->CNT != hi);
+    return (hi << 16) | lo;
+}
+
+/******************************************************************************
+ * Function: Time_Now
+ * Description:
+ *   Adds the software overflow count. If the TIM4 interrupt has not run yet
+ *   (reader is a higher priority interrupt, or interrupts are masked), the
+ *   pending update flag with a small counter value means the wrap happened.
+ ******************************************************************************/
+uint64_t Time_Now(void) {
+    uint32_t wraps, chain, pending;
+
+    do {
+        wraps = time_wraps;
+        chain = Time_ReadChain();
+        pending = TIM4->SR & (1 << 0);
+    } while (wraps != time_wraps);              // TIM4 interrupt ran in between
+
+    if (pending && chain < 0x80000000UL) {
+        wraps++;
+    }
+    return ((uint64_t)wraps << 32) | chain;
+}
+
+/******************************************************************************
+ * Function: Time_Now32
+ * Description:
+ *   Hardware chain only, no software extension.
+ ******************************************************************************/
+uint32_t Time_Now32(void) {
+    return Time_ReadChain();
+}
+
+/******************************************************************************
+ * Function: Time_ToEpoch
+ * Description:
+ *   Applies the offset last set by the host (0 until the first sync).
+ ******************************************************************************/
+uint64_t Time_ToEpoch(uint64_t local_us) {
+    return local_us + (uint64_t)time_epoch_offset;
+}
+
+/******************************************************************************
+ * Function: Time_Command
+ * Description:
+ *   Sets the epoch offset if one is given, then replies with the current
+ *   local time and the offset. The local clock itself never jumps.
+ ******************************************************************************/
+void Time_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[16];
+    uint64_t now;
+
+    if (len >= 8) {
+        uint64_t v = 0;
+        for (uint8_t i = 0; i < 8; i++) {
+            v = (v << 8) | args[i];             // Big-endian
+        }
+        time_epoch_offset = (int64_t)v;
+    }
+
+    now = Time_Now();
+    UART_PutU32(&reply[0], (uint32_t)(now >> 32));
+    UART_PutU32(&reply[4], (uint32_t)now);
+    UART_PutU32(&reply[8], (uint32_t)((uint64_t)time_epoch_offset >> 32));
+    UART_PutU32(&reply[12], (uint32_t)time_epoch_offset);
+    UART_SendReply(UART_CMD_TIME, reply, sizeof(reply));
+}
+
+/******************************************************************************
+ * Function: TIM4_IRQHandler
+ * Description:
+ *   TIM4 overflow (every 2^32 us): carry into the upper 32 bits.
+ ******************************************************************************/
+void TIM4_IRQHandler(void) {
+    if (TIM4->SR & (1 << 0)) {
+        TIM4->SR &= ~(1 << 0);                  // Clear update flag
+        time_wraps++;
+    }
+}
+
+/******************************************************************************
+ * End of File
+ ******************************************************************************/
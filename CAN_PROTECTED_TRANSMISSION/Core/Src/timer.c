@@ -1,6 +1,6 @@
 /*****************************************************************************
  * @file    timer.c
- * @brief   Timer2 configuration and interrupt handler for repeated CAN frame sending
+ * @brief   Cyclic CAN frame transmission on absolute time base deadlines
  *****************************************************************************/
 
 /******************************************************************************
@@ -8,80 +8,323 @@
  ******************************************************************************/
 #include "timer.h"
 #include "can.h"
+#include "uart.h"
+#include "timebase.h"
+#include "sched.h"
 
 /******************************************************************************
- * Function: Timer2_Config
+ * Local types and variables
+ ******************************************************************************/
+
+/**
+ * @brief Frame content of a cyclic slot, written only by the main loop.
+ */
+typedef struct {
+    CanFrame can;           // Register image, DLC includes the counter byte
+    uint32_t period_us;     // Period
+} CyclicFrame;
+
+/**
+ * @brief One cyclic slot. The main loop fills the buffer that frame does not
+ *        point to and then publishes it with a single pointer store, so the
+ *        interrupt always sees a complete frame. Deadline and statistics
+ *        belong to the interrupt; version changes on every update so the
+ *        main loop can take a consistent snapshot without masking it.
+ */
+typedef struct {
+    CyclicFrame buf[2];                 // Double buffer
+    const CyclicFrame * volatile frame; // Published buffer
+    volatile uint8_t active;            // Set by the interrupt on restart, cleared by Stop
+    volatile uint8_t restart;           // New frame published: restart deadline and statistics
+    volatile uint32_t version;          // Incremented by the interrupt after each update
+    uint32_t deadline;                  // Next absolute deadline (Time_Now32)
+    uint32_t sent;                      // Frames handed to CAN_QueueFrame
+    uint32_t missed;                    // Deadlines skipped
+    uint32_t failed;                    // Not queued: bus-off or queue full
+    uint32_t jitter_min;                // Deadline to transmit request (us)
+    uint32_t jitter_max;
+    uint64_t jitter_sum;
+} CyclicMsg;
+
+/**
+ * @brief Snapshot of a slot for the query reply.
+ */
+typedef struct {
+    uint8_t  active;
+    uint32_t period_us;
+    uint32_t sent;
+    uint32_t missed;
+    uint32_t failed;
+    uint32_t jitter_min;
+    uint32_t jitter_max;
+    uint64_t jitter_sum;
+} CyclicStats;
+
+static CyclicMsg timer_cyclic[TIMER_CYCLIC_SLOTS];
+
+/******************************************************************************
+ * Function: Timer_Arm
+ * Description:
+ *   Loads the earliest active deadline into TIM3 CCR1. The compare matches
+ *   the low 16 bits, so a deadline further away than 65.5 ms gives an early
+ *   interrupt that finds nothing due and re-arms. A deadline that has
+ *   already passed is triggered by software. Runs only inside the TIM3
+ *   interrupt, which owns CCR1 and the deadlines.
+ ******************************************************************************/
+static void Timer_Arm(void) {
+    uint32_t now = Time_Now32();
+    uint32_t next = 0;
+    int32_t best = 0;
+    uint8_t any = 0;
+
+    for (uint8_t i = 0; i < TIMER_CYCLIC_SLOTS; i++) {
+        int32_t left = (int32_t)(timer_cyclic[i].deadline - now);   // Negative when overdue
+        if (timer_cyclic[i].active && (!any || left < best)) {
+            best = left;
+            next = timer_cyclic[i].deadline;
+            any = 1;
+        }
+    }
+
+    if (!any) {
+        TIM3_DIER_BB(1) = 0;                    // CC1IE off: nothing scheduled
+        return;
+    }
+
+    TIM3->CCR1 = next & 0xFFFF;
+    TIM3->SR = ~(1 << 1);                       // Clear a stale CC1IF (rc_w0)
+    TIM3_DIER_BB(1) = 1;                        // CC1IE
+    if ((int32_t)(Time_Now32() - next) >= 0) {
+        TIM3->EGR = (1 << 1);                   // CC1G: already due
+    }
+}
+
+/******************************************************************************
+ * Function: Timer_Kick
+ * Description:
+ *   Runs the TIM3 interrupt now (software compare event) so it applies a
+ *   start or stop from the main loop and re-arms channel 1.
+ ******************************************************************************/
+static void Timer_Kick(void) {
+    TIM3_DIER_BB(1) = 1;                        // CC1IE
+    TIM3->EGR = (1 << 1);                       // CC1G
+}
+
+/******************************************************************************
+ * Function: Timer_Config
+ * Description:
+ *   Channel 1 of the time base timer in frozen output compare mode (no pin),
+ *   used only for its compare interrupt.
+ ******************************************************************************/
+void Timer_Config(void) {
+    memset(timer_cyclic, 0, sizeof(timer_cyclic));
+    for (uint8_t i = 0; i < TIMER_CYCLIC_SLOTS; i++) {
+        timer_cyclic[i].frame = &timer_cyclic[i].buf[0];
+    }
+    TIM3->CCMR1 &= ~0xFF;                       // CC1S = output, OC1M = frozen
+    TIM3_DIER_BB(1) = 0;
+    NVIC_EnableIRQ(TIM3_IRQn);                  // Enable TIM3 interrupt in NVIC
+}
+
+/******************************************************************************
+ * Function: Timer_StartCyclic
+ * Description:
+ *   Fills the buffer the interrupt is not using, publishes it and lets the
+ *   interrupt restart the slot: statistics cleared, first deadline one
+ *   period from then. Nothing is masked; the interrupt cannot run halfway
+ *   through a frame it reads because the main loop never writes that one.
+ ******************************************************************************/
+void Timer_StartCyclic(uint8_t slot, uint8_t mode, uint32_t id, const uint8_t *data,
+                       uint8_t len, uint32_t period_us) {
+    CyclicMsg *c;
+    CyclicFrame *f;
+
+    if (slot >= TIMER_CYCLIC_SLOTS || period_us == 0) return;
+    if (len > 7) len = 7;                       // Room for the counter byte
+
+    c = &timer_cyclic[slot];
+    f = (c->frame == &c->buf[0]) ? &c->buf[1] : &c->buf[0];
+    CAN_FramePack(&f->can, mode, id, data, len);
+    f->can.rdtr = len + 1;                      // Last byte: counter, filled in per send
+    f->period_us = period_us;
+
+    __DMB();                                    // Frame complete before it is published
+    c->frame = f;
+    c->restart = 1;
+    Timer_Kick();
+}
+
+/******************************************************************************
+ * Function: Timer_StopCyclic
+ * Description:
+ *   Deactivates the slot; the interrupt re-arms for the remaining ones.
+ ******************************************************************************/
+void Timer_StopCyclic(uint8_t slot) {
+    if (slot >= TIMER_CYCLIC_SLOTS) return;
+
+    timer_cyclic[slot].restart = 0;
+    timer_cyclic[slot].active = 0;
+    Timer_Kick();
+}
+
+/******************************************************************************
+ * Function: Timer_GetCyclic
  * Description:
- *   Configure Timer2 to generate an update event every 1ms based on an 8MHz clock.
- *   Enable update interrupt and enable NVIC interrupt for Timer2.
+ *   Reads back the published frame of a slot; the counter byte is not part
+ *   of the returned data. Main loop only: the published buffer is never
+ *   written by the interrupt.
  ******************************************************************************/
-void Timer2_Config(void) {
-	RCC->APB1ENR |= (1 << 0);   // Enable clock for TIM2
-    TIM2->PSC = 1000 - 1;                  // Prescaler: 8 MHz / 1000 = 8 kHz (1 tick = 125 us)
-    TIM2->ARR = 8000;                      // Auto-reload register for 1s period (8000 ticks * 125 us)
-    TIM2->DIER |= (1 << 0);            // Enable update interrupt (UIE)
-    NVIC_EnableIRQ(TIM2_IRQn);             // Enable TIM2 interrupt in NVIC
+uint8_t Timer_GetCyclic(uint8_t slot, uint8_t *mode, uint32_t *id, uint8_t *data,
+                        uint8_t *len, uint32_t *period_us) {
+    const CyclicMsg *c;
+    const CyclicFrame *f;
+
+    if (slot >= TIMER_CYCLIC_SLOTS) return 0;
+
+    c = &timer_cyclic[slot];
+    f = c->frame;
+    *mode = CAN_FRAME_IDE(&f->can);
+    *id = CAN_FRAME_ID(&f->can);
+    *len = CAN_FRAME_LEN(&f->can) ? CAN_FRAME_LEN(&f->can) - 1 : 0;   // Without the counter
+    *period_us = f->period_us;
+    memcpy(data, CAN_FRAME_DATA(&f->can), 8);
+    return c->active || c->restart;
 }
 
 /******************************************************************************
- * Function: Timer2_Start
+ * Function: Timer_Snapshot
  * Description:
- *   Start Timer2 with interrupt period set by interval_ms parameter.
- *   Timer counts with 1ms ticks configured in Timer2_Config.
- * Params:
- *   interval_ms - Timer duration in milliseconds before update interrupt occurs.
+ *   Copies the slot statistics, again if the interrupt updated them in
+ *   between (version changed).
  ******************************************************************************/
-void Timer2_Start(uint16_t interval_ms) {
-    // Adjust ARR according to 1 tick = 125 us (8 kHz)
-    TIM2->ARR = (uint32_t)interval_ms * 8;  // 1 ms = 8 ticks (125 us * 8 = 1 ms)
-    TIM2->CNT = 0;                          // Reset counter
-    TIM2->SR &= ~(1 << 0);                // Clear update interrupt flag
-    TIM2->DIER |= (1 << 0);             // Enable update interrupt
-    TIM2->CR1 |= (1 << 0);               // Enable timer counter
+static void Timer_Snapshot(uint8_t slot, CyclicStats *st) {
+    const CyclicMsg *c = &timer_cyclic[slot];
+    uint32_t version;
+
+    do {
+        version = c->version;
+        __DMB();                                // Also keeps the compiler from caching the fields
+        st->active = c->active;
+        st->period_us = c->frame->period_us;
+        st->sent = c->sent;
+        st->missed = c->missed;
+        st->failed = c->failed;
+        st->jitter_min = c->jitter_min;
+        st->jitter_max = c->jitter_max;
+        st->jitter_sum = c->jitter_sum;
+        __DMB();
+    } while (c->version != version);
 }
 
 /******************************************************************************
- * Function: Timer2_Stop
+ * Function: Timer_CyclicCommand
  * Description:
- *   Stop Timer2, disable update interrupt, and clear interrupt flag.
+ *   Starts or stops the slot when a period is given, then replies with the
+ *   slot statistics.
  ******************************************************************************/
-void Timer2_Stop(void) {
-	TIM2->CR1 &= ~(1 << 0);              // Disable timer counter
-	TIM2->DIER &= ~(1 << 0);             // Disable update interrupt
-	TIM2->SR &= ~(1 << 0);                 // Clear update interrupt flag
+void Timer_CyclicCommand(const uint8_t *args, uint8_t len) {
+    uint8_t reply[30];
+    CyclicStats c;
+    uint8_t slot;
+
+    if (len < 1 || args[0] >= TIMER_CYCLIC_SLOTS) return;
+    slot = args[0];
+
+    if (len >= TIMER_CYCLIC_HDR_LEN) {
+        uint32_t period = ((uint32_t)args[1] << 24) | ((uint32_t)args[2] << 16) |
+                          ((uint32_t)args[3] <<  8) |  (uint32_t)args[4];
+        uint32_t id     = ((uint32_t)args[6] << 24) | ((uint32_t)args[7] << 16) |
+                          ((uint32_t)args[8] <<  8) |  (uint32_t)args[9];
+        uint8_t data_len = args[10];
+
+        if (data_len > 7 || TIMER_CYCLIC_HDR_LEN + data_len > len) return;
+        if (period == 0) {
+            Timer_StopCyclic(slot);
+        } else {
+            Timer_StartCyclic(slot, args[5] ? 1 : 0, id, &args[TIMER_CYCLIC_HDR_LEN], data_len, period);
+        }
+    }
+
+    Timer_Snapshot(slot, &c);
+
+    reply[0] = slot;
+    reply[1] = c.active;
+    UART_PutU32(&reply[2],  c.period_us);
+    UART_PutU32(&reply[6],  c.sent);
+    UART_PutU32(&reply[10], c.missed);
+    UART_PutU32(&reply[14], c.failed);
+    UART_PutU32(&reply[18], c.sent ? c.jitter_min : 0);
+    UART_PutU32(&reply[22], c.jitter_max);
+    UART_PutU32(&reply[26], c.sent ? (uint32_t)(c.jitter_sum / c.sent) : 0);
+    UART_SendReply(UART_CMD_CYCLIC, reply, sizeof(reply));
 }
 
 /******************************************************************************
- * Function: TIM2_IRQHandler
+ * Function: TIM3_IRQHandler
  * Description:
- *   Interrupt handler for Timer2 update event.
- *   If global flag 'repeat' is enabled, send the stored CAN frame repeatedly.
- *   Update the last byte in payload as a counter to avoid duplicate frames.
+ *   Applies restarts published by the main loop, sends each due message,
+ *   then advances its deadline by whole periods from the previous deadline.
+ *   If the next deadline has already passed (the bus or a long interrupt
+ *   held us up) the late periods are skipped and counted instead of being
+ *   sent back-to-back. Nothing in this path masks interrupts.
  ******************************************************************************/
-void TIM2_IRQHandler(void) {
-	if (!(TIM2->SR & (1 << 0))) return;  // Check update interrupt flag
-	TIM2->SR &= ~(1 << 0);                // Clear interrupt flag
+void TIM3_IRQHandler(void) {
+    uint32_t now;
+
+    if (TIM3->SR & (1 << 2)) {                  // Channel 2: main-loop deadline (power.c)
+        TIM3->SR = ~(1 << 2);                   // Clear CC2IF (rc_w0)
+        TIM3_DIER_BB(2) = 0;                    // One-shot
+        Sched_Post(SCHED_EVT_TIMEOUT);
+    }
+    if (!(TIM3->SR & (1 << 1))) return;         // Channel 1: cyclic messages
+    TIM3->SR = ~(1 << 1);                       // Clear CC1IF (rc_w0)
 
-    if (!repeat) return;                    // Exit if repeat mode is off
+    for (uint8_t i = 0; i < TIMER_CYCLIC_SLOTS; i++) {
+        CyclicMsg *c = &timer_cyclic[i];
+        const CyclicFrame *f = c->frame;        // Read once: complete frame
+        CanFrame tx;
+        uint32_t jitter;
 
-    uint8_t mode = current_frame[0];
-    // Extract ID depending on mode: 11-bit standard or 29-bit extended
-    uint32_t id = (mode == 0) ?
-        ((current_frame[3] << 8) | current_frame[4]) :
-        ((current_frame[1] << 24) | (current_frame[2] << 16) |
-         (current_frame[3] << 8) | current_frame[4]);
+        now = Time_Now32();
+        if (c->restart) {
+            c->restart = 0;
+            c->sent = 0;
+            c->missed = 0;
+            c->failed = 0;
+            c->jitter_min = 0xFFFFFFFFUL;
+            c->jitter_max = 0;
+            c->jitter_sum = 0;
+            c->deadline = now + f->period_us;
+            c->active = 1;
+            c->version++;
+            continue;
+        }
+        if (!c->active) continue;
+        if ((int32_t)(now - c->deadline) < 0) continue;
 
-    uint8_t len = current_frame[5];
-    uint8_t data[8];
+        jitter = now - c->deadline;
+        tx = f->can;
+        ((uint8_t *)&tx.rdlr)[CAN_FRAME_DLC(&tx) - 1] = tx_counter++;  // Counter byte as for single frames
+        if (CAN_QueueFrame(&tx) != CAN_TX_OK) {             // Mailbox 2, no wait
+            c->failed++;
+        }
 
-    __disable_irq();                        // Disable interrupts for atomic copy
-    memcpy(data, &current_frame[6], len);  // Copy payload
-    __enable_irq();
+        c->sent++;
+        c->jitter_sum += jitter;
+        if (jitter < c->jitter_min) c->jitter_min = jitter;
+        if (jitter > c->jitter_max) c->jitter_max = jitter;
 
-    data[len - 1] = tx_counter++;          // Increment last byte as counter
-    current_frame[6 + len - 1] = data[len - 1]; // Update frame buffer with new counter
+        c->deadline += f->period_us;
+        now = Time_Now32();
+        if ((int32_t)(now - c->deadline) >= 0) {
+            uint32_t skip = (now - c->deadline) / f->period_us + 1;
+            c->missed += skip;
+            c->deadline += skip * f->period_us;
+        }
+        c->version++;
+    }
 
-    CAN_Send(mode, id, data, len);         // Send CAN frame
+    Timer_Arm();
 }
 
 /******************************************************************************
@@ -0,0 +1,298 @@
+/*****************************************************************************
+ * @file    tsync.c
+ * @brief   SYNC/FUP time master, slave clock servo and the host interface
+ *****************************************************************************/
+
+/******************************************************************************
+ * Include files
+ ******************************************************************************/
+#include "tsync.h"
+#include "timebase.h"
+#include "sched.h"
+#include "uart.h"
+
+/******************************************************************************
+ * Local variables
+ ******************************************************************************/
+
+static uint8_t  tsync_role = TSYNC_ROLE_OFF;    // TSYNC_ROLE_xxx
+static uint8_t  tsync_domain = 0;               // Time domain (0-15)
+static uint16_t tsync_period_ms = TSYNC_PERIOD_MS; // Master: SYNC period
+static uint8_t  tsync_seq = 0;                  // Master: last sequence counter
+static uint32_t tsync_next = 0;                 // Master: Time_Now32() of next SYNC
+
+static uint32_t tsync_syncs = 0;                // SYNC sent / received
+static uint32_t tsync_fups = 0;                 // FUP sent / pairs applied
+static uint32_t tsync_dropped = 0;              // SYNC without FUP
+static uint32_t tsync_steps = 0;                // Slave: clock set, not steered
+static uint32_t tsync_window = 0;               // Master: last stamp window (us)
+
+/* Slave, CAN RX interrupt only: SYNC waiting for its FUP */
+static uint8_t  tsync_rx_seq = 0xFF;            // 0xFF: none
+static uint32_t tsync_rx_sec = 0;               // Seconds from the SYNC
+static uint64_t tsync_rx_local = 0;             // Time_Now() at reception
+
+/* Slave: pair handed from the interrupt to the main loop */
+static volatile uint8_t tsync_pair_ready = 0;   // Set by the interrupt, cleared by Tsync_Poll()
+static uint64_t tsync_pair_local = 0;           // Local time of the SYNC (us)
+static uint64_t tsync_pair_global = 0;          // Master time of the SYNC (ns)
+
+/* Slave, main loop only: synchronised clock */
+static uint8_t  tsync_synced = 0;               // Reference valid
+static uint64_t tsync_ref_local = 0;            // Local time of the reference (us)
+static uint64_t tsync_ref_global = 0;           // Global time of the reference (ns)
+static int32_t  tsync_rate_ppb = 0;             // Local clock rate correction
+static int32_t  tsync_offset_ns = 0;            // Last error before correction
+static uint32_t tsync_offset_max = 0;           // Largest |error| since the last step
+
+/******************************************************************************
+ * Function: Tsync_GetU32
+ * Description:
+ *   Read a big-endian word from message bytes.
+ ******************************************************************************/
+static uint32_t Tsync_GetU32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/******************************************************************************
+ * Function: Tsync_Global
+ * Description:
+ *   Slave clock: global ns of a local time, from the reference and the rate
+ *   correction.
+ ******************************************************************************/
+static uint64_t Tsync_Global(uint64_t local_us) {
+    int64_t d = (int64_t)(local_us - tsync_ref_local);
+
+    return tsync_ref_global + (uint64_t)(d * 1000 + d * tsync_rate_ppb / 1000000);
+}
+
+/******************************************************************************
+ * Function: Tsync_Frame
+ * Description:
+ *   Stamp a SYNC, pair it with its FUP and hand the pair over.
+ *
+ *   The master ignores the messages; a second master in the domain is a
+ *   configuration error.
+ ******************************************************************************/
+uint8_t Tsync_Frame(const CanFrame *frame) {
+    const uint8_t *d = CAN_FRAME_DATA(frame);
+    uint64_t now;
+
+    if (tsync_role == TSYNC_ROLE_OFF || CAN_FRAME_IDE(frame) || (frame->rir & (1 << 1)) ||
+        CAN_FRAME_ID(frame) != TSYNC_CAN_ID) return 0;
+
+    now = Time_Now();
+    if (tsync_role != TSYNC_ROLE_SLAVE || CAN_FRAME_LEN(frame) != 8 || (d[2] >> 4) != tsync_domain) {
+        return 1;
+    }
+
+    if (d[0] == TSYNC_TYPE_SYNC) {
+        if (tsync_rx_seq != 0xFF) {
+            tsync_dropped++;                    // Previous SYNC never got its FUP
+        }
+        tsync_rx_seq = d[2] & 0x0F;
+        tsync_rx_sec = Tsync_GetU32(&d[4]);
+        tsync_rx_local = now;
+        tsync_syncs++;
+    } else if (d[0] == TSYNC_TYPE_FUP && (d[2] & 0x0F) == tsync_rx_seq) {
+        tsync_rx_seq = 0xFF;
+        if (now - tsync_rx_local > TSYNC_FUP_TIMEOUT_US || tsync_pair_ready) {
+            tsync_dropped++;
+            return 1;
+        }
+        tsync_pair_local = tsync_rx_local;
+        tsync_pair_global = (uint64_t)(tsync_rx_sec + d[3]) * 1000000000ULL + Tsync_GetU32(&d[4]);
+        tsync_pair_ready = 1;
+        Sched_Post(SCHED_EVT_TIMEOUT);
+    }
+    return 1;
+}
+
+/******************************************************************************
+ * Function: Tsync_Apply
+ * Description:
+ *   Steer the slave clock with one SYNC/FUP pair.
+ *
+ *   The phase is corrected fully at each pair; the error left over one period
+ *   is the rate error, half of which is added to the rate correction, which
+ *   filters the 1 us stamp noise. Large errors set the clock.
+ ******************************************************************************/
+static void Tsync_Apply(uint64_t local, uint64_t global) {
+    int64_t err = 0;
+    int64_t d = (int64_t)(local - tsync_ref_local);
+    int64_t rate;
+
+    if (tsync_synced) {
+        err = (int64_t)(global - Tsync_Global(local));
+    }
+    if (!tsync_synced || d <= 0 || err > TSYNC_STEP_NS || err < -TSYNC_STEP_NS) {
+        if (tsync_synced) {
+            tsync_steps++;
+        } else {
+            tsync_rate_ppb = 0;
+        }
+        tsync_offset_max = 0;
+        tsync_synced = 1;
+    } else {
+        rate = tsync_rate_ppb + err * 1000000 / d / 2;
+        if (rate > TSYNC_RATE_MAX_PPB)  rate = TSYNC_RATE_MAX_PPB;
+        if (rate < -TSYNC_RATE_MAX_PPB) rate = -TSYNC_RATE_MAX_PPB;
+        tsync_rate_ppb = (int32_t)rate;
+        if ((uint32_t)(err < 0 ? -err : err) > tsync_offset_max) {
+            tsync_offset_max = (uint32_t)(err < 0 ? -err : err);
+        }
+    }
+    tsync_offset_ns = (int32_t)err;
+    tsync_ref_local = local;
+    tsync_ref_global = global;
+    tsync_fups++;
+}
+
+/******************************************************************************
+ * Function: Tsync_SendSync
+ * Description:
+ *   Master: send a SYNC with the current second, stamp its completion and
+ *   send the FUP with the rest.
+ ******************************************************************************/
+static void Tsync_SendSync(void) {
+    uint8_t d[8] = { 0 };
+    CanFrame f;
+    uint64_t now, sync;
+    uint32_t sec, done, window;
+
+    tsync_seq = (tsync_seq + 1) & 0x0F;
+    sec = (uint32_t)(Time_ToEpoch(Time_Now()) / 1000000);
+
+    d[0] = TSYNC_TYPE_SYNC;
+    d[2] = (tsync_domain << 4) | tsync_seq;
+    UART_PutU32(&d[4], sec);
+    CAN_FramePack(&f, 0, TSYNC_CAN_ID, d, 8);
+    if (CAN_SendFrameTimed(&f, &done, &window) != CAN_TX_OK) {
+        tsync_dropped++;
+        return;
+    }
+    tsync_syncs++;
+    tsync_window = window;
+    if (window > TSYNC_WINDOW_MAX_US) {
+        tsync_dropped++;                        // Slaves drop the SYNC without its FUP
+        return;
+    }
+
+    now = Time_Now();
+    sync = Time_ToEpoch(now - (uint32_t)((uint32_t)now - done)) * 1000 - (uint64_t)sec * 1000000000ULL;
+    d[0] = TSYNC_TYPE_FUP;
+    d[3] = (uint8_t)(sync / 1000000000ULL);     // Overflow seconds
+    UART_PutU32(&d[4], (uint32_t)(sync % 1000000000ULL));
+    CAN_FramePack(&f, 0, TSYNC_CAN_ID, d, 8);
+    if (CAN_SendFrame(&f) == CAN_TX_OK) {
+        tsync_fups++;
+    } else {
+        tsync_dropped++;
+    }
+}
+
+/******************************************************************************
+ * Function: Tsync_Poll
+ * Description:
+ *   Apply a pending pair; send the SYNC when its time has come, skipping
+ *   periods that have already passed.
+ ******************************************************************************/
+void Tsync_Poll(void) {
+    uint32_t now;
+
+    if (tsync_pair_ready) {
+        Tsync_Apply(tsync_pair_local, tsync_pair_global);
+        tsync_pair_ready = 0;
+    }
+
+    if (tsync_role != TSYNC_ROLE_MASTER) return;
+    now = Time_Now32();
+    if ((int32_t)(now - tsync_next) < 0) return;
+    tsync_next += tsync_period_ms * 1000UL;
+    if ((int32_t)(now - tsync_next) >= 0) {
+        tsync_next = now + tsync_period_ms * 1000UL;
+    }
+    Tsync_SendSync();
+}
+
+/******************************************************************************
+ * Function: Tsync_NextDeadline
+ * Description:
+ *   The next SYNC time while master.
+ ******************************************************************************/
+uint8_t Tsync_NextDeadline(uint32_t *deadline) {
+    if (tsync_role != TSYNC_ROLE_MASTER) return 0;
+    *deadline = tsync_next;
+    return 1;
+}
+
+/******************************************************************************
+ * Function: Tsync_Command
+ * Description:
+ *   Restart with a new role if given, then reply with the state and the clock
+ *   reference.
+ ******************************************************************************/
+void Tsync_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[54];
+    uint64_t ref_local, ref_global;
+    uint8_t synced;
+
+    if (len >= 5 && args[0] == TSYNC_OP_CONFIG && args[1] <= TSYNC_ROLE_SLAVE) {
+        tsync_role = TSYNC_ROLE_OFF;            // Interrupt ignores the domain meanwhile
+        tsync_domain = args[2] & 0x0F;
+        tsync_period_ms = ((uint16_t)args[3] << 8) | args[4];
+        if (tsync_period_ms < TSYNC_PERIOD_MIN_MS) {
+            tsync_period_ms = TSYNC_PERIOD_MIN_MS;
+        }
+        tsync_syncs = 0;
+        tsync_fups = 0;
+        tsync_dropped = 0;
+        tsync_steps = 0;
+        tsync_window = 0;
+        tsync_rx_seq = 0xFF;
+        tsync_pair_ready = 0;
+        tsync_synced = 0;
+        tsync_rate_ppb = 0;
+        tsync_offset_ns = 0;
+        tsync_offset_max = 0;
+        tsync_next = Time_Now32();
+        tsync_role = args[1];
+        if (tsync_role == TSYNC_ROLE_MASTER) {
+            Sched_Post(SCHED_EVT_TIMEOUT);      // First SYNC now
+        }
+    }
+
+    if (tsync_role == TSYNC_ROLE_MASTER) {
+        ref_local = Time_Now();
+        ref_global = Time_ToEpoch(ref_local) * 1000;
+        synced = 1;
+    } else {
+        ref_local = tsync_ref_local;
+        ref_global = tsync_ref_global;
+        synced = tsync_synced;
+    }
+
+    reply[0] = (len >= 1) ? args[0] : TSYNC_OP_STATUS;
+    reply[1] = tsync_role;
+    reply[2] = tsync_domain;
+    reply[3] = synced;
+    reply[4] = tsync_period_ms >> 8;
+    reply[5] = tsync_period_ms & 0xFF;
+    UART_PutU32(&reply[6],  tsync_syncs);
+    UART_PutU32(&reply[10], tsync_fups);
+    UART_PutU32(&reply[14], tsync_dropped);
+    UART_PutU32(&reply[18], tsync_steps);
+    UART_PutU32(&reply[22], tsync_window);
+    UART_PutU32(&reply[26], (uint32_t)tsync_offset_ns);
+    UART_PutU32(&reply[30], tsync_offset_max);
+    UART_PutU32(&reply[34], (uint32_t)(tsync_role == TSYNC_ROLE_MASTER ? 0 : tsync_rate_ppb));
+    UART_PutU32(&reply[38], (uint32_t)(ref_local >> 32));
+    UART_PutU32(&reply[42], (uint32_t)ref_local);
+    UART_PutU32(&reply[46], (uint32_t)(ref_global >> 32));
+    UART_PutU32(&reply[50], (uint32_t)ref_global);
+    UART_SendReply(UART_CMD_TSYNC, reply, sizeof(reply));
+}
+
+/******************************************************************************
+ * End of File
+ ******************************************************************************/
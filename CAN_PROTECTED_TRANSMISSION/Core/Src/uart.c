@@ -9,11 +9,73 @@
 #include "uart.h"
 #include "can.h"
 #include "timer.h"
+#include "bench.h"
+#include "clock.h"
+#include "compact.h"
+#include "forward.h"
+#include "timebase.h"
+#include "power.h"
+#include "sched.h"
+#include "capture.h"
+#include "idstats.h"
+#include "crc.h"
+#include "cfgstore.h"
+#include "boot.h"
+#include "tsync.h"
+#include "iddisp.h"
+#include "pool.h"
+
+/******************************************************************************
+ * Local variables
+ ******************************************************************************/
+static uint32_t uart_baud = UART_BOOT_BAUD;         // Current link speed
+static uint32_t uart_baud_previous = 0;             // Fallback speed until confirmed, 0 = confirmed
+static uint32_t uart_baud_switch_time = 0;          // Time base (us) when the speed was changed
+
+static uint8_t uart_batch[UART_BATCH_HDR_LEN + UART_BATCH_SIZE];  // Header + frame records
+static uint16_t uart_batch_len = 0;                 // Frame record bytes in the batch
+static uint8_t uart_batch_count = 0;                // Frames in the batch
+static uint8_t uart_batch_frames = 0;               // Frames per batch, 0/1 = batching off
+static uint32_t uart_batch_age_us = 0;              // Send a batch this long after its first frame
+static uint32_t uart_batch_start = 0;               // Time base (us) at the first frame of the batch
+
+/**
+ * @brief Command queue of pool blocks holding [length][frame...]. The RX
+ *        interrupt assembles each host frame in its own block and queues the
+ *        handle, so a frame arriving while the main loop is busy neither
+ *        overwrites nor is copied into the one being processed.
+ */
+_Static_assert(1 + UART_FRAME_MAX <= POOL_BLOCK_SIZE, "host frame does not fit a pool block");
+
+static uint8_t uart_rx_block = POOL_NONE;           // Block being assembled
+static uint8_t uart_cmd_queue[UART_CMD_QUEUE_LEN];  // Handles of queued host frames
+static volatile uint8_t uart_cmd_head = 0;          // Oldest queued frame
+static volatile uint8_t uart_cmd_count = 0;         // Frames in the queue
+static volatile uint8_t uart_cmd_overflow = 0;      // 1 = a sequenced frame was discarded
+static volatile uint8_t uart_cmd_overflow_seq = 0;  // Its sequence number
+
+/******************************************************************************
+ * Function: UART_BaudToBrr
+ * Description:
+ *   Computes BRR for the given baud rate (16x oversampling: BRR = fPCLK2 / baud).
+ *   Returns 0 if the rate is above fPCLK2 / 16 or off by more than 2 %.
+ ******************************************************************************/
+static uint32_t UART_BaudToBrr(uint32_t baud) {
+    uint32_t pclk2 = Clock_GetPclk2();
+    uint32_t brr, actual;
+
+    if (baud == 0) return 0;
+    brr = (pclk2 + baud / 2) / baud;                // Rounded divider (mantissa:fraction)
+    if (brr < 16 || brr > 0xFFFF) return 0;         // Mantissa must be 1..4095
+    actual = pclk2 / brr;
+    if ((actual > baud ? actual - baud : baud - actual) > baud / 50) return 0;
+    return brr;
+}
 
 /******************************************************************************
  * Function: UART_Config
  * Description:
- *   Configures UART1 at 9600 baudrate with 8MHz clock.
+ *   Configures UART1 at UART_BOOT_BAUD (115200) from the APB2 clock.
  *   Sets PA9 as TX (Alternate function push-pull) and PA10 as RX (Input floating).
  *   Enables UART RX interrupt for receiving data byte-by-byte.
  ******************************************************************************/
@@ -25,7 +87,7 @@ void UART_Config(void) {
 	GPIOA->CRH |= (0b10 << 4) | (0b10 << 6); // TX: Alternate function push-pull, max speed 2 MHz
 	GPIOA->CRH |= (0b01 << 10);  // RX: Input floating mode
 
-    USART1->BRR = 0x45; // Set baud rate register for 9600 baud at 8 MHz clock
+    USART1->BRR = UART_BaudToBrr(UART_BOOT_BAUD); // 115200 baud: 72 MHz / 115200 = 625
     USART1->CR1 |= (1 << 2) | (1 << 3) | (1 << 13) | (1 << 5); // Enable UART RX, TX, UART peripheral, and RX interrupt
     NVIC_EnableIRQ(USART1_IRQn);  // Enable USART1 interrupt in NVIC
 }
@@ -66,117 +128,528 @@ void UART_SendString(const char* s) {
     }
 }
 
+/******************************************************************************
+ * Function: UART_SendReply
+ * Description:
+ *   Sends a reply record [cmd | 0x80][len][payload] for a host command.
+ ******************************************************************************/
+void UART_SendReply(uint8_t cmd, const uint8_t *payload, uint8_t len) {
+    UART_SendByte(cmd | UART_REPLY_FLAG);  // Reply type = command byte with reply flag
+    UART_SendByte(len);                    // Payload length
+    for (uint8_t i = 0; i < len; i++) {
+        UART_SendByte(payload[i]);         // Payload bytes
+    }
+}
+
+/******************************************************************************
+ * Function: UART_PutU32
+ * Description:
+ *   Stores a 32-bit value most-significant byte first into a reply buffer.
+ ******************************************************************************/
+void UART_PutU32(uint8_t *p, uint32_t v) {
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >>  8) & 0xFF;
+    p[3] =  v        & 0xFF;
+}
+
+/******************************************************************************
+ * Function: UART_SetBaud
+ * Description:
+ *   Waits for the last byte to leave the shift register (TC), then loads the
+ *   new divider. Bytes already queued by the caller go out at the old speed.
+ ******************************************************************************/
+static void UART_SetBaud(uint32_t baud) {
+    while (!(USART1->SR & (1 << 6)));               // Wait for transmission complete
+    USART1->BRR = UART_BaudToBrr(baud);
+    uart_baud = baud;
+}
+
+/******************************************************************************
+ * Function: UART_SendCrc
+ * Description:
+ *   Sends the CRC trailer of a record or batch, big-endian.
+ ******************************************************************************/
+static void UART_SendCrc(uint32_t crc) {
+    uint8_t b[4];
+
+    UART_PutU32(b, crc);
+    for (uint8_t i = 0; i < 4; i++) {
+        UART_SendByte(b[i]);
+    }
+}
+
+/******************************************************************************
+ * Function: UART_BatchFlush
+ * Description:
+ *   Sends the batch with its shared header and empties it.
+ ******************************************************************************/
+static void UART_BatchFlush(void) {
+    if (uart_batch_count == 0) return;
+
+    uart_batch[0] = UART_REC_BATCH;                 // Shared header
+    uart_batch[1] = uart_batch_count;
+    uart_batch[2] = (uart_batch_len >> 8) & 0xFF;
+    uart_batch[3] =  uart_batch_len       & 0xFF;
+    for (uint16_t i = 0; i < UART_BATCH_HDR_LEN + uart_batch_len; i++) {
+        UART_SendByte(uart_batch[i]);
+    }
+    if (Crc_RecordsEnabled()) {
+        UART_SendCrc(Crc_Record(uart_batch, UART_BATCH_HDR_LEN + uart_batch_len));
+    }
+    uart_batch_len = 0;
+    uart_batch_count = 0;
+}
+
+/******************************************************************************
+ * Function: UART_SendRecord
+ * Description:
+ *   Without batching the record goes out byte by byte. Otherwise it is
+ *   appended to the batch, which is sent when it holds the configured number
+ *   of frames or the next record does not fit. Runs in the main loop (see
+ *   Fwd_Poll()), so the RX interrupt never waits for the UART.
+ ******************************************************************************/
+void UART_SendRecord(const uint8_t *rec, uint8_t len) {
+    if (uart_batch_frames <= 1) {
+        for (uint8_t i = 0; i < len; i++) {
+            UART_SendByte(rec[i]);                  // Single record
+        }
+        if (Crc_RecordsEnabled()) {
+            UART_SendCrc(Crc_Record(rec, len));
+        }
+        return;
+    }
+
+    if (uart_batch_len + len > UART_BATCH_SIZE) {
+        UART_BatchFlush();                          // No room left
+    }
+    if (uart_batch_count == 0) {
+        uart_batch_start = Time_Now32();            // Age counts from the first frame
+    }
+    memcpy(&uart_batch[UART_BATCH_HDR_LEN + uart_batch_len], rec, len);
+    uart_batch_len += len;
+    uart_batch_count++;
+
+    if (uart_batch_count >= uart_batch_frames) {
+        UART_BatchFlush();
+    }
+}
+
+/******************************************************************************
+ * Function: UART_BatchPoll
+ * Description:
+ *   Sends the batch once its first frame is older than the configured age.
+ ******************************************************************************/
+void UART_BatchPoll(void) {
+    if (uart_batch_count &&
+        (Time_Now32() - uart_batch_start) >= uart_batch_age_us) {
+        UART_BatchFlush();                          // Flush on timeout
+    }
+}
+
+/******************************************************************************
+ * Function: UART_NextDeadline
+ * Description:
+ *   Earliest of the batch age and the baud confirmation deadlines, for the
+ *   tickless idle.
+ ******************************************************************************/
+uint8_t UART_NextDeadline(uint32_t *deadline) {
+    uint8_t found = 0;
+    uint32_t t;
+
+    if (uart_batch_count) {
+        *deadline = uart_batch_start + uart_batch_age_us;
+        found = 1;
+    }
+    if (uart_baud_previous) {
+        t = uart_baud_switch_time + UART_BAUD_CONFIRM_MS * 1000UL + 1;
+        if (!found || (int32_t)(t - *deadline) < 0) {
+            *deadline = t;
+        }
+        found = 1;
+    }
+    return found;
+}
+
+/******************************************************************************
+ * Function: UART_BatchConfig
+ * Description:
+ *   Sets the batch limits. Frames already in the batch are sent first so
+ *   nothing is lost when batching is switched off.
+ ******************************************************************************/
+static void UART_BatchConfig(uint8_t frames, uint32_t age_us) {
+    UART_BatchFlush();
+    uart_batch_frames = frames;
+    uart_batch_age_us = age_us;
+}
+
+/******************************************************************************
+ * Function: UART_BaudCheck
+ * Description:
+ *   Falls back to the previous link speed if no command frame was received at
+ *   the new speed within UART_BAUD_CONFIRM_MS.
+ ******************************************************************************/
+void UART_BaudCheck(void) {
+    if (uart_baud_previous &&
+        (Time_Now32() - uart_baud_switch_time) > UART_BAUD_CONFIRM_MS * 1000UL) {
+        UART_SetBaud(uart_baud_previous);           // Host never confirmed: restore
+        uart_baud_previous = 0;
+        uart_rx_index = 0;                          // Drop bytes received at the wrong speed
+    }
+}
+
+/******************************************************************************
+ * Function: UART_FrameLength
+ * Description:
+ *   Checks the first n bytes of a host frame. Returns the total frame length
+ *   once the header shows it, 0 if more bytes are needed and -1 if the frame
+ *   is invalid:
+ *     - mode byte (0 or 1), or a command byte (>= UART_CMD_BASE)
+ *     - data length (max 7), or command payload length
+ *     - total frame length depending on mode
+ ******************************************************************************/
+static int16_t UART_FrameLength(const uint8_t *buf, uint8_t n) {
+    uint8_t mode, data_len;
+
+    if (n < 1) return 0;
+    mode = buf[0];
+
+    // Command frame: [cmd][payload length][payload]
+    if (mode >= UART_CMD_BASE) {
+        if (mode & UART_REPLY_FLAG) return -1;      // Reply types are invalid
+        if (n < 2) return 0;
+        if (buf[1] > ((mode == UART_CMD_SEQ) ? UART_SEQ_MAX_PAYLOAD : UART_CMD_MAX_PAYLOAD)) {
+            return -1;                              // Oversize payload
+        }
+        return 2 + buf[1];
+    }
+
+    // CAN frame: [mode][ID 2|4][len][data][interval 2B]
+    if (mode != 0 && mode != 1) return -1;          // Invalid mode
+    if (n < ((mode == 0) ? 4 : 6)) return 0;
+    data_len = (mode == 0) ? buf[3] : buf[5];       // Get data length depending on mode
+    if (data_len > 7) return -1;                    // Invalid data length
+    return ((mode == 0) ? 6 : 8) + data_len;
+}
+
+/******************************************************************************
+ * Function: UART_QueueFrame
+ * Description:
+ *   Queues the assembled block and takes a fresh one for the next frame.
+ *   When the queue is full, or no block is free, the frame is discarded and
+ *   its block reused; for a sequenced frame the main loop then sends a
+ *   UART_ACK_OVERFLOW acknowledgement. Runs in the RX interrupt.
+ ******************************************************************************/
+static void UART_QueueFrame(uint8_t len) {
+    uint8_t *block = Pool_Block(uart_rx_block);
+    uint8_t next = POOL_NONE;
+
+    if (uart_cmd_count < UART_CMD_QUEUE_LEN) {
+        next = Pool_Alloc();
+    }
+    if (next == POOL_NONE) {
+        if (block[1] == UART_CMD_SEQ && len >= 3) {
+            uart_cmd_overflow_seq = block[3];
+            uart_cmd_overflow = 1;
+        }
+    } else {
+        block[0] = len;
+        uart_cmd_queue[(uart_cmd_head + uart_cmd_count) % UART_CMD_QUEUE_LEN] = uart_rx_block;
+        uart_cmd_count++;
+        uart_rx_block = next;
+    }
+    Sched_Post(SCHED_EVT_UART_RX);
+}
+
 /******************************************************************************
  * Function: USART1_IRQHandler
  * Description:
  *   UART1 RX interrupt handler to receive data byte-by-byte.
- *   Stores received bytes in buffer.
- *   Checks for valid frame format:
- *     - mode byte (0 or 1)
- *     - data length (max 7)
- *     - total frame length depending on mode
- *   Sets frame_ready flag when a complete frame is received.
+ *   Stores received bytes in the current pool block, after its length
+ *   byte, and checks them with
+ *   UART_FrameLength(). A complete frame is queued and the buffer restarts
+ *   immediately, so back-to-back frames are not lost.
  *   Resets buffer on overflow or invalid data.
  ******************************************************************************/
 void USART1_IRQHandler(void) {
 	if (USART1->SR & (1 << 5)) {                // Check if RX data register is not empty (data received)
         uint8_t received_byte = USART1->DR;          // Read received byte clears RXNE flag
+        uint8_t *frame;
+        int16_t frame_len;
+
+        if (uart_rx_block == POOL_NONE) {             // First byte after reset
+            uart_rx_block = Pool_Alloc();
+            uart_rx_index = 0;
+            if (uart_rx_block == POOL_NONE) {
+                return;                                // Pool empty: byte lost
+            }
+        }
 
         // Prevent buffer overflow
-        if (uart_rx_index >= sizeof(uart_rx_buffer)) {
+        if (uart_rx_index >= UART_FRAME_MAX) {
             uart_rx_index = 0;                         // Reset buffer index if overflow would occur
             return;
         }
 
-        uart_rx_buffer[uart_rx_index++] = received_byte;  // Store received byte in buffer
-
-        // Check minimal frame length and validity
-        if (uart_rx_index >= 6 && !uart_frame_ready) {    // Only process if enough bytes received and frame not ready
-            uint8_t mode = uart_rx_buffer[0];             // Get mode byte
-
-            // Validate mode
-            if (mode != 0 && mode != 1) {
-                uart_rx_index = 0;                         // Invalid mode, reset buffer
-                return;
-            }
+        frame = (uint8_t*)Pool_Block(uart_rx_block) + 1;
+        frame[uart_rx_index++] = received_byte;        // Store received byte in the block
 
-            uint8_t data_len = (mode == 0) ? uart_rx_buffer[3] : uart_rx_buffer[5];  // Get data length depending on mode
-            if (data_len > 7) {
-                uart_rx_index = 0;                         // Invalid data length, reset buffer
-                return;
-            }
-
-            uint8_t expected_total_len = (mode == 0) ? (6 + data_len) : (8 + data_len);  // Calculate expected frame length
-
-            if (uart_rx_index >= expected_total_len) {   // Check if full frame received
-                uart_frame_ready = 1;                      // Set frame ready flag
-            }
-        }
-
-        // Reset buffer if it grows too large (timeout simulation)
-        if (uart_rx_index > 30) {
-            uart_rx_index = 0;                             // Reset buffer to avoid stuck state
+        frame_len = UART_FrameLength(frame, uart_rx_index);
+        if (frame_len < 0) {
+            uart_rx_index = 0;                         // Invalid frame, reset buffer
+        } else if (frame_len > 0 && uart_rx_index >= frame_len) {
+            UART_QueueFrame(uart_rx_index);            // Full frame received
+            uart_rx_index = 0;
         }
     }
 }
 
 /******************************************************************************
- * Function: Process_UART_Frame
+ * Function: UART_SendAck
+ * Description:
+ *   Acknowledges a sequenced frame: [seq][status][free queue slots].
+ ******************************************************************************/
+static void UART_SendAck(uint8_t seq, uint8_t status) {
+    uint8_t reply[3];
+
+    reply[0] = seq;
+    reply[1] = status;
+    reply[2] = UART_CMD_QUEUE_LEN - uart_cmd_count;
+    UART_SendReply(UART_CMD_SEQ, reply, sizeof(reply));
+}
+
+/******************************************************************************
+ * Function: UART_HandleFrame
  * Description:
- *   Processes a complete UART frame.
+ *   Processes one complete host frame and returns its UART_ACK_* status.
  *   Decodes mode, ID (standard or extended), data length, payload, and interval.
  *   If interval == 0, sends CAN frame once.
- *   If interval > 0, saves the frame and starts timer for repeated sending.
+ *   If interval > 0, repeats the frame in cyclic slot 0 every interval ms.
  *   The last byte of payload is a counter byte that increments with each send.
+ *   Command frames (first byte >= UART_CMD_BASE) are dispatched by command.
  ******************************************************************************/
-void Process_UART_Frame(void)
+static uint8_t UART_HandleFrame(const uint8_t *frame)
 {
-    uint8_t mode = uart_rx_buffer[0];               // Extract mode byte from UART buffer
+    uint8_t mode = frame[0];                        // Extract mode byte from the frame
+
+    if (mode >= UART_CMD_BASE) {                    // Host command instead of a CAN frame
+        const uint8_t *args = &frame[2];
+        uint8_t args_len = frame[1];
+
+        uart_baud_previous = 0;                     // Any command at the current speed confirms it
+
+        switch (mode) {
+        case UART_CMD_BURST:
+            Bench_Burst(args, args_len);            // Max-rate burst benchmark
+            break;
+        case UART_CMD_PING:
+            Bench_Ping(args, args_len);             // Ping-pong round-trip probe
+            break;
+        case UART_CMD_PING_HIST:
+            Bench_PingHistogram(args, args_len);    // Round-trip histogram slice
+            break;
+        case UART_CMD_CAN_MODE: {
+            uint8_t current;
+            if (args_len >= 1) {
+                CAN_SetTestMode(args[0]);           // Normal / loopback / silent
+            }
+            current = CAN_GetTestMode();
+            UART_SendReply(UART_CMD_CAN_MODE, &current, 1);
+            break;
+        }
+        case UART_CMD_SELFTEST:
+            Bench_SelfTest(args, args_len);         // Loopback throughput + latency
+            break;
+        case UART_CMD_CAN_BITRATE: {
+            uint8_t reply[9];                       // [status][bitrate 4B][BTR 4B]
+            reply[0] = 0;
+            if (args_len >= 4) {                    // Empty payload only queries
+                uint32_t bitrate = ((uint32_t)args[0] << 24) | ((uint32_t)args[1] << 16) |
+                                   ((uint32_t)args[2] <<  8) |  (uint32_t)args[3];
+                reply[0] = CAN_SetBitrate(bitrate);
+            }
+            UART_PutU32(&reply[1], CAN_GetBitrate());
+            UART_PutU32(&reply[5], CAN_GetBitTiming());
+            UART_SendReply(UART_CMD_CAN_BITRATE, reply, sizeof(reply));
+            break;
+        }
+        case UART_CMD_UART_BAUD: {
+            uint8_t reply[5];                       // [status][baud 4B]
+            uint32_t baud = uart_baud;
+            reply[0] = 0;
+            if (args_len >= 4) {                    // Empty payload queries / confirms
+                baud = ((uint32_t)args[0] << 24) | ((uint32_t)args[1] << 16) |
+                       ((uint32_t)args[2] <<  8) |  (uint32_t)args[3];
+                if (UART_BaudToBrr(baud) == 0) {
+                    reply[0] = 1;                   // Not reachable from PCLK2
+                    baud = uart_baud;
+                }
+            }
+            UART_PutU32(&reply[1], baud);
+            UART_SendReply(UART_CMD_UART_BAUD, reply, sizeof(reply));  // Still at the old speed
+            if (baud != uart_baud) {
+                uart_baud_previous = uart_baud;     // Armed until the host confirms
+                uart_baud_switch_time = Time_Now32();
+                UART_SetBaud(baud);
+            }
+            break;
+        }
+        case UART_CMD_BATCH: {
+            uint8_t reply[6];                       // [status][frames][age us 4B]
+            reply[0] = 0;
+            if (args_len >= 5) {                    // [frames][age us 4B], empty = query
+                uint32_t age_us = ((uint32_t)args[1] << 24) | ((uint32_t)args[2] << 16) |
+                                  ((uint32_t)args[3] <<  8) |  (uint32_t)args[4];
+                if (args[0] > UART_BATCH_MAX_FRAMES) {
+                    reply[0] = 1;                   // More frames than the buffer is sized for
+                } else {
+                    UART_BatchConfig(args[0], age_us);
+                }
+            }
+            reply[1] = uart_batch_frames;
+            UART_PutU32(&reply[2], uart_batch_age_us);
+            UART_SendReply(UART_CMD_BATCH, reply, sizeof(reply));
+            break;
+        }
+        case UART_CMD_COMPACT:
+            Compact_Command(args, args_len);        // Compact records on/off + stats
+            break;
+        case UART_CMD_FWD:
+            Fwd_Command(args, args_len);            // Queue policy + loss counters
+            break;
+        case UART_CMD_TIME:
+            Time_Command(args, args_len);           // Time base and host epoch offset
+            break;
+        case UART_CMD_CYCLIC:
+            Timer_CyclicCommand(args, args_len);    // Cyclic message + jitter statistics
+            break;
+        case UART_CMD_POWER:
+            Power_Command(args, args_len);          // Idle sleep depth + wakeup latency
+            break;
+        case UART_CMD_SCHED:
+            Sched_Command(args, args_len);          // Per-task run-time accounting
+            break;
+        case UART_CMD_CAPTURE:
+            Capture_Command(args, args_len);        // Triggered capture buffer + dump
+            break;
+        case UART_CMD_IDSTATS:
+            IdStats_Command(args, args_len);        // Per-ID statistics table
+            break;
+        case UART_CMD_CRC:
+            UART_BatchFlush();                      // Batch keeps the old trailer setting
+            Crc_Command(args, args_len);            // Record CRCs + CRC unit benchmark
+            break;
+        case UART_CMD_CFGSTORE:
+            CfgStore_Command(args, args_len);       // Saved configuration
+            break;
+        case UART_CMD_BOOT:
+            UART_BatchFlush();                      // Queued records out before the reset
+            Boot_Command(args, args_len);           // Does not return
+            break;
+        case UART_CMD_TSYNC:
+            Tsync_Command(args, args_len);          // Time sync role + clock reference
+            break;
+        case UART_CMD_IDDISP:
+            IdDisp_Command(args, args_len);         // Table layout + lookup cycles
+            break;
+        case UART_CMD_POOL:
+            Pool_Command(args, args_len);           // Occupancy + high water
+            break;
+        default:
+            return UART_ACK_UNKNOWN;                // Unknown command: ignore
+        }
+        return UART_ACK_OK;
+    }
+
     uint32_t id  = 0;                               // Initialize CAN ID
-    uint8_t  data_len = (mode == 0) ? uart_rx_buffer[3]
-                                    : uart_rx_buffer[5]; // Extract data length
+    uint8_t  data_len = (mode == 0) ? frame[3]
+                                    : frame[5];     // Extract data length
 
-    if (data_len > 7) return;                        // Safety check on data length
+    if (data_len > 7) return UART_ACK_BAD_FRAME;    // Safety check on data length
 
     uint16_t interval;
-    uint8_t *data_ptr;
+    const uint8_t *data_ptr;
 
     if (mode == 0) {     // Standard ID frame format
-        id       = (uart_rx_buffer[1] << 8) | uart_rx_buffer[2];     // Combine two bytes into 11-bit standard ID
-        data_ptr = (uint8_t*)&uart_rx_buffer[4];                     // Data payload start index
-        interval = (uart_rx_buffer[4 + data_len] << 8) |             // High byte of interval
-                    uart_rx_buffer[5 + data_len];                     // Low byte of interval
+        id       = (frame[1] << 8) | frame[2];                        // Combine two bytes into 11-bit standard ID
+        data_ptr = &frame[4];                                         // Data payload start index
+        interval = (frame[4 + data_len] << 8) |                       // High byte of interval
+                    frame[5 + data_len];                              // Low byte of interval
     } else {             // Extended ID frame format
-        id       = (uart_rx_buffer[1] << 24) | (uart_rx_buffer[2] << 16) | // Combine four bytes into 29-bit extended ID
-                   (uart_rx_buffer[3] <<  8) |  uart_rx_buffer[4];
-        data_ptr = (uint8_t*)&uart_rx_buffer[6];                     // Data payload start index
-        interval = (uart_rx_buffer[6 + data_len] << 8) |             // High byte of interval
-                    uart_rx_buffer[7 + data_len];                     // Low byte of interval
+        id       = ((uint32_t)frame[1] << 24) | ((uint32_t)frame[2] << 16) | // Combine four bytes into 29-bit extended ID
+                   ((uint32_t)frame[3] <<  8) |  frame[4];
+        data_ptr = &frame[6];                                         // Data payload start index
+        interval = (frame[6 + data_len] << 8) |                       // High byte of interval
+                    frame[7 + data_len];                              // Low byte of interval
     }
 
-    uint8_t can_len  = data_len + 1;                  // CAN frame length = data length + 1 counter byte
-    uint8_t can_data[8] = {0};                         // Initialize CAN data buffer
+    if (interval == 0) {                               // If no repeat interval
+        uint8_t can_len  = data_len + 1;               // CAN frame length = data length + 1 counter byte
+        uint8_t can_data[8] = {0};                     // Initialize CAN data buffer
 
-    memcpy(can_data, data_ptr, data_len);              // Copy payload data from UART buffer to CAN data buffer
-    can_data[data_len] = tx_counter++;                  // Append/increment counter byte at end of payload
+        memcpy(can_data, data_ptr, data_len);          // Copy payload data from UART buffer to CAN data buffer
+        can_data[data_len] = tx_counter++;             // Append/increment counter byte at end of payload
 
-    if (interval == 0) {                               // If no repeat interval
-        repeat = 0;                                    // Disable repeated sending
-        Timer2_Stop();                                 // Stop the timer to prevent repeated sending
-        CAN_Send(mode, id, can_data, can_len);        // Send CAN frame once immediately
+        Timer_StopCyclic(0);                           // Stop the repeated frame
+        switch (CAN_Send(mode, id, can_data, can_len)) {  // Send CAN frame once immediately
+        case CAN_TX_OK:      return UART_ACK_OK;
+        case CAN_TX_BUS_OFF: return UART_ACK_BUS_OFF;
+        case CAN_TX_BUSY:    return UART_ACK_TX_BUSY;
+        default:             return UART_ACK_TX_FAILED;
+        }
     } else {                                           // If interval > 0 (repeat enabled)
-        repeat = 1;                                    // Enable repeat mode
-
-        // Save the current frame in global buffer for repeated sending in Timer2 interrupt
-        current_frame[0] = mode;
-        current_frame[1] = (id >> 24) & 0xFF;
-        current_frame[2] = (id >> 16) & 0xFF;
-        current_frame[3] = (id >>  8) & 0xFF;
-        current_frame[4] =  id        & 0xFF;
-        current_frame[5] = can_len;
-        memcpy((uint8_t*)&current_frame[6], can_data, can_len);  // Copy CAN payload including counter
-
-        Timer2_Start(interval);                         // Start timer with specified interval for repeated sending
+        // Cyclic slot 0 repeats the frame every interval ms (counter byte added per frame)
+        Timer_StartCyclic(0, mode, id, data_ptr, data_len, (uint32_t)interval * 1000);
+    }
+    return UART_ACK_OK;
+}
+
+/******************************************************************************
+ * Function: Process_UART_Frame
+ * Description:
+ *   Takes frames out of the command queue one at a time (USART1 interrupt
+ *   masked only to dequeue the handle) and handles them in their pool
+ *   blocks, which are then freed. A sequenced envelope is
+ *   unwrapped, its inner frame validated and handled, then acknowledged
+ *   with the result. A pending overflow is acknowledged first.
+ ******************************************************************************/
+void Process_UART_Frame(void)
+{
+    uint8_t *frame;
+    uint8_t h, len;
+
+    while (1) {
+        NVIC_DisableIRQ(USART1_IRQn);
+        if (uart_cmd_overflow) {
+            uint8_t seq = uart_cmd_overflow_seq;
+            uart_cmd_overflow = 0;
+            NVIC_EnableIRQ(USART1_IRQn);
+            UART_SendAck(seq, UART_ACK_OVERFLOW);
+            continue;
+        }
+        if (uart_cmd_count == 0) {
+            NVIC_EnableIRQ(USART1_IRQn);
+            return;
+        }
+        h = uart_cmd_queue[uart_cmd_head];
+        uart_cmd_head = (uart_cmd_head + 1) % UART_CMD_QUEUE_LEN;
+        uart_cmd_count--;
+        NVIC_EnableIRQ(USART1_IRQn);
+        frame = Pool_Block(h);
+        len = *frame++;
+
+        if (frame[0] != UART_CMD_SEQ) {
+            UART_HandleFrame(frame);                // Unsequenced frame: no acknowledgement
+        } else if (len >= 3) {
+            uint8_t inner_len = len - 3;            // [cmd][len][seq] + inner frame
+            if (inner_len > 0 && frame[3] != UART_CMD_SEQ &&
+                UART_FrameLength(&frame[3], inner_len) == inner_len) {
+                UART_SendAck(frame[2], UART_HandleFrame(&frame[3]));
+            } else {
+                UART_SendAck(frame[2], UART_ACK_BAD_FRAME);
+            }
+        }
+        Pool_Free(h);
     }
 }
 
@@ -5,39 +5,84 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../Core/Src/bench.c \
+../Core/Src/boot.c \
 ../Core/Src/can.c \
+../Core/Src/capture.c \
+../Core/Src/cfgstore.c \
+../Core/Src/clock.c \
+../Core/Src/compact.c \
+../Core/Src/crc.c \
+../Core/Src/forward.c \
 ../Core/Src/gpio.c \
+../Core/Src/iddisp.c \
+../Core/Src/idstats.c \
 ../Core/Src/main.c \
+../Core/Src/pool.c \
+../Core/Src/power.c \
+../Core/Src/sched.c \
 ../Core/Src/stm32f1xx_hal_msp.c \
 ../Core/Src/stm32f1xx_it.c \
 ../Core/Src/syscalls.c \
 ../Core/Src/sysmem.c \
 ../Core/Src/system_stm32f1xx.c \
+../Core/Src/timebase.c \
 ../Core/Src/timer.c \
+../Core/Src/tsync.c \
 ../Core/Src/uart.c 
 
 OBJS += \
+./Core/Src/bench.o \
+./Core/Src/boot.o \
 ./Core/Src/can.o \
+./Core/Src/capture.o \
+./Core/Src/cfgstore.o \
+./Core/Src/clock.o \
+./Core/Src/compact.o \
+./Core/Src/crc.o \
+./Core/Src/forward.o \
 ./Core/Src/gpio.o \
+./Core/Src/iddisp.o \
+./Core/Src/idstats.o \
 ./Core/Src/main.o \
+./Core/Src/pool.o \
+./Core/Src/power.o \
+./Core/Src/sched.o \
 ./Core/Src/stm32f1xx_hal_msp.o \
 ./Core/Src/stm32f1xx_it.o \
 ./Core/Src/syscalls.o \
 ./Core/Src/sysmem.o \
 ./Core/Src/system_stm32f1xx.o \
+./Core/Src/timebase.o \
 ./Core/Src/timer.o \
+./Core/Src/tsync.o \
 ./Core/Src/uart.o 
 
 C_DEPS += \
+./Core/Src/bench.d \
+./Core/Src/boot.d \
 ./Core/Src/can.d \
+./Core/Src/capture.d \
+./Core/Src/cfgstore.d \
+./Core/Src/clock.d \
+./Core/Src/compact.d \
+./Core/Src/crc.d \
+./Core/Src/forward.d \
 ./Core/Src/gpio.d \
+./Core/Src/iddisp.d \
+./Core/Src/idstats.d \
 ./Core/Src/main.d \
+./Core/Src/pool.d \
+./Core/Src/power.d \
+./Core/Src/sched.d \
 ./Core/Src/stm32f1xx_hal_msp.d \
 ./Core/Src/stm32f1xx_it.d \
 ./Core/Src/syscalls.d \
 ./Core/Src/sysmem.d \
 ./Core/Src/system_stm32f1xx.d \
+./Core/Src/timebase.d \
 ./Core/Src/timer.d \
+./Core/Src/tsync.d \
 ./Core/Src/uart.d 
 
 
@@ -48,7 +93,7 @@ Core/Src/%.o Core/Src/%.su Core/Src/%.cyclo: ../Core/Src/%.c Core/Src/subdir.mk
 clean: clean-Core-2f-Src
 
 clean-Core-2f-Src:
-	-$(RM) ./Core/Src/can.cyclo ./Core/Src/can.d ./Core/Src/can.o ./Core/Src/can.su ./Core/Src/gpio.cyclo ./Core/Src/gpio.d ./Core/Src/gpio.o ./Core/Src/gpio.su ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/stm32f1xx_hal_msp.cyclo ./Core/Src/stm32f1xx_hal_msp.d ./Core/Src/stm32f1xx_hal_msp.o ./Core/Src/stm32f1xx_hal_msp.su ./Core/Src/stm32f1xx_it.cyclo ./Core/Src/stm32f1xx_it.d ./Core/Src/stm32f1xx_it.o ./Core/Src/stm32f1xx_it.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32f1xx.cyclo ./Core/Src/system_stm32f1xx.d ./Core/Src/system_stm32f1xx.o ./Core/Src/system_stm32f1xx.su ./Core/Src/timer.cyclo ./Core/Src/timer.d ./Core/Src/timer.o ./Core/Src/timer.su ./Core/Src/uart.cyclo ./Core/Src/uart.d ./Core/Src/uart.o ./Core/Src/uart.su
+	-$(RM) ./Core/Src/bench.cyclo ./Core/Src/bench.d ./Core/Src/bench.o ./Core/Src/bench.su ./Core/Src/boot.cyclo ./Core/Src/boot.d ./Core/Src/boot.o ./Core/Src/boot.su ./Core/Src/can.cyclo ./Core/Src/can.d ./Core/Src/can.o ./Core/Src/can.su ./Core/Src/capture.cyclo ./Core/Src/capture.d ./Core/Src/capture.o ./Core/Src/capture.su ./Core/Src/cfgstore.cyclo ./Core/Src/cfgstore.d ./Core/Src/cfgstore.o ./Core/Src/cfgstore.su ./Core/Src/clock.cyclo ./Core/Src/clock.d ./Core/Src/clock.o ./Core/Src/clock.su ./Core/Src/compact.cyclo ./Core/Src/compact.d ./Core/Src/compact.o ./Core/Src/compact.su ./Core/Src/crc.cyclo ./Core/Src/crc.d ./Core/Src/crc.o ./Core/Src/crc.su ./Core/Src/forward.cyclo ./Core/Src/forward.d ./Core/Src/forward.o ./Core/Src/forward.su ./Core/Src/gpio.cyclo ./Core/Src/gpio.d ./Core/Src/gpio.o ./Core/Src/gpio.su ./Core/Src/iddisp.cyclo ./Core/Src/iddisp.d ./Core/Src/iddisp.o ./Core/Src/iddisp.su ./Core/Src/idstats.cyclo ./Core/Src/idstats.d ./Core/Src/idstats.o ./Core/Src/idstats.su ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/pool.cyclo ./Core/Src/pool.d ./Core/Src/pool.o ./Core/Src/pool.su ./Core/Src/power.cyclo ./Core/Src/power.d ./Core/Src/power.o ./Core/Src/power.su ./Core/Src/sched.cyclo ./Core/Src/sched.d ./Core/Src/sched.o ./Core/Src/sched.su ./Core/Src/stm32f1xx_hal_msp.cyclo ./Core/Src/stm32f1xx_hal_msp.d ./Core/Src/stm32f1xx_hal_msp.o ./Core/Src/stm32f1xx_hal_msp.su ./Core/Src/stm32f1xx_it.cyclo ./Core/Src/stm32f1xx_it.d ./Core/Src/stm32f1xx_it.o ./Core/Src/stm32f1xx_it.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32f1xx.cyclo ./Core/Src/system_stm32f1xx.d ./Core/Src/system_stm32f1xx.o ./Core/Src/system_stm32f1xx.su ./Core/Src/timebase.cyclo ./Core/Src/timebase.d ./Core/Src/timebase.o ./Core/Src/timebase.su ./Core/Src/timer.cyclo ./Core/Src/timer.d ./Core/Src/timer.o ./Core/Src/timer.su ./Core/Src/tsync.cyclo ./Core/Src/tsync.d ./Core/Src/tsync.o ./Core/Src/tsync.su ./Core/Src/uart.cyclo ./Core/Src/uart.d ./Core/Src/uart.o ./Core/Src/uart.su
 
 .PHONY: clean-Core-2f-Src
 
@@ -0,0 +1,66 @@
+/**
+ *****************************************************************************
+ * @file    clock_config.h
+ * @brief   Header file for system clock configuration on STM32F1 series.
+ *          Contains the 72 MHz PLL setup and bus clock queries.
+ *****************************************************************************
+ */
+
+#ifndef CLOCK_CONFIG_H
+#define CLOCK_CONFIG_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "stm32f1xx.h"
+#include <stdint.h>
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Core clock when the 8 MHz crystal starts (HSE x 9).
+ */
+#define CLOCK_SYSCLK_HZ         72000000UL
+
+/**
+ * @brief HSE start-up wait in polling loops before falling back to HSI.
+ */
+#define CLOCK_HSE_TIMEOUT       0x5000
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Switch SYSCLK to the PLL before any peripheral is configured.
+ *
+ * HSE 8 MHz x 9 = 72 MHz, AHB /1, APB1 /2 (36 MHz), APB2 /1 (72 MHz).
+ * If the crystal does not start, HSI/2 x 9 = 36 MHz is used with both APB
+ * buses at /1, so PCLK1 (and the CAN bit timing) stays at PCLK1_HZ.
+ *
+ * @param None
+ * @retval None
+ */
+void Clock_Config(void);
+
+/**
+ * @brief APB2 clock (USART1).
+ *
+ * @retval Clock in Hz
+ */
+uint32_t Clock_GetPclk2(void);
+
+/**
+ * @brief TIM2-TIM4 clock (twice PCLK1 when APB1 is divided).
+ *
+ * @retval Clock in Hz
+ */
+uint32_t Clock_GetTimerClock(void);
+
+#endif /* CLOCK_CONFIG_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -0,0 +1,89 @@
+/*****************************************************************************
+ * @file    compact_handler.h
+ * @brief   Compact record encoding for forwarded CAN frames: short ID
+ *          dictionary indices, XOR-delta payloads and delta timestamps.
+ *****************************************************************************/
+
+#ifndef COMPACT_HANDLER_H
+#define COMPACT_HANDLER_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "stm32f1xx.h"
+#include <stdint.h>
+#include "forward_handler.h"
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Dictionary slots (power of two). Slot = hash(IDE, ID); a frame with
+ *        a different ID in the same slot replaces the entry.
+ */
+#define COMPACT_DICT_SIZE       64
+
+/**
+ * @brief Compact record layout (type UART_REC_COMPACT):
+ *        [type][slot | IDE << 6 | DEF << 7][ID 2|4 if DEF]
+ *        [len][delta us, LEB128][gap, LEB128][mask if len > 0][XOR bytes]
+ *
+ * DEF marks a new dictionary entry; the host then clears its copy of the
+ * slot payload. Bit i of the mask is set when payload byte i changed, and
+ * only those bytes are sent, XORed with the previous payload of the slot.
+ * The delta counts microseconds since the previous compact record and the
+ * gap the frames lost in between (sequence numbers skipped, see
+ * forward_handler.h).
+ */
+#define COMPACT_FLAG_DEF        0x80
+#define COMPACT_FLAG_IDE        0x40
+#define COMPACT_REC_MAX         27      /**< Worst case record length */
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Switch compact records on or off.
+ *
+ * Always clears the dictionary, the time and sequence references and the
+ * statistics so host and MCU start from the same state.
+ *
+ * @param on  1 = compact records, 0 = plain records
+ */
+void Compact_Enable(uint8_t on);
+
+/**
+ * @brief Check whether compact records are enabled.
+ *
+ * @retval 1 if enabled, 0 otherwise
+ */
+uint8_t Compact_IsEnabled(void);
+
+/**
+ * @brief Encode one queued frame and pass it to UART_SendRecord().
+ *
+ * Called from the main loop (see Fwd_Poll()).
+ *
+ * @param f  Frame in the forwarding queue (read in place)
+ */
+void Compact_Forward(const FwdFrame *f);
+
+/**
+ * @brief Handle UART_CMD_COMPACT.
+ *
+ * Command payload: [enable] (empty = query only)
+ * Reply payload:   [enabled][dictionary size][records 4B][compact bytes 4B]
+ *                  [plain bytes 4B]
+ *
+ * @param args  Command payload
+ * @param len   Payload length in bytes
+ */
+void Compact_Command(const uint8_t *args, uint8_t len);
+
+#endif /* COMPACT_HANDLER_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
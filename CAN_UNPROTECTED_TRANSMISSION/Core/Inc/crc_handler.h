@@ -0,0 +1,137 @@
+/*****************************************************************************
+ * @file    crc_handler.h
+ * @brief   CRC-32 service on the STM32F1 CRC unit (word-wise, DMA for large
+ *          buffers) with a table-driven software fallback, for UART record
+ *          checks and per-ID payload fingerprints.
+ *****************************************************************************/
+
+#ifndef CRC_HANDLER_H
+#define CRC_HANDLER_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "stm32f1xx.h"
+#include <stdint.h>
+#include "can_handler.h"     // CanFrame register image
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief The CRC definition of the unit: polynomial 0x04C11DB7, initial
+ *        value 0xFFFFFFFF, MSB first, no final XOR (CRC-32/MPEG-2).
+ *
+ * Data is fed in 32-bit words as the CPU and the DMA read them from memory,
+ * i.e. little-endian: bytes b0 b1 b2 b3 enter as b3 b2 b1 b0. A buffer
+ * tail of 1-3 bytes is zero-padded to a word. The host computes the same
+ * value with the table-driven variant.
+ *
+ * Building with CRC_SOFTWARE (host build, no CRC unit) routes every call
+ * to the software fallback.
+ */
+#define CRC_POLY                0x04C11DB7UL
+#define CRC_INIT                0xFFFFFFFFUL
+
+/**
+ * @brief Word-aligned buffers of at least this many words are fed by DMA1
+ *        channel 1 (memory-to-memory into CRC->DR); shorter ones by the CPU.
+ */
+#define CRC_DMA_MIN_WORDS       32
+
+/**
+ * @brief Flash bytes hashed by CRC_OP_BENCH (start of the vector table).
+ */
+#define CRC_BENCH_BYTES         1024
+
+/**
+ * @brief UART_CMD_CRC operations (first payload byte).
+ */
+#define CRC_OP_STATUS           0       /**< Query record CRCs                */
+#define CRC_OP_RECORDS          1       /**< Append a CRC to UART records     */
+#define CRC_OP_BENCH            2       /**< Hardware vs software cycles      */
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Enable the clocks of the CRC unit and DMA1.
+ */
+void Crc_Init(void);
+
+/**
+ * @brief CRC of a byte buffer.
+ *
+ * Main loop only: the CAN RX interrupt masked while the unit holds a
+ * partial result, since Crc_Payload() resets it.
+ *
+ * @param buf  Data
+ * @param len  Length in bytes
+ * @return CRC as defined above.
+ */
+uint32_t Crc_Buffer(const void *buf, uint16_t len);
+
+/**
+ * @brief Fingerprint of a frame payload: CRC of the two data words (bytes
+ *        past len cleared) and len.
+ *
+ * Three word writes on the unit; called from the CAN RX interrupt.
+ *
+ * @param frame  Register image
+ * @param len    Data bytes to include (0 for remote frames)
+ */
+uint32_t Crc_Payload(const CanFrame *frame, uint8_t len);
+
+/**
+ * @brief Software (table-driven) equivalents of Crc_Buffer() and
+ *        Crc_Payload(), also used for the benchmark.
+ */
+uint32_t Crc_SoftBuffer(const void *buf, uint16_t len);
+uint32_t Crc_SoftPayload(const CanFrame *frame, uint8_t len);
+
+/**
+ * @brief CRC appended to a UART record or batch; counted for the status.
+ *
+ * @param buf  Record bytes
+ * @param len  Length in bytes
+ */
+uint32_t Crc_Record(const uint8_t *buf, uint16_t len);
+
+/**
+ * @brief Check whether UART records carry a CRC.
+ *
+ * @return 1 if UART_SendRecord() appends [CRC 4B] to each record (or
+ *         batch).
+ */
+uint8_t Crc_RecordsEnabled(void);
+
+/**
+ * @brief Handle UART_CMD_CRC.
+ *
+ * Command payload: empty or [CRC_OP_STATUS]: query
+ *                  [CRC_OP_RECORDS][enable]
+ *                  [CRC_OP_BENCH][frames 2B]
+ * Reply payload:   status: [CRC_OP_STATUS][records enabled]
+ *                          [records sent with a CRC 4B]
+ *                  bench:  [CRC_OP_BENCH][frames 2B][hw cycles 4B]
+ *                          [sw cycles 4B][buffer bytes 2B][dma cycles 4B]
+ *                          [cpu cycles 4B][sw cycles 4B][buffer CRC 4B]
+ *                          [match]
+ *
+ * The bench fingerprints the given number of frames with the unit and
+ * with the table (total cycles each), then hashes CRC_BENCH_BYTES of flash
+ * by DMA, by CPU word writes and by table. match is 1 when all results
+ * agree.
+ *
+ * @param args  Command payload
+ * @param len   Payload length in bytes
+ */
+void Crc_Command(const uint8_t *args, uint8_t len);
+
+#endif /* CRC_HANDLER_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -0,0 +1,124 @@
+/*****************************************************************************
+ * @file    forward_handler.h
+ * @brief   Bounded forwarding queue between the CAN RX interrupt and the
+ *          UART: overflow policy, frame sequence numbers and loss counters.
+ *****************************************************************************/
+
+#ifndef FORWARD_HANDLER_H
+#define FORWARD_HANDLER_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "stm32f1xx.h"
+#include <stdint.h>
+#include "can_handler.h"     // CanFrame register image
+#include "pool_handler.h"    // Frame pool
+#include "uart_handler.h"    // UART_POOL_BLOCKS
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Queue depth in frames: the frame pool blocks the host path cannot
+ *        hold.
+ *
+ * The RX interrupt only stores the register image into a pool block and
+ * queues its handle; the main loop encodes and sends it from there.
+ */
+#define FWD_QUEUE_LEN           (POOL_BLOCKS - UART_POOL_BLOCKS)
+
+/**
+ * @brief Frames Fwd_Poll() sends per scheduler run.
+ */
+#define FWD_POLL_BUDGET         8
+
+/**
+ * @brief What happens to a frame that arrives while the queue is full.
+ *
+ * FWD_POLICY_LATEST_ID removes the queued frame with the same ID (the new
+ * one supersedes it) and falls back to dropping the oldest frame when that
+ * ID is not queued.
+ */
+#define FWD_POLICY_DROP_NEWEST  0
+#define FWD_POLICY_DROP_OLDEST  1
+#define FWD_POLICY_LATEST_ID    2
+#define FWD_POLICY_COUNT        3
+
+/**
+ * @brief Plain frame record: [IDE][ID 2|4][len][data 0..8][seq 2B]
+ *
+ * Every received frame takes the next 16-bit sequence number, including
+ * frames the queue drops later, so a jump in seq tells the host exactly how
+ * many frames were lost. Compact records carry the same information as a gap
+ * count (see compact_handler.h).
+ */
+#define FWD_REC_MAX             16
+
+/*****************************************************************************
+ * Type definitions
+ *****************************************************************************/
+
+/**
+ * @brief Received frame waiting in the queue, in a frame pool block.
+ */
+typedef struct {
+    CanFrame can;          /**< Register image as received            */
+    uint32_t stamp;        /**< Time_Now32() at reception (us)        */
+    uint16_t seq;          /**< Frame sequence number                 */
+} FwdFrame;
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Queue a received frame, applying the overflow policy when full.
+ *
+ * Called from the CAN RX interrupt.
+ *
+ * @param frame  Register image from the RX FIFO
+ */
+void Fwd_Push(const CanFrame *frame);
+
+/**
+ * @brief Count a bxCAN FIFO overrun.
+ *
+ * Those frames are lost before they get a sequence number. Called from the
+ * CAN RX interrupt.
+ */
+void Fwd_FifoOverrun(void);
+
+/**
+ * @brief Send queued frames as plain or compact records.
+ *
+ * Scheduler task for SCHED_EVT_CAN_RX, which Fwd_Push() posts.
+ */
+void Fwd_Poll(void);
+
+/**
+ * @brief Sequence number of the next frame Fwd_Poll() will send.
+ *
+ * @retval Sequence number
+ */
+uint16_t Fwd_NextSeq(void);
+
+/**
+ * @brief Handle UART_CMD_FWD.
+ *
+ * Command payload: [policy] (empty = query only; setting clears the counters)
+ * Reply payload:   [policy][queue length][queued][high water][next seq 2B]
+ *                  [dropped newest 4B][dropped oldest 4B][superseded 4B]
+ *                  [FIFO overruns 4B]
+ *
+ * @param args  Command payload
+ * @param len   Payload length in bytes
+ */
+void Fwd_Command(const uint8_t *args, uint8_t len);
+
+#endif /* FORWARD_HANDLER_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
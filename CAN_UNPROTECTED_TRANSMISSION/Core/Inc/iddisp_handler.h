@@ -0,0 +1,106 @@
+/*****************************************************************************
+ * @file    iddisp_handler.h
+ * @brief   Per-ID dispatch of received frames: a table in flash, generated
+ *          at compile time from a declarative ID -> handler/policy list,
+ *          looked up in constant time by the CAN RX interrupt.
+ *****************************************************************************/
+
+#ifndef IDDISP_HANDLER_H
+#define IDDISP_HANDLER_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "stm32f1xx.h"
+#include <stdint.h>
+#include "can_handler.h"     // CanFrame register image
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Table key of an ID: the RIR image without RTR, bit 0 set so a key
+ *        is never 0 (the value of an empty slot).
+ */
+#define IDDISP_STD(id)          (((uint32_t)(id) << 21) | 1UL)
+#define IDDISP_EXT(id)          (((uint32_t)(id) << 3) | (1UL << 2) | 1UL)
+
+/**
+ * @brief Perfect hash: the top IDDISP_SLOT_BITS bits of key * IDDISP_MULT.
+ *
+ * The configured keys must land in distinct slots; this is checked at
+ * compile time, and a collision stops the build with a message asking for
+ * another multiplier (any odd constant) or more slots. A lookup is one
+ * multiply, one shift and one key compare whatever the number of entries.
+ */
+#define IDDISP_SLOT_BITS        4
+#define IDDISP_SLOTS            (1 << IDDISP_SLOT_BITS)
+#define IDDISP_MULT             2654435761UL
+#define IDDISP_HASH(key)        ((uint32_t)((uint32_t)(key) * IDDISP_MULT) >> (32 - IDDISP_SLOT_BITS))
+
+/**
+ * @brief Policies, applied when the entry has no handler or its handler
+ *        leaves the frame.
+ */
+#define IDDISP_FORWARD          0       /**< Capture, statistics, forward to the host */
+#define IDDISP_DROP             1       /**< Counted and discarded at once       */
+#define IDDISP_RATE             2       /**< Forward, discarding frames closer than
+                                             the entry's gap to the last one     */
+
+/**
+ * @brief Policy of IDs not in the table.
+ */
+#define IDDISP_DEFAULT_POLICY   IDDISP_FORWARD
+
+/**
+ * @brief IDs timed by UART_CMD_IDDISP besides the configured ones.
+ */
+#define IDDISP_BENCH_MISSES     64
+
+/**
+ * @brief UART_CMD_IDDISP operations (first payload byte).
+ */
+#define IDDISP_OP_STATUS        0       /**< Table layout, counters, lookup time */
+#define IDDISP_OP_CLEAR         1       /**< Same, then clear the counters       */
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Look up the frame's ID and apply its entry.
+ *
+ * Called first in the CAN RX interrupt. The entry's handler runs first and
+ * may take the frame; otherwise the policy decides.
+ *
+ * @param frame  Register image from the RX FIFO
+ * @return 1 if the frame was taken or discarded, 0 to forward it.
+ */
+uint8_t IdDisp_Frame(const CanFrame *frame);
+
+/**
+ * @brief Handle UART_CMD_IDDISP.
+ *
+ * Command payload: empty, [IDDISP_OP_STATUS] or [IDDISP_OP_CLEAR]
+ * Reply payload:   [op][entries][slots][entry bytes][table bytes 2B]
+ *                  [multiplier 4B][handled 4B][dropped 4B][limited 4B]
+ *                  [lookup min cycles 4B][lookup max cycles 4B]
+ *                  [lookups timed 2B]
+ *
+ * handled counts frames taken by a handler, dropped those of IDDISP_DROP
+ * entries, limited those discarded by IDDISP_RATE entries. The lookup is
+ * timed with the cycle counter, interrupts masked, for every configured ID
+ * and IDDISP_BENCH_MISSES extended IDs from 0; the overhead of the counter
+ * reads is subtracted.
+ *
+ * @param args  Command payload
+ * @param len   Payload length in bytes
+ */
+void IdDisp_Command(const uint8_t *args, uint8_t len);
+
+#endif /* IDDISP_HANDLER_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
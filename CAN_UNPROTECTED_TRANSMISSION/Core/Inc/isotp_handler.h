@@ -0,0 +1,201 @@
+/*****************************************************************************
+ * @file    isotp_handler.h
+ * @brief   ISO 15765-2 (ISO-TP) segmented transport: a sender driven by the
+ *          CAN TX-complete interrupt and a receiver that answers with flow
+ *          control, for payloads of up to 4095 bytes.
+ *****************************************************************************/
+
+#ifndef ISOTP_HANDLER_H
+#define ISOTP_HANDLER_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "stm32f1xx.h"
+#include <stdint.h>
+#include "can_handler.h"     // CanFrame register image
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Largest payload (12-bit first frame length).
+ */
+#define ISOTP_MAX_LEN           4095
+
+/**
+ * @brief Payload buffer for host data, filled with ISOTP_OP_LOAD.
+ *
+ * The benchmark generates its payload (byte i = i & 0xFF) instead, so a
+ * 4095-byte transfer does not need a 4 KB buffer in the 20 KB of RAM.
+ * One flash page plus the block header, so the bridge can forward a
+ * bootloader DATA message (boot_handler.h) as one transfer.
+ */
+#define ISOTP_BUF_LEN           1028
+
+/**
+ * @brief TX mailbox owned by the sender.
+ *
+ * Mailbox 0 stays with CAN_SendFrame() and mailbox 2 with CAN_QueueFrame(),
+ * which sends the flow control; the burst benchmark does not run during a
+ * transfer.
+ */
+#define ISOTP_MAILBOX           1
+
+/**
+ * @brief Padding of the unused bytes; every frame is sent with DLC 8.
+ */
+#define ISOTP_PAD               0xCC
+
+/**
+ * @brief N_Bs / N_Cr: longest wait for a flow control or the next
+ *        consecutive frame.
+ *
+ * Enforced by IsoTp_Poll() from the main loop's timed task, at the deadline
+ * reported by IsoTp_NextDeadline().
+ */
+#define ISOTP_TIMEOUT_US        1000000UL
+
+/**
+ * @brief Default addressing: one ID for both directions.
+ *
+ * A single board in loopback mode then answers its own sender, and two
+ * boards with the default answer each other.
+ */
+#define ISOTP_DEFAULT_ID        0x7E0
+
+/**
+ * @brief Sender and receiver states.
+ */
+#define ISOTP_IDLE              0
+#define ISOTP_TX_WAIT_FC        1       /**< First frame or block sent        */
+#define ISOTP_TX_SENDING        2       /**< Frame in the mailbox or STmin    */
+#define ISOTP_RX_RECEIVING      3       /**< First frame received             */
+
+/**
+ * @brief Result of the last transfer in each direction.
+ */
+#define ISOTP_RES_OK            0
+#define ISOTP_RES_TIMEOUT       1       /**< No flow control / frame in time  */
+#define ISOTP_RES_OVERFLOW      2       /**< Receiver reported overflow       */
+#define ISOTP_RES_TX_FAILED     3       /**< Bus-off or frame not sent        */
+#define ISOTP_RES_BAD_SN        4       /**< Consecutive frame out of order   */
+#define ISOTP_RES_ABORTED       5       /**< Host abort or new first frame    */
+#define ISOTP_RES_BUSY          6       /**< Mailbox not free at start        */
+#define ISOTP_RES_NONE          0xFF
+
+/**
+ * @brief UART_CMD_ISOTP operations (first payload byte).
+ */
+#define ISOTP_OP_STATUS         0       /**< Query both directions            */
+#define ISOTP_OP_CONFIG         1       /**< Addressing, block size, STmin    */
+#define ISOTP_OP_LOAD           2       /**< Write host data into the buffer  */
+#define ISOTP_OP_SEND           3       /**< Send the buffer                  */
+#define ISOTP_OP_BENCH          4       /**< Send a generated payload         */
+#define ISOTP_OP_ABORT          5       /**< Stop the sender                  */
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Set the default addressing and prepare the STmin timer.
+ *
+ * Uses channel 3 of the time base timer. Call after Timer_Config().
+ */
+void IsoTp_Init(void);
+
+/**
+ * @brief Feed a received frame to the receiver and the sender's flow
+ *        control wait.
+ *
+ * Called from the CAN RX interrupt; frames on other IDs are ignored. The
+ * frames are still forwarded to the host as usual, so the receiver keeps
+ * no copy of the payload, only its length, timing and hash.
+ *
+ * @param frame Register image from the RX FIFO.
+ */
+void IsoTp_Frame(const CanFrame *frame);
+
+/**
+ * @brief Continue the sender after its mailbox completed.
+ *
+ * Called from the CAN TX interrupt.
+ *
+ * @param ok 1 if the frame was acknowledged (TXOK).
+ */
+void IsoTp_TxComplete(uint8_t ok);
+
+/**
+ * @brief Send the next consecutive frame once STmin has elapsed.
+ *
+ * Called from the TIM3 interrupt (channel 3).
+ */
+void IsoTp_StMinElapsed(void);
+
+/**
+ * @brief Report whether a transfer is running.
+ *
+ * @return 1 while the sender owns its mailbox and the TX interrupt's
+ *         completions.
+ */
+uint8_t IsoTp_TxPending(void);
+
+/**
+ * @brief End a transfer whose N_Bs / N_Cr wait has run out.
+ *
+ * Called from the main loop's timed task; masks the CAN interrupts while it
+ * checks.
+ */
+void IsoTp_Poll(void);
+
+/**
+ * @brief Earliest time (Time_Now32() us) at which a flow control or
+ *        consecutive frame wait runs out, for the tickless idle.
+ *
+ * @param deadline  Set to that time when there is one
+ * @retval 1 if a deadline is pending, 0 if none
+ */
+uint8_t IsoTp_NextDeadline(uint32_t *deadline);
+
+/**
+ * @brief Handle UART_CMD_ISOTP.
+ *
+ * Command payload: empty or [ISOTP_OP_STATUS]: query
+ *                  [ISOTP_OP_CONFIG][IDE][TX ID 4B][RX ID 4B][BS][STmin]
+ *                      TX ID carries our frames and our flow control, RX ID
+ *                      the peer's; BS/STmin are sent in our flow control
+ *                  [ISOTP_OP_LOAD][offset 2B][data...] (no reply)
+ *                  [ISOTP_OP_SEND][length 2B]
+ *                  [ISOTP_OP_BENCH][length 2B]
+ *                  [ISOTP_OP_ABORT]
+ * Reply payload:   [ISOTP_OP_STATUS]
+ *                  [TX state][TX result][length 2B][sent 2B][frames 2B]
+ *                  [flow controls 2B][waits 2B][BS][STmin][duration us 4B]
+ *                  [payload hash 4B]
+ *                  [RX state][RX result][length 2B][received 2B][frames 2B]
+ *                  [SN errors 2B][duration us 4B][payload hash 4B]
+ *                  [transfers 4B]
+ *
+ * SEND and BENCH while a transfer is running, and LOAD into its buffer, are
+ * refused with UART_ACK_TX_BUSY. A start that fails on a busy mailbox or
+ * bus-off is acknowledged with UART_ACK_TX_BUSY / UART_ACK_BUS_OFF and also
+ * recorded as the sender's result. The status reply is sent either way.
+ *
+ * The sender's BS/STmin are the ones from the peer's last flow control.
+ * Durations run from the first frame to the last frame's completion. The
+ * hash is FNV-1a over the payload bytes, so the host can check a transfer
+ * end to end.
+ *
+ * @param args Command payload.
+ * @param len  Payload length in bytes.
+ * @return UART_ACK_* status for the sequenced acknowledgement.
+ */
+uint8_t IsoTp_Command(const uint8_t *args, uint8_t len);
+
+#endif /* ISOTP_HANDLER_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -13,11 +13,10 @@
 #include <string.h>
 
 /**
- * @brief Buffer sizes for UART and CAN communication.
+ * @brief APB1 peripheral clock feeding bxCAN (72 MHz SYSCLK / 2, or the
+ *        36 MHz HSI fallback with APB1 /1; see Clock_Config()).
  */
-#define UART_RX_BUFFER_SIZE 50
-#define CAN_RX_BUFFER_SIZE  20
-#define CURRENT_FRAME_SIZE  20
+#define PCLK1_HZ            36000000UL
 
 /**
  * @brief Structure for tracking CAN message counters.
@@ -28,40 +27,10 @@ typedef struct {
 } CounterTracker;
 
 /**
- * @brief UART receive buffer storing incoming bytes.
- */
-extern volatile uint8_t uart_rx_buffer[UART_RX_BUFFER_SIZE];
-
-/**
- * @brief Current index in the UART receive buffer.
+ * @brief Current index in the UART frame being assembled.
  */
 extern volatile uint16_t uart_rx_index;
 
-/**
- * @brief Flag indicating a complete UART frame has been received.
- */
-extern volatile uint8_t uart_frame_ready;
-
-/**
- * @brief CAN receive buffer storing incoming CAN message data.
- */
-extern volatile uint8_t can_rx_buffer[CAN_RX_BUFFER_SIZE];
-
-/**
- * @brief Flag indicating a complete CAN frame has been received.
- */
-extern volatile uint8_t can_frame_ready;
-
-/**
- * @brief Flag indicating if repeating frame transmission is active.
- */
-extern volatile uint8_t repeat;
-
-/**
- * @brief Buffer holding the current CAN frame to be repeated.
- */
-extern volatile uint8_t current_frame[CURRENT_FRAME_SIZE];
-
 /**
  * @brief Counter for transmitted CAN frames.
  */
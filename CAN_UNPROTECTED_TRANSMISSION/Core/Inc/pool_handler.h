@@ -0,0 +1,105 @@
+/*****************************************************************************
+ * @file    pool_handler.h
+ * @brief   Frame pool: fixed-size blocks shared by the queues between the
+ *          interrupts and the main loop. Queues pass block handles instead
+ *          of copying frames; allocation and release are lock-free and
+ *          safe from any interrupt.
+ *****************************************************************************/
+
+#ifndef POOL_HANDLER_H
+#define POOL_HANDLER_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "stm32f1xx.h"
+#include <stdint.h>
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Pool size. A block holds the largest user: a host frame with its
+ *        length byte (1 + UART_FRAME_MAX) or a queued CAN frame (FwdFrame).
+ *        Blocks are word aligned.
+ *
+ * The blocks are split between the users by their queue lengths (see
+ * UART_POOL_BLOCKS and FWD_QUEUE_LEN), so the host commands always find a
+ * block under full bus load. UART_CMD_POOL reports the high water mark to
+ * size the pool from measurement.
+ */
+#define POOL_BLOCKS             28
+#define POOL_BLOCK_SIZE         36
+
+/**
+ * @brief Handle returned when the pool is empty.
+ */
+#define POOL_NONE               0xFF
+
+/**
+ * @brief UART_CMD_POOL operations (first payload byte).
+ */
+#define POOL_OP_STATUS          0       /**< Occupancy and counters            */
+#define POOL_OP_CLEAR           1       /**< Same, then restart the high water
+                                             mark and clear the failures      */
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Link all blocks into the free list.
+ *
+ * Called first in main(), before any interrupt can allocate.
+ */
+void Pool_Init(void);
+
+/**
+ * @brief Take a block from the free list.
+ *
+ * Constant time, no interrupt masked: the free list head and the free
+ * count are one word updated with an exclusive load/store pair, so an
+ * interrupt taking or returning a block in between only makes the caller
+ * retry. Safe from any interrupt and the main loop.
+ *
+ * @retval Block handle, or POOL_NONE if the pool is empty (counted)
+ */
+uint8_t Pool_Alloc(void);
+
+/**
+ * @brief Return a block to the free list. Same guarantees as Pool_Alloc().
+ *
+ * @param h  Handle from Pool_Alloc(); POOL_NONE is ignored
+ */
+void Pool_Free(uint8_t h);
+
+/**
+ * @brief Address of a block.
+ *
+ * @param h  Handle from Pool_Alloc()
+ * @retval POOL_BLOCK_SIZE bytes, word aligned
+ */
+void *Pool_Block(uint8_t h);
+
+/**
+ * @brief Handle UART_CMD_POOL.
+ *
+ * Command payload: empty, [POOL_OP_STATUS] or [POOL_OP_CLEAR]
+ * Reply payload:   [op][blocks][block size][in use][high water]
+ *                  [alloc failures 4B][allocs 4B]
+ *
+ * high water is the most blocks in use at once since reset or the last
+ * POOL_OP_CLEAR; alloc failures counts Pool_Alloc() calls that found the
+ * pool empty.
+ *
+ * @param args  Command payload
+ * @param len   Payload length in bytes
+ */
+void Pool_Command(const uint8_t *args, uint8_t len);
+
+#endif /* POOL_HANDLER_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -0,0 +1,81 @@
+/*****************************************************************************
+ * @file    power_handler.h
+ * @brief   Tickless idle for the main loop (WFI/WFE sleep when there is no
+ *          work) and measurement of the wakeup latency it adds.
+ *****************************************************************************/
+
+#ifndef POWER_HANDLER_H
+#define POWER_HANDLER_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "stm32f1xx.h"
+#include <stdint.h>
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Sleep depth used when the main loop is idle.
+ *        POWER_SLEEP_WFI masks interrupts (PRIMASK) around the idle check and
+ *        WFI; POWER_SLEEP_WFE uses SEVONPEND so an interrupt arriving after
+ *        the check still ends the WFE, without masking. POWER_SLEEP_WFE_LP
+ *        also stops the flash and SRAM interface clocks during sleep.
+ *        Stop/Standby are not offered: they halt the time base and the
+ *        bxCAN clock.
+ */
+#define POWER_SLEEP_OFF         0       /**< Busy polling (no sleep)          */
+#define POWER_SLEEP_WFI         1       /**< Sleep mode entered with WFI      */
+#define POWER_SLEEP_WFE         2       /**< Sleep mode entered with WFE      */
+#define POWER_SLEEP_WFE_LP      3       /**< WFE, flash/SRAM clocks gated     */
+#define POWER_SLEEP_COUNT       4
+
+#define POWER_SLEEP_DEFAULT     POWER_SLEEP_OFF
+
+/**
+ * @brief Wakeup latency probe: a one-shot SysTick interrupt fires while the
+ *        main loop idles. The handler reads how many core cycles have passed
+ *        since the counter reached zero (interrupt latency, including the
+ *        wakeup), and the main loop measures from the handler to resuming
+ *        its own code (processing latency).
+ */
+#define POWER_PROBE_MAX         1000    /**< Probes per command          */
+#define POWER_PROBE_BASE_CYCLES 7200    /**< 100 us at 72 MHz, varied per probe */
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Idle hook of the scheduler: arm the next UART batch/baud deadline
+ *        on TIM3 channel 2 (its interrupt posts SCHED_EVT_TIMEOUT), then
+ *        sleep until the next interrupt if no event is pending.
+ */
+void Power_Idle(void);
+
+/**
+ * @brief SysTick part of the latency probe. Called from SysTick_Handler().
+ */
+void Power_SysTickProbe(void);
+
+/**
+ * @brief Handle UART_CMD_POWER.
+ *
+ * Command payload: [depth] or [depth][probes 2B] (empty = query). Setting a
+ *                  depth clears the statistics; probes run at that depth.
+ * Reply payload:   [depth][sleeps 4B][asleep us 4B][awake us 4B][probes 2B]
+ *                  [IRQ latency min/mean/max cycles 2B each]
+ *                  [processing latency min/mean/max cycles 2B each]
+ *
+ * @param args  Command payload
+ * @param len   Payload length in bytes
+ */
+void Power_Command(const uint8_t *args, uint8_t len);
+
+#endif /* POWER_HANDLER_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -0,0 +1,121 @@
+/*****************************************************************************
+ * @file    slcan_handler.h
+ * @brief   SLCAN (Lawicel) ASCII host interface, selectable at run time in
+ *          place of the binary protocol, so slcand/SocketCAN and python-can
+ *          can drive the node.
+ *****************************************************************************/
+
+#ifndef SLCAN_HANDLER_H
+#define SLCAN_HANDLER_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "stm32f1xx.h"
+#include <stdint.h>
+#include "forward_handler.h" // Queued frames
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Line terminator and error reply.
+ */
+#define SLCAN_CR                '\r'
+#define SLCAN_BEL               0x07
+
+/**
+ * @brief Longest line: 'T', 8 ID digits, DLC, 16 data digits, CR.
+ */
+#define SLCAN_LINE_MAX          27
+
+/**
+ * @brief Version and serial number reported by 'V' and 'N'.
+ */
+#define SLCAN_VERSION           "V0101"
+#define SLCAN_SERIAL            "N0001"
+
+/**
+ * @brief Leave SLCAN mode: "B\r" (not a Lawicel command).
+ *
+ * The reply CR is the last ASCII byte; the binary protocol follows.
+ */
+#define SLCAN_CMD_BINARY        'B'
+
+/**
+ * @brief UART_CMD_SLCAN operations (first payload byte).
+ */
+#define SLCAN_OP_STATUS         0       /**< Query mode and counters          */
+#define SLCAN_OP_ENTER          1       /**< Switch the host link to SLCAN    */
+#define SLCAN_OP_CLEAR          2       /**< Clear the counters               */
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Check whether the host link speaks SLCAN.
+ *
+ * @return 1 in SLCAN mode, 0 for the binary protocol.
+ */
+uint8_t Slcan_IsEnabled(void);
+
+/**
+ * @brief Check a partly received line.
+ *
+ * Called from the USART1 interrupt in SLCAN mode instead of the binary
+ * frame check.
+ *
+ * @param buf  Line bytes
+ * @param n    Bytes received so far
+ * @return Line length including the CR once complete, 0 if more bytes are
+ *         needed, -1 to discard the bytes (empty LF line).
+ */
+int16_t Slcan_LineLength(const uint8_t *buf, uint8_t n);
+
+/**
+ * @brief Execute one command line and send its reply (CR, BEL, or data).
+ *
+ * Runs in the main loop for each line taken from the command queue.
+ *
+ * @param line  Line bytes including the CR
+ * @param len   Line length in bytes
+ */
+void Slcan_Line(const uint8_t *line, uint8_t len);
+
+/**
+ * @brief Send a received frame as a t/T/r/R line, with the millisecond
+ *        timestamp when enabled ('Z1').
+ *
+ * Called from Fwd_Poll() in SLCAN mode. Frames are dropped while the
+ * channel is closed.
+ *
+ * @param f  Frame in the forwarding queue (read in place)
+ */
+void Slcan_Forward(const FwdFrame *f);
+
+/**
+ * @brief Handle UART_CMD_SLCAN.
+ *
+ * Command payload: empty or [SLCAN_OP_STATUS]: query
+ *                  [SLCAN_OP_ENTER]: the reply is the last binary record;
+ *                      SLCAN starts with the next host byte
+ *                  [SLCAN_OP_CLEAR]
+ * Reply payload:   [enabled][open][timestamps][lines 4B][errors 4B]
+ *                  [frames sent 4B][frames forwarded 4B][line bytes 4B]
+ *                  [plain record bytes 4B]
+ *
+ * The last two count the forwarded frames as SLCAN lines and as the plain
+ * binary records they would have been, for comparing the two modes.
+ *
+ * @param args  Command payload
+ * @param len   Payload length in bytes
+ */
+void Slcan_Command(const uint8_t *args, uint8_t len);
+
+#endif /* SLCAN_HANDLER_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
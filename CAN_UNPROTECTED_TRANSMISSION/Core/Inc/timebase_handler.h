@@ -0,0 +1,82 @@
+/*****************************************************************************
+ * @file    timebase_handler.h
+ * @brief   Free-running 1 us time base: TIM3 and TIM4 chained into a 32-bit
+ *          hardware counter, extended to 64 bits in software, with an epoch
+ *          offset synchronised by the host.
+ *****************************************************************************/
+
+#ifndef TIMEBASE_HANDLER_H
+#define TIMEBASE_HANDLER_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "stm32f1xx.h"
+#include <stdint.h>
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Bit-band alias of one TIM3->DIER bit.
+ *
+ * TIM3 also serves channel 1 (cyclic deadlines, timer_handler.c),
+ * channel 2 (idle deadline, power_handler.c) and channel 3 (ISO-TP STmin,
+ * isotp_handler.c) from both the main loop and interrupts. A store to the alias changes only that bit in one bus
+ * write, so neither side can undo the other's change and no interrupt has
+ * to be masked.
+ */
+#define TIM3_DIER_BB(bit)  (*(volatile uint32_t *)(PERIPH_BB_BASE + \
+                            (TIM3_BASE + 0x0C - PERIPH_BASE) * 32 + (bit) * 4))  /* DIER at 0x0C */
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Start the time base. TIM3 counts microseconds and drives TIM4
+ *        (slave, external clock from ITR2) with its update event; the TIM4
+ *        update interrupt counts the upper 32 bits.
+ *
+ * The timers are never reprogrammed afterwards, so the clock is monotonic
+ * from reset. Call after Clock_Config().
+ */
+void Time_Init(void);
+
+/**
+ * @brief Microseconds since Time_Init(), 64 bits. Safe in any context.
+ */
+uint64_t Time_Now(void);
+
+/**
+ * @brief Lower 32 bits of Time_Now() (wraps after 71.6 minutes). Cheaper;
+ *        use for timestamps and intervals compared by subtraction.
+ */
+uint32_t Time_Now32(void);
+
+/**
+ * @brief Convert a local time to host epoch time (local + synced offset).
+ */
+uint64_t Time_ToEpoch(uint64_t local_us);
+
+/**
+ * @brief Handle UART_CMD_TIME.
+ *
+ * Command payload: [offset 8B] (signed, epoch = local + offset; empty =
+ *                  query only)
+ * Reply payload:   [local time us 8B][offset 8B]
+ *
+ * The host queries first, estimates the offset from its own send/receive
+ * times (half the round trip), then sets it.
+ *
+ * @param args Command payload.
+ * @param len  Payload length in bytes.
+ */
+void Time_Command(const uint8_t *args, uint8_t len);
+
+#endif /* TIMEBASE_HANDLER_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -1,7 +1,8 @@
 /*****************************************************************************
  * @file    timer_handler.h
- * @brief   Header file for Timer2 configuration and handling on STM32F1 series.
- *          Provides function prototypes and variables for repeating CAN frames.
+ * @brief   Header file for cyclic CAN frame transmission on STM32F1 series.
+ *          Frames are sent on absolute deadlines of the 1 us time base
+ *          (TIM3 channel 1 compare) with per-message jitter statistics.
  *****************************************************************************/
 
 #ifndef TIMER_HANDLER_H
@@ -18,65 +19,105 @@
  *****************************************************************************/
 
 /**
- * @brief Size of buffer to store repeating CAN frame data.
+ * @brief Number of cyclic messages sent at the same time.
+ *
+ * Slot 0 is also used by the legacy UART frame with a non-zero interval.
  */
-#define REPEAT_FRAME_SIZE 20
-
-/*****************************************************************************
- * Global variables
- *****************************************************************************/
+#define TIMER_CYCLIC_SLOTS      4
 
 /**
- * @brief Buffer to store current CAN frame for repeated transmission.
+ * @brief UART_CMD_CYCLIC payload layout:
+ *        [slot][period us 4B][mode][id 4B][len][data...]
+ *
+ * A period of 0 stops the slot; a payload of [slot] only queries it.
  */
-extern volatile uint8_t current_frame[REPEAT_FRAME_SIZE];
+#define TIMER_CYCLIC_HDR_LEN    11
 
 /*****************************************************************************
  * Function prototypes
  *****************************************************************************/
 
 /**
- * @brief Initialize Timer 2 with interrupt for periodic CAN frame sending.
+ * @brief Enable the TIM3 interrupt used for cyclic deadlines.
  *
- * Configures Timer 2 to generate interrupts at specified intervals for
- * sending repeated CAN frames.
+ * Must be called after Time_Init().
  *
  * @param None
  * @retval None
  */
-void Timer2_Config(void);
+void Timer_Config(void);
 
 /**
- * @brief Stop Timer 2 and disable its interrupt.
+ * @brief Start (or replace) a cyclic message.
  *
- * @param None
+ * Deadlines are absolute: each one is the previous deadline plus the period,
+ * never the time the previous frame actually went out, so latency does not
+ * accumulate. The first frame is sent one period from now.
+ *
+ * Called from the main loop. The frame is double-buffered and published by
+ * a pointer swap, so the TIM3 interrupt is never masked and never sends a
+ * half-updated frame.
+ *
+ * @param slot       Cyclic slot (0 .. TIMER_CYCLIC_SLOTS-1)
+ * @param mode       CAN mode: 0 = Standard ID, 1 = Extended ID
+ * @param id         CAN identifier
+ * @param data       Pointer to data bytes
+ * @param len        Length of data in bytes (0-8)
+ * @param period_us  Period in microseconds (> 0)
+ *
+ * @retval None
+ */
+void Timer_StartCyclic(uint8_t slot, uint8_t mode, uint32_t id, const uint8_t *data,
+                       uint8_t len, uint32_t period_us);
+
+/**
+ * @brief Stop a cyclic message. Its statistics are kept until restarted.
+ *
+ * @param slot  Cyclic slot
  * @retval None
  */
-void Timer_Stop(void);
+void Timer_StopCyclic(uint8_t slot);
+
+/**
+ * @brief Read back the message of a slot (for the saved configuration).
+ *
+ * @param slot       Cyclic slot
+ * @param mode       CAN mode: 0 = Standard ID, 1 = Extended ID
+ * @param id         CAN identifier
+ * @param data       Data bytes (buffer of 8)
+ * @param len        Length of data in bytes
+ * @param period_us  Period in microseconds
+ *
+ * @retval 1 if the slot is running, 0 if stopped
+ */
+uint8_t Timer_GetCyclic(uint8_t slot, uint8_t *mode, uint32_t *id, uint8_t *data,
+                        uint8_t *len, uint32_t *period_us);
 
 /**
- * @brief Setup Timer 2 to periodically send a CAN frame with given parameters.
+ * @brief Handle UART_CMD_CYCLIC: start, stop or query a slot.
+ *
+ * Reply payload: [slot][active][period us 4B][sent 4B][missed 4B][failed 4B]
+ *                [jitter min us 4B][jitter max us 4B][jitter mean us 4B]
  *
- * @param mode      CAN mode: 0 = Standard ID, 1 = Extended ID
- * @param id        CAN identifier
- * @param data      Pointer to data bytes
- * @param len       Length of data in bytes (0-8)
- * @param interval  Interval in milliseconds for repeat sending
+ * Jitter is the time from the deadline to the start of the transmit request.
+ * Missed counts deadlines skipped because a whole period had already passed.
  *
+ * @param args  Command payload (see TIMER_CYCLIC_HDR_LEN)
+ * @param len   Payload length in bytes
  * @retval None
  */
-void Timer_Setup_Repeat(uint8_t mode, uint32_t id, uint8_t *data, uint8_t len, uint16_t interval);
+void Timer_CyclicCommand(const uint8_t *args, uint8_t len);
 
 /**
- * @brief Timer 2 interrupt handler to send repeated CAN frames.
+ * @brief TIM3 interrupt handler to send the cyclic CAN frames.
  *
- * This handler is called on Timer 2 interrupt to transmit the CAN frame
- * stored in the current_frame buffer.
+ * Sends every cyclic message that is due and arms channel 1 for the next
+ * deadline.
  *
  * @param None
  * @retval None
  */
-void TIM2_IRQHandler(void);
+void TIM3_IRQHandler(void);
 
 #endif /* TIMER_HANDLER_H */
 
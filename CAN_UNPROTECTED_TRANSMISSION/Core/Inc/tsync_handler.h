@@ -0,0 +1,146 @@
+/*****************************************************************************
+ * @file    tsync_handler.h
+ * @brief   Time synchronisation over CAN in the manner of AUTOSAR CanTSyn:
+ *          a master broadcasts SYNC/FUP pairs carrying the transmit time of
+ *          the SYNC, slaves steer a synchronised clock from them, and the
+ *          host converts node timestamps to that common time.
+ *****************************************************************************/
+
+#ifndef TSYNC_HANDLER_H
+#define TSYNC_HANDLER_H
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "stm32f1xx.h"
+#include <stdint.h>
+#include "can_handler.h"     // CanFrame register image
+
+/*****************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+/**
+ * @brief Standard CAN ID of the SYNC and FUP messages (8 bytes each,
+ *        big-endian):
+ *
+ *   SYNC: [TSYNC_TYPE_SYNC][0][domain << 4 | seq][0][seconds 4B]
+ *   FUP:  [TSYNC_TYPE_FUP][0][domain << 4 | seq][overflow s][nanoseconds 4B]
+ *
+ * seconds is the master time when the SYNC was requested; the FUP gives
+ * how far past that second the SYNC actually completed on the bus, so the
+ * global time of the SYNC is (seconds + overflow) s + nanoseconds. The
+ * 4-bit sequence counter pairs the two messages. The CRC byte is unused
+ * (CanTSyn "not CRC secured" types).
+ */
+#define TSYNC_CAN_ID            0x7C0
+#define TSYNC_TYPE_SYNC         0x10
+#define TSYNC_TYPE_FUP          0x18
+
+/**
+ * @brief SYNC period: default and lower limit, in ms.
+ */
+#define TSYNC_PERIOD_MS         100
+#define TSYNC_PERIOD_MIN_MS     10
+
+/**
+ * @brief Master: a SYNC whose completion stamp is less certain than this
+ *        (an interrupt ran during the completion poll) gets no FUP, and
+ *        slaves discard it.
+ */
+#define TSYNC_WINDOW_MAX_US     3
+
+/**
+ * @brief Slave: a FUP must follow its SYNC within this time.
+ */
+#define TSYNC_FUP_TIMEOUT_US    20000UL
+
+/**
+ * @brief Slave: an error beyond this sets the clock instead of steering
+ *        it (first SYNC, master restarted or epoch changed), in ns.
+ */
+#define TSYNC_STEP_NS           1000000L
+
+/**
+ * @brief Slave: limit of the rate correction (crystal tolerance), in ppb.
+ */
+#define TSYNC_RATE_MAX_PPB      500000L
+
+/**
+ * @brief Roles.
+ */
+#define TSYNC_ROLE_OFF          0
+#define TSYNC_ROLE_MASTER       1       /**< Sends SYNC/FUP; global = host epoch */
+#define TSYNC_ROLE_SLAVE        2       /**< Follows the master of its domain    */
+
+/**
+ * @brief UART_CMD_TSYNC operations (first payload byte).
+ */
+#define TSYNC_OP_STATUS         0       /**< Query state and clock reference     */
+#define TSYNC_OP_CONFIG         1       /**< [role][domain][period ms 2B]        */
+
+/*****************************************************************************
+ * Function prototypes
+ *****************************************************************************/
+
+/**
+ * @brief Take a received frame if it is a SYNC or FUP of the time domain.
+ *
+ * Called first in the CAN RX interrupt, so the SYNC is stamped with the
+ * least delay after the end of the frame. A complete SYNC/FUP pair is
+ * handed to Tsync_Poll() with SCHED_EVT_TIMEOUT.
+ *
+ * @param frame  Register image from the RX FIFO
+ * @return 1 if the frame is time sync traffic (not forwarded), 0 otherwise.
+ */
+uint8_t Tsync_Frame(const CanFrame *frame);
+
+/**
+ * @brief Main loop work: send the SYNC/FUP pair when due (master), apply a
+ *        received pair to the synchronised clock (slave).
+ *
+ * Called from the SCHED_EVT_TIMEOUT task.
+ */
+void Tsync_Poll(void);
+
+/**
+ * @brief Next time (Time_Now32() us) at which the master sends a SYNC, for
+ *        the tickless idle.
+ *
+ * @param deadline  Set to that time when there is one
+ * @retval 1 if a deadline is pending, 0 if none
+ */
+uint8_t Tsync_NextDeadline(uint32_t *deadline);
+
+/**
+ * @brief Handle UART_CMD_TSYNC.
+ *
+ * Command payload: empty or [TSYNC_OP_STATUS]: query
+ *                  [TSYNC_OP_CONFIG][role][domain][period ms 2B]: restart
+ * Reply payload:   [op][role][domain][synced][period ms 2B][syncs 4B]
+ *                  [fups 4B][dropped 4B][steps 4B][window us 4B]
+ *                  [offset ns 4B][max offset ns 4B][rate ppb 4B]
+ *                  [local ref us 8B][global ref ns 8B]
+ *
+ * syncs/fups count sent messages on the master, received SYNCs and applied
+ * pairs on a slave. dropped counts SYNCs without FUP (master: stamp window
+ * too wide or send failure; slave: FUP missing). offset is the slave's
+ * last error against the master before correction, max offset its largest
+ * magnitude since the last step.
+ *
+ * The reference converts a local timestamp t (us, Time_Now32() or
+ * Time_Now()) to global ns:
+ *   global = global ref + d * 1000 + d * rate / 1000000, d = t - local ref
+ * On the master the global time is the host epoch (UART_CMD_TIME) and the
+ * rate is 0.
+ *
+ * @param args  Command payload
+ * @param len   Payload length in bytes
+ */
+void Tsync_Command(const uint8_t *args, uint8_t len);
+
+#endif /* TSYNC_HANDLER_H */
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
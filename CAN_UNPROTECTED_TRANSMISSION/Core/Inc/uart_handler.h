@@ -18,21 +18,106 @@
  *****************************************************************************/
 
 /**
- * @brief Size of UART receive buffer.
+ * @brief Command frames from the host use a first byte at or above
+ *        UART_CMD_BASE instead of the 0/1 CAN mode byte:
+ *        [cmd][payload length][payload...]
  */
-#define UART_BUFFER_SIZE 50
+#define UART_CMD_BASE           0x10
+#define UART_CMD_MAX_PAYLOAD    28      /**< Keeps a command within 30 bytes */
+
+#define UART_CMD_BURST          0x10    /**< Max-rate burst transmit benchmark */
+#define UART_CMD_PING           0x11    /**< Ping-pong round-trip probe        */
+#define UART_CMD_PING_HIST      0x12    /**< Read round-trip histogram bins    */
+#define UART_CMD_CAN_MODE       0x13    /**< Select normal/loopback/silent mode */
+#define UART_CMD_SELFTEST       0x14    /**< Single-board loopback self-test   */
+#define UART_CMD_CAN_BITRATE    0x15    /**< Select/query CAN bit rate         */
+#define UART_CMD_UART_BAUD      0x16    /**< Negotiate the UART link speed     */
+#define UART_CMD_BATCH          0x17    /**< Configure record batching         */
+#define UART_CMD_COMPACT        0x18    /**< Compact (dictionary) records      */
+#define UART_CMD_FWD            0x19    /**< Forwarding queue policy and losses */
+#define UART_CMD_SEQ            0x1A    /**< Sequenced envelope, acknowledged   */
+#define UART_CMD_TIME           0x1B    /**< Read time base, set epoch offset   */
+#define UART_CMD_CYCLIC         0x1C    /**< Cyclic message with us period      */
+#define UART_CMD_POWER          0x1D    /**< Idle sleep depth, wakeup latency   */
+#define UART_CMD_SCHED          0x1E    /**< Scheduler per-task run time        */
+#define UART_CMD_CAPTURE        0x1F    /**< Triggered capture buffer and dump  */
+#define UART_CMD_IDSTATS        0x20    /**< Per-ID traffic statistics table    */
+#define UART_CMD_ISOTP          0x21    /**< ISO-TP transfer and benchmark      */
+#define UART_CMD_SLCAN          0x22    /**< Switch the host link to SLCAN      */
+#define UART_CMD_CRC            0x23    /**< Record CRCs, CRC unit benchmark    */
+#define UART_CMD_CFGSTORE       0x24    /**< Save/erase the flash configuration */
+#define UART_CMD_BOOT           0x25    /**< Reset into the bootloader          */
+#define UART_CMD_TSYNC          0x26    /**< CAN time sync role and clock reference */
+#define UART_CMD_IDDISP         0x27    /**< Per-ID dispatch table and lookup time */
+#define UART_CMD_POOL           0x28    /**< Frame pool occupancy and high water */
 
-/*****************************************************************************
- * Global variables
- *****************************************************************************/
+/**
+ * @brief Sequenced envelope around any host frame (CAN frame or command):
+ *        [UART_CMD_SEQ][1 + frame length][seq][frame...]
+ *
+ * After the inner frame has been handled (and after its own reply, if any)
+ * the MCU answers with
+ * [UART_CMD_SEQ | UART_REPLY_FLAG][3][seq][status][credits]
+ * where credits is the number of free command queue slots. The host keeps
+ * at most that many frames in flight.
+ */
+#define UART_SEQ_MAX_PAYLOAD    (1 + 2 + UART_CMD_MAX_PAYLOAD)
+#define UART_FRAME_MAX          (2 + UART_SEQ_MAX_PAYLOAD)   /**< Longest host frame */
+#define UART_CMD_QUEUE_LEN      4       /**< Complete host frames waiting for the main loop */
+
+/**
+ * @brief Host frames live in frame pool blocks as [length][frame...]: the
+ *        RX interrupt assembles into a block and queues its handle. The
+ *        host path holds at most the block being assembled, the queued ones
+ *        and the one being handled.
+ */
+#define UART_POOL_BLOCKS        (2 + UART_CMD_QUEUE_LEN)
+
+#define UART_ACK_OK             0x00    /**< Frame handled                        */
+#define UART_ACK_BAD_FRAME      0x01    /**< Malformed inner frame                */
+#define UART_ACK_OVERFLOW       0x02    /**< Command queue full, frame discarded  */
+#define UART_ACK_UNKNOWN        0x03    /**< Unknown command                      */
+#define UART_ACK_BUS_OFF        0x04    /**< CAN frame not sent: bus-off          */
+#define UART_ACK_TX_BUSY        0x05    /**< CAN frame not sent: mailbox busy     */
+#define UART_ACK_TX_FAILED      0x06    /**< CAN frame not acknowledged on the bus */
+
+/**
+ * @brief Link speed after reset. A new speed requested with
+ *        UART_CMD_UART_BAUD must be confirmed by any command frame at the new
+ *        speed within UART_BAUD_CONFIRM_MS, otherwise the MCU falls back.
+ */
+#define UART_BOOT_BAUD          115200
+#define UART_BAUD_CONFIRM_MS    1000
+
+/**
+ * @brief Replies to the host echo the command byte with this bit set:
+ *        [cmd | UART_REPLY_FLAG][payload length][payload...]
+ */
+#define UART_REPLY_FLAG         0x80
+
+/**
+ * @brief Batch record carrying several CAN frame records:
+ *        [UART_REC_BATCH][frame count][payload length 2B][frame records...]
+ *        Each frame record keeps the single-record layout (see
+ *        forward_handler.h). Batching is off (one record per frame) until
+ *        enabled with UART_CMD_BATCH.
+ */
+#define UART_REC_BATCH          0x40
+#define UART_BATCH_HDR_LEN      4
+#define UART_BATCH_SIZE         240     /**< Frame record bytes per batch   */
+#define UART_BATCH_MAX_FRAMES   32      /**< Upper limit for the frame count */
 
 /**
- * @brief UART receive buffer for commands from PC.
+ * @brief Compact frame record (see compact_handler.h for the layout).
  */
-extern volatile uint8_t uart_rx_buffer[UART_BUFFER_SIZE];
+#define UART_REC_COMPACT        0x42
+
+/*****************************************************************************
+ * Global variables
+ *****************************************************************************/
 
 /**
- * @brief Index of the next byte to write in uart_rx_buffer.
+ * @brief Index of the next byte to write in the frame being assembled.
  */
 extern volatile uint16_t uart_rx_index;
 
@@ -72,9 +157,64 @@ void UART_SendString(const char* s);
 void UART_SendHex(uint8_t b);
 
 /**
- * @brief Process a received UART frame stored in uart_rx_buffer.
+ * @brief Send a reply record for a host command.
+ *
+ * @param cmd     Command byte being answered.
+ * @param payload Pointer to the reply payload.
+ * @param len     Payload length in bytes.
+ */
+void UART_SendReply(uint8_t cmd, const uint8_t *payload, uint8_t len);
+
+/**
+ * @brief Send one CAN frame record to the host.
+ *
+ * Sent directly, or appended to the current batch when batching is on.
+ * With record CRCs on (UART_CMD_CRC) a direct record, or a whole batch, is
+ * followed by [CRC 4B] over its bytes (see crc_handler.h). Called from the
+ * main loop only.
+ *
+ * @param rec  Record bytes
+ * @param len  Record length in bytes
+ */
+void UART_SendRecord(const uint8_t *rec, uint8_t len);
+
+/**
+ * @brief Send the batch once its first frame is older than the configured age.
+ *
+ * Called from the main loop.
+ */
+void UART_BatchPoll(void);
+
+/**
+ * @brief Next time (Time_Now32() us) at which UART_BatchPoll() or
+ *        UART_BaudCheck() has work to do.
+ *
+ * @param deadline  Set to that time when there is one
+ * @retval 1 if a deadline is pending, 0 if none
+ */
+uint8_t UART_NextDeadline(uint32_t *deadline);
+
+/**
+ * @brief Revert an unconfirmed link speed change.
+ *
+ * Called from the main loop; restores the previous baud rate when no command
+ * arrived at the new speed within UART_BAUD_CONFIRM_MS.
+ */
+void UART_BaudCheck(void);
+
+/**
+ * @brief Store a 32-bit value big-endian (the byte order used on the link).
+ *
+ * @param p Destination (4 bytes).
+ * @param v Value to store.
+ */
+void UART_PutU32(uint8_t *p, uint32_t v);
+
+/**
+ * @brief Process every host frame waiting in the command queue.
  *
- * Parses and handles the command/data received from UART.
+ * Sequenced frames are answered with an acknowledgement. Scheduler task
+ * for SCHED_EVT_UART_RX, which the RX interrupt posts.
  */
 void Process_UART_Frame(void);
 
@@ -85,7 +225,7 @@ void Process_UART_Frame(void);
 /**
  * @brief UART1 interrupt handler.
  *
- * Handles UART RX interrupts and stores incoming bytes into buffer.
+ * Assembles incoming bytes into frames and queues complete frames.
  */
 void USART1_IRQHandler(void);
 
@@ -0,0 +1,412 @@
+/*****************************************************************************
+ * @file    bench_handler.c
+ * @brief   Max-rate burst transmit benchmark for measuring CAN bus throughput,
+ *          two-node ping-pong round-trip latency probe and a single-board
+ *          loopback self-test running both.
+ *****************************************************************************/
+
+#include "bench_handler.h"
+#include "uart_handler.h"
+#include "can_handler.h"
+#include "isotp_handler.h"
+#include "timebase_handler.h"
+#include "main.h"
+
+/*****************************************************************************
+ * Local types
+ *****************************************************************************/
+
+/**
+ * @brief Counters accumulated while a burst is running.
+ */
+typedef struct {
+    uint32_t ok;        /**< Mailbox completed with TXOK set            */
+    uint32_t arb_lost;  /**< Mailbox saw at least one arbitration loss  */
+    uint32_t errors;    /**< Mailbox completed without TXOK             */
+    uint32_t done;      /**< Mailboxes completed (any outcome)          */
+} BenchBurstStats;
+
+/**
+ * @brief Round-trip statistics of the ping-pong probe.
+ */
+typedef struct {
+    uint32_t sent;      /**< Probes transmitted                        */
+    uint32_t received;  /**< Matching echoes received                  */
+    uint32_t min_us;    /**< Shortest round trip                       */
+    uint32_t max_us;    /**< Longest round trip                        */
+    uint32_t sum_us;    /**< Sum of round trips (for the mean)         */
+    uint32_t overflow;  /**< Round trips beyond the last histogram bin */
+} BenchPingStats;
+
+/*****************************************************************************
+ * Local variables
+ *****************************************************************************/
+static volatile BenchPingStats ping_stats;
+static volatile uint16_t ping_hist[BENCH_HIST_BINS];   // 1 us bins
+static volatile uint8_t  ping_pending = 0;             // Probe outstanding
+static volatile uint8_t  ping_seq = 0;                 // Sequence of outstanding probe
+static volatile uint32_t bench_rx_frames = 0;          // Self-test frames seen by the RX path
+
+/*****************************************************************************
+ * Local functions
+ *****************************************************************************/
+
+/**
+ * @brief Load one frame into a free TX mailbox and request transmission.
+ *        Data is packed into TDLR/TDHR locally so each register is written once.
+ */
+static void Bench_LoadMailbox(uint8_t mb, uint8_t isExtended, uint32_t id,
+                              const uint8_t *data, uint8_t len) {
+    uint32_t tdlr = 0;
+    uint32_t tdhr = 0;
+
+    for (uint8_t i = 0; i < len && i < 8; i++) {
+        if (i < 4) {
+            tdlr |= ((uint32_t)data[i] << (8 * i));         // Bytes 0-3
+        } else {
+            tdhr |= ((uint32_t)data[i] << (8 * (i - 4)));   // Bytes 4-7
+        }
+    }
+
+    CAN1->sTxMailBox[mb].TIR  = isExtended ? ((id << 3) | (1 << 2)) : (id << 21);
+    CAN1->sTxMailBox[mb].TDTR = len & 0x0F;                 // DLC
+    CAN1->sTxMailBox[mb].TDLR = tdlr;
+    CAN1->sTxMailBox[mb].TDHR = tdhr;
+    CAN1->sTxMailBox[mb].TIR |= (1 << 0);                   // TXRQ: request transmission
+}
+
+/**
+ * @brief Collect completed mailboxes 0 and 1 from a TSR snapshot.
+ *        Each mailbox owns 8 status bits: RQCP(0), TXOK(1), ALST(2), TERR(3).
+ *        Mailbox 2's completion is left for the TX interrupt.
+ * @return Non-zero if at least one mailbox completed.
+ */
+static uint8_t Bench_CollectMailboxes(uint32_t tsr, BenchBurstStats *st) {
+    uint8_t progress = 0;
+
+    for (uint8_t mb = 0; mb < 2; mb++) {
+        uint32_t status = (tsr >> (8 * mb)) & 0x0F;
+        if (!(status & (1 << 0))) continue;                 // RQCP not set: still pending
+
+        if (status & (1 << 1)) st->ok++;                    // TXOK
+        else                   st->errors++;                // Aborted or TERR
+        if (status & (1 << 2)) st->arb_lost++;              // ALST
+
+        CAN1->TSR = (1 << (8 * mb));                        // Clear RQCP/TXOK/ALST/TERR (write-1-to-clear)
+        st->done++;
+        progress = 1;
+    }
+    return progress;
+}
+
+/**
+ * @brief Clear the ping-pong statistics and histogram.
+ */
+static void Bench_PingReset(void) {
+    ping_stats.sent = 0;
+    ping_stats.received = 0;
+    ping_stats.min_us = 0xFFFFFFFF;
+    ping_stats.max_us = 0;
+    ping_stats.sum_us = 0;
+    ping_stats.overflow = 0;
+    for (uint16_t i = 0; i < BENCH_HIST_BINS; i++) {
+        ping_hist[i] = 0;
+    }
+}
+
+/**
+ * @brief Add one round trip to the statistics (called from the RX ISR).
+ */
+static void Bench_PingRecord(uint32_t rtt_cycles) {
+    uint32_t rtt_us = rtt_cycles / (SystemCoreClock / 1000000);
+
+    ping_stats.received++;
+    ping_stats.sum_us += rtt_us;
+    if (rtt_us < ping_stats.min_us) ping_stats.min_us = rtt_us;
+    if (rtt_us > ping_stats.max_us) ping_stats.max_us = rtt_us;
+
+    if (rtt_us < BENCH_HIST_BINS) {
+        if (ping_hist[rtt_us] != 0xFFFF) ping_hist[rtt_us]++;  // Saturate bin
+    } else {
+        ping_stats.overflow++;
+    }
+}
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/**
+ * @brief Enable the DWT cycle counter (trace must be enabled first).
+ */
+void Bench_Init(void) {
+    CoreDebug->DEMCR |= (1 << 24);                          // TRCENA: enable DWT
+    DWT->CYCCNT = 0;                                        // Reset cycle counter
+    DWT->CTRL |= (1 << 0);                                  // CYCCNTENA: start counting
+
+    Bench_PingReset();
+}
+
+/**
+ * @brief Read the DWT cycle counter.
+ */
+uint32_t Bench_Cycles(void) {
+    return DWT->CYCCNT;
+}
+
+/**
+ * @brief Run a burst: keep mailboxes 0 and 1 loaded until N frames have
+ *        completed, then report the counters to the host. Mailbox 2 stays
+ *        with the interrupt handlers' CAN_QueueFrame().
+ *        Cyclic transmission is paused for the duration of the burst, and
+ *        the TX interrupt is masked so the completions are left for
+ *        Bench_CollectMailboxes().
+ */
+void Bench_Burst(const uint8_t *args, uint8_t len) {
+    uint8_t  reply[25] = {0};
+    BenchBurstStats st = {0, 0, 0, 0};
+    uint8_t  status = BENCH_STATUS_OK;
+    uint32_t count = 0;
+    uint32_t elapsed = 0;
+
+    if (len < BENCH_BURST_HDR_LEN || args[10] > 8 ||
+        len < BENCH_BURST_HDR_LEN + args[10]) {
+        status = BENCH_STATUS_BAD_ARGS;
+    } else if (CAN1->ESR & (1 << 2)) {                      // BOFF
+        status = BENCH_STATUS_BUS_OFF;
+    } else if (IsoTp_TxPending()) {                         // Its mailbox is not ours
+        status = BENCH_STATUS_BUSY;
+    }
+
+    if (status == BENCH_STATUS_OK) {
+        uint8_t  flags    = args[0];
+        uint8_t  mode     = args[5];
+        uint32_t base_id  = ((uint32_t)args[6] << 24) | ((uint32_t)args[7] << 16) |
+                            ((uint32_t)args[8] <<  8) |  (uint32_t)args[9];
+        uint32_t id_mask  = mode ? 0x1FFFFFFF : 0x7FF;
+        uint8_t  data_len = args[10];
+        uint8_t  data[8]  = {0};
+        uint32_t queued   = 0;
+        uint32_t stall    = SystemCoreClock / 10;           // 100 ms without progress
+
+        count = ((uint32_t)args[1] << 24) | ((uint32_t)args[2] << 16) |
+                ((uint32_t)args[3] <<  8) |  (uint32_t)args[4];
+        memcpy(data, &args[BENCH_BURST_HDR_LEN], data_len);
+
+        NVIC_DisableIRQ(TIM3_IRQn);                         // Keep cyclic frames out of the measurement
+        NVIC_DisableIRQ(CAN1_TX_IRQn);                      // Completions are collected here
+
+        uint32_t start = Bench_Cycles();
+        uint32_t last_progress = start;
+
+        while (st.done < count) {
+            uint32_t tsr = CAN1->TSR;
+
+            if (Bench_CollectMailboxes(tsr, &st)) {
+                last_progress = Bench_Cycles();
+            }
+
+            if (queued < count && (tsr & (0x3 << 26))) {    // TME0 or TME1
+                uint8_t  mb = (tsr & (1 << 26)) ? 0 : 1;
+                uint32_t id = (flags & BENCH_FLAG_INC_ID) ? ((base_id + queued) & id_mask)
+                                                          : (base_id & id_mask);
+                Bench_LoadMailbox(mb, mode, id, data, data_len);
+                queued++;
+            }
+
+            if ((Bench_Cycles() - last_progress) > stall) {
+                uint32_t t0 = Time_Now32();
+                uint32_t limit = 2 * CAN_FrameTimeUs();     // A frame already on the bus ends first
+                CAN1->TSR = (1 << 7) | (1 << 15);           // ABRQ0/1: abort pending mailboxes
+                while ((CAN1->TSR & (0x3 << 26)) != (0x3 << 26) && Time_Now32() - t0 < limit) ;
+                Bench_CollectMailboxes(CAN1->TSR, &st);
+                st.errors += count - st.done;               // Never sent or aborted
+                status = BENCH_STATUS_TIMEOUT;
+                break;
+            }
+        }
+
+        elapsed = Bench_Cycles() - start;
+        NVIC_EnableIRQ(CAN1_TX_IRQn);
+        NVIC_EnableIRQ(TIM3_IRQn);
+    }
+
+    reply[0] = status;
+    UART_PutU32(&reply[1],  count);
+    UART_PutU32(&reply[5],  st.ok);
+    UART_PutU32(&reply[9],  st.arb_lost);
+    UART_PutU32(&reply[13], st.errors);
+    UART_PutU32(&reply[17], elapsed);
+    UART_PutU32(&reply[21], SystemCoreClock);
+    UART_SendReply(UART_CMD_BURST, reply, sizeof(reply));
+}
+
+/**
+ * @brief Send probes one at a time, waiting for each echo (or the timeout)
+ *        before the next, then report the summary to the host.
+ */
+void Bench_Ping(const uint8_t *args, uint8_t len) {
+    uint8_t reply[29] = {0};
+    uint8_t status = BENCH_STATUS_OK;
+
+    if (len < 6) {
+        status = BENCH_STATUS_BAD_ARGS;
+    } else if (CAN1->ESR & (1 << 2)) {                      // BOFF
+        status = BENCH_STATUS_BUS_OFF;
+    }
+
+    if (status == BENCH_STATUS_OK) {
+        uint32_t count = ((uint32_t)args[0] << 24) | ((uint32_t)args[1] << 16) |
+                         ((uint32_t)args[2] <<  8) |  (uint32_t)args[3];
+        uint32_t gap = (((uint32_t)args[4] << 8) | args[5]) * (SystemCoreClock / 1000000);
+        uint32_t timeout = BENCH_PING_TIMEOUT_US * (SystemCoreClock / 1000000);
+
+        if (count) Bench_PingReset();
+
+        for (uint32_t i = 0; i < count; i++) {
+            uint8_t  probe[BENCH_PING_LEN];
+            uint32_t t0 = Bench_Cycles();
+
+            ping_seq = (uint8_t)i;
+            probe[0] = ping_seq;
+            probe[1] = (t0 >> 24) & 0xFF;                   // Timestamp travels with the probe
+            probe[2] = (t0 >> 16) & 0xFF;
+            probe[3] = (t0 >>  8) & 0xFF;
+            probe[4] =  t0        & 0xFF;
+
+            ping_pending = 1;
+            CAN_Send(0, BENCH_PING_ID, probe, BENCH_PING_LEN);
+            ping_stats.sent++;
+
+            while (ping_pending && (Bench_Cycles() - t0) < timeout) ;  // Echo clears ping_pending
+            ping_pending = 0;
+
+            uint32_t t1 = Bench_Cycles();
+            while ((Bench_Cycles() - t1) < gap) ;           // Gap between probes
+        }
+    }
+
+    uint32_t received = ping_stats.received;
+    reply[0] = status;
+    UART_PutU32(&reply[1],  ping_stats.sent);
+    UART_PutU32(&reply[5],  received);
+    UART_PutU32(&reply[9],  ping_stats.sent - received);
+    UART_PutU32(&reply[13], received ? ping_stats.min_us : 0);
+    UART_PutU32(&reply[17], ping_stats.max_us);
+    UART_PutU32(&reply[21], received ? ping_stats.sum_us / received : 0);
+    UART_PutU32(&reply[25], ping_stats.overflow);
+    UART_SendReply(UART_CMD_PING, reply, sizeof(reply));
+}
+
+/**
+ * @brief Reply with up to BENCH_HIST_MAX_READ histogram bins.
+ */
+void Bench_PingHistogram(const uint8_t *args, uint8_t len) {
+    uint8_t  reply[3 + 2 * BENCH_HIST_MAX_READ];
+    uint16_t first = 0;
+    uint8_t  n = 0;
+
+    if (len >= 3) {
+        first = ((uint16_t)args[0] << 8) | args[1];
+        n = args[2];
+    }
+    if (n > BENCH_HIST_MAX_READ) n = BENCH_HIST_MAX_READ;
+    if (first >= BENCH_HIST_BINS) n = 0;
+    else if (first + n > BENCH_HIST_BINS) n = BENCH_HIST_BINS - first;
+
+    reply[0] = (first >> 8) & 0xFF;
+    reply[1] =  first       & 0xFF;
+    reply[2] = n;
+    for (uint8_t i = 0; i < n; i++) {
+        reply[3 + 2 * i] = (ping_hist[first + i] >> 8) & 0xFF;
+        reply[4 + 2 * i] =  ping_hist[first + i]       & 0xFF;
+    }
+    UART_SendReply(UART_CMD_PING_HIST, reply, 3 + 2 * n);
+}
+
+/**
+ * @brief Loopback self-test: burst then ping with the same commands as the
+ *        two-node setup, on an internal TX -> RX loop.
+ */
+void Bench_SelfTest(const uint8_t *args, uint8_t len) {
+    uint8_t reply[6] = {0};
+    uint8_t status = BENCH_STATUS_OK;
+    uint8_t saved_mode = CAN_GetTestMode();
+
+    if (len < 4) {
+        status = BENCH_STATUS_BAD_ARGS;
+    } else {
+        uint8_t burst[BENCH_BURST_HDR_LEN + 8];
+        uint8_t ping[6];
+
+        burst[0] = 0;                                       // Same ID every frame
+        memcpy(&burst[1], args, 4);                         // Frame count
+        burst[5] = 0;                                       // Standard ID
+        UART_PutU32(&burst[6], BENCH_SELFTEST_ID);
+        burst[10] = 8;                                      // 8 data bytes
+        memset(&burst[BENCH_BURST_HDR_LEN], 0x55, 8);
+
+        memcpy(&ping[0], args, 4);                          // Probe count
+        ping[4] = 0;                                        // No gap between probes
+        ping[5] = 0;
+
+        CAN_SetTestMode(CAN_MODE_SELFTEST);
+
+        bench_rx_frames = 0;
+        Bench_Burst(burst, sizeof(burst));
+        uint32_t start = Bench_Cycles();
+        while ((Bench_Cycles() - start) < SystemCoreClock / 10) ;   // Let RX/UART drain (100 ms)
+        UART_PutU32(&reply[1], bench_rx_frames);
+
+        Bench_Ping(ping, sizeof(ping));
+
+        CAN_SetTestMode(saved_mode);
+    }
+
+    reply[0] = status;
+    reply[5] = CAN_GetTestMode();
+    UART_SendReply(UART_CMD_SELFTEST, reply, sizeof(reply));
+}
+
+/**
+ * @brief Echo probes and time echoes.
+ *        Runs inside the CAN RX interrupt.
+ */
+uint8_t Bench_PingRx(const CanFrame *frame) {
+    if (CAN_FRAME_IDE(frame) || CAN_FRAME_DLC(frame) != BENCH_PING_LEN) return 0;
+
+    uint32_t id = CAN_FRAME_ID(frame);
+    if (id == BENCH_PING_ID) {                              // Peer: echo immediately
+        CanFrame pong = *frame;
+        pong.rir = (uint32_t)BENCH_PONG_ID << 21;           // Same data words, new ID
+        CAN_QueueFrame(&pong);                              // Mailbox 2: no wait in the ISR
+        return 1;
+    }
+
+    if (id == BENCH_PONG_ID) {                              // Originator: time the echo
+        const uint8_t *data = CAN_FRAME_DATA(frame);
+        uint32_t now = Bench_Cycles();
+        uint32_t t0  = ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) |
+                       ((uint32_t)data[3] <<  8) |  (uint32_t)data[4];
+
+        if (ping_pending && data[0] == ping_seq) {          // Late echoes are ignored
+            Bench_PingRecord(now - t0);
+            ping_pending = 0;
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Count self-test frames; runs inside the CAN RX interrupt.
+ */
+uint8_t Bench_SelfTestRx(const CanFrame *frame) {
+    bench_rx_frames++;
+    return 0;
+}
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
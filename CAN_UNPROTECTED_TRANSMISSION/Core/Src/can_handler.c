@@ -9,16 +9,69 @@
 #include "can_handler.h"    // Include header defining CAN functions and constants
 #include "uart_handler.h"   // Include UART header to use UART sending functions
 #include "main.h"           // Include main header with common definitions and global variables
+#include "forward_handler.h" // Include forwarding queue
+#include "capture_handler.h" // Include triggered capture buffer
+#include "idstats_handler.h" // Include per-ID statistics table
+#include "isotp_handler.h"  // Include ISO-TP transport
+#include "iddisp_handler.h" // Include per-ID dispatch table
+#include "timebase_handler.h" // Include 1 us time base for TX stamps
 
 /*****************************************************************************
- * Global variables
+ * Bit timing calculator
+ *
+ * Evaluated at compile time from PCLK1_HZ. The number of time quanta per bit
+ * is the first of 16, 18, 20, 15, 12, 10, 8 that divides the clock exactly
+ * with a prescaler <= 1024. BS2 = round(tq / 8) gives a sample point close
+ * to 87.5 % (CiA recommendation), SJW = min(BS2, 4).
  *****************************************************************************/
+#define CAN_TQ_FITS(r, n)   ((PCLK1_HZ % ((uint32_t)(r) * (n))) == 0 && \
+                             (PCLK1_HZ / ((uint32_t)(r) * (n))) <= 1024)
+#define CAN_NTQ(r)          (CAN_TQ_FITS(r, 16) ? 16 : CAN_TQ_FITS(r, 18) ? 18 : \
+                             CAN_TQ_FITS(r, 20) ? 20 : CAN_TQ_FITS(r, 15) ? 15 : \
+                             CAN_TQ_FITS(r, 12) ? 12 : CAN_TQ_FITS(r, 10) ? 10 : \
+                             CAN_TQ_FITS(r,  8) ?  8 : 0)
+#define CAN_PRESC(r)        (PCLK1_HZ / ((uint32_t)(r) * CAN_NTQ(r)))
+#define CAN_BS2(r)          ((CAN_NTQ(r) + 4) / 8)
+#define CAN_BS1(r)          (CAN_NTQ(r) - 1 - CAN_BS2(r))
+#define CAN_SJW(r)          (CAN_BS2(r) < 4 ? CAN_BS2(r) : 4)
+#define CAN_BTR_VALUE(r)    (((uint32_t)(CAN_SJW(r) - 1) << 24)   /* SJW, bits 24-25 */ \
+                           | ((uint32_t)(CAN_BS2(r) - 1) << 20)   /* BS2, bits 20-22 */ \
+                           | ((uint32_t)(CAN_BS1(r) - 1) << 16)   /* BS1, bits 16-19 */ \
+                           | ((uint32_t)(CAN_PRESC(r) - 1)))      /* BRP, bits 0-9   */
+
+_Static_assert(CAN_NTQ(125000)  != 0, "no exact 125 kbit/s timing at PCLK1_HZ");
+_Static_assert(CAN_NTQ(250000)  != 0, "no exact 250 kbit/s timing at PCLK1_HZ");
+_Static_assert(CAN_NTQ(500000)  != 0, "no exact 500 kbit/s timing at PCLK1_HZ");
+_Static_assert(CAN_NTQ(1000000) != 0, "no exact 1 Mbit/s timing at PCLK1_HZ");
+_Static_assert(sizeof(CanFrame) == 16, "CanFrame must mirror the four mailbox registers");
 
 /**
- * @brief Buffer to store CAN data received from interrupt.
- * @note  Marked volatile because accessed inside ISR.
+ * @brief Bit rate and its BTR value.
  */
-volatile uint8_t can_rx_buffer[CAN_BUFFER_SIZE]; // Buffer array for storing received CAN data
+typedef struct {
+    uint32_t bitrate;   /**< Bit rate in bit/s              */
+    uint32_t btr;       /**< SJW/BS2/BS1/BRP fields of BTR  */
+} CanBitTiming;
+
+/**
+ * @brief Bit timing table, generated at compile time and kept in flash.
+ */
+static const CanBitTiming can_bit_timing[CAN_BITRATE_COUNT] = {
+    { 125000,  CAN_BTR_VALUE(125000)  },
+    { 250000,  CAN_BTR_VALUE(250000)  },
+    { 500000,  CAN_BTR_VALUE(500000)  },
+    { 1000000, CAN_BTR_VALUE(1000000) },
+};
+
+/*****************************************************************************
+ * Local variables
+ *****************************************************************************/
+static uint8_t can_bitrate_index = CAN_BITRATE_DEFAULT;    // Active table entry
+static uint8_t can_boot_mode = CAN_MODE_NORMAL;            // Test mode CAN_Config() starts in
+static volatile uint32_t can_tx0_status;                   // Mailbox 0 status bits latched by the TX interrupt
+static CanFrame can_txq[CAN_TXQ_LEN];                      // Interrupt senders' frames waiting for mailbox 2
+static uint8_t can_txq_head;                               // Oldest queued frame
+static uint8_t can_txq_count;                              // Frames queued
 
 /*****************************************************************************
  * Function Definitions
@@ -28,15 +81,15 @@ volatile uint8_t can_rx_buffer[CAN_BUFFER_SIZE]; // Buffer array for storing rec
  * @brief  Initialize CAN1 configuration.
  *
  * Setup:
- * - Bit timing for 500 kbps speed with 8 MHz clock.
+ * - Bit timing from the compile-time table (default 500 kbit/s).
  * - Filter 0 accepts all standard and extended IDs.
  * - Enable interrupts for FIFO0, successful transmission, and CAN errors.
  *
- * Bit timing configuration:
- * - Prescaler = 4
- * - BS1 = 1
- * - BS2 = 0
- * - SJW = 1
+ * Bit timing configuration (500 kbit/s @ 36 MHz, sample point 88.9 %):
+ * - Prescaler = 4 (18 time quanta per bit)
+ * - BS1 = 15
+ * - BS2 = 2
+ * - SJW = 2
  *
  * @retval None
  */
@@ -53,10 +106,8 @@ void CAN_Config(void) {
 
     CAN1->MCR |= (1 << 2);             // Enable automatic bus-off management
 
-    CAN1->BTR = (0 << 24)                  // SJW = 1 (bits 24-25 = 00)
-              | (1 << 16)                  // BS1 = 1 (bits 16-19)
-              | (0 << 20)                  // BS2 = 0 (bits 20-22)
-              | (3 << 0);                  // Prescaler = 4 (0-based: 3 means divide by 4)
+    CAN1->BTR = can_bit_timing[can_bitrate_index].btr     // SJW/BS2/BS1/prescaler from the table
+              | ((uint32_t)can_boot_mode << 30);           // LBKM/SILM (CAN_Preset())
 
     CAN1->FMR |= (1 << 0);            // Enter filter init mode
     CAN1->FA1R &= ~(1 << 0);               // Deactivate filter 0
@@ -68,147 +119,416 @@ void CAN_Config(void) {
     CAN1->FA1R |= (1 << 0);                // Activate filter 0
     CAN1->FMR &= ~(1 << 0);           // Exit filter init mode
 
-    CAN1->IER |= (1 << 1)  // Bit 1: FMPIE0
+    CAN1->IER |= (1 << 0)  // Bit 0: TMEIE (completions, see USB_HP_CAN1_TX_IRQHandler())
+			  | (1 << 1)  // Bit 1: FMPIE0
 			  | (1 << 2)  // Bit 2: EWGIE
 			  | (1 << 3)  // Bit 3: EPVIE
 			  | (1 << 4); // Bit 4: BOFIE       // Enable bus-off interrupt
 
     NVIC_EnableIRQ(CAN1_RX0_IRQn);         // Enable CAN1 RX FIFO0 interrupt in NVIC
     NVIC_EnableIRQ(CAN1_TX_IRQn);          // Enable CAN1 TX interrupt in NVIC
+    NVIC_EnableIRQ(CAN1_SCE_IRQn);         // Error interrupt, enabled in IER by the capture trigger
 
     CAN1->MCR &= ~(1 << 0);	            // Exit initialization mode
     while (CAN1->MSR & (1 << 0));       // Wait until initialization mode cleared
 }
 
 /**
- * @brief  Send one CAN frame using mailbox 0.
+ * @brief  Look a bit rate up in the bit timing table.
  *
- * Supports standard (11-bit) and extended (29-bit) IDs.
- * Waits for mailbox availability or timeout, checks bus-off status.
+ * @param[in] bitrate  Bit rate in bit/s
+ * @retval Table index, CAN_BITRATE_COUNT if not supported
+ */
+static uint8_t CAN_BitrateIndex(uint32_t bitrate) {
+    uint8_t index = 0;
+    while (index < CAN_BITRATE_COUNT && can_bit_timing[index].bitrate != bitrate) {
+        index++;
+    }
+    return index;
+}
+
+/**
+ * @brief  Select the bit rate and test mode CAN_Config() starts with.
+ *
+ * Only stores the selection, so a saved configuration can be restored
+ * before the controller first leaves initialization mode.
+ *
+ * @param[in] bitrate  Bit rate in bit/s (one of the table entries)
+ * @param[in] mode     CAN_MODE_NORMAL, CAN_MODE_LOOPBACK, CAN_MODE_SILENT or CAN_MODE_SELFTEST
+ * @retval 0 on success, 1 if the bit rate is not supported (nothing changed)
+ */
+uint8_t CAN_Preset(uint32_t bitrate, uint8_t mode) {
+    uint8_t index = CAN_BitrateIndex(bitrate);
+    if (index == CAN_BITRATE_COUNT) return 1;
+
+    can_bitrate_index = index;
+    can_boot_mode = mode & 0x03;
+    return 0;
+}
+
+/**
+ * @brief  Change the CAN1 bit rate.
+ *
+ * Looks the bit rate up in the compile-time table, enters initialization
+ * mode, reloads the timing fields of BTR and returns to normal operation.
+ * LBKM/SILM test mode bits and filters are left unchanged.
+ *
+ * @param[in] bitrate  Bit rate in bit/s (125000, 250000, 500000 or 1000000)
+ * @retval 0 on success, 1 if the bit rate is not supported
+ */
+uint8_t CAN_SetBitrate(uint32_t bitrate) {
+    uint8_t index = CAN_BitrateIndex(bitrate);
+    if (index == CAN_BITRATE_COUNT) return 1;  // Not in the table
+
+	CAN1->MCR |= (1 << 0);            // Request initialization mode
+	while (!(CAN1->MSR & (1 << 0)));  // Wait until CAN enters init mode (INAK flag set)
+
+    CAN1->BTR = (CAN1->BTR & (0x3UL << 30))    // Keep LBKM (bit 30) and SILM (bit 31)
+              | can_bit_timing[index].btr;     // New SJW/BS2/BS1/prescaler
+    can_bitrate_index = index;
+
+    CAN1->MCR &= ~(1 << 0);	            // Exit initialization mode
+    while (CAN1->MSR & (1 << 0));       // Wait until initialization mode cleared
+    return 0;
+}
+
+/**
+ * @brief  Read the current CAN1 bit rate.
+ *
+ * @retval Bit rate in bit/s
+ */
+uint32_t CAN_GetBitrate(void) {
+    return can_bit_timing[can_bitrate_index].bitrate;
+}
+
+/**
+ * @brief  Longest frame time at the current bit rate.
+ *
+ * @retval CAN_FRAME_BITS_MAX bit times in us, rounded up
+ */
+uint32_t CAN_FrameTimeUs(void) {
+    uint32_t bitrate = CAN_GetBitrate();
+
+    return (CAN_FRAME_BITS_MAX * 1000000UL + bitrate - 1) / bitrate;
+}
+
+/**
+ * @brief  Read the current CAN1 bit timing.
+ *
+ * @retval BTR without the LBKM/SILM test mode bits
+ */
+uint32_t CAN_GetBitTiming(void) {
+    return CAN1->BTR & ~(0x3UL << 30);
+}
+
+/**
+ * @brief  Switch CAN1 test mode.
+ *
+ * Enters initialization mode, updates the LBKM/SILM bits of BTR and returns
+ * to normal operation. Bit timing and filters are left unchanged.
+ *
+ * @param[in] mode  CAN_MODE_NORMAL, CAN_MODE_LOOPBACK, CAN_MODE_SILENT or CAN_MODE_SELFTEST
+ * @retval None
+ */
+void CAN_SetTestMode(uint8_t mode) {
+	CAN1->MCR |= (1 << 0);            // Request initialization mode
+	while (!(CAN1->MSR & (1 << 0)));  // Wait until CAN enters init mode (INAK flag set)
+
+    CAN1->BTR = (CAN1->BTR & ~(0x3UL << 30))   // Clear LBKM (bit 30) and SILM (bit 31)
+              | ((uint32_t)(mode & 0x03) << 30); // Bit 30 = loopback, bit 31 = silent
+
+    CAN1->MCR &= ~(1 << 0);	            // Exit initialization mode
+    while (CAN1->MSR & (1 << 0));       // Wait until initialization mode cleared
+}
+
+/**
+ * @brief  Read the current CAN1 test mode.
  *
+ * @retval LBKM/SILM bits of BTR as CAN_MODE_xxx
+ */
+uint8_t CAN_GetTestMode(void) {
+    return (CAN1->BTR >> 30) & 0x03;
+}
+
+/**
+ * @brief  Build a register image: ID/IDE as in TIR, DLC, data packed into
+ *         the two data words (unused bytes are zero).
+ *
+ * @param[out] f          Frame to fill
  * @param[in] isExtended  1 if extended ID, 0 if standard ID
  * @param[in] id          CAN ID (11 or 29 bits)
  * @param[in] data        Pointer to data bytes (up to 8)
  * @param[in] len         Number of data bytes (0-8)
  * @retval None
  */
-void CAN_Send(uint8_t isExtended, uint32_t id, uint8_t *data, uint8_t len) {
+void CAN_FramePack(CanFrame *f, uint8_t isExtended, uint32_t id, const uint8_t *data, uint8_t len) {
+    if (isExtended) {                     // Extended frame
+        f->rir = (id << 3) | (1 << 2);    // Set extended ID and IDE bit
+    } else {                             // Standard frame
+        f->rir = (id << 21);              // Set standard 11-bit ID
+    }
+    f->rdtr = len & 0x0F;                 // Data length (DLC) (0-8)
+    f->rdlr = 0;
+    f->rdhr = 0;
+    memcpy(&f->rdlr, data, len < 8 ? len : 8);  // Little-endian: byte i lands in bits 8*i
+}
+
+/**
+ * @brief  Send a register image using mailbox 0.
+ *
+ * The mailbox is written with four word stores; the TIR store carries TXRQ
+ * and goes last so the frame is complete when it is requested.
+ * Waits for mailbox availability or timeout, checks bus-off status. Each
+ * wait lasts at most CAN_TX_WAIT_FRAMES frame times at the current bit rate,
+ * measured on the time base so it does not depend on the core clock.
+ * With done_us set, each completion poll is preceded by a time base read
+ * (see CAN_SendFrameTimed()).
+ *
+ * @param[in]  f          Frame to send
+ * @param[out] done_us    Completion stamp, or NULL
+ * @param[out] window_us  Stamp uncertainty (with done_us)
+ * @retval CAN_TX_OK, CAN_TX_BUS_OFF, CAN_TX_BUSY or CAN_TX_FAILED
+ */
+static uint8_t CAN_SendMailbox0(const CanFrame *f, uint32_t *done_us, uint32_t *window_us) {
+    uint8_t result;                       // Transmission result
+    uint32_t prev, now;                   // Time base reads around the completion
+    uint32_t t0;                          // Start of the current wait
+    uint32_t limit;                       // Longest wait in us
+
 	if (CAN1->ESR & (1 << 2)) {       // If bus is off, cannot send
-        return;                           // Exit function
+        return CAN_TX_BUS_OFF;            // Exit function
     }
 
-    uint32_t timeout = 10000;             // Timeout counter waiting for free mailbox
+    limit = CAN_TX_WAIT_FRAMES * CAN_FrameTimeUs();
+    t0 = Time_Now32();
     while (!(CAN1->TSR & (1 << 26))   // Check if mailbox 0 is free
-           && timeout--) ;                // Decrement timeout
-    if (timeout == 0) {                   // If timeout expired and mailbox not free
-        return;                          // Exit without sending
+           && Time_Now32() - t0 < limit) ;  // Until the wait runs out
+    if (!(CAN1->TSR & (1 << 26))) {       // If timeout expired and mailbox not free
+        return CAN_TX_BUSY;               // Exit without sending
     }
 
-    if (isExtended) {                     // Extended frame
-        CAN1->sTxMailBox[0].TIR = (id << 3) | (1 << 2); // Set extended ID and IDE bit
-    } else {                             // Standard frame
-        CAN1->sTxMailBox[0].TIR = (id << 21);                 // Set standard 11-bit ID
+    CAN1->sTxMailBox[0].TDTR = f->rdtr & 0x0F;  // DLC only (no TGT, RX filter index/time dropped)
+    CAN1->sTxMailBox[0].TDLR = f->rdlr;         // Data bytes 0-3
+    CAN1->sTxMailBox[0].TDHR = f->rdhr;         // Data bytes 4-7
+    can_tx0_status = 0;                         // Latched by the TX interrupt on completion
+    CAN1->sTxMailBox[0].TIR  = f->rir | (1 << 0);  // ID/IDE/RTR and transmit request
+
+    t0 = Time_Now32();                       // Wait for transmit complete or error
+    if (done_us) {
+        now = t0;
+        prev = now;
+        while (!((CAN1->TSR | can_tx0_status) & ((1 << 0) | (1 << 19) | (1 << 20))) && now - t0 < limit) {
+            prev = now;                      // Completion lies after this read...
+            now = Time_Now32();              // ...and before the poll that follows this one
+        }
+        *done_us = now;
+        *window_us = now - prev;
+    } else {
+        while (!((CAN1->TSR | can_tx0_status) & ((1 << 0)  // RQCP0: Request Completed Mailbox 0
+                                | (1 << 19) 	 // TERR0: Transmission Error
+                                | (1 << 20))) 	 // ALST0: Arbitration Lost
+                   && Time_Now32() - t0 < limit) ;  // Until the wait runs out
     }
+    result = ((CAN1->TSR | can_tx0_status) & (1 << 1)) ? CAN_TX_OK : CAN_TX_FAILED;  // TXOK0: sent and acknowledged
+
+    CAN1->TSR = (1 << 0);                    // RQCP0 (rc_w1, also clears TXOK0/ALST0/TERR0), when
+                                             // called with the TX interrupt masked; a read-modify-write
+                                             // would clear RQCP1 too
+    return result;
+}
+
+/**
+ * @brief  Send a register image using mailbox 0.
+ *
+ * @param[in] f  Frame to send
+ * @retval CAN_TX_OK, CAN_TX_BUS_OFF, CAN_TX_BUSY or CAN_TX_FAILED
+ */
+uint8_t CAN_SendFrame(const CanFrame *f) {
+    return CAN_SendMailbox0(f, NULL, NULL);
+}
+
+/**
+ * @brief  Send a register image using mailbox 0, stamping its completion.
+ *
+ * @param[in]  f          Frame to send
+ * @param[out] done_us    Time_Now32() at completion
+ * @param[out] window_us  Stamp uncertainty in us
+ * @retval CAN_TX_OK, CAN_TX_BUS_OFF, CAN_TX_BUSY or CAN_TX_FAILED
+ */
+uint8_t CAN_SendFrameTimed(const CanFrame *f, uint32_t *done_us, uint32_t *window_us) {
+    return CAN_SendMailbox0(f, done_us, window_us);
+}
 
-    CAN1->sTxMailBox[0].TDTR = len & 0x0F;  // Set data length (DLC) (0-8)
+/**
+ * @brief  Load a register image into mailbox 2, TIR with TXRQ last.
+ *
+ * @param[in] f  Frame to send
+ * @retval None
+ */
+static void CAN_LoadMailbox2(const CanFrame *f) {
+    CAN1->sTxMailBox[2].TDTR = f->rdtr & 0x0F;  // DLC only
+    CAN1->sTxMailBox[2].TDLR = f->rdlr;
+    CAN1->sTxMailBox[2].TDHR = f->rdhr;
+    CAN1->sTxMailBox[2].TIR  = f->rir | (1 << 0);
+}
 
-    CAN1->sTxMailBox[0].TDLR = 0;         // Clear low data register (first 4 bytes)
-    CAN1->sTxMailBox[0].TDHR = 0;         // Clear high data register (next 4 bytes)
+/**
+ * @brief  Move the oldest queued frame into mailbox 2 (TME2 set).
+ *
+ * @retval None
+ */
+static void CAN_TxqNext(void) {
+    CAN_LoadMailbox2(&can_txq[can_txq_head]);
+    can_txq_head = (can_txq_head + 1) % CAN_TXQ_LEN;
+    can_txq_count--;
+}
 
-    for (uint8_t i = 0; i < len && i < 8; i++) {  // Copy data bytes into mailbox registers
-        if (i < 4) {
-            CAN1->sTxMailBox[0].TDLR |= ((uint32_t)data[i] << (8 * i));  // first 4 bytes
-        } else {
-            CAN1->sTxMailBox[0].TDHR |= ((uint32_t)data[i] << (8 * (i - 4))); // next 4 bytes
+/**
+ * @brief  Queue a register image for mailbox 2 (interrupt handlers only).
+ *
+ * @param[in] f  Frame to send
+ * @retval CAN_TX_OK (loaded or queued), CAN_TX_BUS_OFF or CAN_TX_BUSY
+ */
+uint8_t CAN_QueueFrame(const CanFrame *f) {
+    if (CAN1->ESR & (1 << 2)) {               // Bus-off
+        return CAN_TX_BUS_OFF;
+    }
+    if (CAN1->TSR & (1 << 28)) {              // TME2: mailbox 2 idle
+        if (can_txq_count == 0) {
+            CAN_LoadMailbox2(f);              // Four stores, no copy
+            return CAN_TX_OK;
         }
+        CAN_TxqNext();                        // Left idle while Bench_Burst() masked the TX interrupt
     }
+    if (can_txq_count == CAN_TXQ_LEN) {
+        return CAN_TX_BUSY;
+    }
+    can_txq[(can_txq_head + can_txq_count) % CAN_TXQ_LEN] = *f;
+    can_txq_count++;
+    return CAN_TX_OK;
+}
 
-    CAN1->sTxMailBox[0].TIR |= (1 << 0);    // Request transmission
-
-    timeout = 10000;                         // Timeout waiting for transmit complete or error
-    while (!(CAN1->TSR & ((1 << 0)  		 // RQCP0: Request Completed Mailbox 0
-                            | (1 << 19) 	 // TERR0: Transmission Error
-                            | (1 << 20))) 	 // ALST0: Arbitration Lost
-               && timeout--) ;               // Decrement timeout
+/**
+ * @brief  Send one CAN frame using mailbox 0.
+ *
+ * Supports standard (11-bit) and extended (29-bit) IDs.
+ *
+ * @param[in] isExtended  1 if extended ID, 0 if standard ID
+ * @param[in] id          CAN ID (11 or 29 bits)
+ * @param[in] data        Pointer to data bytes (up to 8)
+ * @param[in] len         Number of data bytes (0-8)
+ * @retval CAN_TX_OK, CAN_TX_BUS_OFF, CAN_TX_BUSY or CAN_TX_FAILED
+ */
+uint8_t CAN_Send(uint8_t isExtended, uint32_t id, uint8_t *data, uint8_t len) {
+    CanFrame f;                           // Register image for the mailbox
 
-    CAN1->TSR |= (1 << 0)  // RQCP0
-			  | (1 << 19) // TERR0
-			  | (1 << 20); // ALST0
+    CAN_FramePack(&f, isExtended, id, data, len);
+    return CAN_SendFrame(&f);
 }
 
 /**
  * @brief  Interrupt handler for CAN FIFO 0 receive.
  *
- * - Clears error flags if any.
- * - Reads ID and data from FIFO.
+ * - Clears FIFO full/overrun flags if any.
+ * - Reads the register image from FIFO (four loads, no decoding).
  * - Calls processing function for received frame.
  *
+ * @note  Error warning/passive/bus-off are controller states (read-only in
+ *        ESR), not per-frame errors, so they must not stop the FIFO from
+ *        draining.
+ *
  * @retval None
  */
 void USB_LP_CAN1_RX0_IRQHandler(void) {
-	if (CAN1->ESR & ((1 << 0) | (1 << 1) | (1 << 2))) { // Check CAN errors
-		CAN1->ESR &= ~((1 << 0) | (1 << 1) | (1 << 2));  // Clear error flags
-        return;                                                     // Exit if error present
+	if (CAN1->RF0R & ((1 << 3) | (1 << 4))) {  // FIFO full / overrun flags set
+        if (CAN1->RF0R & (1 << 4)) Fwd_FifoOverrun();  // Frames lost in hardware
+		CAN1->RF0R = (1 << 3) | (1 << 4);       // Clear FULL0, FOVR0 (write 1 to clear)
     }
 
 	if (((CAN1->RF0R >> 0) & 0x03) == 0) return;   // Exit if FIFO0 empty
 
-    uint32_t id = 0;                              // Variable for CAN ID
-    uint8_t isExtended = ((CAN1->sFIFOMailBox[0].RIR >> 2) & 0x01); // Check extended ID
-    uint8_t len = CAN1->sFIFOMailBox[0].RDTR & 0x0F;  // Read data length (DLC)
-    uint8_t data[8];                              // Data array
-
-    if (isExtended)                              // Extended frame
-        id = (CAN1->sFIFOMailBox[0].RIR >> 3); // Read 29-bit ID (shift right by 3)
-    else
-        id = (CAN1->sFIFOMailBox[0].RIR >> 21); // Read 11-bit ID (shift right by 21)
-
-    uint32_t rdlr = CAN1->sFIFOMailBox[0].RDLR; // Read data low register (4 bytes)
-    uint32_t rdhr = CAN1->sFIFOMailBox[0].RDHR; // Read data high register (4 bytes)
-
-    for (uint8_t i = 0; i < len && i < 8; i++) { // Extract each data byte
-        data[i] = (i < 4) ? (rdlr >> (8 * i)) & 0xFF : (rdhr >> (8 * (i - 4))) & 0xFF;
-    }
+    CanFrame frame;                               // Output mailbox as it is
+    frame.rir  = CAN1->sFIFOMailBox[0].RIR;       // ID, IDE, RTR
+    frame.rdtr = CAN1->sFIFOMailBox[0].RDTR;      // DLC
+    frame.rdlr = CAN1->sFIFOMailBox[0].RDLR;      // Data bytes 0-3
+    frame.rdhr = CAN1->sFIFOMailBox[0].RDHR;      // Data bytes 4-7
 
     CAN1->RF0R |= (1 << 5);                // Release FIFO0 (remove read message)
 
-    Process_CAN_Frame(id, isExtended, data, len); // Call function to process received CAN frame
+    Process_CAN_Frame(&frame);             // Call function to process received CAN frame
 }
 
 /**
- * @brief  Process received CAN frame and send raw data via UART.
+ * @brief  Process received CAN frame and queue it for the UART.
  *
- * Data sent over UART format:
- * [isExtended][ID bytes][length][data bytes]
+ * The main loop sends it as a plain record
+ * [isExtended][ID bytes][length][data bytes][seq 2B]
+ * either directly or inside a batch record (see UART_SendRecord()), or as a
+ * compact record when enabled (see forward_handler.h, compact_handler.h).
  *
- * Also sets flag to indicate frame is ready.
+ * Fwd_Push() posts SCHED_EVT_CAN_RX for the scheduler.
+ * The per-ID dispatch table runs first: its handlers (time sync, ping-pong
+ * probe, bootloader enter request) and policies (drop, rate limit) may
+ * take the frame.
  *
- * @param[in] id          CAN ID
- * @param[in] isExtended  1 if extended ID, 0 if standard
- * @param[in] data        Pointer to received data
- * @param[in] len         Number of data bytes
+ * @param[in] frame  Register image read from FIFO 0
  * @retval None
  */
-void Process_CAN_Frame(uint32_t id, uint8_t isExtended, uint8_t *data, uint8_t len) {
-    UART_SendByte(isExtended);                    // Send byte indicating extended or standard ID
-
-    if (isExtended) {                             // If extended ID (4 bytes)
-        UART_SendByte((id >> 24) & 0xFF);        // Send highest byte
-        UART_SendByte((id >> 16) & 0xFF);        // Send second byte
-        UART_SendByte((id >> 8) & 0xFF);         // Send third byte
-        UART_SendByte(id & 0xFF);                 // Send lowest byte
-    } else {                                      // If standard ID (2 bytes)
-        UART_SendByte((id >> 8) & 0xFF);         // Send high byte
-        UART_SendByte(id & 0xFF);                 // Send low byte
-    }
+void Process_CAN_Frame(const CanFrame *frame) {
+    if (IdDisp_Frame(frame)) return;              // Per-ID handler or policy, O(1) lookup
 
-    UART_SendByte(len);                           // Send data length (DLC)
+    Capture_Frame(frame);                         // Triggered capture buffer
+    IdStats_Frame(frame);                         // Per-ID statistics
+    IsoTp_Frame(frame);                           // ISO-TP receiver / flow control
+    Fwd_Push(frame);                              // Queued as is; decoded and sent from the main loop
+}
 
-    for (uint8_t i = 0; i < len; i++) {          // Send each data byte
-        UART_SendByte(data[i]);
+/**
+ * @brief  CAN TX interrupt handler (TMEIE, enabled once by CAN_Config()).
+ *
+ * TMEIE is level-triggered, so every completion is cleared here:
+ * - RQCP0: the status bits are latched for CAN_SendFrame(), which polls them.
+ * - RQCP1: completes the ISO-TP sender's frame.
+ * - RQCP2: the next CAN_QueueFrame() frame goes out, once TME2 shows the
+ *   mailbox was not reloaded by a sender that ran before this handler.
+ * Bench_Burst() masks this interrupt and collects the mailboxes itself.
+ *
+ * @retval None
+ */
+void USB_HP_CAN1_TX_IRQHandler(void) {
+    uint32_t tsr = CAN1->TSR;
+
+    if (tsr & (1 << 0)) {                     // RQCP0
+        can_tx0_status = tsr & 0xFF;          // RQCP0/TXOK0/ALST0/TERR0
+        CAN1->TSR = (1 << 0);                 // Clear them (rc_w1)
+    }
+    if (tsr & (1 << 8)) {                     // RQCP1
+        CAN1->TSR = (1 << 8);                 // Clear RQCP1/TXOK1/ALST1/TERR1 (rc_w1)
+        IsoTp_TxComplete((tsr >> 9) & 1);     // TXOK1
+    }
+    if (tsr & (1 << 16)) {                    // RQCP2
+        CAN1->TSR = (1 << 16);
+        if (can_txq_count && (CAN1->TSR & (1 << 28))) {  // TME2
+            CAN_TxqNext();
+        }
     }
+}
 
-    can_frame_ready = 1;                          // Set flag indicating CAN frame ready for processing
+/**
+ * @brief  CAN status change/error interrupt handler.
+ *
+ * Only raised while the capture error trigger is armed (LECIE/ERRIE):
+ * passes the last error code on and clears ERRI.
+ *
+ * @retval None
+ */
+void CAN1_SCE_IRQHandler(void) {
+    uint8_t lec = (CAN1->ESR >> 4) & 0x07;    // Last error code
+
+    CAN1->MSR = (1 << 2);                     // Clear ERRI (rc_w1)
+    if (lec != 0 && lec != 7) {               // 7 = set by software, no new error
+        Capture_Error(lec);
+    }
 }
 
 /*****************************************************************************
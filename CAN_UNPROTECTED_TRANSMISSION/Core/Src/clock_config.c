@@ -0,0 +1,81 @@
+/*****************************************************************************
+ * @file    clock_config.c
+ * @brief   System clock configuration: HSE + PLL at 72 MHz with HSI fallback
+ *****************************************************************************/
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "clock_config.h"
+
+/*****************************************************************************
+ * @brief  Configures SYSCLK = 72 MHz from the 8 MHz crystal.
+ *
+ * - Starts HSE and waits up to CLOCK_HSE_TIMEOUT polls for HSERDY.
+ * - Sets 2 flash wait states (required above 48 MHz) and the prefetch buffer.
+ * - PLL x9 from HSE, APB1 /2 (max 36 MHz), APB2 /1.
+ * - Switches SYSCLK to the PLL and updates SystemCoreClock.
+ *
+ * @note  Without a crystal the PLL runs from HSI/2 (36 MHz) with APB1 /1,
+ *        so the CAN bit timing computed for PCLK1_HZ remains valid.
+ *
+ * @param None
+ * @retval None
+ *****************************************************************************/
+void Clock_Config(void) {
+    uint32_t timeout = CLOCK_HSE_TIMEOUT;
+    uint32_t cfgr;
+
+    RCC->CR |= (1 << 16);                                   // HSEON: start the crystal oscillator
+    while (!(RCC->CR & (1 << 17)) && --timeout);            // Wait for HSERDY
+
+    FLASH->ACR = (1 << 4) | (2 << 0);                       // Prefetch buffer on, 2 wait states
+
+    if (RCC->CR & (1 << 17)) {
+        cfgr = (7 << 18)                                    // PLLMUL = x9
+             | (1 << 16)                                    // PLLSRC = HSE (no /2)
+             | (0 << 11)                                    // PPRE2 = /1 (72 MHz)
+             | (4 << 8)                                     // PPRE1 = /2 (36 MHz)
+             | (0 << 4);                                    // HPRE  = /1
+    } else {
+        RCC->CR &= ~(1 << 16);                              // Crystal missing: stop HSE
+        cfgr = (7 << 18)                                    // PLLMUL = x9, PLLSRC = HSI/2 -> 36 MHz
+             | (0 << 11)                                    // PPRE2 = /1 (36 MHz)
+             | (0 << 8)                                     // PPRE1 = /1 (36 MHz)
+             | (0 << 4);                                    // HPRE  = /1
+    }
+    RCC->CFGR = cfgr;                                       // SYSCLK still on HSI (SW = 00)
+
+    RCC->CR |= (1 << 24);                                   // PLLON
+    while (!(RCC->CR & (1 << 25)));                         // Wait for PLLRDY
+
+    RCC->CFGR = cfgr | (2 << 0);                            // SW = PLL
+    while (((RCC->CFGR >> 2) & 0x3) != 2);                  // Wait until SWS reports PLL
+
+    SystemCoreClockUpdate();                                // Recompute SystemCoreClock from RCC
+}
+
+/*****************************************************************************
+ * @brief  Returns the APB2 clock derived from SystemCoreClock and PPRE2.
+ *
+ * @retval Clock in Hz
+ *****************************************************************************/
+uint32_t Clock_GetPclk2(void) {
+    return SystemCoreClock >> APBPrescTable[(RCC->CFGR >> 11) & 0x7];
+}
+
+/*****************************************************************************
+ * @brief  Returns the TIM2-TIM4 clock (timers run at 2x PCLK1 when APB1 is
+ *         divided).
+ *
+ * @retval Clock in Hz
+ *****************************************************************************/
+uint32_t Clock_GetTimerClock(void) {
+    uint32_t ppre1 = (RCC->CFGR >> 8) & 0x7;
+    uint32_t pclk1 = SystemCoreClock >> APBPrescTable[ppre1];
+    return (ppre1 < 4) ? pclk1 : pclk1 * 2;
+}
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -0,0 +1,185 @@
+/*****************************************************************************
+ * @file    compact_handler.c
+ * @brief   Compact record encoding: ID dictionary, XOR-delta payload and
+ *          delta timestamp for frames forwarded to the host
+ *****************************************************************************/
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "compact_handler.h" // Compact record encoder declarations
+#include "uart_handler.h"    // UART_SendRecord / UART_SendReply
+#include "timebase_handler.h" // 1 us time base
+#include "forward_handler.h" // Queued frames and sequence numbers
+#include "main.h"            // Common definitions
+
+/*****************************************************************************
+ * Local variables
+ *****************************************************************************/
+
+/**
+ * @brief Dictionary entry: the ID owning the slot and the last payload sent
+ *        for it, mirrored by the host.
+ */
+typedef struct {
+    uint32_t id;            /**< CAN ID                              */
+    uint8_t  ide;           /**< 1 = extended ID                     */
+    uint8_t  valid;         /**< Entry in use                        */
+    uint8_t  last[8];       /**< Last payload forwarded for this ID  */
+} CompactSlot;
+
+static CompactSlot compact_dict[COMPACT_DICT_SIZE];  /**< ID dictionary                 */
+static uint8_t  compact_enabled = 0;        /**< Compact records on/off                      */
+static uint32_t compact_time_ref = 0;       /**< Time base (us) the last delta counts from   */
+static uint16_t compact_seq = 0;            /**< Sequence number the next gap counts from    */
+static uint32_t compact_records = 0;        /**< Records sent                                */
+static uint32_t compact_bytes = 0;          /**< Bytes sent as compact records               */
+static uint32_t compact_plain_bytes = 0;    /**< Bytes the same frames take as plain records */
+
+/*****************************************************************************
+ * Function: Compact_Slot
+ *****************************************************************************/
+
+/**
+ * @brief Folds the ID into a dictionary index (direct-mapped, O(1) per frame).
+ */
+static uint8_t Compact_Slot(uint8_t isExtended, uint32_t id) {
+    uint32_t h = id ^ (id >> 6) ^ (id >> 12) ^ (id >> 18) ^ (id >> 24) ^ ((uint32_t)isExtended << 5);
+    return h & (COMPACT_DICT_SIZE - 1);
+}
+
+/*****************************************************************************
+ * Function: Compact_Enable
+ *****************************************************************************/
+
+/**
+ * @brief Resets the dictionary, time and sequence references and statistics,
+ *        then switches the record format.
+ *
+ * Runs in the main loop like the encoder.
+ */
+void Compact_Enable(uint8_t on) {
+    memset(compact_dict, 0, sizeof(compact_dict));
+    compact_time_ref = Time_Now32();
+    compact_seq = Fwd_NextSeq();
+    compact_records = 0;
+    compact_bytes = 0;
+    compact_plain_bytes = 0;
+    compact_enabled = on ? 1 : 0;
+}
+
+/*****************************************************************************
+ * Function: Compact_IsEnabled
+ *****************************************************************************/
+
+/**
+ * @brief Returns 1 when frames are forwarded as compact records.
+ */
+uint8_t Compact_IsEnabled(void) {
+    return compact_enabled;
+}
+
+/*****************************************************************************
+ * Function: Compact_Forward
+ *****************************************************************************/
+
+/**
+ * @brief Builds the compact record for one frame (see compact_handler.h for the layout)
+ *        and hands it to UART_SendRecord().
+ *
+ * The timestamp delta is the time base difference in microseconds, so the
+ * host's running sum does not drift. Frames received before the reference
+ * was set count as delta 0.
+ */
+void Compact_Forward(const FwdFrame *f) {
+    uint8_t isExtended = CAN_FRAME_IDE(&f->can);
+    uint32_t id = CAN_FRAME_ID(&f->can);
+    const uint8_t *data = CAN_FRAME_DATA(&f->can);         // Bytes read from the image in place
+    uint8_t len = CAN_FRAME_LEN(&f->can);
+    uint8_t slot = Compact_Slot(isExtended, id);
+    CompactSlot *s = &compact_dict[slot];
+    uint8_t rec[COMPACT_REC_MAX];
+    uint8_t n = 0;
+    uint8_t def = !s->valid || s->id != id || s->ide != isExtended;
+    int32_t age = (int32_t)(f->stamp - compact_time_ref);
+    uint32_t delta_us = (age > 0) ? (uint32_t)age : 0;
+    uint32_t v = delta_us;
+
+    rec[n++] = UART_REC_COMPACT;
+    rec[n++] = slot | (isExtended ? COMPACT_FLAG_IDE : 0) | (def ? COMPACT_FLAG_DEF : 0);
+    if (def) {                                              // New entry: ID sent once
+        if (isExtended) {
+            rec[n++] = (id >> 24) & 0xFF;
+            rec[n++] = (id >> 16) & 0xFF;
+        }
+        rec[n++] = (id >> 8) & 0xFF;
+        rec[n++] =  id       & 0xFF;
+    }
+    rec[n++] = len;
+
+    do {                                                    // LEB128: 7 bits per byte
+        rec[n++] = (v & 0x7F) | ((v >> 7) ? 0x80 : 0);
+        v >>= 7;
+    } while (v);
+
+    v = (uint16_t)(f->seq - compact_seq);                   // Frames lost since the last record
+    do {
+        rec[n++] = (v & 0x7F) | ((v >> 7) ? 0x80 : 0);
+        v >>= 7;
+    } while (v);
+
+    if (len) {
+        uint8_t mask_pos = n++;
+        uint8_t mask = 0;
+        for (uint8_t i = 0; i < len; i++) {
+            uint8_t x = data[i] ^ (def ? 0 : s->last[i]);  // XOR delta against the mirror
+            if (x) {
+                mask |= (1 << i);
+                rec[n++] = x;
+            }
+        }
+        rec[mask_pos] = mask;
+    }
+
+    UART_SendRecord(rec, n);
+
+    if (def) {
+        s->id = id;
+        s->ide = isExtended;
+        s->valid = 1;
+        memset(s->last, 0, sizeof(s->last));
+    }
+    memcpy(s->last, data, len);
+    compact_time_ref += delta_us;
+    compact_seq = f->seq + 1;
+
+    compact_records++;
+    compact_bytes += n;
+    compact_plain_bytes += (isExtended ? 8 : 6) + len;      // [IDE][ID][len][data][seq]
+}
+
+/*****************************************************************************
+ * Function: Compact_Command
+ *****************************************************************************/
+
+/**
+ * @brief Enables/disables compact records and replies with the statistics.
+ */
+void Compact_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[14];
+
+    if (len >= 1) {
+        Compact_Enable(args[0]);
+    }
+
+    reply[0] = compact_enabled;
+    reply[1] = COMPACT_DICT_SIZE;
+    UART_PutU32(&reply[2], compact_records);
+    UART_PutU32(&reply[6], compact_bytes);
+    UART_PutU32(&reply[10], compact_plain_bytes);
+    UART_SendReply(UART_CMD_COMPACT, reply, sizeof(reply));
+}
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -0,0 +1,409 @@
+/*****************************************************************************
+ * @file    crc_handler.c
+ * @brief   CRC-32 on the CRC unit (CPU or DMA feeding) and the table-driven
+ *          software fallback
+ *****************************************************************************/
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "crc_handler.h"     // CRC service declarations
+#include "uart_handler.h"    // UART_PutU32 / UART_SendReply
+#include "bench_handler.h"   // DWT cycle counter
+#include "main.h"            // Common definitions
+
+/*****************************************************************************
+ * Local variables
+ *****************************************************************************/
+
+/**
+ * @brief CRC of each byte value shifted to the top of the register
+ *        (polynomial CRC_POLY, MSB first), kept in flash.
+ */
+static const uint32_t crc_table[256] = {
+    0x00000000UL, 0x04C11DB7UL, 0x09823B6EUL, 0x0D4326D9UL,
+    0x130476DCUL, 0x17C56B6BUL, 0x1A864DB2UL, 0x1E475005UL,
+    0x2608EDB8UL, 0x22C9F00FUL, 0x2F8AD6D6UL, 0x2B4BCB61UL,
+    0x350C9B64UL, 0x31CD86D3UL, 0x3C8EA00AUL, 0x384FBDBDUL,
+    0x4C11DB70UL, 0x48D0C6C7UL, 0x4593E01EUL, 0x4152FDA9UL,
+    0x5F15ADACUL, 0x5BD4B01BUL, 0x569796C2UL, 0x52568B75UL,
+    0x6A1936C8UL, 0x6ED82B7FUL, 0x639B0DA6UL, 0x675A1011UL,
+    0x791D4014UL, 0x7DDC5DA3UL, 0x709F7B7AUL, 0x745E66CDUL,
+    0x9823B6E0UL, 0x9CE2AB57UL, 0x91A18D8EUL, 0x95609039UL,
+    0x8B27C03CUL, 0x8FE6DD8BUL, 0x82A5FB52UL, 0x8664E6E5UL,
+    0xBE2B5B58UL, 0xBAEA46EFUL, 0xB7A96036UL, 0xB3687D81UL,
+    0xAD2F2D84UL, 0xA9EE3033UL, 0xA4AD16EAUL, 0xA06C0B5DUL,
+    0xD4326D90UL, 0xD0F37027UL, 0xDDB056FEUL, 0xD9714B49UL,
+    0xC7361B4CUL, 0xC3F706FBUL, 0xCEB42022UL, 0xCA753D95UL,
+    0xF23A8028UL, 0xF6FB9D9FUL, 0xFBB8BB46UL, 0xFF79A6F1UL,
+    0xE13EF6F4UL, 0xE5FFEB43UL, 0xE8BCCD9AUL, 0xEC7DD02DUL,
+    0x34867077UL, 0x30476DC0UL, 0x3D044B19UL, 0x39C556AEUL,
+    0x278206ABUL, 0x23431B1CUL, 0x2E003DC5UL, 0x2AC12072UL,
+    0x128E9DCFUL, 0x164F8078UL, 0x1B0CA6A1UL, 0x1FCDBB16UL,
+    0x018AEB13UL, 0x054BF6A4UL, 0x0808D07DUL, 0x0CC9CDCAUL,
+    0x7897AB07UL, 0x7C56B6B0UL, 0x71159069UL, 0x75D48DDEUL,
+    0x6B93DDDBUL, 0x6F52C06CUL, 0x6211E6B5UL, 0x66D0FB02UL,
+    0x5E9F46BFUL, 0x5A5E5B08UL, 0x571D7DD1UL, 0x53DC6066UL,
+    0x4D9B3063UL, 0x495A2DD4UL, 0x44190B0DUL, 0x40D816BAUL,
+    0xACA5C697UL, 0xA864DB20UL, 0xA527FDF9UL, 0xA1E6E04EUL,
+    0xBFA1B04BUL, 0xBB60ADFCUL, 0xB6238B25UL, 0xB2E29692UL,
+    0x8AAD2B2FUL, 0x8E6C3698UL, 0x832F1041UL, 0x87EE0DF6UL,
+    0x99A95DF3UL, 0x9D684044UL, 0x902B669DUL, 0x94EA7B2AUL,
+    0xE0B41DE7UL, 0xE4750050UL, 0xE9362689UL, 0xEDF73B3EUL,
+    0xF3B06B3BUL, 0xF771768CUL, 0xFA325055UL, 0xFEF34DE2UL,
+    0xC6BCF05FUL, 0xC27DEDE8UL, 0xCF3ECB31UL, 0xCBFFD686UL,
+    0xD5B88683UL, 0xD1799B34UL, 0xDC3ABDEDUL, 0xD8FBA05AUL,
+    0x690CE0EEUL, 0x6DCDFD59UL, 0x608EDB80UL, 0x644FC637UL,
+    0x7A089632UL, 0x7EC98B85UL, 0x738AAD5CUL, 0x774BB0EBUL,
+    0x4F040D56UL, 0x4BC510E1UL, 0x46863638UL, 0x42472B8FUL,
+    0x5C007B8AUL, 0x58C1663DUL, 0x558240E4UL, 0x51435D53UL,
+    0x251D3B9EUL, 0x21DC2629UL, 0x2C9F00F0UL, 0x285E1D47UL,
+    0x36194D42UL, 0x32D850F5UL, 0x3F9B762CUL, 0x3B5A6B9BUL,
+    0x0315D626UL, 0x07D4CB91UL, 0x0A97ED48UL, 0x0E56F0FFUL,
+    0x1011A0FAUL, 0x14D0BD4DUL, 0x19939B94UL, 0x1D528623UL,
+    0xF12F560EUL, 0xF5EE4BB9UL, 0xF8AD6D60UL, 0xFC6C70D7UL,
+    0xE22B20D2UL, 0xE6EA3D65UL, 0xEBA91BBCUL, 0xEF68060BUL,
+    0xD727BBB6UL, 0xD3E6A601UL, 0xDEA580D8UL, 0xDA649D6FUL,
+    0xC423CD6AUL, 0xC0E2D0DDUL, 0xCDA1F604UL, 0xC960EBB3UL,
+    0xBD3E8D7EUL, 0xB9FF90C9UL, 0xB4BCB610UL, 0xB07DABA7UL,
+    0xAE3AFBA2UL, 0xAAFBE615UL, 0xA7B8C0CCUL, 0xA379DD7BUL,
+    0x9B3660C6UL, 0x9FF77D71UL, 0x92B45BA8UL, 0x9675461FUL,
+    0x8832161AUL, 0x8CF30BADUL, 0x81B02D74UL, 0x857130C3UL,
+    0x5D8A9099UL, 0x594B8D2EUL, 0x5408ABF7UL, 0x50C9B640UL,
+    0x4E8EE645UL, 0x4A4FFBF2UL, 0x470CDD2BUL, 0x43CDC09CUL,
+    0x7B827D21UL, 0x7F436096UL, 0x7200464FUL, 0x76C15BF8UL,
+    0x68860BFDUL, 0x6C47164AUL, 0x61043093UL, 0x65C52D24UL,
+    0x119B4BE9UL, 0x155A565EUL, 0x18197087UL, 0x1CD86D30UL,
+    0x029F3D35UL, 0x065E2082UL, 0x0B1D065BUL, 0x0FDC1BECUL,
+    0x3793A651UL, 0x3352BBE6UL, 0x3E119D3FUL, 0x3AD08088UL,
+    0x2497D08DUL, 0x2056CD3AUL, 0x2D15EBE3UL, 0x29D4F654UL,
+    0xC5A92679UL, 0xC1683BCEUL, 0xCC2B1D17UL, 0xC8EA00A0UL,
+    0xD6AD50A5UL, 0xD26C4D12UL, 0xDF2F6BCBUL, 0xDBEE767CUL,
+    0xE3A1CBC1UL, 0xE760D676UL, 0xEA23F0AFUL, 0xEEE2ED18UL,
+    0xF0A5BD1DUL, 0xF464A0AAUL, 0xF9278673UL, 0xFDE69BC4UL,
+    0x89B8FD09UL, 0x8D79E0BEUL, 0x803AC667UL, 0x84FBDBD0UL,
+    0x9ABC8BD5UL, 0x9E7D9662UL, 0x933EB0BBUL, 0x97FFAD0CUL,
+    0xAFB010B1UL, 0xAB710D06UL, 0xA6322BDFUL, 0xA2F33668UL,
+    0xBCB4666DUL, 0xB8757BDAUL, 0xB5365D03UL, 0xB1F740B4UL
+};
+
+static uint8_t  crc_records = 0;            /**< Append a CRC to UART records   */
+static uint32_t crc_records_sent = 0;       /**< Records (or batches) with a CRC */
+
+/*****************************************************************************
+ * Function: Crc_Tail
+ *****************************************************************************/
+
+/**
+ * @brief Pack the last 1-3 bytes of a buffer into a zero-padded word.
+ */
+static uint32_t Crc_Tail(const uint8_t *p, uint8_t n) {
+    uint32_t w = 0;
+
+    for (uint8_t i = 0; i < n; i++) {
+        w |= (uint32_t)p[i] << (8 * i);
+    }
+    return w;
+}
+
+/*****************************************************************************
+ * Function: Crc_PayloadWords
+ *****************************************************************************/
+
+/**
+ * @brief Data words of a frame with the bytes past len cleared (the RX
+ *        FIFO leaves stale bytes there).
+ */
+static void Crc_PayloadWords(const CanFrame *frame, uint8_t len, uint32_t *lo, uint32_t *hi) {
+    *lo = (len >= 4) ? frame->rdlr : frame->rdlr & ((1UL << (8 * len)) - 1);
+    *hi = (len >= 8) ? frame->rdhr :
+          (len <= 4) ? 0 : frame->rdhr & ((1UL << (8 * (len - 4))) - 1);
+}
+
+/*****************************************************************************
+ * Function: Crc_SoftWord
+ *****************************************************************************/
+
+/**
+ * @brief Table-driven CRC step over one word, most significant byte first
+ *        as the unit processes it.
+ */
+static uint32_t Crc_SoftWord(uint32_t crc, uint32_t w) {
+    crc = (crc << 8) ^ crc_table[((crc >> 24) ^ (w >> 24)) & 0xFF];
+    crc = (crc << 8) ^ crc_table[((crc >> 24) ^ (w >> 16)) & 0xFF];
+    crc = (crc << 8) ^ crc_table[((crc >> 24) ^ (w >>  8)) & 0xFF];
+    crc = (crc << 8) ^ crc_table[((crc >> 24) ^  w       ) & 0xFF];
+    return crc;
+}
+
+/*****************************************************************************
+ * Function: Crc_SoftBuffer
+ *****************************************************************************/
+
+/**
+ * @brief Software CRC of a byte buffer, same result as Crc_Buffer().
+ */
+uint32_t Crc_SoftBuffer(const void *buf, uint16_t len) {
+    const uint8_t *p = buf;
+    uint32_t crc = CRC_INIT;
+    uint32_t w;
+
+    for (uint16_t i = 0; i < len / 4; i++) {
+        memcpy(&w, &p[4 * i], 4);
+        crc = Crc_SoftWord(crc, w);
+    }
+    if (len & 3) {
+        crc = Crc_SoftWord(crc, Crc_Tail(&p[len & ~3], len & 3));
+    }
+    return crc;
+}
+
+/*****************************************************************************
+ * Function: Crc_SoftPayload
+ *****************************************************************************/
+
+/**
+ * @brief Software payload fingerprint, same result as Crc_Payload().
+ */
+uint32_t Crc_SoftPayload(const CanFrame *frame, uint8_t len) {
+    uint32_t lo, hi;
+
+    Crc_PayloadWords(frame, len, &lo, &hi);
+    return Crc_SoftWord(Crc_SoftWord(Crc_SoftWord(CRC_INIT, lo), hi), len);
+}
+
+#ifdef CRC_SOFTWARE
+
+/*****************************************************************************
+ * Function: Crc_HwBuffer
+ *****************************************************************************/
+
+/**
+ * @brief Host build: no CRC unit, the table does the work.
+ */
+static uint32_t Crc_HwBuffer(const uint8_t *p, uint16_t len, uint8_t dma) {
+    (void)dma;
+    return Crc_SoftBuffer(p, len);
+}
+
+void Crc_Init(void) {
+}
+
+uint32_t Crc_Payload(const CanFrame *frame, uint8_t len) {
+    return Crc_SoftPayload(frame, len);
+}
+
+#else
+
+/*****************************************************************************
+ * Function: Crc_Init
+ *****************************************************************************/
+
+/**
+ * @brief Enable the CRC unit and DMA1 on the AHB.
+ */
+void Crc_Init(void) {
+    RCC->AHBENR |= (1 << 6)     // CRCEN
+                 | (1 << 0);    // DMA1EN
+}
+
+/*****************************************************************************
+ * Function: Crc_Dma
+ *****************************************************************************/
+
+/**
+ * @brief Feed words to CRC->DR with DMA1 channel 1 (memory-to-memory, 32-bit
+ *        on both sides) and wait for the transfer to complete.
+ */
+static void Crc_Dma(const uint8_t *p, uint16_t words) {
+    DMA1_Channel1->CCR   = 0;
+    DMA1_Channel1->CPAR  = (uint32_t)&CRC->DR;
+    DMA1_Channel1->CMAR  = (uint32_t)p;
+    DMA1_Channel1->CNDTR = words;
+    DMA1_Channel1->CCR   = (1 << 14)    // MEM2MEM
+                         | (2 << 10)    // MSIZE = 32 bit
+                         | (2 << 8)     // PSIZE = 32 bit
+                         | (1 << 7)     // MINC
+                         | (1 << 4)     // DIR: memory -> CRC->DR
+                         | (1 << 0);    // EN
+    while (!(DMA1->ISR & (1 << 1)));   // TCIF1
+    DMA1->IFCR = (1 << 0);              // CGIF1: clear all channel 1 flags
+    DMA1_Channel1->CCR = 0;
+}
+
+/*****************************************************************************
+ * Function: Crc_HwBuffer
+ *****************************************************************************/
+
+/**
+ * @brief CRC of a buffer on the unit, the words fed by DMA or by the CPU.
+ *
+ * The CAN RX interrupt is masked while the unit holds the partial result.
+ */
+static uint32_t Crc_HwBuffer(const uint8_t *p, uint16_t len, uint8_t dma) {
+    uint16_t words = len / 4;
+    uint32_t crc, w;
+
+    NVIC_DisableIRQ(CAN1_RX0_IRQn);
+    CRC->CR = 1;                                // RESET: DR = CRC_INIT
+    if (dma && words) {
+        Crc_Dma(p, words);
+    } else {
+        for (uint16_t i = 0; i < words; i++) {
+            memcpy(&w, &p[4 * i], 4);
+            CRC->DR = w;
+        }
+    }
+    if (len & 3) {
+        CRC->DR = Crc_Tail(&p[len & ~3], len & 3);
+    }
+    crc = CRC->DR;
+    NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    return crc;
+}
+
+/*****************************************************************************
+ * Function: Crc_Payload
+ *****************************************************************************/
+
+/**
+ * @brief Payload fingerprint on the unit: reset and three word writes.
+ */
+uint32_t Crc_Payload(const CanFrame *frame, uint8_t len) {
+    uint32_t lo, hi;
+
+    Crc_PayloadWords(frame, len, &lo, &hi);
+    CRC->CR = 1;
+    CRC->DR = lo;
+    CRC->DR = hi;
+    CRC->DR = len;
+    return CRC->DR;
+}
+
+#endif /* CRC_SOFTWARE */
+
+/*****************************************************************************
+ * Function: Crc_Buffer
+ *****************************************************************************/
+
+/**
+ * @brief DMA for word-aligned buffers of CRC_DMA_MIN_WORDS or more, CPU
+ *        word writes otherwise.
+ */
+uint32_t Crc_Buffer(const void *buf, uint16_t len) {
+    uint8_t dma = (len / 4 >= CRC_DMA_MIN_WORDS) && (((uint32_t)buf & 3) == 0);
+
+    return Crc_HwBuffer(buf, len, dma);
+}
+
+/*****************************************************************************
+ * Function: Crc_Record
+ *****************************************************************************/
+
+/**
+ * @brief Counts the record and returns its CRC.
+ */
+uint32_t Crc_Record(const uint8_t *buf, uint16_t len) {
+    crc_records_sent++;
+    return Crc_Buffer(buf, len);
+}
+
+/*****************************************************************************
+ * Function: Crc_RecordsEnabled
+ *****************************************************************************/
+
+/**
+ * @brief Report whether UART records carry a CRC.
+ */
+uint8_t Crc_RecordsEnabled(void) {
+    return crc_records;
+}
+
+/*****************************************************************************
+ * Function: Crc_Bench
+ *****************************************************************************/
+
+/**
+ * @brief Time the payload fingerprint and a flash buffer on every path.
+ *
+ * The fingerprint loops run with the CAN RX interrupt masked, since that
+ * interrupt uses the unit too. The payload varies per frame so every
+ * result is computed.
+ */
+static void Crc_Bench(uint16_t frames) {
+    uint8_t reply[30];
+    const uint8_t *flash = (const uint8_t *)FLASH_BASE;
+    CanFrame f = { 0x123UL << 21, 8, 0, 0x55AA55AAUL };
+    uint32_t acc_hw = 0, acc_sw = 0;
+    uint32_t t, hw, sw, dma, cpu, soft;
+    uint32_t c_dma, c_cpu, c_soft;
+
+    NVIC_DisableIRQ(CAN1_RX0_IRQn);
+    t = Bench_Cycles();
+    for (uint16_t i = 0; i < frames; i++) {
+        f.rdlr = i;
+        acc_hw ^= Crc_Payload(&f, 8);
+    }
+    hw = Bench_Cycles() - t;
+
+    t = Bench_Cycles();
+    for (uint16_t i = 0; i < frames; i++) {
+        f.rdlr = i;
+        acc_sw ^= Crc_SoftPayload(&f, 8);
+    }
+    sw = Bench_Cycles() - t;
+    NVIC_EnableIRQ(CAN1_RX0_IRQn);
+
+    t = Bench_Cycles();
+    c_dma = Crc_HwBuffer(flash, CRC_BENCH_BYTES, 1);
+    dma = Bench_Cycles() - t;
+    t = Bench_Cycles();
+    c_cpu = Crc_HwBuffer(flash, CRC_BENCH_BYTES, 0);
+    cpu = Bench_Cycles() - t;
+    t = Bench_Cycles();
+    c_soft = Crc_SoftBuffer(flash, CRC_BENCH_BYTES);
+    soft = Bench_Cycles() - t;
+
+    reply[0] = CRC_OP_BENCH;
+    reply[1] = frames >> 8;
+    reply[2] = frames & 0xFF;
+    UART_PutU32(&reply[3], hw);
+    UART_PutU32(&reply[7], sw);
+    reply[11] = CRC_BENCH_BYTES >> 8;
+    reply[12] = CRC_BENCH_BYTES & 0xFF;
+    UART_PutU32(&reply[13], dma);
+    UART_PutU32(&reply[17], cpu);
+    UART_PutU32(&reply[21], soft);
+    UART_PutU32(&reply[25], c_dma);
+    reply[29] = (acc_hw == acc_sw && c_dma == c_cpu && c_cpu == c_soft);
+    UART_SendReply(UART_CMD_CRC, reply, sizeof(reply));
+}
+
+/*****************************************************************************
+ * Function: Crc_Command
+ *****************************************************************************/
+
+/**
+ * @brief Switches record CRCs, runs the benchmark or reports the state.
+ */
+void Crc_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[6];
+
+    if (len >= 1 && args[0] == CRC_OP_BENCH) {
+        uint16_t frames = (len >= 3) ? (args[1] << 8) | args[2] : 1000;
+        Crc_Bench(frames ? frames : 1);
+        return;
+    }
+    if (len >= 2 && args[0] == CRC_OP_RECORDS) {
+        crc_records = args[1] ? 1 : 0;
+    }
+
+    reply[0] = CRC_OP_STATUS;
+    reply[1] = crc_records;
+    UART_PutU32(&reply[2], crc_records_sent);
+    UART_SendReply(UART_CMD_CRC, reply, sizeof(reply));
+}
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -0,0 +1,186 @@
+/*****************************************************************************
+ * @file    iddisp_handler.c
+ * @brief   Per-ID dispatch table: configuration, compile-time perfect hash
+ *          and the RX interrupt lookup
+ *****************************************************************************/
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "iddisp_handler.h"  // Per-ID dispatch declarations
+#include "bench_handler.h"   // Ping-pong / self-test handlers, cycle counter
+#include "tsync_handler.h"   // Time sync handler
+#include "boot_handler.h"    // Bootloader enter request
+#include "timebase_handler.h" // 1 us time base
+#include "uart_handler.h"    // UART_PutU32 / UART_SendReply
+#include "main.h"            // Common definitions
+
+/*****************************************************************************
+ * Dispatch configuration
+ *****************************************************************************/
+
+/**
+ * @brief One line per ID: X(key, policy, handler, gap ms).
+ *
+ * The handler (0 for none) is called with the frame and returns 1 when it
+ * has taken it, 0 to continue with the policy. gap is the minimum spacing
+ * of an IDDISP_RATE entry. For example
+ *   X(IDDISP_STD(0x321), IDDISP_RATE, 0, 10)        0x321 at most every 10 ms
+ *   X(IDDISP_EXT(0x18FEF100), IDDISP_DROP, 0, 0)    never forwarded
+ * The ISO-TP receiver is not listed: its ID is set at run time, and it
+ * checks the ID itself on the forwarding path.
+ */
+#define IDDISP_TABLE(X) \
+    X(IDDISP_STD(TSYNC_CAN_ID),      IDDISP_FORWARD, Tsync_Frame,      0)  /* SYNC/FUP while time sync is on */ \
+    X(IDDISP_STD(BENCH_PING_ID),     IDDISP_FORWARD, Bench_PingRx,     0)  /* Probe to echo                  */ \
+    X(IDDISP_STD(BENCH_PONG_ID),     IDDISP_FORWARD, Bench_PingRx,     0)  /* Echo of our probe              */ \
+    X(IDDISP_STD(BENCH_SELFTEST_ID), IDDISP_FORWARD, Bench_SelfTestRx, 0)  /* Counted by the self-test       */ \
+    X(IDDISP_STD(BOOT_CAN_RX_ID),    IDDISP_FORWARD, Boot_Frame,       0)  /* Bootloader enter request       */
+
+/*****************************************************************************
+ * Generated table
+ *****************************************************************************/
+
+/**
+ * @brief Table entry, 12 bytes in flash.
+ */
+typedef struct {
+    uint32_t key;                               /**< IDDISP_STD/EXT(), 0 = empty slot */
+    uint8_t (*handler)(const CanFrame *frame);  /**< Runs first; 1 = frame taken      */
+    uint8_t  policy;                            /**< IDDISP_xxx                        */
+    uint16_t gap_ms;                            /**< IDDISP_RATE: minimum spacing      */
+} IdDispEntry;
+
+#define IDDISP_GEN_SLOT(key, policy, handler, gap)  [IDDISP_HASH(key)] = { (key), (handler), (policy), (gap) },
+#define IDDISP_GEN_KEY(key, policy, handler, gap)   (key),
+#define IDDISP_GEN_ONE(key, policy, handler, gap)   + 1
+#define IDDISP_GEN_SUM(key, policy, handler, gap)   + (1ULL << IDDISP_HASH(key))
+#define IDDISP_GEN_OR(key, policy, handler, gap)    | (1ULL << IDDISP_HASH(key))
+
+#define IDDISP_ENTRIES          (0 IDDISP_TABLE(IDDISP_GEN_ONE))
+
+/* The slot bits of all keys add up to their union only if no two share a slot */
+_Static_assert(IDDISP_SLOT_BITS <= 6, "slot check uses a 64-bit map");
+_Static_assert(IDDISP_ENTRIES <= IDDISP_SLOTS, "more IDs than slots: raise IDDISP_SLOT_BITS");
+_Static_assert((0 IDDISP_TABLE(IDDISP_GEN_SUM)) == (0 IDDISP_TABLE(IDDISP_GEN_OR)),
+               "two IDs share a slot: change IDDISP_MULT or raise IDDISP_SLOT_BITS");
+_Static_assert(IDDISP_DEFAULT_POLICY != IDDISP_RATE, "rate state exists only for table slots");
+
+static const IdDispEntry iddisp_table[IDDISP_SLOTS] = { IDDISP_TABLE(IDDISP_GEN_SLOT) };
+static const uint32_t iddisp_keys[] = { IDDISP_TABLE(IDDISP_GEN_KEY) };
+static const IdDispEntry iddisp_default = { 0, 0, IDDISP_DEFAULT_POLICY, 0 };
+
+/*****************************************************************************
+ * Local variables
+ *****************************************************************************/
+
+static uint32_t iddisp_last[IDDISP_SLOTS];      /**< IDDISP_RATE: Time_Now32() of the last forwarded frame */
+static uint8_t  iddisp_seen[IDDISP_SLOTS];      /**< IDDISP_RATE: iddisp_last is valid */
+static uint32_t iddisp_handled = 0;             /**< Frames taken by a handler        */
+static uint32_t iddisp_dropped = 0;             /**< Frames of IDDISP_DROP entries    */
+static uint32_t iddisp_limited = 0;             /**< Frames discarded by IDDISP_RATE  */
+
+/*****************************************************************************
+ * Function: IdDisp_Lookup
+ *****************************************************************************/
+
+/**
+ * @brief Entry of a key, or the default entry: one probe, no search.
+ */
+static const IdDispEntry *IdDisp_Lookup(uint32_t key) {
+    const IdDispEntry *e = &iddisp_table[IDDISP_HASH(key)];
+
+    return (e->key == key) ? e : &iddisp_default;
+}
+
+/*****************************************************************************
+ * Function: IdDisp_Frame
+ *****************************************************************************/
+
+/**
+ * @brief Run the entry's handler, then its policy.
+ */
+uint8_t IdDisp_Frame(const CanFrame *frame) {
+    uint32_t mask = CAN_FRAME_IDE(frame) ? 0xFFFFFFFCUL : 0xFFE00004UL;
+    const IdDispEntry *e = IdDisp_Lookup((frame->rir & mask) | 1);
+    uint32_t now, slot;
+
+    if (e->handler && e->handler(frame)) {
+        iddisp_handled++;
+        return 1;
+    }
+    if (e->policy == IDDISP_DROP) {
+        iddisp_dropped++;
+        return 1;
+    }
+    if (e->policy == IDDISP_RATE) {
+        slot = e - iddisp_table;
+        now = Time_Now32();
+        if (iddisp_seen[slot] && now - iddisp_last[slot] < e->gap_ms * 1000UL) {
+            iddisp_limited++;
+            return 1;
+        }
+        iddisp_last[slot] = now;
+        iddisp_seen[slot] = 1;                  // First frame always passes
+    }
+    return 0;
+}
+
+/*****************************************************************************
+ * Function: IdDisp_Command
+ *****************************************************************************/
+
+/**
+ * @brief Report the table layout and counters, timing the lookup of every
+ *        configured key and of IDDISP_BENCH_MISSES others.
+ */
+void IdDisp_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[32];
+    const IdDispEntry *volatile hit;            // Keeps the timed lookup
+    uint32_t t, overhead, cycles, key;
+    uint32_t min = 0xFFFFFFFFUL, max = 0;
+    uint16_t n;
+
+    __disable_irq();
+    t = Bench_Cycles();
+    overhead = Bench_Cycles() - t;
+    __enable_irq();
+
+    for (n = 0; n < IDDISP_ENTRIES + IDDISP_BENCH_MISSES; n++) {
+        key = (n < IDDISP_ENTRIES) ? iddisp_keys[n] : IDDISP_EXT(n);
+        __disable_irq();
+        t = Bench_Cycles();
+        hit = IdDisp_Lookup(key);
+        cycles = Bench_Cycles() - t - overhead;
+        __enable_irq();
+        if (cycles < min) min = cycles;
+        if (cycles > max) max = cycles;
+    }
+    (void)hit;
+
+    reply[0] = (len >= 1) ? args[0] : IDDISP_OP_STATUS;
+    reply[1] = IDDISP_ENTRIES;
+    reply[2] = IDDISP_SLOTS;
+    reply[3] = sizeof(IdDispEntry);
+    reply[4] = sizeof(iddisp_table) >> 8;
+    reply[5] = sizeof(iddisp_table) & 0xFF;
+    UART_PutU32(&reply[6],  IDDISP_MULT);
+    UART_PutU32(&reply[10], iddisp_handled);
+    UART_PutU32(&reply[14], iddisp_dropped);
+    UART_PutU32(&reply[18], iddisp_limited);
+    UART_PutU32(&reply[22], min);
+    UART_PutU32(&reply[26], max);
+    reply[30] = n >> 8;
+    reply[31] = n & 0xFF;
+    UART_SendReply(UART_CMD_IDDISP, reply, sizeof(reply));
+
+    if (len >= 1 && args[0] == IDDISP_OP_CLEAR) {
+        iddisp_handled = 0;
+        iddisp_dropped = 0;
+        iddisp_limited = 0;
+    }
+}
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
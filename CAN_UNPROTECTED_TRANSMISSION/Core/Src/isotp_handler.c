@@ -0,0 +1,681 @@
+/*****************************************************************************
+ * @file    isotp_handler.c
+ * @brief   ISO-TP sender and receiver: single/first/consecutive frames and
+ *          flow control, paced by the TX-complete interrupt and STmin
+ *****************************************************************************/
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "isotp_handler.h"    // ISO-TP declarations
+#include "uart_handler.h"     // UART_PutU32 / UART_SendReply
+#include "timebase_handler.h" // 1 us time base, TIM3_DIER_BB
+#include "main.h"             // Common definitions
+
+/*****************************************************************************
+ * Local types and variables
+ *****************************************************************************/
+
+/**
+ * @brief N_PCI types (high nibble of the first data byte).
+ */
+#define ISOTP_PCI_SF            0x0     /**< Single frame                     */
+#define ISOTP_PCI_FF            0x1     /**< First frame                      */
+#define ISOTP_PCI_CF            0x2     /**< Consecutive frame                */
+#define ISOTP_PCI_FC            0x3     /**< Flow control                     */
+
+#define ISOTP_FS_CTS            0       /**< Flow status: continue to send    */
+#define ISOTP_FS_WAIT           1
+#define ISOTP_FS_OVFLW          2
+
+/**
+ * @brief Sender state; owned by the CAN TX, CAN RX and TIM3 interrupts once
+ *        started (all at the same priority).
+ */
+typedef struct {
+    volatile uint8_t state;
+    uint8_t  result;
+    uint8_t  bench;         /**< Payload generated instead of isotp_buf   */
+    uint8_t  await_fc;      /**< Frame in the mailbox ends a block        */
+    uint8_t  sn;            /**< Next sequence number                     */
+    uint8_t  bs;            /**< Block size of the last flow control      */
+    uint8_t  stmin;         /**< STmin byte of the last flow control      */
+    uint8_t  block;         /**< Consecutive frames sent in this block    */
+    uint16_t len;
+    uint16_t offset;        /**< Payload bytes handed to the mailbox      */
+    uint16_t frames;
+    uint16_t fc;            /**< Flow controls received                   */
+    uint16_t waits;         /**< Of those, WAIT                           */
+    uint32_t stmin_us;
+    uint32_t deadline;      /**< Earliest start of the next frame         */
+    uint32_t start;         /**< First frame handed to the mailbox        */
+    uint32_t end;           /**< Last completion (or FC wait start)       */
+    uint32_t hash;
+} IsoTpTx;
+
+/**
+ * @brief Receiver state; owned by the CAN RX interrupt.
+ */
+typedef struct {
+    uint8_t  state;
+    uint8_t  result;
+    uint8_t  sn;            /**< Expected sequence number                 */
+    uint8_t  block;         /**< Consecutive frames since our flow control */
+    uint16_t len;
+    uint16_t received;
+    uint16_t frames;
+    uint16_t sn_errors;
+    uint32_t start;
+    uint32_t last;          /**< Latest frame of the transfer             */
+    uint32_t hash;
+    uint32_t transfers;     /**< Completed transfers                      */
+} IsoTpRx;
+
+static uint8_t  isotp_buf[ISOTP_BUF_LEN];       /**< Host payload                     */
+static IsoTpTx  isotp_tx;
+static IsoTpRx  isotp_rx;
+static uint8_t  isotp_ide = 0;                  /**< Addressing: 1 = extended IDs     */
+static uint32_t isotp_tx_id = ISOTP_DEFAULT_ID; /**< Our frames and flow control      */
+static uint32_t isotp_rx_id = ISOTP_DEFAULT_ID; /**< Peer's frames and flow control   */
+static uint32_t isotp_rx_mask = 0;              /**< RIR bits compared for RX ID      */
+static uint32_t isotp_rx_match = 0;
+static uint8_t  isotp_bs = 0;                   /**< Our flow control: block size     */
+static uint8_t  isotp_stmin = 0;                /**< Our flow control: STmin byte     */
+
+/*****************************************************************************
+ * Function: IsoTp_Hash
+ *****************************************************************************/
+
+/**
+ * @brief Continue an FNV-1a hash over more payload bytes.
+ */
+static uint32_t IsoTp_Hash(uint32_t h, const uint8_t *data, uint8_t n) {
+    for (uint8_t i = 0; i < n; i++) {
+        h = (h ^ data[i]) * 16777619UL;
+    }
+    return h;
+}
+
+/*****************************************************************************
+ * Function: IsoTp_StMinUs
+ *****************************************************************************/
+
+/**
+ * @brief Decode an STmin byte: 0-127 ms, 0xF1-0xF9 100-900 us.
+ *
+ * Reserved values are treated as the longest time, as the standard asks.
+ */
+static uint32_t IsoTp_StMinUs(uint8_t st) {
+    if (st <= 0x7F) return st * 1000UL;
+    if (st >= 0xF1 && st <= 0xF9) return (st - 0xF0) * 100UL;
+    return 127000UL;
+}
+
+/*****************************************************************************
+ * Function: IsoTp_SetRxId
+ *****************************************************************************/
+
+/**
+ * @brief Precompute the RIR compare for the RX ID (ID and IDE, not RTR).
+ */
+static void IsoTp_SetRxId(void) {
+    if (isotp_ide) {
+        isotp_rx_mask = 0xFFFFFFF8UL | (1 << 2);
+        isotp_rx_match = (isotp_rx_id << 3) | (1 << 2);
+    } else {
+        isotp_rx_mask = 0xFFE00000UL | (1 << 2);
+        isotp_rx_match = isotp_rx_id << 21;
+    }
+}
+
+/*****************************************************************************
+ * Function: IsoTp_Load
+ *****************************************************************************/
+
+/**
+ * @brief Request transmission of 8 bytes on the TX ID from the sender's
+ *        mailbox; the TX interrupt reports its completion.
+ */
+static void IsoTp_Load(const uint8_t *data) {
+    CanFrame f;
+
+    CAN_FramePack(&f, isotp_ide, isotp_tx_id, data, 8);
+    CAN1->sTxMailBox[ISOTP_MAILBOX].TDTR = f.rdtr;
+    CAN1->sTxMailBox[ISOTP_MAILBOX].TDLR = f.rdlr;
+    CAN1->sTxMailBox[ISOTP_MAILBOX].TDHR = f.rdhr;
+    CAN1->sTxMailBox[ISOTP_MAILBOX].TIR  = f.rir | (1 << 0);   // TXRQ last
+}
+
+/*****************************************************************************
+ * Function: IsoTp_SendFc
+ *****************************************************************************/
+
+/**
+ * @brief Send our flow control (CTS with our BS/STmin, or overflow).
+ *
+ * Runs in the RX interrupt, so it is queued for mailbox 2 rather than
+ * waiting for mailbox 0.
+ */
+static void IsoTp_SendFc(uint8_t status) {
+    uint8_t d[8] = { (ISOTP_PCI_FC << 4) | status, isotp_bs, isotp_stmin,
+                     ISOTP_PAD, ISOTP_PAD, ISOTP_PAD, ISOTP_PAD, ISOTP_PAD };
+    CanFrame f;
+
+    CAN_FramePack(&f, isotp_ide, isotp_tx_id, d, 8);
+    CAN_QueueFrame(&f);
+}
+
+/*****************************************************************************
+ * Function: IsoTp_TxEnd
+ *****************************************************************************/
+
+/**
+ * @brief Finish the sender with a result.
+ */
+static void IsoTp_TxEnd(uint8_t result) {
+    isotp_tx.result = result;
+    isotp_tx.end = Time_Now32();
+    isotp_tx.state = ISOTP_IDLE;
+    TIM3_DIER_BB(3) = 0;                        // No STmin wait pending
+}
+
+/*****************************************************************************
+ * Function: IsoTp_SendCf
+ *****************************************************************************/
+
+/**
+ * @brief Load the next consecutive frame.
+ *
+ * The frame that ends a block (BS reached) makes the sender wait for the
+ * next flow control once it has completed.
+ */
+static void IsoTp_SendCf(void) {
+    IsoTpTx *t = &isotp_tx;
+    uint8_t d[8];
+    uint8_t n = 0;
+
+    d[0] = (ISOTP_PCI_CF << 4) | t->sn;
+    while (n < 7 && t->offset < t->len) {
+        d[1 + n++] = t->bench ? (uint8_t)t->offset : isotp_buf[t->offset];
+        t->offset++;
+    }
+    while (n < 7) {
+        d[1 + n++] = ISOTP_PAD;
+    }
+
+    t->sn = (t->sn + 1) & 0x0F;
+    t->frames++;
+    t->await_fc = 0;
+    if (t->bs && ++t->block == t->bs && t->offset < t->len) {
+        t->block = 0;
+        t->await_fc = 1;
+    }
+    IsoTp_Load(d);
+}
+
+/*****************************************************************************
+ * Function: IsoTp_ArmStMin
+ *****************************************************************************/
+
+/**
+ * @brief Run IsoTp_StMinElapsed() at the sender's deadline (TIM3 CCR3).
+ *
+ * As with the cyclic deadlines, the compare matches the low 16 bits, so a
+ * deadline more than 65.5 ms away gives an early interrupt that re-arms.
+ */
+static void IsoTp_ArmStMin(void) {
+    TIM3->CCR3 = isotp_tx.deadline & 0xFFFF;
+    TIM3->SR = ~(1 << 3);                       // Clear a stale CC3IF (rc_w0)
+    TIM3_DIER_BB(3) = 1;                        // CC3IE
+    if ((int32_t)(Time_Now32() - isotp_tx.deadline) >= 0) {
+        TIM3->EGR = (1 << 3);                   // CC3G: already due
+    }
+}
+
+/*****************************************************************************
+ * Function: IsoTp_Init
+ *****************************************************************************/
+
+/**
+ * @brief Set the default addressing and prepare TIM3 channel 3.
+ *
+ * Channel 3 runs in frozen output compare mode (no pin) and is used only
+ * for its compare interrupt, like channels 1 and 2.
+ */
+void IsoTp_Init(void) {
+    memset(&isotp_tx, 0, sizeof(isotp_tx));
+    memset(&isotp_rx, 0, sizeof(isotp_rx));
+    isotp_tx.result = ISOTP_RES_NONE;
+    isotp_rx.result = ISOTP_RES_NONE;
+    IsoTp_SetRxId();
+    TIM3->CCMR2 &= ~0xFF;                       // CC3S = output, OC3M = frozen
+    TIM3_DIER_BB(3) = 0;
+}
+
+/*****************************************************************************
+ * Function: IsoTp_TxComplete
+ *****************************************************************************/
+
+/**
+ * @brief Continue the sender from the TX-complete interrupt.
+ *
+ * After the first frame or the last frame of a block the sender waits for
+ * flow control; otherwise the next consecutive frame goes out at once
+ * (STmin 0) or from the STmin timer.
+ */
+void IsoTp_TxComplete(uint8_t ok) {
+    IsoTpTx *t = &isotp_tx;
+    uint32_t now;
+
+    if (t->state != ISOTP_TX_SENDING) return;   // Aborted meanwhile
+
+    if (!ok) {
+        IsoTp_TxEnd(ISOTP_RES_TX_FAILED);
+        return;
+    }
+    if (t->offset >= t->len) {
+        IsoTp_TxEnd(ISOTP_RES_OK);
+        return;
+    }
+
+    now = Time_Now32();
+    if (t->await_fc) {
+        t->end = now;                           // Start of the N_Bs wait
+        t->state = ISOTP_TX_WAIT_FC;
+    } else if (t->stmin_us == 0) {
+        IsoTp_SendCf();
+    } else {
+        t->deadline = now + t->stmin_us;
+        IsoTp_ArmStMin();
+    }
+}
+
+/*****************************************************************************
+ * Function: IsoTp_StMinElapsed
+ *****************************************************************************/
+
+/**
+ * @brief Send the next consecutive frame when the STmin deadline is due.
+ */
+void IsoTp_StMinElapsed(void) {
+    if (isotp_tx.state != ISOTP_TX_SENDING) return;
+
+    if ((int32_t)(Time_Now32() - isotp_tx.deadline) < 0) {
+        IsoTp_ArmStMin();                       // Early match (> 65.5 ms)
+        return;
+    }
+    IsoTp_SendCf();
+}
+
+/*****************************************************************************
+ * Function: IsoTp_TxPending
+ *****************************************************************************/
+
+/**
+ * @brief Report a transfer in progress, which owns the sender's mailbox.
+ */
+uint8_t IsoTp_TxPending(void) {
+    return isotp_tx.state != ISOTP_IDLE;
+}
+
+/*****************************************************************************
+ * Function: IsoTp_FlowControl
+ *****************************************************************************/
+
+/**
+ * @brief Apply a flow control from the peer while the sender waits for one.
+ */
+static void IsoTp_FlowControl(const uint8_t *d, uint8_t len) {
+    IsoTpTx *t = &isotp_tx;
+
+    if (t->state != ISOTP_TX_WAIT_FC || len < 3) return;
+
+    t->fc++;
+    switch (d[0] & 0x0F) {
+    case ISOTP_FS_CTS:
+        t->bs = d[1];
+        t->stmin = d[2];
+        t->stmin_us = IsoTp_StMinUs(d[2]);
+        t->block = 0;
+        t->state = ISOTP_TX_SENDING;
+        IsoTp_SendCf();                         // STmin applies between CFs only
+        break;
+    case ISOTP_FS_WAIT:
+        t->waits++;
+        t->end = Time_Now32();                  // Restart N_Bs
+        break;
+    default:
+        IsoTp_TxEnd(ISOTP_RES_OVERFLOW);
+        break;
+    }
+}
+
+/*****************************************************************************
+ * Function: IsoTp_RxEnd
+ *****************************************************************************/
+
+/**
+ * @brief Finish the receiver with a result.
+ */
+static void IsoTp_RxEnd(uint8_t result) {
+    isotp_rx.result = result;
+    isotp_rx.state = ISOTP_IDLE;
+    if (result == ISOTP_RES_OK) {
+        isotp_rx.transfers++;
+    }
+}
+
+/*****************************************************************************
+ * Function: IsoTp_Frame
+ *****************************************************************************/
+
+/**
+ * @brief Dispatch a frame on the RX ID by its N_PCI type.
+ *
+ * Single and first frames start a reception (a first frame during one
+ * aborts it), consecutive frames are checked for their sequence number and
+ * every BS frames are answered with a new flow control; flow control goes
+ * to the sender.
+ */
+void IsoTp_Frame(const CanFrame *frame) {
+    IsoTpRx *r = &isotp_rx;
+    const uint8_t *d = CAN_FRAME_DATA(frame);
+    uint8_t len = CAN_FRAME_LEN(frame);
+    uint32_t now;
+    uint8_t n;
+
+    if ((frame->rir & isotp_rx_mask) != isotp_rx_match ||
+        (frame->rir & (1 << 1)) || len == 0) return;
+
+    now = Time_Now32();
+    switch (d[0] >> 4) {
+    case ISOTP_PCI_SF:
+        n = d[0] & 0x0F;
+        if (n == 0 || n > len - 1) return;
+        if (r->state == ISOTP_RX_RECEIVING) {
+            IsoTp_RxEnd(ISOTP_RES_ABORTED);
+        }
+        r->len = r->received = n;
+        r->frames = 1;
+        r->start = r->last = now;
+        r->hash = IsoTp_Hash(2166136261UL, &d[1], n);
+        IsoTp_RxEnd(ISOTP_RES_OK);
+        break;
+
+    case ISOTP_PCI_FF:
+        if (len < 8) return;
+        if (r->state == ISOTP_RX_RECEIVING) {
+            IsoTp_RxEnd(ISOTP_RES_ABORTED);
+        }
+        r->len = ((d[0] & 0x0F) << 8) | d[1];
+        if (r->len < 8) return;                 // Would have been a single frame
+        r->received = 6;
+        r->frames = 1;
+        r->sn = 1;
+        r->block = 0;
+        r->start = r->last = now;
+        r->hash = IsoTp_Hash(2166136261UL, &d[2], 6);
+        r->state = ISOTP_RX_RECEIVING;
+        IsoTp_SendFc(ISOTP_FS_CTS);
+        break;
+
+    case ISOTP_PCI_CF:
+        if (r->state != ISOTP_RX_RECEIVING) return;
+        if ((d[0] & 0x0F) != r->sn) {
+            r->sn_errors++;
+            IsoTp_RxEnd(ISOTP_RES_BAD_SN);
+            return;
+        }
+        n = r->len - r->received;
+        if (n > 7) n = 7;
+        if (n > len - 1) n = len - 1;
+        r->hash = IsoTp_Hash(r->hash, &d[1], n);
+        r->received += n;
+        r->frames++;
+        r->sn = (r->sn + 1) & 0x0F;
+        r->last = now;
+        if (r->received >= r->len) {
+            IsoTp_RxEnd(ISOTP_RES_OK);
+        } else if (isotp_bs && ++r->block == isotp_bs) {
+            r->block = 0;
+            IsoTp_SendFc(ISOTP_FS_CTS);
+        }
+        break;
+
+    case ISOTP_PCI_FC:
+        IsoTp_FlowControl(d, len);
+        break;
+    }
+}
+
+/*****************************************************************************
+ * Function: IsoTp_CheckTimeouts
+ *****************************************************************************/
+
+/**
+ * @brief End the sender or receiver when its wait has run out (N_Bs, N_Cr).
+ *
+ * Called with the CAN interrupts masked.
+ */
+static void IsoTp_CheckTimeouts(uint32_t now) {
+    if (isotp_tx.state == ISOTP_TX_WAIT_FC && now - isotp_tx.end > ISOTP_TIMEOUT_US) {
+        IsoTp_TxEnd(ISOTP_RES_TIMEOUT);
+    }
+    if (isotp_rx.state == ISOTP_RX_RECEIVING && now - isotp_rx.last > ISOTP_TIMEOUT_US) {
+        IsoTp_RxEnd(ISOTP_RES_TIMEOUT);
+    }
+}
+
+/*****************************************************************************
+ * Function: IsoTp_Poll
+ *****************************************************************************/
+
+/**
+ * @brief Apply the timeouts from the main loop.
+ */
+void IsoTp_Poll(void) {
+    NVIC_DisableIRQ(CAN1_RX0_IRQn);
+    NVIC_DisableIRQ(CAN1_TX_IRQn);
+    IsoTp_CheckTimeouts(Time_Now32());
+    NVIC_EnableIRQ(CAN1_TX_IRQn);
+    NVIC_EnableIRQ(CAN1_RX0_IRQn);
+}
+
+/*****************************************************************************
+ * Function: IsoTp_NextDeadline
+ *****************************************************************************/
+
+/**
+ * @brief Earliest end of a flow control or consecutive frame wait.
+ *
+ * Read without masking: a frame arriving meanwhile only moves the wait
+ * later, so a stale value wakes the loop early and IsoTp_Poll() finds
+ * nothing to do.
+ */
+uint8_t IsoTp_NextDeadline(uint32_t *deadline) {
+    uint8_t timed = 0;
+    uint32_t t;
+
+    if (isotp_tx.state == ISOTP_TX_WAIT_FC) {
+        *deadline = isotp_tx.end + ISOTP_TIMEOUT_US + 1;
+        timed = 1;
+    }
+    if (isotp_rx.state == ISOTP_RX_RECEIVING) {
+        t = isotp_rx.last + ISOTP_TIMEOUT_US + 1;
+        if (!timed || (int32_t)(t - *deadline) < 0) {
+            *deadline = t;
+        }
+        timed = 1;
+    }
+    return timed;
+}
+
+/*****************************************************************************
+ * Function: IsoTp_Start
+ *****************************************************************************/
+
+/**
+ * @brief Start the sender with a single frame or a first frame.
+ *
+ * The payload hash is computed before the interrupts are masked; the first
+ * frame is loaded with the CAN interrupts masked so a flow control cannot
+ * arrive half-way through the setup.
+ *
+ * @retval UART_ACK_TX_BUSY while a transfer runs (it is left alone) or the
+ *         mailbox is in use, UART_ACK_BUS_OFF when bus-off,
+ *         UART_ACK_BAD_FRAME for a length out of range, else UART_ACK_OK
+ */
+static uint8_t IsoTp_Start(uint16_t len, uint8_t bench) {
+    IsoTpTx *t = &isotp_tx;
+    uint8_t d[8];
+    uint8_t n, i;
+    uint32_t hash = 2166136261UL;
+    uint8_t ack = UART_ACK_OK;
+
+    if (t->state != ISOTP_IDLE) return UART_ACK_TX_BUSY;
+    if (len == 0 || len > (bench ? ISOTP_MAX_LEN : ISOTP_BUF_LEN)) return UART_ACK_BAD_FRAME;
+
+    for (uint16_t k = 0; k < len; k++) {
+        uint8_t b = bench ? (uint8_t)k : isotp_buf[k];
+        hash = IsoTp_Hash(hash, &b, 1);
+    }
+
+    NVIC_DisableIRQ(CAN1_RX0_IRQn);
+    NVIC_DisableIRQ(CAN1_TX_IRQn);
+    memset(t, 0, sizeof(*t));
+    t->bench = bench;
+    t->len = len;
+    t->hash = hash;
+    t->result = ISOTP_RES_NONE;
+    t->start = Time_Now32();
+
+    if (CAN1->ESR & (1 << 2)) {                 // Bus-off
+        IsoTp_TxEnd(ISOTP_RES_TX_FAILED);
+        ack = UART_ACK_BUS_OFF;
+    } else if (!(CAN1->TSR & (1 << (26 + ISOTP_MAILBOX)))) {
+        IsoTp_TxEnd(ISOTP_RES_BUSY);            // TME1 clear: mailbox in use
+        ack = UART_ACK_TX_BUSY;
+    } else {
+        if (len <= 7) {
+            d[0] = (ISOTP_PCI_SF << 4) | len;
+            n = len;
+            i = 1;
+        } else {
+            d[0] = (ISOTP_PCI_FF << 4) | (len >> 8);
+            d[1] = len & 0xFF;
+            n = 6;
+            i = 2;
+            t->sn = 1;
+            t->await_fc = 1;
+        }
+        for (uint8_t k = 0; k < 8 - i; k++) {
+            d[i + k] = (k < n) ? (bench ? k : isotp_buf[k]) : ISOTP_PAD;
+        }
+        t->offset = n;
+        t->frames = 1;
+        t->state = ISOTP_TX_SENDING;
+        IsoTp_Load(d);
+    }
+    NVIC_EnableIRQ(CAN1_TX_IRQn);
+    NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    return ack;
+}
+
+/*****************************************************************************
+ * Function: IsoTp_Command
+ *****************************************************************************/
+
+/**
+ * @brief Configure, load, start or abort, then reply with both directions.
+ *
+ * Timeouts are applied here too, with the CAN interrupts masked for a
+ * consistent snapshot, so the reply never shows an expired wait.
+ */
+uint8_t IsoTp_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[45];
+    uint8_t ack = UART_ACK_OK;
+    IsoTpTx t;
+    IsoTpRx r;
+    uint32_t now;
+
+    if (len >= 12 && args[0] == ISOTP_OP_CONFIG && isotp_tx.state == ISOTP_IDLE) {
+        NVIC_DisableIRQ(CAN1_RX0_IRQn);
+        isotp_ide = args[1] ? 1 : 0;
+        isotp_tx_id = ((uint32_t)args[2] << 24) | ((uint32_t)args[3] << 16) |
+                      ((uint32_t)args[4] << 8) | args[5];
+        isotp_rx_id = ((uint32_t)args[6] << 24) | ((uint32_t)args[7] << 16) |
+                      ((uint32_t)args[8] << 8) | args[9];
+        isotp_bs = args[10];
+        isotp_stmin = args[11];
+        IsoTp_SetRxId();
+        isotp_rx.state = ISOTP_IDLE;
+        NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    } else if (len >= 3 && args[0] == ISOTP_OP_LOAD) {
+        uint16_t offset = (args[1] << 8) | args[2];
+        if (isotp_tx.state != ISOTP_IDLE) {
+            return UART_ACK_TX_BUSY;            // Buffer in use by the sender
+        }
+        if (offset + (len - 3) > ISOTP_BUF_LEN) {
+            return UART_ACK_BAD_FRAME;
+        }
+        memcpy(&isotp_buf[offset], &args[3], len - 3);
+        return UART_ACK_OK;                     // The sequenced ack is enough
+    } else if (len >= 3 && (args[0] == ISOTP_OP_SEND || args[0] == ISOTP_OP_BENCH)) {
+        ack = IsoTp_Start((args[1] << 8) | args[2], args[0] == ISOTP_OP_BENCH);
+    } else if (len >= 1 && args[0] == ISOTP_OP_ABORT) {
+        NVIC_DisableIRQ(CAN1_RX0_IRQn);
+        NVIC_DisableIRQ(CAN1_TX_IRQn);
+        if (isotp_tx.state != ISOTP_IDLE) {
+            CAN1->TSR = (1 << (7 + 8 * ISOTP_MAILBOX));  // ABRQ1
+            IsoTp_TxEnd(ISOTP_RES_ABORTED);
+        }
+        NVIC_EnableIRQ(CAN1_TX_IRQn);
+        NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    }
+
+    NVIC_DisableIRQ(CAN1_RX0_IRQn);
+    NVIC_DisableIRQ(CAN1_TX_IRQn);
+    now = Time_Now32();
+    IsoTp_CheckTimeouts(now);
+    t = isotp_tx;
+    r = isotp_rx;
+    NVIC_EnableIRQ(CAN1_TX_IRQn);
+    NVIC_EnableIRQ(CAN1_RX0_IRQn);
+
+    reply[0] = ISOTP_OP_STATUS;
+    reply[1] = t.state;
+    reply[2] = t.result;
+    reply[3] = t.len >> 8;
+    reply[4] = t.len & 0xFF;
+    reply[5] = t.offset >> 8;
+    reply[6] = t.offset & 0xFF;
+    reply[7] = t.frames >> 8;
+    reply[8] = t.frames & 0xFF;
+    reply[9] = t.fc >> 8;
+    reply[10] = t.fc & 0xFF;
+    reply[11] = t.waits >> 8;
+    reply[12] = t.waits & 0xFF;
+    reply[13] = t.bs;
+    reply[14] = t.stmin;
+    UART_PutU32(&reply[15], (t.state == ISOTP_IDLE ? t.end : now) - t.start);
+    UART_PutU32(&reply[19], t.hash);
+    reply[23] = r.state;
+    reply[24] = r.result;
+    reply[25] = r.len >> 8;
+    reply[26] = r.len & 0xFF;
+    reply[27] = r.received >> 8;
+    reply[28] = r.received & 0xFF;
+    reply[29] = r.frames >> 8;
+    reply[30] = r.frames & 0xFF;
+    reply[31] = r.sn_errors >> 8;
+    reply[32] = r.sn_errors & 0xFF;
+    UART_PutU32(&reply[33], r.last - r.start);
+    UART_PutU32(&reply[37], r.hash);
+    UART_PutU32(&reply[41], r.transfers);
+    UART_SendReply(UART_CMD_ISOTP, reply, sizeof(reply));
+    return ack;
+}
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
@@ -7,69 +7,88 @@
  * Include files
  *****************************************************************************/
 #include "main.h"
+#include "clock_config.h"
 #include "gpio_config.h"
 #include "uart_handler.h"
 #include "can_handler.h"
 #include "timer_handler.h"
+#include "bench_handler.h"
+#include "forward_handler.h"
+#include "timebase_handler.h"
+#include "sched_handler.h"
+#include "isotp_handler.h"
+#include "crc_handler.h"
+#include "cfgstore_handler.h"
+#include "tsync_handler.h"
+#include "pool_handler.h"
 
 /*****************************************************************************
- * Global variables
+ * Local variables
  *****************************************************************************/
 
+static void Task_Timeouts(void);
 
-/** Flag set when a CAN frame has been received via interrupt. */
-volatile uint8_t can_frame_ready  = 0;
-
-/** Flag indicating whether to repeat sending a CAN frame. */
-volatile uint8_t repeat           = 0;
+/**
+ * @brief Main loop tasks, highest priority first (see sched_handler.h).
+ */
+static const SchedTask main_tasks[] = {
+    { SCHED_EVT_UART_RX, Process_UART_Frame, 5000 },  /**< Host frames queued by USART1 */
+    { SCHED_EVT_TIMEOUT, Task_Timeouts,      2000 },  /**< Timeouts: batch, baud, sync  */
+    { SCHED_EVT_CAN_RX,  Fwd_Poll,           2000 },  /**< Forward received CAN frames  */
+};
 
 /*****************************************************************************
  * Function definitions
  *****************************************************************************/
 
+/**
+ * @brief  Timed work, run when the deadline armed by Power_Idle() is due.
+ */
+static void Task_Timeouts(void)
+{
+    UART_BatchPoll();       /* Send a batch that reached its age limit         */
+    UART_BaudCheck();       /* Fall back if a new UART speed was not confirmed */
+    Tsync_Poll();           /* SYNC/FUP due (master), received pair (slave)    */
+    IsoTp_Poll();           /* ISO-TP flow control / consecutive frame timeout */
+}
+
 /**
  * @brief  Main program entry point.
  *
  * The function performs the following steps:
- * 1. Initializes GPIO, UART, CAN and Timer 2.
- * 2. Clears UART buffers and disables repeat mode.
- * 3. Enters an infinite loop that
- *    - Processes a UART frame when @ref uart_frame_ready is set
- *    - Clears @ref can_frame_ready when a CAN frame was handled in the ISR
- *
- * @note  Additional CAN-frame post-processing can be placed where indicated
- *        in the loop if required.
+ * 1. Links the frame pool, switches to the 72 MHz PLL clock, starts the 1 us time base, then
+ *    initializes GPIO, UART, CAN (with the bit rate and test mode saved in
+ *    flash), the cyclic transmit deadlines (and the saved cyclic messages)
+ *    and the DWT cycle counter (benchmarks and scheduler run-time
+ *    accounting).
+ * 2. Clears UART buffers.
+ * 3. Hands over to the scheduler. The USART1, CAN RX and TIM3 interrupts
+ *    post events; the scheduler runs the matching task from main_tasks[]
+ *    and sleeps (WFI/WFE, see power_handler.h) when none is pending.
  *
  * @retval int This function never returns; the value is for ISO-C compliance.
  */
 int main(void)
 {
     /* ---- Peripheral initialization -------------------------------------- */
+    Pool_Init();            /*   Frame pool free list, before any interrupt  */
+    Clock_Config();         /*   SYSCLK = 72 MHz from HSE + PLL              */
+    Time_Init();            /*   1 us time base on TIM3 -> TIM4              */
     GPIO_Config();          /*   Configure GPIO pins                         */
+    Crc_Init();             /*   CRC unit + DMA1 clocks, before CAN RX       */
     UART_Config();          /*   Initialize UART1                            */
+    CfgStore_Restore();     /*   Saved bit rate and test mode from flash     */
     CAN_Config();           /*   Initialize CAN1                             */
-    Timer2_Config();        /*   Initialize Timer 2 for repeated CAN frames  */
+    Timer_Config();         /*   Cyclic CAN frames on TIM3 compare           */
+    IsoTp_Init();           /*   ISO-TP addressing, STmin on TIM3 channel 3  */
+    CfgStore_StartCyclic(); /*   Saved cyclic messages                       */
+    Bench_Init();           /*   Start DWT cycle counter for benchmarks      */
 
     UART_Init_Buffers();    /*   Clear UART receive buffers                  */
-    repeat = 0;             /*   Disable repeat mode initially               */
-
-    /* ---- Main loop ------------------------------------------------------ */
-    while (1)
-    {
-        /* Handle a complete UART frame */
-        if (uart_frame_ready)
-        {
-            uart_frame_ready = 0;
-            Process_UART_Frame();
-        }
 
-        /* Optional main-loop processing of a received CAN frame             */
-        if (can_frame_ready)
-        {
-            can_frame_ready = 0;
-            /* CAN frame already handled in USB_LP_CAN1_RX0_IRQHandler()     */
-        }
-    }
+    /* ---- Event loop ----------------------------------------------------- */
+    Sched_Init(main_tasks, sizeof(main_tasks) / sizeof(main_tasks[0]));
+    Sched_Run();            /*   Never returns                               */
 }
 
 /*****************************************************************************
@@ -0,0 +1,333 @@
+/*****************************************************************************
+ * @file    slcan_handler.c
+ * @brief   SLCAN (Lawicel) command lines from the host and t/T/r/R lines
+ *          for received frames
+ *****************************************************************************/
+
+/*****************************************************************************
+ * Include files
+ *****************************************************************************/
+#include "slcan_handler.h"   // SLCAN declarations
+#include "uart_handler.h"    // UART_SendByte / UART_SendReply
+#include "can_handler.h"     // CAN_SendFrame, bit rate and test mode
+#include "main.h"            // Common definitions
+
+/*****************************************************************************
+ * Local variables
+ *****************************************************************************/
+
+/**
+ * @brief Bit rates of the 'S0'..'S8' commands; only those in the CAN bit
+ *        timing table are accepted.
+ */
+static const uint32_t slcan_bitrates[9] = {
+    10000, 20000, 50000, 100000, 125000, 250000, 500000, 800000, 1000000
+};
+
+static const char slcan_digits[] = "0123456789ABCDEF";
+
+static uint8_t  slcan_enabled = 0;          /**< Host link speaks SLCAN                     */
+static uint8_t  slcan_open = 0;             /**< Channel open ('O' or 'L')                  */
+static uint8_t  slcan_listen = 0;           /**< Opened listen-only ('L')                   */
+static uint8_t  slcan_saved_mode = 0;       /**< CAN test mode restored when 'L' closes     */
+static uint8_t  slcan_timestamps = 0;       /**< 'Z1': append the ms timestamp              */
+static uint32_t slcan_lines = 0;            /**< Command lines executed                     */
+static uint32_t slcan_errors = 0;           /**< Of those, answered with BEL                */
+static uint32_t slcan_tx_frames = 0;        /**< Frames sent from t/T/r/R lines             */
+static uint32_t slcan_rx_frames = 0;        /**< Received frames sent as lines              */
+static uint32_t slcan_line_bytes = 0;       /**< Bytes of those lines                       */
+static uint32_t slcan_plain_bytes = 0;      /**< Bytes the same frames take as plain records */
+
+/*****************************************************************************
+ * Function: Slcan_Hex
+ *****************************************************************************/
+
+/**
+ * @brief Parse a fixed number of hex digits (either case).
+ *
+ * @return 1 if all digits were valid.
+ */
+static uint8_t Slcan_Hex(const uint8_t *p, uint8_t digits, uint32_t *value) {
+    uint32_t v = 0;
+    uint8_t c;
+
+    for (uint8_t i = 0; i < digits; i++) {
+        c = p[i];
+        if (c >= '0' && c <= '9')      c -= '0';
+        else if (c >= 'A' && c <= 'F') c -= 'A' - 10;
+        else if (c >= 'a' && c <= 'f') c -= 'a' - 10;
+        else return 0;
+        v = (v << 4) | c;
+    }
+    *value = v;
+    return 1;
+}
+
+/*****************************************************************************
+ * Function: Slcan_PutHex
+ *****************************************************************************/
+
+/**
+ * @brief Write the low digits of a value as upper-case hex.
+ */
+static void Slcan_PutHex(uint8_t *p, uint32_t value, uint8_t digits) {
+    while (digits--) {
+        p[digits] = slcan_digits[value & 0x0F];
+        value >>= 4;
+    }
+}
+
+/*****************************************************************************
+ * Function: Slcan_IsEnabled
+ *****************************************************************************/
+
+/**
+ * @brief Report the host link mode.
+ */
+uint8_t Slcan_IsEnabled(void) {
+    return slcan_enabled;
+}
+
+/*****************************************************************************
+ * Function: Slcan_LineLength
+ *****************************************************************************/
+
+/**
+ * @brief Complete at CR; a lone LF (CR LF line ends) is dropped, and a line
+ *        too long for any command is discarded.
+ */
+int16_t Slcan_LineLength(const uint8_t *buf, uint8_t n) {
+    if (n == 1 && buf[0] == '\n') return -1;
+    if (buf[n - 1] == SLCAN_CR) return n;
+    if (n >= SLCAN_LINE_MAX) return -1;
+    return 0;
+}
+
+/*****************************************************************************
+ * Function: Slcan_Transmit
+ *****************************************************************************/
+
+/**
+ * @brief Send the frame of a t/T/r/R line: ID, DLC digit, data (none for
+ *        remote frames).
+ *
+ * @return 1 if the line was valid and the frame was acknowledged.
+ */
+static uint8_t Slcan_Transmit(const uint8_t *line, uint8_t len) {
+    uint8_t ext = (line[0] == 'T' || line[0] == 'R');
+    uint8_t rtr = (line[0] == 'r' || line[0] == 'R');
+    uint8_t id_digits = ext ? 8 : 3;
+    uint8_t data[8] = { 0 };
+    uint32_t id, dlc, byte;
+    CanFrame f;
+
+    if (!slcan_open || slcan_listen) return 0;
+    if (len < 1 + id_digits + 1) return 0;
+    if (!Slcan_Hex(&line[1], id_digits, &id) || id > (ext ? 0x1FFFFFFFUL : 0x7FFUL)) return 0;
+    if (!Slcan_Hex(&line[1 + id_digits], 1, &dlc) || dlc > 8) return 0;
+    if (len != 1 + id_digits + 1 + (rtr ? 0 : 2 * dlc)) return 0;
+
+    for (uint8_t i = 0; !rtr && i < dlc; i++) {
+        if (!Slcan_Hex(&line[2 + id_digits + 2 * i], 2, &byte)) return 0;
+        data[i] = byte;
+    }
+
+    CAN_FramePack(&f, ext, id, data, dlc);
+    if (rtr) {
+        f.rir |= (1 << 1);                      // RTR
+    }
+    if (CAN_SendFrame(&f) != CAN_TX_OK) return 0;
+    slcan_tx_frames++;
+    return 1;
+}
+
+/*****************************************************************************
+ * Function: Slcan_Line
+ *****************************************************************************/
+
+/**
+ * @brief Execute one line. Replies follow the Lawicel protocol: CR for
+ *        success, BEL for an error, z/Z CR after a transmitted frame.
+ *
+ * 'C' always succeeds, since slcand sends it before configuring the
+ * channel. Without a controller reset the channel only gates forwarding
+ * and transmission; 'L' sets the silent test mode and 'C' restores the
+ * previous one.
+ */
+void Slcan_Line(const uint8_t *line, uint8_t len) {
+    uint8_t reply[8];
+    uint8_t n = 0;
+    uint8_t ok = 1;
+    uint32_t esr;
+
+    len--;                                      // Drop the CR
+    slcan_lines++;
+    if (len == 0) {
+        UART_SendByte(SLCAN_CR);                // Empty line: resync
+        return;
+    }
+
+    switch (line[0]) {
+    case 'O':
+        ok = !slcan_open;
+        slcan_open = 1;
+        break;
+    case 'L':
+        ok = !slcan_open;
+        if (ok) {
+            slcan_saved_mode = CAN_GetTestMode();
+            CAN_SetTestMode(CAN_MODE_SILENT);
+            slcan_open = 1;
+            slcan_listen = 1;
+        }
+        break;
+    case 'C':
+        if (slcan_listen) {
+            CAN_SetTestMode(slcan_saved_mode);
+        }
+        slcan_open = 0;
+        slcan_listen = 0;
+        break;
+    case 'S':
+        ok = !slcan_open && len == 2 && line[1] >= '0' && line[1] <= '8' &&
+             CAN_SetBitrate(slcan_bitrates[line[1] - '0']) == 0;
+        break;
+    case 't':
+    case 'T':
+    case 'r':
+    case 'R':
+        ok = Slcan_Transmit(line, len);
+        if (ok) {
+            reply[n++] = (line[0] == 't' || line[0] == 'r') ? 'z' : 'Z';
+        }
+        break;
+    case 'F':
+        esr = CAN1->ESR;
+        reply[n++] = 'F';
+        Slcan_PutHex(&reply[n], ((esr & (1 << 0)) ? 0x04 : 0) |    // EWGF: error warning
+                                ((esr & (1 << 1)) ? 0x20 : 0) |    // EPVF: error passive
+                                ((esr & (1 << 2)) ? 0x80 : 0), 2); // BOFF: bus error
+        n += 2;
+        break;
+    case 'V':
+    case 'N': {
+        const char *s = (line[0] == 'V') ? SLCAN_VERSION : SLCAN_SERIAL;
+        while (*s) {
+            reply[n++] = *s++;
+        }
+        break;
+    }
+    case 'Z':
+        ok = len == 2 && (line[1] == '0' || line[1] == '1');
+        if (ok) {
+            slcan_timestamps = line[1] - '0';
+        }
+        break;
+    case SLCAN_CMD_BINARY:
+        if (slcan_listen) {
+            CAN_SetTestMode(slcan_saved_mode);
+        }
+        slcan_open = 0;
+        slcan_listen = 0;
+        UART_SendByte(SLCAN_CR);
+        slcan_enabled = 0;                      // Next host byte is binary
+        return;
+    default:
+        ok = 0;
+        break;
+    }
+
+    if (!ok) {
+        slcan_errors++;
+        UART_SendByte(SLCAN_BEL);
+        return;
+    }
+    for (uint8_t i = 0; i < n; i++) {
+        UART_SendByte(reply[i]);
+    }
+    UART_SendByte(SLCAN_CR);
+}
+
+/*****************************************************************************
+ * Function: Slcan_Forward
+ *****************************************************************************/
+
+/**
+ * @brief Format the frame as t/T/r/R line: ID digits, DLC digit, data
+ *        digits, optional timestamp (ms, wraps at 60000), CR.
+ */
+void Slcan_Forward(const FwdFrame *f) {
+    uint8_t line[SLCAN_LINE_MAX + 4];
+    uint8_t ide = CAN_FRAME_IDE(&f->can);
+    uint8_t rtr = (f->can.rir & (1 << 1)) ? 1 : 0;
+    uint8_t dlc = CAN_FRAME_DLC(&f->can);
+    uint8_t len = rtr ? 0 : CAN_FRAME_LEN(&f->can);
+    const uint8_t *data = CAN_FRAME_DATA(&f->can);
+    uint8_t n = 0;
+
+    if (!slcan_open) return;
+
+    line[n++] = rtr ? (ide ? 'R' : 'r') : (ide ? 'T' : 't');
+    Slcan_PutHex(&line[n], CAN_FRAME_ID(&f->can), ide ? 8 : 3);
+    n += ide ? 8 : 3;
+    line[n++] = slcan_digits[dlc > 8 ? 8 : dlc];
+    for (uint8_t i = 0; i < len; i++) {
+        Slcan_PutHex(&line[n], data[i], 2);
+        n += 2;
+    }
+    if (slcan_timestamps) {
+        Slcan_PutHex(&line[n], (f->stamp / 1000) % 60000, 4);
+        n += 4;
+    }
+    line[n++] = SLCAN_CR;
+
+    for (uint8_t i = 0; i < n; i++) {
+        UART_SendByte(line[i]);
+    }
+    slcan_rx_frames++;
+    slcan_line_bytes += n;
+    slcan_plain_bytes += 1 + (ide ? 4 : 2) + 1 + len + 2;  // See forward_handler.h
+}
+
+/*****************************************************************************
+ * Function: Slcan_Command
+ *****************************************************************************/
+
+/**
+ * @brief Clears the counters or enters SLCAN mode, then replies with the
+ *        state.
+ *
+ * The reply and the sequenced acknowledgement are still binary records;
+ * only host lines and forwarded frames change format.
+ */
+void Slcan_Command(const uint8_t *args, uint8_t len) {
+    uint8_t reply[27];
+
+    if (len >= 1 && args[0] == SLCAN_OP_CLEAR) {
+        slcan_lines = 0;
+        slcan_errors = 0;
+        slcan_tx_frames = 0;
+        slcan_rx_frames = 0;
+        slcan_line_bytes = 0;
+        slcan_plain_bytes = 0;
+    }
+
+    if (len >= 1 && args[0] == SLCAN_OP_ENTER) {
+        slcan_enabled = 1;                      // Takes effect with the next host line
+    }
+
+    reply[0] = slcan_enabled;
+    reply[1] = slcan_open;
+    reply[2] = slcan_timestamps;
+    UART_PutU32(&reply[3], slcan_lines);
+    UART_PutU32(&reply[7], slcan_errors);
+    UART_PutU32(&reply[11], slcan_tx_frames);
+    UART_PutU32(&reply[15], slcan_rx_frames);
+    UART_PutU32(&reply[19], slcan_line_bytes);
+    UART_PutU32(&reply[23], slcan_plain_bytes);
+    UART_SendReply(UART_CMD_SLCAN, reply, sizeof(reply));
+}
+
+/*****************************************************************************
+ * End of File
+ *****************************************************************************/
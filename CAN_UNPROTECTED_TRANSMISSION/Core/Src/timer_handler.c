@@ -1,6 +1,6 @@
 /*****************************************************************************
  * @file    timer_handler.c
- * @brief   Timer 2 configuration and repeat-frame logic for CAN transmission
+ * @brief   Cyclic CAN frame transmission on absolute time base deadlines
  *****************************************************************************/
 
 /*****************************************************************************
@@ -8,123 +8,374 @@
  *****************************************************************************/
 #include "timer_handler.h"
 #include "can_handler.h"
+#include "uart_handler.h"
+#include "timebase_handler.h"
+#include "sched_handler.h"
+#include "isotp_handler.h"
 #include "main.h"
 
 /*****************************************************************************
- * Global variables
+ * Local types and variables
  *****************************************************************************/
+
+/**
+ * @brief Frame content of a cyclic slot, written only by the main loop.
+ */
+typedef struct {
+    CanFrame can;           /**< Register image, sent as is            */
+    uint32_t period_us;     /**< Period                                */
+} CyclicFrame;
+
+/**
+ * @brief One cyclic slot and its timing statistics.
+ *
+ * The main loop fills the buffer that @c frame does not point to and then
+ * publishes it with a single pointer store, so the interrupt always sees a
+ * complete frame. Deadline and statistics belong to the interrupt;
+ * @c version changes on every update so the main loop can take a consistent
+ * snapshot without masking it.
+ */
+typedef struct {
+    CyclicFrame buf[2];                 /**< Double buffer                          */
+    const CyclicFrame * volatile frame; /**< Published buffer                       */
+    volatile uint8_t  active;           /**< Set by the ISR on restart, cleared by Stop */
+    volatile uint8_t  restart;          /**< New frame: restart deadline and stats  */
+    volatile uint32_t version;          /**< Incremented by the ISR after updates   */
+    uint32_t deadline;                  /**< Next absolute deadline (Time_Now32)    */
+    uint32_t sent;                      /**< Frames handed to CAN_QueueFrame        */
+    uint32_t missed;                    /**< Deadlines skipped                      */
+    uint32_t failed;                    /**< Not queued: bus-off or queue full      */
+    uint32_t jitter_min;                /**< Deadline to transmit request (us)      */
+    uint32_t jitter_max;
+    uint64_t jitter_sum;
+} CyclicMsg;
+
 /**
- * @brief Buffer that holds the CAN frame to be sent repeatedly.
- * @note  Declared volatile because it is accessed from an ISR.
+ * @brief Snapshot of a slot for the query reply.
  */
-volatile uint8_t current_frame[REPEAT_FRAME_SIZE];
+typedef struct {
+    uint8_t  active;
+    uint32_t period_us;
+    uint32_t sent;
+    uint32_t missed;
+    uint32_t failed;
+    uint32_t jitter_min;
+    uint32_t jitter_max;
+    uint64_t jitter_sum;
+} CyclicStats;
+
+static CyclicMsg timer_cyclic[TIMER_CYCLIC_SLOTS];  /**< Cyclic message slots */
 
 /*****************************************************************************
- * @brief Configure Timer 2.
+ * @brief Load the earliest active deadline into TIM3 CCR1.
  *
- * Sets up TIM2 to generate a 1 ms tick (APB1 = 8 MHz, PSC = 999) and a default
- * period of 1 s (ARR = 1000). The update interrupt is enabled so that
- * @ref TIM2_IRQHandler is invoked on overflow.
+ * The compare matches the low 16 bits, so a deadline further away than
+ * 65.5 ms gives an early interrupt that finds nothing due and re-arms. A
+ * deadline that has already passed is triggered by software. Runs only
+ * inside the TIM3 interrupt, which owns CCR1 and the deadlines.
  *
  * @retval None
  *****************************************************************************/
-void Timer2_Config(void)
+static void Timer_Arm(void)
 {
-	RCC->APB1ENR |= (1 << 0);             /* Enable TIM2 clock                */
-    TIM2->PSC  = 1000 - 1;                /* Set prescaler for 1 ms tick      */
-    TIM2->ARR  = 1000;                    /* Set auto-reload for 1 second     */
-    TIM2->DIER |= (1 << 0);               /* Enable update interrupt          */
-    NVIC_EnableIRQ(TIM2_IRQn);            /* Enable TIM2 IRQ in NVIC          */
+    uint32_t now  = Time_Now32();
+    uint32_t next = 0;
+    int32_t  best = 0;
+    uint8_t  any  = 0;
+
+    for (uint8_t i = 0; i < TIMER_CYCLIC_SLOTS; ++i) {
+        int32_t left = (int32_t)(timer_cyclic[i].deadline - now);   /* Negative when overdue */
+        if (timer_cyclic[i].active && (!any || left < best)) {
+            best = left;
+            next = timer_cyclic[i].deadline;
+            any  = 1;
+        }
+    }
+
+    if (!any) {
+        TIM3_DIER_BB(1) = 0;           /* CC1IE off: nothing scheduled     */
+        return;
+    }
+
+    TIM3->CCR1  = next & 0xFFFF;
+    TIM3->SR    = ~(1 << 1);           /* Clear a stale CC1IF (rc_w0)      */
+    TIM3_DIER_BB(1) = 1;               /* CC1IE                            */
+    if ((int32_t)(Time_Now32() - next) >= 0) {
+        TIM3->EGR = (1 << 1);          /* CC1G: already due                */
+    }
 }
 
 /*****************************************************************************
- * @brief Stop Timer 2 and clear its update flag.
+ * @brief Run the TIM3 interrupt now (software compare event).
  *
- * Disables the counter, the update interrupt, and clears any pending
- * update-event flag to prevent spurious interrupts.
+ * The interrupt then applies a start or stop from the main loop and re-arms
+ * channel 1.
  *
  * @retval None
  *****************************************************************************/
-void Timer_Stop(void)
+static void Timer_Kick(void)
 {
-	TIM2->CR1  &= ~(1 << 0);     /* Stop counter                   */
-	TIM2->DIER &= ~(1 << 0);     /* Disable update interrupt       */
-	TIM2->SR   &= ~(1 << 0);    /* Clear update flag              */
+    TIM3_DIER_BB(1) = 1;               /* CC1IE                            */
+    TIM3->EGR = (1 << 1);              /* CC1G                             */
 }
 
 /*****************************************************************************
- * @brief Store a CAN frame and start periodic retransmission.
+ * @brief Configure the cyclic deadline interrupt.
  *
- * Copies the specified CAN frame into @ref current_frame and configures TIM2
- * so that it overflows every **interval** ms. On each overflow, the ISR
- * resends the stored frame.
+ * Channel 1 of the time base timer runs in frozen output compare mode (no
+ * pin) and is used only for its compare interrupt.
  *
- * @param mode      CAN mode: 0 = standard (11-bit ID), 1 = extended (29-bit ID)
- * @param id        CAN identifier
- * @param data      Pointer to data bytes
- * @param len       Number of data bytes (0 – 8)
- * @param interval  Repeat interval in milliseconds
+ * @retval None
+ *****************************************************************************/
+void Timer_Config(void)
+{
+    memset(timer_cyclic, 0, sizeof(timer_cyclic));
+    for (uint8_t i = 0; i < TIMER_CYCLIC_SLOTS; ++i)
+        timer_cyclic[i].frame = &timer_cyclic[i].buf[0];
+    TIM3->CCMR1 &= ~0xFF;              /* CC1S = output, OC1M = frozen     */
+    TIM3_DIER_BB(1) = 0;
+    NVIC_EnableIRQ(TIM3_IRQn);         /* Enable TIM3 IRQ in NVIC          */
+}
+
+/*****************************************************************************
+ * @brief Store a CAN frame in a cyclic slot and schedule it.
+ *
+ * Fills the buffer the interrupt is not using, publishes it and lets the
+ * interrupt restart the slot: statistics cleared, first deadline one period
+ * from then. Nothing is masked; the interrupt cannot run halfway through a
+ * frame it reads because the main loop never writes that one.
+ *
+ * @param slot       Cyclic slot
+ * @param mode       CAN mode: 0 = standard (11-bit ID), 1 = extended (29-bit ID)
+ * @param id         CAN identifier
+ * @param data       Pointer to data bytes
+ * @param len        Number of data bytes (0 – 8)
+ * @param period_us  Period in microseconds
+ *
+ * @retval None
+ *****************************************************************************/
+void Timer_StartCyclic(uint8_t slot, uint8_t mode, uint32_t id, const uint8_t *data,
+                       uint8_t len, uint32_t period_us)
+{
+    CyclicMsg   *c;
+    CyclicFrame *f;
+
+    if (slot >= TIMER_CYCLIC_SLOTS || period_us == 0)
+        return;
+    if (len > 8)
+        len = 8;
+
+    c = &timer_cyclic[slot];
+    f = (c->frame == &c->buf[0]) ? &c->buf[1] : &c->buf[0];
+    CAN_FramePack(&f->can, mode, id, data, len);
+    f->period_us = period_us;
+
+    __DMB();                           /* Frame complete before publishing */
+    c->frame   = f;
+    c->restart = 1;
+    Timer_Kick();
+}
+
+/*****************************************************************************
+ * @brief Deactivate a cyclic slot; the interrupt re-arms for the rest.
  *
+ * @param slot  Cyclic slot
  * @retval None
  *****************************************************************************/
-void Timer_Setup_Repeat(uint8_t mode,
-                        uint32_t id,
-                        uint8_t *data,
-                        uint8_t len,
-                        uint16_t interval)
+void Timer_StopCyclic(uint8_t slot)
 {
-    /* Copy frame header */
-    current_frame[0] = mode;
-    current_frame[1] = (id >> 24) & 0xFF;
-    current_frame[2] = (id >> 16) & 0xFF;
-    current_frame[3] = (id >>  8) & 0xFF;
-    current_frame[4] =  id        & 0xFF;
-    current_frame[5] = len;
-
-    /* Copy payload */
-    for (uint8_t i = 0; i < len; ++i) {
-        current_frame[6 + i] = data[i];
+    if (slot >= TIMER_CYCLIC_SLOTS)
+        return;
+
+    timer_cyclic[slot].restart = 0;
+    timer_cyclic[slot].active  = 0;
+    Timer_Kick();
+}
+
+/*****************************************************************************
+ * @brief Read back the message of a slot.
+ *
+ * Main loop only: the published buffer is never written by the interrupt.
+ *
+ * @param slot       Cyclic slot
+ * @param mode       CAN mode: 0 = standard, 1 = extended
+ * @param id         CAN identifier
+ * @param data       Data bytes (8-byte buffer)
+ * @param len        Number of data bytes
+ * @param period_us  Period in microseconds
+ *
+ * @retval 1 if the slot is running (or about to start), 0 if stopped
+ *****************************************************************************/
+uint8_t Timer_GetCyclic(uint8_t slot, uint8_t *mode, uint32_t *id, uint8_t *data,
+                        uint8_t *len, uint32_t *period_us)
+{
+    const CyclicMsg   *c;
+    const CyclicFrame *f;
+
+    if (slot >= TIMER_CYCLIC_SLOTS)
+        return 0;
+
+    c = &timer_cyclic[slot];
+    f = c->frame;
+    *mode      = CAN_FRAME_IDE(&f->can);
+    *id        = CAN_FRAME_ID(&f->can);
+    *len       = CAN_FRAME_LEN(&f->can);
+    *period_us = f->period_us;
+    memcpy(data, CAN_FRAME_DATA(&f->can), 8);
+    return c->active || c->restart;
+}
+
+/*****************************************************************************
+ * @brief Copy the slot statistics without masking the interrupt.
+ *
+ * Copies again if the interrupt updated them in between (version changed).
+ *
+ * @param slot  Cyclic slot
+ * @param st    Destination
+ * @retval None
+ *****************************************************************************/
+static void Timer_Snapshot(uint8_t slot, CyclicStats *st)
+{
+    const CyclicMsg *c = &timer_cyclic[slot];
+    uint32_t version;
+
+    do {
+        version = c->version;
+        __DMB();                       /* Also keeps the fields uncached   */
+        st->active     = c->active;
+        st->period_us  = c->frame->period_us;
+        st->sent       = c->sent;
+        st->missed     = c->missed;
+        st->failed     = c->failed;
+        st->jitter_min = c->jitter_min;
+        st->jitter_max = c->jitter_max;
+        st->jitter_sum = c->jitter_sum;
+        __DMB();
+    } while (c->version != version);
+}
+
+/*****************************************************************************
+ * @brief Handle UART_CMD_CYCLIC.
+ *
+ * Starts or stops the slot when a period is given, then replies with the
+ * slot statistics.
+ *
+ * @param args  Command payload
+ * @param len   Payload length in bytes
+ * @retval None
+ *****************************************************************************/
+void Timer_CyclicCommand(const uint8_t *args, uint8_t len)
+{
+    uint8_t     reply[30];
+    CyclicStats c;
+    uint8_t     slot;
+
+    if (len < 1 || args[0] >= TIMER_CYCLIC_SLOTS)
+        return;
+    slot = args[0];
+
+    if (len >= TIMER_CYCLIC_HDR_LEN) {
+        uint32_t period   = ((uint32_t)args[1] << 24) | ((uint32_t)args[2] << 16) |
+                            ((uint32_t)args[3] <<  8) |  (uint32_t)args[4];
+        uint32_t id       = ((uint32_t)args[6] << 24) | ((uint32_t)args[7] << 16) |
+                            ((uint32_t)args[8] <<  8) |  (uint32_t)args[9];
+        uint8_t  data_len = args[10];
+
+        if (data_len > 8 || TIMER_CYCLIC_HDR_LEN + data_len > len)
+            return;
+        if (period == 0)
+            Timer_StopCyclic(slot);
+        else
+            Timer_StartCyclic(slot, args[5] ? 1 : 0, id, &args[TIMER_CYCLIC_HDR_LEN], data_len, period);
     }
 
-    /* Configure timer period (tick = 1 ms ⇒ ARR = interval) */
-    TIM2->ARR = interval;          /* Set auto-reload value to interval  */
-    TIM2->CNT = 0;                 /* Reset counter                      */
-    TIM2->SR  &= ~(1 << 0);        /* Clear pending update flag          */
-    TIM2->DIER |= (1 << 0);        /* Enable update interrupt            */
-    TIM2->CR1  |= (1 << 0);        /* Start timer                        */
+    Timer_Snapshot(slot, &c);
+
+    reply[0] = slot;
+    reply[1] = c.active;
+    UART_PutU32(&reply[2],  c.period_us);
+    UART_PutU32(&reply[6],  c.sent);
+    UART_PutU32(&reply[10], c.missed);
+    UART_PutU32(&reply[14], c.failed);
+    UART_PutU32(&reply[18], c.sent ? c.jitter_min : 0);
+    UART_PutU32(&reply[22], c.jitter_max);
+    UART_PutU32(&reply[26], c.sent ? (uint32_t)(c.jitter_sum / c.sent) : 0);
+    UART_SendReply(UART_CMD_CYCLIC, reply, sizeof(reply));
 }
 
 /*****************************************************************************
- * @brief TIM2 update-event interrupt handler.
+ * @brief TIM3 capture/compare interrupt handler.
  *
- * When @c repeat mode is active (global flag in @ref main.c), this ISR sends
- * the stored CAN frame on every timer overflow.
+ * Applies restarts published by the main loop, sends each due message, then
+ * advances its deadline by whole periods from the previous deadline. If the
+ * next deadline has already passed (the bus or a long interrupt held us up)
+ * the late periods are skipped and counted instead of being sent
+ * back-to-back. Nothing in this path masks interrupts.
  *
  * @retval None
  *****************************************************************************/
-void TIM2_IRQHandler(void)
+void TIM3_IRQHandler(void)
 {
-	if (!(TIM2->SR & (1 << 0)))
-        return;                       /* Spurious interrupt, ignore       */
-
-	TIM2->SR &= ~(1 << 0);          /* Clear update flag                */
-    if (!repeat)
-        return;                       /* Repeat mode not enabled, skip    */
-
-    /* Reconstruct CAN parameters from buffer */
-    uint8_t  mode = current_frame[0];
-    uint32_t id   = (mode == 0)
-                  ? ((current_frame[3] << 8) | current_frame[4])          /* 11-bit */
-                  : ((current_frame[1] << 24) | (current_frame[2] << 16)  /* 29-bit */
-                   | (current_frame[3] <<  8) |  current_frame[4]);
-
-    uint8_t len  = current_frame[5];
-    uint8_t data[8];
-    for (uint8_t i = 0; i < len && i < 8; ++i) {
-        data[i] = current_frame[6 + i];
+    uint32_t now;
+
+    if (TIM3->SR & (1 << 2)) {         /* Channel 2: main-loop deadline    */
+        TIM3->SR = ~(1 << 2);          /* Clear CC2IF (rc_w0)              */
+        TIM3_DIER_BB(2) = 0;           /* One-shot                         */
+        Sched_Post(SCHED_EVT_TIMEOUT);
+    }
+    if (TIM3->SR & (1 << 3)) {         /* Channel 3: ISO-TP STmin          */
+        TIM3->SR = ~(1 << 3);          /* Clear CC3IF (rc_w0)              */
+        TIM3_DIER_BB(3) = 0;           /* One-shot, re-armed per frame     */
+        IsoTp_StMinElapsed();
+    }
+	if (!(TIM3->SR & (1 << 1)))
+        return;                        /* Channel 1: cyclic messages       */
+	TIM3->SR = ~(1 << 1);              /* Clear CC1IF (rc_w0)              */
+
+    for (uint8_t i = 0; i < TIMER_CYCLIC_SLOTS; ++i) {
+        CyclicMsg         *c = &timer_cyclic[i];
+        const CyclicFrame *f = c->frame;   /* Read once: complete frame    */
+        uint32_t           jitter;
+
+        now = Time_Now32();
+        if (c->restart) {
+            c->restart    = 0;
+            c->sent       = 0;
+            c->missed     = 0;
+            c->failed     = 0;
+            c->jitter_min = 0xFFFFFFFFUL;
+            c->jitter_max = 0;
+            c->jitter_sum = 0;
+            c->deadline   = now + f->period_us;
+            c->active     = 1;
+            c->version++;
+            continue;
+        }
+        if (!c->active)
+            continue;
+        if ((int32_t)(now - c->deadline) < 0)
+            continue;
+
+        jitter = now - c->deadline;
+        if (CAN_QueueFrame(&f->can) != CAN_TX_OK) /* Mailbox 2, no wait    */
+            c->failed++;
+
+        c->sent++;
+        c->jitter_sum += jitter;
+        if (jitter < c->jitter_min) c->jitter_min = jitter;
+        if (jitter > c->jitter_max) c->jitter_max = jitter;
+
+        c->deadline += f->period_us;
+        now = Time_Now32();
+        if ((int32_t)(now - c->deadline) >= 0) {
+            uint32_t skip = (now - c->deadline) / f->period_us + 1;
+            c->missed   += skip;
+            c->deadline += skip * f->period_us;
+        }
+        c->version++;
     }
 
-    CAN_Send(mode, id, data, len);    /* Re-transmit stored CAN frame     */
+    Timer_Arm();
 }
 
 /*****************************************************************************
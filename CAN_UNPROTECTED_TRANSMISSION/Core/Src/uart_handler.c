@@ -9,7 +9,24 @@
  *****************************************************************************/
 #include "uart_handler.h"   // Header file for UART handling declarations
 #include "can_handler.h"    // Header file for CAN communication functions
-#include "timer_handler.h"  // Header file for timer functions used for repeated sending
+#include "timer_handler.h"  // Header file for cyclic (repeated) sending
+#include "bench_handler.h"  // Header file for benchmark commands
+#include "timebase_handler.h" // Time base and epoch command
+#include "clock_config.h"   // Header file for the APB2 clock used by the baud rate divider
+#include "compact_handler.h" // Header file for compact record encoding
+#include "forward_handler.h" // Header file for the forwarding queue commands
+#include "power_handler.h"  // Header file for the idle sleep command
+#include "sched_handler.h"  // Header file for the scheduler events and command
+#include "capture_handler.h" // Header file for the triggered capture buffer
+#include "idstats_handler.h" // Header file for the per-ID statistics table
+#include "isotp_handler.h"   // Header file for the ISO-TP transport
+#include "slcan_handler.h"   // Header file for the SLCAN ASCII mode
+#include "crc_handler.h"     // Header file for the record CRC and CRC unit
+#include "cfgstore_handler.h" // Header file for the flash configuration store
+#include "boot_handler.h"     // Header file for the bootloader entry
+#include "tsync_handler.h"    // Header file for the CAN time synchronisation
+#include "iddisp_handler.h"   // Header file for the per-ID dispatch table
+#include "pool_handler.h"     // Header file for the frame pool
 #include "main.h"           // Main project header (e.g. global defines, variables)
 
 /*****************************************************************************
@@ -17,26 +34,71 @@
  *****************************************************************************/
 
 /**
- * @brief UART receive buffer for commands from PC.
+ * @brief Current index in the frame being assembled.
  */
-volatile uint8_t uart_rx_buffer[UART_BUFFER_SIZE];  // Buffer to store incoming UART bytes
+volatile uint16_t uart_rx_index = 0;  // Index to track current position in receive buffer
+
+/*****************************************************************************
+ * Local variables
+ *****************************************************************************/
+
+static uint32_t uart_baud = UART_BOOT_BAUD;        /**< Current link speed                       */
+static uint32_t uart_baud_previous = 0;            /**< Fallback speed until confirmed, 0 = none */
+static uint32_t uart_baud_switch_time = 0;         /**< Time base (us) when the speed was changed */
+
+static uint8_t uart_batch[UART_BATCH_HDR_LEN + UART_BATCH_SIZE];  /**< Header + frame records */
+static uint16_t uart_batch_len = 0;                /**< Frame record bytes in the batch */
+static uint8_t uart_batch_count = 0;               /**< Frames in the batch */
+static uint8_t uart_batch_frames = 0;              /**< Frames per batch, 0/1 = batching off */
+static uint32_t uart_batch_age_us = 0;             /**< Send a batch this long after its first frame */
+static uint32_t uart_batch_start = 0;              /**< Time base (us) at the first frame of the batch */
 
 /**
- * @brief Current index in UART receive buffer.
+ * @brief Command queue: pool blocks holding [length][frame...].
+ *
+ * The RX interrupt assembles each host frame in its own block and queues
+ * the handle, so a frame arriving while the main loop is busy neither
+ * overwrites nor is copied into the one being processed.
  */
-volatile uint16_t uart_rx_index = 0;  // Index to track current position in receive buffer
+_Static_assert(1 + UART_FRAME_MAX <= POOL_BLOCK_SIZE, "host frame does not fit a pool block");
+
+static uint8_t uart_rx_block = POOL_NONE;          /**< Block being assembled */
+static uint8_t uart_cmd_queue[UART_CMD_QUEUE_LEN]; /**< Handles of queued host frames */
+static volatile uint8_t uart_cmd_head = 0;         /**< Oldest queued frame */
+static volatile uint8_t uart_cmd_count = 0;        /**< Frames in the queue */
+static volatile uint8_t uart_cmd_overflow = 0;     /**< 1 = a sequenced frame was discarded */
+static volatile uint8_t uart_cmd_overflow_seq = 0; /**< Its sequence number */
+
+/*****************************************************************************
+ * Function: UART_BaudToBrr
+ *****************************************************************************/
 
 /**
- * @brief Flag indicating a complete UART frame has been received.
+ * @brief Compute the USART1 BRR value for a baud rate.
+ *
+ * With 16x oversampling BRR = fPCLK2 / baud (mantissa:fraction).
+ *
+ * @param baud  Requested baud rate
+ * @retval BRR value, or 0 if above fPCLK2 / 16 or off by more than 2 %
  */
-volatile uint8_t uart_frame_ready = 0;  // Flag set to 1 when a full frame is ready to process
+static uint32_t UART_BaudToBrr(uint32_t baud) {
+    uint32_t pclk2 = Clock_GetPclk2();
+    uint32_t brr, actual;
+
+    if (baud == 0) return 0;
+    brr = (pclk2 + baud / 2) / baud;               // Rounded divider
+    if (brr < 16 || brr > 0xFFFF) return 0;        // Mantissa must be 1..4095
+    actual = pclk2 / brr;
+    if ((actual > baud ? actual - baud : baud - actual) > baud / 50) return 0;
+    return brr;
+}
 
 /*****************************************************************************
  * Function: UART_Config
  *****************************************************************************/
 
 /**
- * @brief Configure UART1 for 9600 baud rate at 8 MHz clock.
+ * @brief Configure UART1 for UART_BOOT_BAUD (115200) from the APB2 clock.
  *        - PA9: TX (AF Push-Pull, 2 MHz)
  *        - PA10: RX (Input floating)
  *        - Enable USART1 and RX interrupt
@@ -53,26 +115,199 @@ void UART_Config(void) {
 	GPIOA->CRH &= ~((0xF) << 8); // Clear previous config bits for PA10
 	GPIOA->CRH |= (0x1 << 10);                    // CNF10=01 (Floating input), MODE10=00 (Input mode)
 
-    USART1->BRR = 0x45;  // Set baud rate register for 9600 baud at 8 MHz clock (calculated value)
+    USART1->BRR = UART_BaudToBrr(UART_BOOT_BAUD);  // 115200 baud: 72 MHz / 115200 = 625
     USART1->CR1 |= (1 << 13)|(1 << 2)|(1 << 3)|(1 << 5);
     // Enable Receiver, Transmitter, USART, and RX interrupt enable
 
     NVIC_EnableIRQ(USART1_IRQn);  // Enable USART1 interrupt in the NVIC (Nested Vector Interrupt Controller)
 }
 
+/*****************************************************************************
+ * Function: UART_SetBaud
+ *****************************************************************************/
+
+/**
+ * @brief Switch USART1 to a new baud rate.
+ *
+ * Waits for transmission complete (TC) so bytes already queued go out at the
+ * old speed, then loads the new divider.
+ *
+ * @param baud  Baud rate accepted by UART_BaudToBrr()
+ */
+static void UART_SetBaud(uint32_t baud) {
+    while (!(USART1->SR & (1 << 6)));              // Wait for transmission complete
+    USART1->BRR = UART_BaudToBrr(baud);
+    uart_baud = baud;
+}
+
+/*****************************************************************************
+ * Function: UART_SendCrc
+ *****************************************************************************/
+
+/**
+ * @brief Send the CRC trailer of a record or batch, big-endian.
+ */
+static void UART_SendCrc(uint32_t crc) {
+    uint8_t b[4];
+
+    UART_PutU32(b, crc);
+    for (uint8_t i = 0; i < 4; i++) {
+        UART_SendByte(b[i]);
+    }
+}
+
+/*****************************************************************************
+ * Function: UART_BatchFlush
+ *****************************************************************************/
+
+/**
+ * @brief Send the batch with its shared header and empty it.
+ */
+static void UART_BatchFlush(void) {
+    if (uart_batch_count == 0) return;
+
+    uart_batch[0] = UART_REC_BATCH;                 // Shared header
+    uart_batch[1] = uart_batch_count;
+    uart_batch[2] = (uart_batch_len >> 8) & 0xFF;
+    uart_batch[3] =  uart_batch_len       & 0xFF;
+    for (uint16_t i = 0; i < UART_BATCH_HDR_LEN + uart_batch_len; i++) {
+        UART_SendByte(uart_batch[i]);
+    }
+    if (Crc_RecordsEnabled()) {
+        UART_SendCrc(Crc_Record(uart_batch, UART_BATCH_HDR_LEN + uart_batch_len));
+    }
+    uart_batch_len = 0;
+    uart_batch_count = 0;
+}
+
+/*****************************************************************************
+ * Function: UART_SendRecord
+ *****************************************************************************/
+
+/**
+ * @brief Send one CAN frame record, directly or through the batch.
+ *
+ * Without batching the record goes out byte by byte. Otherwise it is
+ * appended to the batch, which is sent when it holds the configured number
+ * of frames or the next record does not fit. Runs in the main loop (see
+ * Fwd_Poll()), so the RX interrupt never waits for the UART.
+ *
+ * @param rec  Record bytes
+ * @param len  Record length in bytes
+ */
+void UART_SendRecord(const uint8_t *rec, uint8_t len) {
+    if (uart_batch_frames <= 1) {
+        for (uint8_t i = 0; i < len; i++) {
+            UART_SendByte(rec[i]);                  // Single record
+        }
+        if (Crc_RecordsEnabled()) {
+            UART_SendCrc(Crc_Record(rec, len));
+        }
+        return;
+    }
+
+    if (uart_batch_len + len > UART_BATCH_SIZE) {
+        UART_BatchFlush();                          // No room left
+    }
+    if (uart_batch_count == 0) {
+        uart_batch_start = Time_Now32();            // Age counts from the first frame
+    }
+    memcpy(&uart_batch[UART_BATCH_HDR_LEN + uart_batch_len], rec, len);
+    uart_batch_len += len;
+    uart_batch_count++;
+
+    if (uart_batch_count >= uart_batch_frames) {
+        UART_BatchFlush();
+    }
+}
+
+/*****************************************************************************
+ * Function: UART_BatchPoll
+ *****************************************************************************/
+
+/**
+ * @brief Send the batch once its first frame is older than the configured age.
+ */
+void UART_BatchPoll(void) {
+    if (uart_batch_count &&
+        (Time_Now32() - uart_batch_start) >= uart_batch_age_us) {
+        UART_BatchFlush();                          // Flush on timeout
+    }
+}
+
+/*****************************************************************************
+ * Function: UART_NextDeadline
+ *****************************************************************************/
+
+/**
+ * @brief Earliest of the batch age and the baud confirmation deadlines, for
+ *        the tickless idle.
+ */
+uint8_t UART_NextDeadline(uint32_t *deadline) {
+    uint8_t found = 0;
+    uint32_t t;
+
+    if (uart_batch_count) {
+        *deadline = uart_batch_start + uart_batch_age_us;
+        found = 1;
+    }
+    if (uart_baud_previous) {
+        t = uart_baud_switch_time + UART_BAUD_CONFIRM_MS * 1000UL + 1;
+        if (!found || (int32_t)(t - *deadline) < 0) {
+            *deadline = t;
+        }
+        found = 1;
+    }
+    return found;
+}
+
+/*****************************************************************************
+ * Function: UART_BatchConfig
+ *****************************************************************************/
+
+/**
+ * @brief Set the batch limits.
+ *
+ * Frames already in the batch are sent first so nothing is lost when
+ * batching is switched off.
+ *
+ * @param frames  Frames per batch, 0 or 1 disables batching
+ * @param age_us  Maximum age of the first frame in a batch
+ */
+static void UART_BatchConfig(uint8_t frames, uint32_t age_us) {
+    UART_BatchFlush();
+    uart_batch_frames = frames;
+    uart_batch_age_us = age_us;
+}
+
+/*****************************************************************************
+ * Function: UART_BaudCheck
+ *****************************************************************************/
+
+/**
+ * @brief Fall back to the previous speed if the new one was not confirmed.
+ */
+void UART_BaudCheck(void) {
+    if (uart_baud_previous &&
+        (Time_Now32() - uart_baud_switch_time) > UART_BAUD_CONFIRM_MS * 1000UL) {
+        UART_SetBaud(uart_baud_previous);          // Host never confirmed: restore
+        uart_baud_previous = 0;
+        uart_rx_index = 0;                         // Drop bytes received at the wrong speed
+    }
+}
+
 /*****************************************************************************
  * Function: UART_Init_Buffers
  *****************************************************************************/
 
 /**
- * @brief Reset UART receive buffer and frame flag.
+ * @brief Reset UART receive buffer.
  *
- * This function clears the receive buffer index and frame ready flag to
- * prepare for receiving a new UART frame.
+ * This function clears the receive buffer index to prepare for receiving a
+ * new UART frame.
  */
 void UART_Init_Buffers(void) {
     uart_rx_index = 0;     // Reset index to start filling buffer from beginning
-    uart_frame_ready = 0;  // Clear flag indicating a frame is ready for processing
 }
 
 /*****************************************************************************
@@ -128,106 +363,445 @@ void UART_SendString(const char* s) {
     }
 }
 
+/*****************************************************************************
+ * Function: UART_SendReply
+ *****************************************************************************/
+
+/**
+ * @brief Send a reply record for a host command.
+ * @param cmd     Command byte being answered.
+ * @param payload Pointer to the reply payload.
+ * @param len     Payload length in bytes.
+ *
+ * Record format: [cmd | UART_REPLY_FLAG][len][payload bytes]
+ */
+void UART_SendReply(uint8_t cmd, const uint8_t *payload, uint8_t len) {
+    UART_SendByte(cmd | UART_REPLY_FLAG);  // Reply type = command byte with reply flag
+    UART_SendByte(len);                    // Payload length
+    for (uint8_t i = 0; i < len; i++) {
+        UART_SendByte(payload[i]);         // Payload bytes
+    }
+}
+
+/*****************************************************************************
+ * Function: UART_PutU32
+ *****************************************************************************/
+
+/**
+ * @brief Store a 32-bit value most-significant byte first.
+ * @param p Destination buffer (4 bytes).
+ * @param v Value to store.
+ */
+void UART_PutU32(uint8_t *p, uint32_t v) {
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >>  8) & 0xFF;
+    p[3] =  v        & 0xFF;
+}
+
+/*****************************************************************************
+ * Function: UART_FrameLength
+ *****************************************************************************/
+
+/**
+ * @brief Check the first n bytes of a host frame.
+ *        - mode byte (0 or 1), or a command byte (>= UART_CMD_BASE)
+ *        - data length (max 8), or command payload length
+ *        - total frame length depending on mode
+ *
+ * @param buf  Frame bytes
+ * @param n    Bytes received so far
+ * @retval Total frame length once the header shows it, 0 if more bytes are
+ *         needed, -1 if the frame is invalid
+ */
+static int16_t UART_FrameLength(const uint8_t *buf, uint8_t n) {
+    uint8_t mode, data_len;
+
+    if (n < 1) return 0;
+    mode = buf[0];                                 // First byte is mode: 0=standard CAN, 1=extended CAN
+
+    if (mode >= UART_CMD_BASE) {                   // Command frame: [cmd][len][payload]
+        if (mode & UART_REPLY_FLAG) return -1;     // Reply types are invalid
+        if (n < 2) return 0;
+        if (buf[1] > ((mode == UART_CMD_SEQ) ? UART_SEQ_MAX_PAYLOAD : UART_CMD_MAX_PAYLOAD)) {
+            return -1;                             // Oversize payload
+        }
+        return 2 + buf[1];
+    }
+
+    if (mode != 0 && mode != 1) return -1;         // Validate mode is either 0 or 1
+    if (n < ((mode == 0) ? 4 : 6)) return 0;
+    data_len = (mode == 0) ? buf[3] : buf[5];      // Data length at different offsets based on mode
+    if (data_len > 8) return -1;                   // Validate data length max 8 bytes (CAN limit)
+    return ((mode == 0) ? 6 : 8) + data_len;       // Header, data, interval bytes
+}
+
+/*****************************************************************************
+ * Function: UART_QueueFrame
+ *****************************************************************************/
+
+/**
+ * @brief Queue the assembled block and take a fresh one for the next frame.
+ *
+ * When the queue is full, or no block is free, the frame is discarded and
+ * its block reused; for a sequenced frame the main loop then sends a
+ * UART_ACK_OVERFLOW acknowledgement. Runs in the RX interrupt.
+ *
+ * @param len  Frame length in bytes
+ */
+static void UART_QueueFrame(uint8_t len) {
+    uint8_t *block = Pool_Block(uart_rx_block);
+    uint8_t next = POOL_NONE;
+
+    if (uart_cmd_count < UART_CMD_QUEUE_LEN) {
+        next = Pool_Alloc();
+    }
+    if (next == POOL_NONE) {
+        if (block[1] == UART_CMD_SEQ && len >= 3) {
+            uart_cmd_overflow_seq = block[3];
+            uart_cmd_overflow = 1;
+        }
+    } else {
+        block[0] = len;
+        uart_cmd_queue[(uart_cmd_head + uart_cmd_count) % UART_CMD_QUEUE_LEN] = uart_rx_block;
+        uart_cmd_count++;
+        uart_rx_block = next;
+    }
+    Sched_Post(SCHED_EVT_UART_RX);
+}
+
 /*****************************************************************************
  * Function: USART1_IRQHandler
  *****************************************************************************/
 
 /**
  * @brief UART1 RX interrupt handler.
- *        - Stores incoming bytes into uart_rx_buffer
- *        - Detects valid frames by checking mode, length and frame size
- *        - Sets uart_frame_ready flag when complete frame received
+ *        - Stores incoming bytes into the current pool block, after its
+ *          length byte
+ *        - Checks them with UART_FrameLength(), or Slcan_LineLength() in
+ *          SLCAN mode
+ *        - Queues a complete frame and restarts the buffer immediately
  *
- * This ISR reads received bytes, accumulates them in a buffer, validates
- * frame format based on mode and length, and signals when a full frame
- * has been received for processing.
+ * Back-to-back frames are not lost while the main loop is still processing
+ * an earlier one.
  */
 void USART1_IRQHandler(void) {
 	if (USART1->SR & (1 << 5)) {          // Check if RX data register not empty (byte received)
         uint8_t received_byte = USART1->DR;   // Read received byte (also clears RXNE flag)
+        uint8_t *frame;
+        int16_t frame_len;
 
-        if (uart_rx_index >= sizeof(uart_rx_buffer)) {  // Prevent buffer overflow
+        if (uart_rx_block == POOL_NONE) {       // First byte after reset
+            uart_rx_block = Pool_Alloc();
+            uart_rx_index = 0;
+            if (uart_rx_block == POOL_NONE) {
+                return;                         // Pool empty: byte lost
+            }
+        }
+        if (uart_rx_index >= UART_FRAME_MAX) {  // Prevent buffer overflow
             uart_rx_index = 0;               // Reset buffer index if overflow happens
             return;                         // Exit ISR early to avoid writing out of bounds
         }
 
-        uart_rx_buffer[uart_rx_index++] = received_byte;  // Store received byte in buffer and increment index
-
-        if (uart_rx_index >= 6 && !uart_frame_ready) {   // Only check frame validity if minimum length reached
-            uint8_t mode = uart_rx_buffer[0];            // First byte is mode: 0=standard CAN, 1=extended CAN
-
-            if (mode != 0 && mode != 1) {                 // Validate mode is either 0 or 1
-                uart_rx_index = 0;                         // Invalid mode: reset buffer to discard frame
-                return;
-            }
-
-            uint8_t data_len = (mode == 0) ? uart_rx_buffer[3] : uart_rx_buffer[5];  // Data length at different offsets based on mode
-            if (data_len > 8) {                            // Validate data length max 8 bytes (CAN limit)
-                uart_rx_index = 0;                         // Invalid length: reset buffer
-                return;
-            }
-
-            // Calculate expected total frame length including header, data, interval bytes
-            uint8_t expected_total_len = (mode == 0) ? (6 + data_len) : (8 + data_len);
+        frame = (uint8_t*)Pool_Block(uart_rx_block) + 1;
+        frame[uart_rx_index++] = received_byte;  // Store received byte in the block and increment index
 
-            if (uart_rx_index >= expected_total_len) {    // Check if entire frame has been received
-                uart_frame_ready = 1;                      // Set flag to signal frame ready for processing
-            }
+        if (Slcan_IsEnabled()) {
+            frame_len = Slcan_LineLength(frame, uart_rx_index);
+        } else {
+            frame_len = UART_FrameLength(frame, uart_rx_index);
         }
-
-        if (uart_rx_index > 30) {   // If buffer length exceeds protocol max size, reset to avoid errors
+        if (frame_len < 0) {
+            uart_rx_index = 0;                   // Invalid frame: reset buffer to discard it
+        } else if (frame_len > 0 && uart_rx_index >= frame_len) {
+            UART_QueueFrame(uart_rx_index);      // Entire frame received
             uart_rx_index = 0;
         }
     }
 }
 
 /*****************************************************************************
- * Function: Process_UART_Frame
+ * Function: UART_SendAck
  *****************************************************************************/
 
 /**
- * @brief Parse a complete UART frame and send it as a CAN frame.
+ * @brief Acknowledge a sequenced frame: [seq][status][free queue slots].
+ *
+ * @param seq     Sequence number from the envelope
+ * @param status  UART_ACK_* result
+ */
+static void UART_SendAck(uint8_t seq, uint8_t status) {
+    uint8_t reply[3];
+
+    reply[0] = seq;
+    reply[1] = status;
+    reply[2] = UART_CMD_QUEUE_LEN - uart_cmd_count;
+    UART_SendReply(UART_CMD_SEQ, reply, sizeof(reply));
+}
+
+/*****************************************************************************
+ * Function: UART_HandleFrame
+ *****************************************************************************/
+
+/**
+ * @brief Parse one complete host frame and send it as a CAN frame.
  *        - Extract mode, ID, data, length, interval
  *        - If interval = 0, send once
- *        - If interval > 0, send repeatedly using Timer
+ *        - If interval > 0, send repeatedly in cyclic slot 0
+ *        - Command frames (first byte >= UART_CMD_BASE) are dispatched by command
  *
- * Parses the received UART frame buffer to extract CAN frame parameters
- * and either sends the CAN frame once or sets up periodic retransmission
- * via the timer handler.
+ * @param frame  Frame bytes
+ * @retval UART_ACK_* status
  */
-void Process_UART_Frame(void) {
-    uint8_t mode = uart_rx_buffer[0];              // Read mode byte (0=standard, 1=extended)
+static uint8_t UART_HandleFrame(const uint8_t *frame) {
+    uint8_t mode = frame[0];                       // Read mode byte (0=standard, 1=extended)
+
+    if (mode >= UART_CMD_BASE) {                   // Host command instead of a CAN frame
+        const uint8_t *args = &frame[2];
+        uint8_t args_len = frame[1];
+
+        uart_baud_previous = 0;                // Any command at the current speed confirms it
+
+        switch (mode) {
+        case UART_CMD_BURST:
+            Bench_Burst(args, args_len);           // Max-rate burst benchmark
+            break;
+        case UART_CMD_PING:
+            Bench_Ping(args, args_len);            // Ping-pong round-trip probe
+            break;
+        case UART_CMD_PING_HIST:
+            Bench_PingHistogram(args, args_len);   // Round-trip histogram slice
+            break;
+        case UART_CMD_CAN_MODE: {
+            uint8_t current;
+            if (args_len >= 1) {
+                CAN_SetTestMode(args[0]);          // Normal / loopback / silent
+            }
+            current = CAN_GetTestMode();
+            UART_SendReply(UART_CMD_CAN_MODE, &current, 1);
+            break;
+        }
+        case UART_CMD_SELFTEST:
+            Bench_SelfTest(args, args_len);        // Loopback throughput + latency
+            break;
+        case UART_CMD_CAN_BITRATE: {
+            uint8_t reply[9];                      // [status][bitrate 4B][BTR 4B]
+            reply[0] = 0;
+            if (args_len >= 4) {                   // Empty payload only queries
+                uint32_t bitrate = ((uint32_t)args[0] << 24) | ((uint32_t)args[1] << 16) |
+                                   ((uint32_t)args[2] <<  8) |  (uint32_t)args[3];
+                reply[0] = CAN_SetBitrate(bitrate);
+            }
+            UART_PutU32(&reply[1], CAN_GetBitrate());
+            UART_PutU32(&reply[5], CAN_GetBitTiming());
+            UART_SendReply(UART_CMD_CAN_BITRATE, reply, sizeof(reply));
+            break;
+        }
+        case UART_CMD_UART_BAUD: {
+            uint8_t reply[5];                      // [status][baud 4B]
+            uint32_t baud = uart_baud;
+            reply[0] = 0;
+            if (args_len >= 4) {                    // Empty payload queries / confirms
+                baud = ((uint32_t)args[0] << 24) | ((uint32_t)args[1] << 16) |
+                       ((uint32_t)args[2] <<  8) |  (uint32_t)args[3];
+                if (UART_BaudToBrr(baud) == 0) {
+                    reply[0] = 1;                   // Not reachable from PCLK2
+                    baud = uart_baud;
+                }
+            }
+            UART_PutU32(&reply[1], baud);
+            UART_SendReply(UART_CMD_UART_BAUD, reply, sizeof(reply));  // Still at the old speed
+            if (baud != uart_baud) {
+                uart_baud_previous = uart_baud;     // Armed until the host confirms
+                uart_baud_switch_time = Time_Now32();
+                UART_SetBaud(baud);
+            }
+            break;
+        }
+        case UART_CMD_BATCH: {
+            uint8_t reply[6];                       // [status][frames][age us 4B]
+            reply[0] = 0;
+            if (args_len >= 5) {                    // [frames][age us 4B], empty = query
+                uint32_t age_us = ((uint32_t)args[1] << 24) | ((uint32_t)args[2] << 16) |
+                                  ((uint32_t)args[3] <<  8) |  (uint32_t)args[4];
+                if (args[0] > UART_BATCH_MAX_FRAMES) {
+                    reply[0] = 1;                   // More frames than the buffer is sized for
+                } else {
+                    UART_BatchConfig(args[0], age_us);
+                }
+            }
+            reply[1] = uart_batch_frames;
+            UART_PutU32(&reply[2], uart_batch_age_us);
+            UART_SendReply(UART_CMD_BATCH, reply, sizeof(reply));
+            break;
+        }
+        case UART_CMD_COMPACT:
+            Compact_Command(args, args_len);       // Compact records on/off + stats
+            break;
+        case UART_CMD_FWD:
+            Fwd_Command(args, args_len);           // Queue policy + loss counters
+            break;
+        case UART_CMD_TIME:
+            Time_Command(args, args_len);          // Time base and host epoch offset
+            break;
+        case UART_CMD_CYCLIC:
+            Timer_CyclicCommand(args, args_len);   // Cyclic message + jitter statistics
+            break;
+        case UART_CMD_POWER:
+            Power_Command(args, args_len);         // Idle sleep depth + wakeup latency
+            break;
+        case UART_CMD_SCHED:
+            Sched_Command(args, args_len);         // Per-task run-time accounting
+            break;
+        case UART_CMD_CAPTURE:
+            Capture_Command(args, args_len);       // Triggered capture buffer + dump
+            break;
+        case UART_CMD_IDSTATS:
+            IdStats_Command(args, args_len);       // Per-ID statistics table
+            break;
+        case UART_CMD_ISOTP:
+            return IsoTp_Command(args, args_len);  // ISO-TP transfer + benchmark; busy is acknowledged
+        case UART_CMD_SLCAN:
+            UART_BatchFlush();                     // Batched binary records go out first
+            Slcan_Command(args, args_len);         // SLCAN mode + counters
+            break;
+        case UART_CMD_CRC:
+            UART_BatchFlush();                     // Batch keeps the old trailer setting
+            Crc_Command(args, args_len);           // Record CRCs + CRC unit benchmark
+            break;
+        case UART_CMD_CFGSTORE:
+            CfgStore_Command(args, args_len);      // Save/erase the configuration
+            break;
+        case UART_CMD_BOOT:
+            UART_BatchFlush();                     // Queued records out before the reset
+            Boot_Command(args, args_len);          // Does not return
+            break;
+        case UART_CMD_TSYNC:
+            Tsync_Command(args, args_len);         // Time sync role + clock reference
+            break;
+        case UART_CMD_IDDISP:
+            IdDisp_Command(args, args_len);        // Table layout + lookup cycles
+            break;
+        case UART_CMD_POOL:
+            Pool_Command(args, args_len);          // Occupancy + high water
+            break;
+        default:
+            return UART_ACK_UNKNOWN;               // Unknown command: ignore
+        }
+        return UART_ACK_OK;
+    }
     uint32_t id = 0;                               // Variable to hold CAN ID
-    uint8_t data_len = (mode == 0) ? uart_rx_buffer[3] : uart_rx_buffer[5];  // Extract data length
+    uint8_t data_len = (mode == 0) ? frame[3] : frame[5];  // Extract data length
     uint16_t interval = 0;                          // Interval between repeated sends (ms)
-    uint8_t *data_ptr;                              // Pointer to data bytes in buffer
+    uint8_t *data_ptr;                              // Pointer to data bytes in frame
 
     if (data_len > 8) data_len = 8;                 // Limit data length to max 8 bytes
 
     if (mode == 0) {
         // For standard CAN frame:
-        id = (uart_rx_buffer[1] << 8) | uart_rx_buffer[2];   // Combine two bytes to form 11-bit ID (stored as 16-bit)
-        data_ptr = (uint8_t*)&uart_rx_buffer[4];             // Data bytes start after 4th byte
-        interval = (uart_rx_buffer[4 + data_len] << 8) | uart_rx_buffer[5 + data_len];  // Interval is two bytes after data
+        id = (frame[1] << 8) | frame[2];                     // Combine two bytes to form 11-bit ID (stored as 16-bit)
+        data_ptr = (uint8_t*)&frame[4];                      // Data bytes start after 4th byte
+        interval = (frame[4 + data_len] << 8) | frame[5 + data_len];  // Interval is two bytes after data
     } else {
         // For extended CAN frame:
-        id = (uart_rx_buffer[1] << 24) | (uart_rx_buffer[2] << 16) |
-             (uart_rx_buffer[3] << 8) | uart_rx_buffer[4];    // Combine 4 bytes to form 29-bit ID (stored as 32-bit)
-        data_ptr = (uint8_t*)&uart_rx_buffer[6];             // Data bytes start after 6th byte
-        interval = (uart_rx_buffer[6 + data_len] << 8) | uart_rx_buffer[7 + data_len];  // Interval two bytes after data
+        id = ((uint32_t)frame[1] << 24) | ((uint32_t)frame[2] << 16) |
+             ((uint32_t)frame[3] << 8) | frame[4];            // Combine 4 bytes to form 29-bit ID (stored as 32-bit)
+        data_ptr = (uint8_t*)&frame[6];                      // Data bytes start after 6th byte
+        interval = (frame[6 + data_len] << 8) | frame[7 + data_len];  // Interval two bytes after data
     }
 
     if (interval == 0) {          // If interval is zero, send CAN frame only once
-        repeat = 0;               // Clear repeat flag (global variable from context)
-        Timer_Stop();             // Stop timer for repeated sending
-        CAN_Send(mode, id, data_ptr, data_len);   // Send CAN frame once
+        Timer_StopCyclic(0);      // Stop the repeated frame
+        switch (CAN_Send(mode, id, data_ptr, data_len)) {   // Send CAN frame once
+        case CAN_TX_OK:      return UART_ACK_OK;
+        case CAN_TX_BUS_OFF: return UART_ACK_BUS_OFF;
+        case CAN_TX_BUSY:    return UART_ACK_TX_BUSY;
+        default:             return UART_ACK_TX_FAILED;
+        }
     } else {
-        repeat = 1;               // Set repeat flag to enable repeated sending
-        Timer_Setup_Repeat(mode, id, data_ptr, data_len, interval);  // Setup timer to send CAN frame repeatedly
+        Timer_StartCyclic(0, mode, id, data_ptr, data_len, (uint32_t)interval * 1000);  // Repeat every interval ms
     }
+    return UART_ACK_OK;
+}
+
+/*****************************************************************************
+ * Function: UART_DropQueued
+ *****************************************************************************/
+
+/**
+ * @brief Discard the queued frames and the one being assembled.
+ *
+ * They were framed for the host link mode before a switch, binary or SLCAN,
+ * and would be misparsed in the new one.
+ */
+static void UART_DropQueued(void) {
+    NVIC_DisableIRQ(USART1_IRQn);
+    while (uart_cmd_count) {
+        Pool_Free(uart_cmd_queue[uart_cmd_head]);
+        uart_cmd_head = (uart_cmd_head + 1) % UART_CMD_QUEUE_LEN;
+        uart_cmd_count--;
+    }
+    uart_rx_index = 0;
+    NVIC_EnableIRQ(USART1_IRQn);
+}
+
+/*****************************************************************************
+ * Function: Process_UART_Frame
+ *****************************************************************************/
 
-    uart_rx_index = 0;            // Reset buffer index to receive next frame
-    uart_frame_ready = 0;         // Clear frame ready flag
+/**
+ * @brief Handle every frame waiting in the command queue.
+ *
+ * Frames are taken out one at a time with the USART1 interrupt masked only
+ * to dequeue the handle; each is handled in its pool block, which is then
+ * freed. A sequenced envelope is unwrapped, its inner frame validated
+ * and handled, then acknowledged with the result. A pending overflow is
+ * acknowledged first. In SLCAN mode the queue holds command lines; frames
+ * still queued when a frame switches the mode are discarded.
+ */
+void Process_UART_Frame(void) {
+    uint8_t *frame;                                // Frame taken from the queue
+    uint8_t h, len, slcan;
+
+    while (1) {
+        NVIC_DisableIRQ(USART1_IRQn);
+        if (uart_cmd_overflow) {
+            uint8_t seq = uart_cmd_overflow_seq;
+            uart_cmd_overflow = 0;
+            NVIC_EnableIRQ(USART1_IRQn);
+            UART_SendAck(seq, UART_ACK_OVERFLOW);
+            continue;
+        }
+        if (uart_cmd_count == 0) {
+            NVIC_EnableIRQ(USART1_IRQn);
+            return;
+        }
+        h = uart_cmd_queue[uart_cmd_head];
+        uart_cmd_head = (uart_cmd_head + 1) % UART_CMD_QUEUE_LEN;
+        uart_cmd_count--;
+        NVIC_EnableIRQ(USART1_IRQn);
+        frame = Pool_Block(h);
+        len = *frame++;
+        slcan = Slcan_IsEnabled();
+
+        if (slcan) {
+            Slcan_Line(frame, len);                // ASCII command line
+        } else if (frame[0] != UART_CMD_SEQ) {
+            UART_HandleFrame(frame);               // Unsequenced frame: no acknowledgement
+        } else if (len >= 3) {
+            uint8_t inner_len = len - 3;           // [cmd][len][seq] + inner frame
+            if (inner_len > 0 && frame[3] != UART_CMD_SEQ &&
+                UART_FrameLength(&frame[3], inner_len) == inner_len) {
+                UART_SendAck(frame[2], UART_HandleFrame(&frame[3]));
+            } else {
+                UART_SendAck(frame[2], UART_ACK_BAD_FRAME);
+            }
+        }
+        Pool_Free(h);
+        if (Slcan_IsEnabled() != slcan) {
+            UART_DropQueued();                     // Framed for the old mode
+        }
+    }
 }
 
 /*****************************************************************************
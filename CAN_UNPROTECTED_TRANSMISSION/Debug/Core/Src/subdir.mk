@@ -5,39 +5,90 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../Core/Src/bench_handler.c \
+../Core/Src/boot_handler.c \
 ../Core/Src/can_handler.c \
+../Core/Src/capture_handler.c \
+../Core/Src/cfgstore_handler.c \
+../Core/Src/clock_config.c \
+../Core/Src/compact_handler.c \
+../Core/Src/crc_handler.c \
+../Core/Src/forward_handler.c \
 ../Core/Src/gpio_config.c \
+../Core/Src/iddisp_handler.c \
+../Core/Src/idstats_handler.c \
+../Core/Src/isotp_handler.c \
 ../Core/Src/main.c \
+../Core/Src/pool_handler.c \
+../Core/Src/power_handler.c \
+../Core/Src/sched_handler.c \
+../Core/Src/slcan_handler.c \
 ../Core/Src/stm32f1xx_hal_msp.c \
 ../Core/Src/stm32f1xx_it.c \
 ../Core/Src/syscalls.c \
 ../Core/Src/sysmem.c \
 ../Core/Src/system_stm32f1xx.c \
+../Core/Src/timebase_handler.c \
 ../Core/Src/timer_handler.c \
+../Core/Src/tsync_handler.c \
 ../Core/Src/uart_handler.c 
 
 OBJS += \
+./Core/Src/bench_handler.o \
+./Core/Src/boot_handler.o \
 ./Core/Src/can_handler.o \
+./Core/Src/capture_handler.o \
+./Core/Src/cfgstore_handler.o \
+./Core/Src/clock_config.o \
+./Core/Src/compact_handler.o \
+./Core/Src/crc_handler.o \
+./Core/Src/forward_handler.o \
 ./Core/Src/gpio_config.o \
+./Core/Src/iddisp_handler.o \
+./Core/Src/idstats_handler.o \
+./Core/Src/isotp_handler.o \
 ./Core/Src/main.o \
+./Core/Src/pool_handler.o \
+./Core/Src/power_handler.o \
+./Core/Src/sched_handler.o \
+./Core/Src/slcan_handler.o \
 ./Core/Src/stm32f1xx_hal_msp.o \
 ./Core/Src/stm32f1xx_it.o \
 ./Core/Src/syscalls.o \
 ./Core/Src/sysmem.o \
 ./Core/Src/system_stm32f1xx.o \
+./Core/Src/timebase_handler.o \
 ./Core/Src/timer_handler.o \
+./Core/Src/tsync_handler.o \
 ./Core/Src/uart_handler.o 
 
 C_DEPS += \
+./Core/Src/bench_handler.d \
+./Core/Src/boot_handler.d \
 ./Core/Src/can_handler.d \
+./Core/Src/capture_handler.d \
+./Core/Src/cfgstore_handler.d \
+./Core/Src/clock_config.d \
+./Core/Src/compact_handler.d \
+./Core/Src/crc_handler.d \
+./Core/Src/forward_handler.d \
 ./Core/Src/gpio_config.d \
+./Core/Src/iddisp_handler.d \
+./Core/Src/idstats_handler.d \
+./Core/Src/isotp_handler.d \
 ./Core/Src/main.d \
+./Core/Src/pool_handler.d \
+./Core/Src/power_handler.d \
+./Core/Src/sched_handler.d \
+./Core/Src/slcan_handler.d \
 ./Core/Src/stm32f1xx_hal_msp.d \
 ./Core/Src/stm32f1xx_it.d \
 ./Core/Src/syscalls.d \
 ./Core/Src/sysmem.d \
 ./Core/Src/system_stm32f1xx.d \
+./Core/Src/timebase_handler.d \
 ./Core/Src/timer_handler.d \
+./Core/Src/tsync_handler.d \
 ./Core/Src/uart_handler.d 
 
 
@@ -48,7 +99,7 @@ Core/Src/%.o Core/Src/%.su Core/Src/%.cyclo: ../Core/Src/%.c Core/Src/subdir.mk
 clean: clean-Core-2f-Src
 
 clean-Core-2f-Src:
-	-$(RM) ./Core/Src/can_handler.cyclo ./Core/Src/can_handler.d ./Core/Src/can_handler.o ./Core/Src/can_handler.su ./Core/Src/gpio_config.cyclo ./Core/Src/gpio_config.d ./Core/Src/gpio_config.o ./Core/Src/gpio_config.su ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/stm32f1xx_hal_msp.cyclo ./Core/Src/stm32f1xx_hal_msp.d ./Core/Src/stm32f1xx_hal_msp.o ./Core/Src/stm32f1xx_hal_msp.su ./Core/Src/stm32f1xx_it.cyclo ./Core/Src/stm32f1xx_it.d ./Core/Src/stm32f1xx_it.o ./Core/Src/stm32f1xx_it.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32f1xx.cyclo ./Core/Src/system_stm32f1xx.d ./Core/Src/system_stm32f1xx.o ./Core/Src/system_stm32f1xx.su ./Core/Src/timer_handler.cyclo ./Core/Src/timer_handler.d ./Core/Src/timer_handler.o ./Core/Src/timer_handler.su ./Core/Src/uart_handler.cyclo ./Core/Src/uart_handler.d ./Core/Src/uart_handler.o ./Core/Src/uart_handler.su
+	-$(RM) ./Core/Src/bench_handler.cyclo ./Core/Src/bench_handler.d ./Core/Src/bench_handler.o ./Core/Src/bench_handler.su ./Core/Src/boot_handler.cyclo ./Core/Src/boot_handler.d ./Core/Src/boot_handler.o ./Core/Src/boot_handler.su ./Core/Src/can_handler.cyclo ./Core/Src/can_handler.d ./Core/Src/can_handler.o ./Core/Src/can_handler.su ./Core/Src/capture_handler.cyclo ./Core/Src/capture_handler.d ./Core/Src/capture_handler.o ./Core/Src/capture_handler.su ./Core/Src/cfgstore_handler.cyclo ./Core/Src/cfgstore_handler.d ./Core/Src/cfgstore_handler.o ./Core/Src/cfgstore_handler.su ./Core/Src/clock_config.cyclo ./Core/Src/clock_config.d ./Core/Src/clock_config.o ./Core/Src/clock_config.su ./Core/Src/compact_handler.cyclo ./Core/Src/compact_handler.d ./Core/Src/compact_handler.o ./Core/Src/compact_handler.su ./Core/Src/crc_handler.cyclo ./Core/Src/crc_handler.d ./Core/Src/crc_handler.o ./Core/Src/crc_handler.su ./Core/Src/forward_handler.cyclo ./Core/Src/forward_handler.d ./Core/Src/forward_handler.o ./Core/Src/forward_handler.su ./Core/Src/gpio_config.cyclo ./Core/Src/gpio_config.d ./Core/Src/gpio_config.o ./Core/Src/gpio_config.su ./Core/Src/iddisp_handler.cyclo ./Core/Src/iddisp_handler.d ./Core/Src/iddisp_handler.o ./Core/Src/iddisp_handler.su ./Core/Src/idstats_handler.cyclo ./Core/Src/idstats_handler.d ./Core/Src/idstats_handler.o ./Core/Src/idstats_handler.su ./Core/Src/isotp_handler.cyclo ./Core/Src/isotp_handler.d ./Core/Src/isotp_handler.o ./Core/Src/isotp_handler.su ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/pool_handler.cyclo ./Core/Src/pool_handler.d ./Core/Src/pool_handler.o ./Core/Src/pool_handler.su ./Core/Src/power_handler.cyclo ./Core/Src/power_handler.d ./Core/Src/power_handler.o ./Core/Src/power_handler.su ./Core/Src/sched_handler.cyclo ./Core/Src/sched_handler.d ./Core/Src/sched_handler.o ./Core/Src/sched_handler.su ./Core/Src/slcan_handler.cyclo ./Core/Src/slcan_handler.d ./Core/Src/slcan_handler.o ./Core/Src/slcan_handler.su ./Core/Src/stm32f1xx_hal_msp.cyclo ./Core/Src/stm32f1xx_hal_msp.d ./Core/Src/stm32f1xx_hal_msp.o ./Core/Src/stm32f1xx_hal_msp.su ./Core/Src/stm32f1xx_it.cyclo ./Core/Src/stm32f1xx_it.d ./Core/Src/stm32f1xx_it.o ./Core/Src/stm32f1xx_it.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32f1xx.cyclo ./Core/Src/system_stm32f1xx.d ./Core/Src/system_stm32f1xx.o ./Core/Src/system_stm32f1xx.su ./Core/Src/timebase_handler.cyclo ./Core/Src/timebase_handler.d ./Core/Src/timebase_handler.o ./Core/Src/timebase_handler.su ./Core/Src/timer_handler.cyclo ./Core/Src/timer_handler.d ./Core/Src/timer_handler.o ./Core/Src/timer_handler.su ./Core/Src/tsync_handler.cyclo ./Core/Src/tsync_handler.d ./Core/Src/tsync_handler.o ./Core/Src/tsync_handler.su ./Core/Src/uart_handler.cyclo ./Core/Src/uart_handler.d ./Core/Src/uart_handler.o ./Core/Src/uart_handler.su
 
 .PHONY: clean-Core-2f-Src
 